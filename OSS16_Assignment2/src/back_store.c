@@ -5,26 +5,746 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <pthread.h>
 #include <bitmap.h>
+#ifdef BACK_STORE_IO_URING
+#include <liburing.h>
+#endif
 #include "../include/back_store.h"
 
-#define BLOCK_SIZE 1024 //2^10 bytes = 1 KB blocks
-#define NUM_BLOCKS 65536 //2^16 blocks
-#define FBM_BLOCKS 8 //NUM_BLOCKSbits / (8bits * BLOCK_SIZEbytes) = 8 blocks for FBM data
-#define FBM_BYTES 8192 //FBM_BLOCKS * BLOCK_SIZE
+#define BLOCK_SIZE 1024 //2^10 bytes = 1 KB blocks, back_store_create's geometry
+#define NUM_BLOCKS 65536 //2^16 blocks, back_store_create's geometry
+#define CACHE_DEFAULT_FRAMES 64 //cache size until someone calls back_store_cache_resize
+#define ASYNC_WORKERS 4 //threads doing async requests when there's no io_uring
+#define SUPERBLOCK_MAGIC 0x31534253 //"SBS1" on disk, first byte can't be 0xFF like an original layout fbm
+
+//block 0 of a back_store made by back_store_create_ex, the fbm starts at block 1
+//back_store_create's layout has the fbm at block 0, and its first byte is always 0xFF (fbm blocks are in use)
+typedef struct {
+    uint32_t magic; // SUPERBLOCK_MAGIC
+    uint32_t block_size; // bytes per block
+    uint32_t block_count; // blocks in the file
+    uint32_t fbm_blocks; // blocks after the superblock taken by the fbm
+} superblock_t;
+
+//one block in the cache
+typedef struct {
+    unsigned block_id; // block in the frame, 0 if the frame is empty
+    unsigned pins; // number of maps that haven't been unmapped yet, pinned frames can't be evicted
+    unsigned next; // frame + 1 of the next frame in the same hash bucket, 0 at the end
+    bool dirty; // changed since it was read in, has to be written out before the frame is reused
+    bool referenced; // CLOCK bit, set on every hit and cleared as the hand goes past
+    uint8_t *data; // block_size bytes, part of cache_data
+} cache_frame_t;
+
+//an async request, queued for a worker or finished and waiting to be polled
+typedef struct {
+    uint64_t tag; // caller's tag
+    void *buffer; // where the block goes (read) or comes from (write)
+    unsigned block_id; // block to read/write
+    bool write; // write instead of read
+    bool success; // how it went, once it's done
+} async_request_t;
+
+//everything for back_store_submit_read/back_store_submit_write/back_store_poll
+//requests that get done on the spot (cache hits) and worker results both land in completed
+typedef struct {
+    bool started; // workers/ring get set up on the first request that needs them
+    bool stopping; // tells the workers to finish the queue and quit
+    unsigned in_flight; // submitted and not polled yet, never more than BACK_STORE_ASYNC_DEPTH
+    pthread_mutex_t lock; // guards everything below (and stopping)
+    pthread_cond_t work; // signaled when there's something in queue
+    pthread_cond_t done; // signaled when something lands in completed
+    async_request_t queue[BACK_STORE_ASYNC_DEPTH]; // waiting for a worker (ring)
+    unsigned queue_head, queue_count;
+    async_request_t completed[BACK_STORE_ASYNC_DEPTH]; // waiting for back_store_poll (ring)
+    unsigned completed_head, completed_count;
+#ifdef BACK_STORE_IO_URING
+    struct io_uring ring; // does the disk requests instead of workers
+#else
+    pthread_t workers[ASYNC_WORKERS];
+#endif
+} async_t;
 
 struct back_store {
     int fd; // file descriptor for backing store
     bitmap_t *fbm; // bitmap for free block map
+    size_t block_size; // bytes per block
+    size_t block_count; // blocks in the file
+    size_t data_start; // first block after the superblock and fbm
+    size_t fbm_offset; // where the fbm is in the file
+    size_t fbm_bytes; // size of the fbm
+    size_t fbm_words; // fbm as 64 bit words
+    size_t fbm_summary_words; // fbm_words / 64 bits per summary word, rounded up
+    uint64_t *fbm_summary; // one bit per fbm word, set if the word has a free block
+    cache_frame_t *cache; // write-back block cache, cache_size frames
+    uint8_t *cache_data; // block data for every frame, back to back
+    unsigned *cache_buckets; // hash of block id to frame + 1 of the first frame in the chain, 0 if empty
+    unsigned cache_bucket_mask; // number of buckets - 1
+    unsigned cache_size; // number of frames
+    unsigned cache_hand; // CLOCK hand, next frame to look at when something needs evicting
+    uint64_t cache_hits; // accesses served from the cache
+    uint64_t cache_misses; // accesses that needed a frame filled
+    uint64_t cache_write_backs; // dirty frames written out, readv checks it to spot one landing mid-read
+    pthread_mutex_t lock; // guards the fbm and the cache, disk reads/writes outside the cache don't need it
+    async_t async; // async request state
 };
 
 ///
-/// Creates a new back_store file at the specified location
-///  and returns a back_store object linked to it
+/// Gets one 64 bit word (64 blocks) of the fbm
+/// \param bs the back_store
+/// \param word index of the word
+/// \return the word
+///
+uint64_t fbm_word(const back_store_t *const bs, const size_t word) {
+    uint64_t value;
+    memcpy(&value, bitmap_export(bs->fbm) + word * sizeof(uint64_t), sizeof(uint64_t));
+    return value;
+}
+
+///
+/// Updates the summary bit for the fbm word holding block_id
+///  has to be called after every change to the fbm
+/// \param bs the back_store
+/// \param block_id the block that changed
+///
+void fbm_summary_update(back_store_t *const bs, const size_t block_id) {
+    size_t word = block_id / 64;
+    uint64_t flag = (uint64_t)1 << (word % 64);
+    if(~fbm_word(bs, word)) {
+        //word still has a free block
+        bs->fbm_summary[word / 64] |= flag;
+    } else {
+        //word is full
+        bs->fbm_summary[word / 64] &= ~flag;
+    }
+}
+
+///
+/// Builds the summary from scratch off the current fbm
+/// \param bs the back_store
+///
+void fbm_summary_build(back_store_t *const bs) {
+    memset(bs->fbm_summary, 0x00, bs->fbm_summary_words * sizeof(uint64_t));
+    for(size_t word = 0; word < bs->fbm_words; word++) {
+        fbm_summary_update(bs, word * 64);
+    }
+}
+
+///
+/// Finds the first free block using the summary
+///  only looks at one fbm word no matter how full the fbm is
+/// \param bs the back_store
+/// \return the first free block, SIZE_MAX if there isn't one
+///
+size_t fbm_ffz(const back_store_t *const bs) {
+    for(size_t i = 0; i < bs->fbm_summary_words; i++) {
+        if(bs->fbm_summary[i]) {
+            size_t word = i * 64 + __builtin_ctzll(bs->fbm_summary[i]);
+            return word * 64 + __builtin_ctzll(~fbm_word(bs, word));
+        }
+    }
+    return SIZE_MAX;
+}
+
+///
+/// Finds the first free block at or after start using the summary
+///  wraps around to the beginning if nothing past start is free
+/// \param bs the back_store
+/// \param start block to start looking from
+/// \return the free block, SIZE_MAX if there isn't one
+///
+size_t fbm_ffz_from(const back_store_t *const bs, const size_t start) {
+    if(start < bs->block_count) {
+        //check the rest of the word start is in first
+        size_t word = start / 64;
+        uint64_t free_bits = ~fbm_word(bs, word) & (~(uint64_t)0 << (start % 64));
+        if(free_bits) {
+            return word * 64 + __builtin_ctzll(free_bits);
+        }
+        //then whatever words after that the summary says have space
+        ++word;
+        for(size_t i = word / 64; i < bs->fbm_summary_words; i++) {
+            uint64_t candidates = bs->fbm_summary[i];
+            if(i == word / 64) {
+                candidates &= ~(uint64_t)0 << (word % 64);
+            }
+            if(candidates) {
+                size_t found = i * 64 + __builtin_ctzll(candidates);
+                return found * 64 + __builtin_ctzll(~fbm_word(bs, found));
+            }
+        }
+    }
+    //nothing past start, wrap around
+    return fbm_ffz(bs);
+}
+
+///
+/// Finds a run of count free blocks
+/// \param bs the back_store
+/// \param count length of the run
+/// \return first block of the run, SIZE_MAX if there isn't one
+///
+size_t fbm_find_run(const back_store_t *const bs, const size_t count) {
+    size_t start = fbm_ffz(bs);
+    while(start != SIZE_MAX && start + count <= bs->block_count) {
+        //see how far the run goes
+        size_t end = start + 1;
+        while(end < start + count && !bitmap_test(bs->fbm, end)) {
+            ++end;
+        }
+        if(end == start + count) {
+            return start;
+        }
+        //end is used, try again from the next free block after it
+        size_t next = fbm_ffz_from(bs, end + 1);
+        if(next <= end) {
+            break; //wrapped around, nothing left
+        }
+        start = next;
+    }
+    return SIZE_MAX;
+}
+
+///
+/// Claims up to count free blocks, going up from start and wrapping around once
+///  takes every free block in a fbm word before moving to the next, so it's one pass
+/// \param bs the back_store
+/// \param start block to start claiming from
+/// \param count number of blocks wanted
+/// \param out array to fill with the claimed block ids
+/// \return number of blocks claimed
+///
+size_t fbm_claim(back_store_t *const bs, const size_t start, const size_t count, unsigned *const out) {
+    size_t claimed = 0;
+    size_t block_id = fbm_ffz_from(bs, start);
+    while(claimed < count && block_id != SIZE_MAX) {
+        //grab all the free blocks in this word
+        size_t word = block_id / 64;
+        uint64_t free_bits = ~fbm_word(bs, word) & (~(uint64_t)0 << (block_id % 64));
+        while(free_bits && claimed < count) {
+            size_t free_block = word * 64 + __builtin_ctzll(free_bits);
+            bitmap_set(bs->fbm, free_block);
+            out[claimed++] = free_block;
+            free_bits &= free_bits - 1; //clear lowest set bit
+        }
+        fbm_summary_update(bs, block_id);
+        //on to the next word with space (every loop claims at least one block so this ends)
+        block_id = claimed < count ? fbm_ffz_from(bs, (word + 1) * 64) : SIZE_MAX;
+    }
+    return claimed;
+}
+
+///
+/// Hashes a block id to a cache bucket
+/// \param bs the back_store
+/// \param block_id the block
+/// \return the bucket
+///
+unsigned cache_bucket(const back_store_t *const bs, const unsigned block_id) {
+    //multiplicative hash, spreads runs of block ids out over the buckets
+    return (block_id * 2654435761U) & bs->cache_bucket_mask;
+}
+
+///
+/// Finds the cache frame a block is in
+/// \param bs the back_store
+/// \param block_id the block
+/// \return the frame, NULL if the block isn't cached
+///
+cache_frame_t *cache_find(const back_store_t *const bs, const unsigned block_id) {
+    unsigned frame = bs->cache_buckets[cache_bucket(bs, block_id)];
+    while(frame && bs->cache[frame - 1].block_id != block_id) {
+        frame = bs->cache[frame - 1].next;
+    }
+    return frame ? &bs->cache[frame - 1] : NULL;
+}
+
+///
+/// Puts a frame in the hash under its block id
+/// \param bs the back_store
+/// \param frame the frame, block_id already set
+///
+void cache_link(back_store_t *const bs, cache_frame_t *const frame) {
+    unsigned *bucket = &bs->cache_buckets[cache_bucket(bs, frame->block_id)];
+    frame->next = *bucket;
+    *bucket = (frame - bs->cache) + 1;
+}
+
+///
+/// Takes a frame out of the hash and marks it empty
+/// \param bs the back_store
+/// \param frame the frame
+///
+void cache_unlink(back_store_t *const bs, cache_frame_t *const frame) {
+    unsigned *link = &bs->cache_buckets[cache_bucket(bs, frame->block_id)];
+    unsigned target = (frame - bs->cache) + 1;
+    while(*link && *link != target) {
+        link = &bs->cache[*link - 1].next;
+    }
+    if(*link) {
+        *link = frame->next;
+    }
+    frame->next = 0;
+    frame->block_id = 0;
+}
+
+///
+/// Writes a frame out if it's dirty
+/// \param bs the back_store
+/// \param frame the frame
+/// \return true if the block on disk matches the frame now
+///
+bool cache_write_back(back_store_t *const bs, cache_frame_t *const frame) {
+    if(frame->block_id && frame->dirty) {
+        ssize_t bytes = pwrite(bs->fd, frame->data, bs->block_size, (off_t)frame->block_id * bs->block_size);
+        if(bytes != (ssize_t)bs->block_size) {
+            return false;
+        }
+        frame->dirty = false;
+        bs->cache_write_backs++;
+    }
+    return true;
+}
+
+///
+/// Picks a frame to reuse with CLOCK, writing out whatever was in it
+///  Frames that were used since the hand last went by get a second chance
+/// \param bs the back_store
+/// \return an empty frame, NULL if every frame is pinned (or the write back failed)
+///
+cache_frame_t *cache_victim(back_store_t *const bs) {
+
+    //two laps is enough to clear every referenced bit and come back around
+    for(unsigned i = 0; i < 2 * bs->cache_size; i++) {
+        cache_frame_t *frame = &bs->cache[bs->cache_hand];
+        bs->cache_hand = (bs->cache_hand + 1) % bs->cache_size;
+        if(frame->pins) {
+            continue;
+        }
+        if(frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+        if(!cache_write_back(bs, frame)) {
+            return NULL;
+        }
+        if(frame->block_id) {
+            cache_unlink(bs, frame);
+        }
+        return frame;
+    }
+
+    return NULL;
+}
+
+///
+/// Gets the frame for a block, bringing the block into the cache if it isn't there
+/// \param bs the back_store
+/// \param block_id the block
+/// \param fill whether to read the block in on a miss (not needed if the caller overwrites all of it)
+/// \return the frame, NULL if there wasn't a frame to put it in
+///
+cache_frame_t *cache_get(back_store_t *const bs, const unsigned block_id, const bool fill) {
+
+    cache_frame_t *frame = cache_find(bs, block_id);
+    if(frame) {
+        bs->cache_hits++;
+        frame->referenced = true;
+        return frame;
+    }
+
+    bs->cache_misses++;
+    frame = cache_victim(bs);
+    if(!frame) {
+        return NULL;
+    }
+    if(fill && pread(bs->fd, frame->data, bs->block_size, (off_t)block_id * bs->block_size) !=
+               (ssize_t)bs->block_size) {
+        return NULL;
+    }
+    frame->block_id = block_id;
+    frame->dirty = false;
+    frame->referenced = true;
+    cache_link(bs, frame);
+    return frame;
+}
+
+///
+/// Throws out a cached block without writing it, for blocks that were just released
+/// \param bs the back_store
+/// \param block_id the block
+///
+void cache_drop(back_store_t *const bs, const unsigned block_id) {
+    cache_frame_t *frame = cache_find(bs, block_id);
+    if(frame && !frame->pins) {
+        cache_unlink(bs, frame);
+        frame->dirty = false;
+    }
+}
+
+///
+/// Writes out every dirty frame
+/// \param bs the back_store
+/// \return true if they all made it
+///
+bool cache_write_back_all(back_store_t *const bs) {
+    bool success = true;
+    for(unsigned i = 0; i < bs->cache_size; i++) {
+        success &= cache_write_back(bs, &bs->cache[i]);
+    }
+    return success;
+}
+
+///
+/// Sets up an empty cache of the given size
+/// \param bs the back_store
+/// \param frames number of frames
+/// \return true on success, the old cache is left alone on failure
+///
+bool cache_setup(back_store_t *const bs, const unsigned frames) {
+
+    //at least as many buckets as frames, and a power of two so the hash can mask
+    unsigned buckets = 1;
+    while(buckets < frames) {
+        buckets <<= 1;
+    }
+
+    cache_frame_t *cache = (cache_frame_t*)calloc(frames, sizeof(cache_frame_t));
+    uint8_t *cache_data = (uint8_t*)malloc((size_t)frames * bs->block_size);
+    unsigned *cache_buckets = (unsigned*)calloc(buckets, sizeof(unsigned));
+    if(!cache || !cache_data || !cache_buckets) {
+        free(cache);
+        free(cache_data);
+        free(cache_buckets);
+        return false;
+    }
+
+    for(unsigned i = 0; i < frames; i++) {
+        cache[i].data = cache_data + (size_t)i * bs->block_size;
+    }
+
+    free(bs->cache);
+    free(bs->cache_data);
+    free(bs->cache_buckets);
+    bs->cache = cache;
+    bs->cache_data = cache_data;
+    bs->cache_buckets = cache_buckets;
+    bs->cache_bucket_mask = buckets - 1;
+    bs->cache_size = frames;
+    bs->cache_hand = 0;
+    return true;
+}
+
+///
+/// Allocates the cache for a new back_store object
+/// \param bs the back_store
+/// \return true on success
+///
+bool cache_init(back_store_t *const bs) {
+    bs->cache = NULL;
+    bs->cache_data = NULL;
+    bs->cache_buckets = NULL;
+    bs->cache_hits = 0;
+    bs->cache_misses = 0;
+    bs->cache_write_backs = 0;
+    pthread_mutex_init(&bs->lock, NULL);
+    return cache_setup(bs, CACHE_DEFAULT_FRAMES);
+}
+
+///
+/// Maps a block into the cache and pins it
+/// \param bs the back_store
+/// \param block_id the block to map
+/// \param mut whether the caller is going to write to it
+/// \return the frame, NULL if the block is bad or every frame is pinned
+///
+cache_frame_t *cache_pin(back_store_t *const bs, const unsigned block_id, const bool mut) {
+
+    if(!bs) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+
+    //same rules as back_store_read/back_store_write
+    cache_frame_t *frame = NULL;
+    if(block_id >= bs->data_start && block_id < bs->block_count && bitmap_test(bs->fbm, block_id)) {
+        frame = cache_get(bs, block_id, true);
+    }
+    if(frame) {
+        frame->pins++;
+        frame->dirty |= mut;
+    }
+
+    pthread_mutex_unlock(&bs->lock);
+    return frame;
+}
+
+///
+/// Works out where everything goes for the given geometry and sizes the fbm summary
+/// \param bs the back_store
+/// \param block_size bytes per block
+/// \param block_count blocks in the file
+/// \param superblock whether block 0 is a superblock (back_store_create_ex) or the fbm (back_store_create)
+/// \return true if the geometry is usable
+///
+bool geometry_setup(back_store_t *const bs, const size_t block_size, const size_t block_count,
+                    const bool superblock) {
+
+    //powers of two for the block size, whole fbm words for the count
+    if(block_size < BACK_STORE_BLOCK_SIZE_MIN || block_size > BACK_STORE_BLOCK_SIZE_MAX ||
+       (block_size & (block_size - 1)) || block_count < 64 || block_count > BACK_STORE_BLOCK_COUNT_MAX ||
+       block_count % 64) {
+        return false;
+    }
+
+    size_t fbm_blocks = (block_count / 8 + block_size - 1) / block_size;
+    bs->block_size = block_size;
+    bs->block_count = block_count;
+    bs->fbm_offset = superblock ? block_size : 0;
+    bs->fbm_bytes = block_count / 8;
+    bs->data_start = fbm_blocks + (superblock ? 1 : 0);
+    bs->fbm_words = block_count / 64;
+    bs->fbm_summary_words = (bs->fbm_words + 63) / 64;
+    if(bs->data_start >= block_count) {
+        return false;
+    }
+
+    bs->fbm_summary = (uint64_t*)calloc(bs->fbm_summary_words, sizeof(uint64_t));
+    return bs->fbm_summary != NULL;
+}
+
+///
+/// Sets up the async state for a new back_store object
+///  workers (or the io_uring) don't start until the first request
+/// \param bs the back_store
+///
+void async_init(back_store_t *const bs) {
+    bs->async.started = false;
+    bs->async.stopping = false;
+    bs->async.in_flight = 0;
+    bs->async.queue_head = bs->async.queue_count = 0;
+    bs->async.completed_head = bs->async.completed_count = 0;
+    pthread_mutex_init(&bs->async.lock, NULL);
+    pthread_cond_init(&bs->async.work, NULL);
+    pthread_cond_init(&bs->async.done, NULL);
+}
+
+///
+/// Hands a finished request to poll, lock has to be held
+/// \param async the async state
+/// \param request the finished request
+///
+void async_complete(async_t *const async, const async_request_t *const request) {
+    //in_flight caps what's out there, so this can't overflow
+    async->completed[(async->completed_head + async->completed_count) % BACK_STORE_ASYNC_DEPTH] = *request;
+    async->completed_count++;
+    pthread_cond_signal(&async->done);
+}
+
+#ifndef BACK_STORE_IO_URING
+///
+/// Worker thread, does queued requests until it's told to stop and the queue is empty
+/// \param arg the back_store
+/// \return nothing
+///
+void *async_worker(void *arg) {
+    back_store_t *bs = (back_store_t*)arg;
+    async_t *async = &bs->async;
+
+    pthread_mutex_lock(&async->lock);
+    while(true) {
+        while(!async->queue_count && !async->stopping) {
+            pthread_cond_wait(&async->work, &async->lock);
+        }
+        if(!async->queue_count) {
+            break;
+        }
+        async_request_t request = async->queue[async->queue_head];
+        async->queue_head = (async->queue_head + 1) % BACK_STORE_ASYNC_DEPTH;
+        async->queue_count--;
+
+        //the actual I/O happens without the lock so the workers overlap
+        pthread_mutex_unlock(&async->lock);
+        off_t offset = (off_t)request.block_id * bs->block_size;
+        ssize_t bytes = request.write ? pwrite(bs->fd, request.buffer, bs->block_size, offset)
+                                      : pread(bs->fd, request.buffer, bs->block_size, offset);
+        request.success = bytes == (ssize_t)bs->block_size;
+        pthread_mutex_lock(&async->lock);
+
+        async_complete(async, &request);
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    return NULL;
+}
+#endif
+
+///
+/// Starts the workers (or io_uring) if they aren't going already
+/// \param bs the back_store
+/// \return true if requests can be handed off
+///
+bool async_start(back_store_t *const bs) {
+
+    if(bs->async.started) {
+        return true;
+    }
+
+#ifdef BACK_STORE_IO_URING
+    if(io_uring_queue_init(BACK_STORE_ASYNC_DEPTH, &bs->async.ring, 0) < 0) {
+        return false;
+    }
+#else
+    bs->async.stopping = false;
+    for(unsigned i = 0; i < ASYNC_WORKERS; i++) {
+        if(pthread_create(&bs->async.workers[i], NULL, async_worker, bs)) {
+            //stop the ones that did start
+            pthread_mutex_lock(&bs->async.lock);
+            bs->async.stopping = true;
+            pthread_cond_broadcast(&bs->async.work);
+            pthread_mutex_unlock(&bs->async.lock);
+            for(unsigned j = 0; j < i; j++) {
+                pthread_join(bs->async.workers[j], NULL);
+            }
+            return false;
+        }
+    }
+#endif
+
+    bs->async.started = true;
+    return true;
+}
+
+///
+/// Waits for everything in flight to hit the disk and shuts the workers (or io_uring) down
+///  completions nobody polled are thrown away
+/// \param bs the back_store
+///
+void async_stop(back_store_t *const bs) {
+
+    if(bs->async.started) {
+#ifdef BACK_STORE_IO_URING
+        //whatever isn't sitting in completed is still out in the ring
+        unsigned outstanding = bs->async.in_flight - bs->async.completed_count;
+        for(unsigned i = 0; i < outstanding; i++) {
+            struct io_uring_cqe *cqe;
+            if(io_uring_wait_cqe(&bs->async.ring, &cqe) < 0) {
+                break;
+            }
+            io_uring_cqe_seen(&bs->async.ring, cqe);
+        }
+        io_uring_queue_exit(&bs->async.ring);
+#else
+        pthread_mutex_lock(&bs->async.lock);
+        bs->async.stopping = true;
+        pthread_cond_broadcast(&bs->async.work);
+        pthread_mutex_unlock(&bs->async.lock);
+        for(unsigned i = 0; i < ASYNC_WORKERS; i++) {
+            pthread_join(bs->async.workers[i], NULL);
+        }
+#endif
+        bs->async.started = false;
+    }
+
+    pthread_mutex_destroy(&bs->async.lock);
+    pthread_cond_destroy(&bs->async.work);
+    pthread_cond_destroy(&bs->async.done);
+}
+
+///
+/// Queues an async read or write
+/// \param bs the back_store
+/// \param block_id the block
+/// \param buffer the caller's block buffer
+/// \param write write instead of read
+/// \param tag the caller's tag
+/// \return true if it was queued (or done on the spot)
+///
+bool async_submit(back_store_t *const bs, const unsigned block_id, void *const buffer, const bool write,
+                  const uint64_t tag) {
+
+    if(!bs || !buffer || bs->async.in_flight >= BACK_STORE_ASYNC_DEPTH) {
+        return false;
+    }
+
+    async_request_t request = {tag, buffer, block_id, write, true};
+
+    //cached blocks are done right here, the workers never touch the cache
+    pthread_mutex_lock(&bs->lock);
+    //same rules as back_store_read/back_store_write
+    if(block_id < bs->data_start || block_id >= bs->block_count || !bitmap_test(bs->fbm, block_id)) {
+        pthread_mutex_unlock(&bs->lock);
+        return false;
+    }
+    cache_frame_t *frame = cache_find(bs, block_id);
+    if(frame) {
+        bs->cache_hits++;
+        frame->referenced = true;
+        if(write) {
+            memcpy(frame->data, buffer, bs->block_size);
+            frame->dirty = true;
+        } else {
+            memcpy(buffer, frame->data, bs->block_size);
+        }
+        pthread_mutex_unlock(&bs->lock);
+        pthread_mutex_lock(&bs->async.lock);
+        bs->async.in_flight++;
+        async_complete(&bs->async, &request);
+        pthread_mutex_unlock(&bs->async.lock);
+        return true;
+    }
+    bs->cache_misses++;
+    pthread_mutex_unlock(&bs->lock);
+
+    //everything else goes to disk without coming into the cache
+    if(!async_start(bs)) {
+        return false;
+    }
+
+#ifdef BACK_STORE_IO_URING
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&bs->async.ring);
+    if(!sqe) {
+        return false;
+    }
+    off_t offset = (off_t)block_id * bs->block_size;
+    if(write) {
+        io_uring_prep_write(sqe, bs->fd, buffer, bs->block_size, offset);
+    } else {
+        io_uring_prep_read(sqe, bs->fd, buffer, bs->block_size, offset);
+    }
+    io_uring_sqe_set_data64(sqe, tag);
+    if(io_uring_submit(&bs->async.ring) < 1) {
+        return false;
+    }
+    pthread_mutex_lock(&bs->async.lock);
+    bs->async.in_flight++;
+    pthread_mutex_unlock(&bs->async.lock);
+#else
+    pthread_mutex_lock(&bs->async.lock);
+    bs->async.queue[(bs->async.queue_head + bs->async.queue_count) % BACK_STORE_ASYNC_DEPTH] = request;
+    bs->async.queue_count++;
+    bs->async.in_flight++;
+    pthread_cond_signal(&bs->async.work);
+    pthread_mutex_unlock(&bs->async.lock);
+#endif
+
+    return true;
+}
+
+///
+/// Creates a new back_store file with any layout
 /// \param fname the file to create
+/// \param block_size bytes per block
+/// \param block_count blocks in the file
+/// \param superblock whether to put a superblock at block 0
 /// \return a pointer to the new object, NULL on error
 ///
-back_store_t *back_store_create(const char *const fname) {
+back_store_t *back_store_create_layout(const char *const fname, const size_t block_size, const size_t block_count,
+                                       const bool superblock) {
 
     if(!fname || !strcmp(fname, "\0") || !strcmp(fname, "\n")) {
         return NULL;
@@ -32,40 +752,99 @@ back_store_t *back_store_create(const char *const fname) {
 
     //create back_store_t object in heap memory
     back_store_t *bs = (back_store_t*)malloc(sizeof(back_store_t));
+    if(!bs) {
+        return NULL;
+    }
+
+    if(!geometry_setup(bs, block_size, block_count, superblock)) {
+        free(bs);
+        return NULL;
+    }
 
     //open the file and store the file descriptor
     int flags = O_CREAT | O_TRUNC | O_RDWR;
     int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
     int fd = open(fname, flags, mode);
     if(fd == -1) {
+        free(bs->fbm_summary);
         free(bs);
         return NULL;
     }
     bs->fd = fd;
 
     //create a new bitmap
-    bs->fbm = bitmap_create(NUM_BLOCKS);
+    bs->fbm = bitmap_create(bs->block_count);
     if(bs->fbm == NULL) {
         close(bs->fd);
+        free(bs->fbm_summary);
         free(bs);
         return NULL;
     }
 
-    //set first bits in bitmap to reserve blocks for FBM
-    for(unsigned i = 0; i < FBM_BLOCKS; i++) {
+    //set first bits in bitmap to reserve blocks for the superblock and FBM
+    for(unsigned i = 0; i < bs->data_start; i++) {
         bitmap_set(bs->fbm, i);
     }
+    fbm_summary_build(bs);
+
+    if(!cache_init(bs)) {
+        bitmap_destroy(bs->fbm);
+        close(bs->fd);
+        free(bs->fbm_summary);
+        free(bs);
+        return NULL;
+    }
+
+    //size the file without writing anything, the whole thing is a hole
+    //never-written blocks read back as zero and don't take up disk space
+    bool valid = ftruncate(bs->fd, (off_t)bs->block_count * bs->block_size) != -1;
+
+    //superblock goes down now, the fbm goes down on flush/close like always
+    if(valid && superblock) {
+        superblock_t super = {SUPERBLOCK_MAGIC, (uint32_t)block_size, (uint32_t)block_count,
+                              (uint32_t)(bs->data_start - 1)};
+        valid = pwrite(bs->fd, &super, sizeof(super), 0) == sizeof(super);
+    }
 
-    //initialize all blocks
-    uint8_t block[BLOCK_SIZE];
-    memset(block, 0x00, BLOCK_SIZE);
-    for(unsigned i = 0; i < NUM_BLOCKS; i++) {
-        write(bs->fd, block, BLOCK_SIZE);
+    if(!valid) {
+        free(bs->cache);
+        free(bs->cache_data);
+        free(bs->cache_buckets);
+        bitmap_destroy(bs->fbm);
+        close(bs->fd);
+        free(bs->fbm_summary);
+        free(bs);
+        return NULL;
     }
 
+    async_init(bs);
     return bs;
 }
 
+///
+/// Creates a new back_store file at the specified location
+///  and returns a back_store object linked to it
+/// \param fname the file to create
+/// \return a pointer to the new object, NULL on error
+///
+back_store_t *back_store_create(const char *const fname) {
+    return back_store_create_layout(fname, BLOCK_SIZE, NUM_BLOCKS, false);
+}
+
+///
+/// Creates a new back_store file with the given geometry
+///  and returns a back_store object linked to it
+///  The geometry goes in a superblock at block 0 (the FBM follows it), back_store_open reads it back
+///  back_store_create is the original layout: 1 KiB blocks, 65536 of them, no superblock
+/// \param fname the file to create
+/// \param block_size bytes per block, a power of two from BACK_STORE_BLOCK_SIZE_MIN to BACK_STORE_BLOCK_SIZE_MAX
+/// \param block_count number of blocks, a multiple of 64 up to BACK_STORE_BLOCK_COUNT_MAX
+/// \return a pointer to the new object, NULL on error
+///
+back_store_t *back_store_create_ex(const char *const fname, const unsigned block_size, const unsigned block_count) {
+    return back_store_create_layout(fname, block_size, block_count, true);
+}
+
 ///
 /// Opens the specified back_store file
 ///  and returns a back_store object linked to it
@@ -80,6 +859,9 @@ back_store_t *back_store_open(const char *const fname) {
 
     //create back_store_t object in heap memory
     back_store_t *bs = (back_store_t*)malloc(sizeof(back_store_t));
+    if(!bs) {
+        return NULL;
+    }
 
     //open the file and store the file descriptor
     int flags = O_RDWR;
@@ -90,18 +872,55 @@ back_store_t *back_store_open(const char *const fname) {
     }
     bs->fd = fd;
 
+    //superblock if there is one, otherwise it's the original layout
+    superblock_t super;
+    if(pread(bs->fd, &super, sizeof(super), 0) != sizeof(super)) {
+        close(bs->fd);
+        free(bs);
+        return NULL;
+    }
+    bool valid;
+    if(super.magic == SUPERBLOCK_MAGIC) {
+        valid = geometry_setup(bs, super.block_size, super.block_count, true);
+    } else {
+        valid = geometry_setup(bs, BLOCK_SIZE, NUM_BLOCKS, false);
+    }
+    if(!valid) {
+        close(bs->fd);
+        free(bs);
+        return NULL;
+    }
+
     //get bitmap_data from file
-    uint8_t bitmap_data[FBM_BYTES];
-    read(bs->fd, bitmap_data, FBM_BYTES);
+    uint8_t *bitmap_data = (uint8_t*)malloc(bs->fbm_bytes);
+    if(!bitmap_data || pread(bs->fd, bitmap_data, bs->fbm_bytes, bs->fbm_offset) != (ssize_t)bs->fbm_bytes) {
+        free(bitmap_data);
+        close(bs->fd);
+        free(bs->fbm_summary);
+        free(bs);
+        return NULL;
+    }
 
     //import the bitmap data into a new bitmap_t
-    bs->fbm = bitmap_import(NUM_BLOCKS, bitmap_data);
+    bs->fbm = bitmap_import(bs->block_count, bitmap_data);
+    free(bitmap_data);
     if(bs->fbm == NULL) {
         close(bs->fd);
+        free(bs->fbm_summary);
         free(bs);
         return NULL;
     }
+    fbm_summary_build(bs);
 
+    if(!cache_init(bs)) {
+        bitmap_destroy(bs->fbm);
+        close(bs->fd);
+        free(bs->fbm_summary);
+        free(bs);
+        return NULL;
+    }
+
+    async_init(bs);
     return bs;
 }
 
@@ -115,21 +934,41 @@ void back_store_close(back_store_t *const bs) {
         return;
     }
 
-    //set offset to beginning of file to write out FBM data
-    lseek(bs->fd, 0, SEEK_SET);
+    //anything in flight has to finish before the file goes away
+    async_stop(bs);
 
-    //get pointer to internal FBM data
-    const uint8_t *bitmap_data = bitmap_export(bs->fbm);
+    //dirty blocks and the fbm go out to disk
+    back_store_flush(bs);
 
-    //write out fbm data to file
-    write(bs->fd, bitmap_data, FBM_BYTES);
-
-    //close the file, destroy the bitmap, and free heap memory
+    //close the file, destroy the bitmap and cache, and free heap memory
     close(bs->fd);
     bitmap_destroy(bs->fbm);
+    free(bs->cache);
+    free(bs->cache_data);
+    free(bs->cache_buckets);
+    free(bs->fbm_summary);
+    pthread_mutex_destroy(&bs->lock);
     free(bs);
 }
 
+///
+/// Gets the size of a block, every read/write/map works in blocks of this size
+/// \param bs the back_store
+/// \return bytes per block, 0 on error
+///
+unsigned back_store_block_size(const back_store_t *const bs) {
+    return bs ? bs->block_size : 0;
+}
+
+///
+/// Gets the number of blocks in the back_store, including the ones it uses for itself
+/// \param bs the back_store
+/// \return number of blocks, 0 on error
+///
+unsigned back_store_block_count(const back_store_t *const bs) {
+    return bs ? bs->block_count : 0;
+}
+
 ///
 /// Allocates a block of storage in the back_store
 /// \param bs the back_store to allocate from
@@ -141,19 +980,114 @@ unsigned back_store_allocate(back_store_t *const bs) {
         return 0;
     }
 
+    pthread_mutex_lock(&bs->lock);
+
     //find the first free block
     size_t block_id = 0;
-    block_id = bitmap_ffz(bs->fbm);
+    block_id = fbm_ffz(bs);
+    if(block_id == SIZE_MAX) {
+        block_id = 0; //no free blocks
+    } else {
+        //set the bit in the fbm
+        bitmap_set(bs->fbm, block_id);
+        fbm_summary_update(bs, block_id);
+    }
+
+    pthread_mutex_unlock(&bs->lock);
+    return block_id;
+}
+
+///
+/// Allocates the first free block at or after the given block id
+///  wrapping around to the start of the store if there's nothing past it
+/// \param bs the back_store to allocate from
+/// \param hint block id to start looking from
+/// \return id of the allocated block, 0 on error
+///
+unsigned back_store_allocate_near(back_store_t *const bs, const unsigned hint) {
+
+    if(!bs) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+
+    //find the first free block past the hint
+    size_t block_id = fbm_ffz_from(bs, hint);
     if(block_id == SIZE_MAX) {
-        return 0; //no free blocks
+        block_id = 0; //no free blocks
+    } else {
+        //set the bit in the fbm
+        bitmap_set(bs->fbm, block_id);
+        fbm_summary_update(bs, block_id);
+    }
+
+    pthread_mutex_unlock(&bs->lock);
+    return block_id;
+}
+
+///
+/// Allocates a run of contiguous blocks
+/// \param bs the back_store to allocate from
+/// \param count number of blocks in the run
+/// \return id of the first block in the run, 0 on error (nothing is allocated)
+///
+unsigned back_store_allocate_contiguous(back_store_t *const bs, const unsigned count) {
+
+    if(!bs || !count) {
+        return 0;
     }
 
-    //set the bit in the fbm
-    bitmap_set(bs->fbm, block_id);
+    pthread_mutex_lock(&bs->lock);
+
+    //find a run long enough
+    size_t block_id = fbm_find_run(bs, count);
+    if(block_id == SIZE_MAX) {
+        block_id = 0; //no run that long
+    } else {
+        //set all the bits in the fbm
+        for(size_t i = block_id; i < block_id + count; i++) {
+            bitmap_set(bs->fbm, i);
+            fbm_summary_update(bs, i);
+        }
+    }
 
+    pthread_mutex_unlock(&bs->lock);
     return block_id;
 }
 
+///
+/// Allocates count blocks in a single pass over the free block map
+/// \param bs the back_store to allocate from
+/// \param count number of blocks wanted
+/// \param out_ptrs array of at least count entries, filled with the allocated block ids
+/// \return number of blocks allocated, less than count only if the store filled up
+///
+unsigned back_store_allocate_range(back_store_t *const bs, const unsigned count, unsigned *const out_ptrs) {
+    return back_store_allocate_range_near(bs, 0, count, out_ptrs);
+}
+
+///
+/// Same as back_store_allocate_range, but claims blocks at or after hint first
+/// \param bs the back_store to allocate from
+/// \param hint block id to start looking from
+/// \param count number of blocks wanted
+/// \param out_ptrs array of at least count entries, filled with the allocated block ids
+/// \return number of blocks allocated, less than count only if the store filled up
+///
+unsigned back_store_allocate_range_near(back_store_t *const bs, const unsigned hint, const unsigned count,
+                                        unsigned *const out_ptrs) {
+
+    if(!bs || !out_ptrs) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+    unsigned claimed = fbm_claim(bs, hint, count, out_ptrs);
+    pthread_mutex_unlock(&bs->lock);
+    return claimed;
+}
+
 ///
 /// Requests the allocation of a specified block id
 /// \param bs back_store to allocate from
@@ -162,14 +1096,21 @@ unsigned back_store_allocate(back_store_t *const bs) {
 ///
 bool back_store_request(back_store_t *const bs, const unsigned block_id) {
 
-    if(!bs || bitmap_test(bs->fbm, block_id)) {
+    if(!bs || block_id >= bs->block_count) {
         return false;
     }
 
-    //set the bit in the fbm
-    bitmap_set(bs->fbm, block_id);
+    pthread_mutex_lock(&bs->lock);
 
-    return true;
+    bool success = !bitmap_test(bs->fbm, block_id);
+    if(success) {
+        //set the bit in the fbm
+        bitmap_set(bs->fbm, block_id);
+        fbm_summary_update(bs, block_id);
+    }
+
+    pthread_mutex_unlock(&bs->lock);
+    return success;
 }
 
 ///
@@ -179,12 +1120,38 @@ bool back_store_request(back_store_t *const bs, const unsigned block_id) {
 ///
 void back_store_release(back_store_t *const bs, const unsigned block_id) {
 
-    if(!bs || block_id < FBM_BLOCKS) {
+    if(!bs || block_id < bs->data_start || block_id >= bs->block_count) {
         return;
     }
 
+    pthread_mutex_lock(&bs->lock);
+
     //free the block in the fbm
     bitmap_reset(bs->fbm, block_id);
+    fbm_summary_update(bs, block_id);
+
+    //no point ever writing out what was in it
+    cache_drop(bs, block_id);
+
+    pthread_mutex_unlock(&bs->lock);
+}
+
+///
+/// Releases every block id in the given array
+/// \param bs back_store object
+/// \param count number of block ids
+/// \param ptrs blocks to release
+///
+void back_store_release_range(back_store_t *const bs, const unsigned count, const unsigned *const ptrs) {
+
+    if(!bs || !ptrs) {
+        return;
+    }
+
+    //same checks as releasing them one at a time
+    for(unsigned i = 0; i < count; i++) {
+        back_store_release(bs, ptrs[i]);
+    }
 }
 
 ///
@@ -196,17 +1163,26 @@ void back_store_release(back_store_t *const bs, const unsigned block_id) {
 ///
 bool back_store_read(back_store_t *const bs, const unsigned block_id, void *const dst) {
 
-    if(!bs || !dst || block_id < FBM_BLOCKS || !bitmap_test(bs->fbm, block_id)) {
+    if(!bs || !dst || block_id < bs->data_start || block_id >= bs->block_count) {
         return false;
     }
 
-    //set file offset to correct block position
-    lseek(bs->fd, block_id*BLOCK_SIZE, SEEK_SET);
+    pthread_mutex_lock(&bs->lock);
 
-    //read the block into dst
-    read(bs->fd, (uint8_t*)dst, BLOCK_SIZE);
+    bool success = bitmap_test(bs->fbm, block_id);
+    if(success) {
+        //through the cache
+        cache_frame_t *frame = cache_get(bs, block_id, true);
+        if(frame) {
+            memcpy(dst, frame->data, bs->block_size);
+        } else {
+            //every frame is pinned, go straight to disk
+            success = pread(bs->fd, dst, bs->block_size, (off_t)block_id * bs->block_size) == (ssize_t)bs->block_size;
+        }
+    }
 
-    return true;
+    pthread_mutex_unlock(&bs->lock);
+    return success;
 }
 
 ///
@@ -218,15 +1194,472 @@ bool back_store_read(back_store_t *const bs, const unsigned block_id, void *cons
 ///
 bool back_store_write(back_store_t *const bs, const unsigned block_id, const void *const src) {
 
-    if(!bs || !src || block_id < FBM_BLOCKS || !bitmap_test(bs->fbm, block_id)) {
+    if(!bs || !src || block_id < bs->data_start || block_id >= bs->block_count) {
+        return false;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+
+    bool success = bitmap_test(bs->fbm, block_id);
+    if(success) {
+        //into the cache, it goes to disk when the frame gets reused or on flush
+        cache_frame_t *frame = cache_get(bs, block_id, false);
+        if(frame) {
+            memcpy(frame->data, src, bs->block_size);
+            frame->dirty = true;
+        } else {
+            //every frame is pinned, go straight to disk
+            success = pwrite(bs->fd, src, bs->block_size, (off_t)block_id * bs->block_size) == (ssize_t)bs->block_size;
+        }
+    }
+
+    pthread_mutex_unlock(&bs->lock);
+    return success;
+}
+
+///
+/// Checks every block id and iovec in a vectored request
+/// \param bs the back_store
+/// \param block_ids the blocks
+/// \param iov the buffers
+/// \param count number of blocks
+/// \return true if all of them are usable
+///
+bool vector_valid(const back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                  const unsigned count) {
+
+    if(!block_ids || !iov) {
+        return false;
+    }
+
+    //same rules as back_store_read/back_store_write, plus the iovec has to be one block
+    for(unsigned i = 0; i < count; i++) {
+        if(block_ids[i] < bs->data_start || block_ids[i] >= bs->block_count || !bitmap_test(bs->fbm, block_ids[i]) ||
+           !iov[i].iov_base || iov[i].iov_len != bs->block_size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+///
+/// Gets the length of the run of consecutive block ids starting at i
+///  capped at IOV_MAX so the whole run fits in one preadv/pwritev
+/// \param block_ids the blocks
+/// \param count number of blocks
+/// \param i where the run starts
+/// \return number of blocks in the run
+///
+unsigned vector_run(const unsigned *const block_ids, const unsigned count, const unsigned i) {
+    unsigned run = 1;
+    while(i + run < count && run < IOV_MAX && block_ids[i + run] == block_ids[i] + run) {
+        run++;
+    }
+    return run;
+}
+
+///
+/// Reads a list of blocks straight from disk, one syscall per run of consecutive blocks
+///  Doesn't look at the cache (or need the lock)
+/// \param bs the back_store
+/// \param block_ids the blocks, already checked
+/// \param iov where each block goes
+/// \param count number of blocks
+/// \return true if every block was read
+///
+bool vector_read(back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                 const unsigned count) {
+    for(unsigned i = 0, run; i < count; i += run) {
+        run = vector_run(block_ids, count, i);
+        ssize_t bytes = preadv(bs->fd, &iov[i], run, (off_t)block_ids[i] * bs->block_size);
+        if(bytes != (ssize_t)(run * bs->block_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+///
+/// Reads a list of blocks, one block per iovec
+///  Blocks with consecutive ids are read together, so a contiguous file is a few big reads
+/// \param bs the object to read from
+/// \param block_ids the blocks to read
+/// \param iov where each block goes, every iov_len has to be one block
+/// \param count number of blocks (and iovecs)
+/// \return bool indicating success, nothing is read if any block id or iovec is bad
+///
+bool back_store_readv(back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                      const unsigned count) {
+
+    if(!bs) {
+        return false;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+    bool valid = vector_valid(bs, block_ids, iov, count);
+    uint64_t write_backs = bs->cache_write_backs;
+    pthread_mutex_unlock(&bs->lock);
+
+    //the disk reads don't need the lock, other threads can use the cache in the meantime
+    if(!valid || !vector_read(bs, block_ids, iov, count)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+
+    //a dirty frame went out (and maybe left the cache) while we were reading, so what we got could be older
+    //than it. Doesn't happen much, just read it all again with the cache held still
+    bool success = bs->cache_write_backs == write_backs || vector_read(bs, block_ids, iov, count);
+
+    //cached blocks may be newer than what's on disk
+    for(unsigned i = 0; i < count && success; i++) {
+        cache_frame_t *frame = cache_find(bs, block_ids[i]);
+        if(frame) {
+            memcpy(iov[i].iov_base, frame->data, bs->block_size);
+        }
+    }
+
+    pthread_mutex_unlock(&bs->lock);
+    return success;
+}
+
+///
+/// Writes a list of blocks, one block per iovec
+///  Blocks with consecutive ids are written together
+/// \param bs the object to write to
+/// \param block_ids the blocks to write
+/// \param iov where each block comes from, every iov_len has to be one block
+/// \param count number of blocks (and iovecs)
+/// \return bool indicating success, nothing is written if any block id or iovec is bad
+///
+bool back_store_writev(back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                       const unsigned count) {
+
+    if(!bs) {
+        return false;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+    bool valid = vector_valid(bs, block_ids, iov, count);
+
+    //big writes skip the cache, but anything already in it has to stay current
+    for(unsigned i = 0; i < count && valid; i++) {
+        cache_frame_t *frame = cache_find(bs, block_ids[i]);
+        if(frame) {
+            memcpy(frame->data, iov[i].iov_base, bs->block_size);
+        }
+    }
+
+    pthread_mutex_unlock(&bs->lock);
+    if(!valid) {
         return false;
     }
 
-    //set file offset to correct block position
-    lseek(bs->fd, block_id*BLOCK_SIZE, SEEK_SET);
+    //one syscall per run of consecutive blocks
+    for(unsigned i = 0, run; i < count; i += run) {
+        run = vector_run(block_ids, count, i);
+        ssize_t bytes = pwritev(bs->fd, &iov[i], run, (off_t)block_ids[i] * bs->block_size);
+        if(bytes != (ssize_t)(run * bs->block_size)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+///
+/// Borrows a block in place for reading, no copy into a caller buffer
+///  The block stays pinned (and the pointer stays good) until back_store_unmap_block
+///  Only a handful of blocks can be pinned at once, so unmap as soon as you're done
+/// \param bs the object to borrow from
+/// \param block_id the block to borrow
+/// \return pointer to the block's data (back_store_block_size bytes), NULL on error
+///
+const void *back_store_map_block(back_store_t *const bs, const unsigned block_id) {
+    cache_frame_t *frame = cache_pin(bs, block_id, false);
+    return frame ? frame->data : NULL;
+}
+
+///
+/// Same as back_store_map_block, but the block can be written through the pointer
+///  Changes are guaranteed to be stored once the block is unmapped
+/// \param bs the object to borrow from
+/// \param block_id the block to borrow
+/// \return pointer to the block's data (back_store_block_size bytes), NULL on error
+///
+void *back_store_map_block_mut(back_store_t *const bs, const unsigned block_id) {
+    cache_frame_t *frame = cache_pin(bs, block_id, true);
+    return frame ? frame->data : NULL;
+}
+
+///
+/// Unpins a block borrowed with back_store_map_block or back_store_map_block_mut
+/// \param bs the object the block was borrowed from
+/// \param block the pointer the map call returned
+///
+void back_store_unmap_block(back_store_t *const bs, const void *const block) {
+
+    if(!bs || !block) {
+        return;
+    }
+
+    //the pointer is the data of some frame, work back to which one
+    if((const uint8_t*)block < bs->cache_data) {
+        return;
+    }
+    size_t distance = (const uint8_t*)block - bs->cache_data;
+    if(distance % bs->block_size || distance / bs->block_size >= bs->cache_size) {
+        return;
+    }
+
+    //stays in the cache (dirty if it was mapped mutable), it's just evictable again
+    pthread_mutex_lock(&bs->lock);
+    cache_frame_t *frame = &bs->cache[distance / bs->block_size];
+    if(frame->pins) {
+        frame->pins--;
+    }
+    pthread_mutex_unlock(&bs->lock);
+}
+
+///
+/// Writes every changed block and the free block map out to disk
+/// \param bs the back_store
+/// \return bool indicating success
+///
+bool back_store_flush(back_store_t *const bs) {
+
+    if(!bs) {
+        return false;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+
+    bool success = cache_write_back_all(bs);
+
+    //fbm lives at the front of the file (right after the superblock if there is one)
+    const uint8_t *bitmap_data = bitmap_export(bs->fbm);
+    success &= pwrite(bs->fd, bitmap_data, bs->fbm_bytes, bs->fbm_offset) == (ssize_t)bs->fbm_bytes;
+
+    pthread_mutex_unlock(&bs->lock);
+    return success && fsync(bs->fd) == 0;
+}
+
+///
+/// Copies the free block map out, one bit per block (set if the block is in use)
+/// \param bs the back_store
+/// \param dst where the map goes, back_store_block_count / 8 bytes
+/// \return bool indicating success
+///
+bool back_store_export_fbm(const back_store_t *const bs, void *const dst) {
+
+    if(!bs || !dst) {
+        return false;
+    }
+
+    //allocations change it under the lock, so the lock gets taken even through a const back_store
+    pthread_mutex_t *lock = (pthread_mutex_t*)&bs->lock;
+    pthread_mutex_lock(lock);
+    memcpy(dst, bitmap_export(bs->fbm), bs->fbm_bytes);
+    pthread_mutex_unlock(lock);
+    return true;
+}
+
+///
+/// Replaces the free block map with one back_store_export_fbm handed out earlier
+///  Only the copy in memory changes, the next flush writes it out like any other allocation
+/// \param bs the back_store
+/// \param src the new map, back_store_block_count / 8 bytes
+/// \return bool indicating success
+///
+bool back_store_import_fbm(back_store_t *const bs, const void *const src) {
+
+    if(!bs || !src) {
+        return false;
+    }
+
+    bitmap_t *fbm = bitmap_import(bs->block_count, src);
+    if(!fbm) {
+        return false;
+    }
+    //superblock and fbm blocks are always in use
+    for(size_t i = 0; i < bs->data_start; i++) {
+        bitmap_set(fbm, i);
+    }
+
+    pthread_mutex_lock(&bs->lock);
+    bitmap_destroy(bs->fbm);
+    bs->fbm = fbm;
+    fbm_summary_build(bs);
+    pthread_mutex_unlock(&bs->lock);
+    return true;
+}
+
+///
+/// Changes how many blocks the cache holds
+///  Dirty blocks are written out and the cache starts over empty
+/// \param bs the back_store
+/// \param blocks number of blocks to cache, at least 1
+/// \return bool indicating success, fails if anything is still mapped
+///
+bool back_store_cache_resize(back_store_t *const bs, const unsigned blocks) {
+
+    if(!bs || !blocks || blocks > bs->block_count) {
+        return false;
+    }
+
+    pthread_mutex_lock(&bs->lock);
+
+    //pinned frames have pointers out to them, can't move those
+    bool success = true;
+    for(unsigned i = 0; i < bs->cache_size && success; i++) {
+        success = !bs->cache[i].pins;
+    }
+    success = success && cache_write_back_all(bs) && cache_setup(bs, blocks);
+
+    pthread_mutex_unlock(&bs->lock);
+    return success;
+}
+
+///
+/// Gets the cache hit/miss counters
+/// \param bs the back_store
+/// \param hits where to put the number of block accesses served from the cache, can be NULL
+/// \param misses where to put the number of accesses that had to bring a block in, can be NULL
+/// \return bool indicating success, false if the back_store has no cache
+///
+bool back_store_cache_stats(const back_store_t *const bs, uint64_t *const hits, uint64_t *const misses) {
+
+    if(!bs) {
+        return false;
+    }
+
+    //the counters change under the lock, so the lock gets taken even through a const back_store
+    pthread_mutex_t *lock = (pthread_mutex_t*)&bs->lock;
+    pthread_mutex_lock(lock);
+    if(hits) {
+        *hits = bs->cache_hits;
+    }
+    if(misses) {
+        *misses = bs->cache_misses;
+    }
+    pthread_mutex_unlock(lock);
+
+    return true;
+}
+
+///
+/// Starts reading a block without waiting for it
+///  dst has to stay around (and untouched) until the completion comes back from back_store_poll
+///  Don't mix sync and async access to a block that has a request in flight
+/// \param bs the object to read from
+/// \param block_id the block to read from
+/// \param dst the buffer to write to
+/// \param tag handed back in the completion so the caller can tell requests apart
+/// \return bool indicating the request was queued, false if it's bad or BACK_STORE_ASYNC_DEPTH are in flight
+///
+bool back_store_submit_read(back_store_t *const bs, const unsigned block_id, void *const dst, const uint64_t tag) {
+    return async_submit(bs, block_id, dst, false, tag);
+}
+
+///
+/// Starts writing a block without waiting for it
+///  src has to stay around (and untouched) until the completion comes back from back_store_poll
+///  Don't mix sync and async access to a block that has a request in flight
+/// \param bs the object to write to
+/// \param block_id the block to write to
+/// \param src the buffer to read from
+/// \param tag handed back in the completion so the caller can tell requests apart
+/// \return bool indicating the request was queued, false if it's bad or BACK_STORE_ASYNC_DEPTH are in flight
+///
+bool back_store_submit_write(back_store_t *const bs, const unsigned block_id, const void *const src,
+                             const uint64_t tag) {
+    //the buffer is only ever read from for a write
+    return async_submit(bs, block_id, (void*)src, true, tag);
+}
+
+///
+/// Collects finished async requests
+/// \param bs the back_store
+/// \param completions where to put them
+/// \param max most completions to hand back
+/// \param wait whether to block until at least one is done (if anything is in flight)
+/// \return number of completions filled in
+///
+unsigned back_store_poll(back_store_t *const bs, back_store_completion_t *const completions, const unsigned max,
+                         const bool wait) {
+
+    if(!bs || !completions || !max) {
+        return 0;
+    }
+
+    async_t *async = &bs->async;
+    unsigned polled = 0;
+
+    pthread_mutex_lock(&async->lock);
+#ifndef BACK_STORE_IO_URING
+    //workers put everything in completed, so that's all there is to wait on
+    while(wait && !async->completed_count && async->in_flight) {
+        pthread_cond_wait(&async->done, &async->lock);
+    }
+#endif
+    while(polled < max && async->completed_count) {
+        async_request_t *request = &async->completed[async->completed_head];
+        completions[polled].tag = request->tag;
+        completions[polled].success = request->success;
+        polled++;
+        async->completed_head = (async->completed_head + 1) % BACK_STORE_ASYNC_DEPTH;
+        async->completed_count--;
+        async->in_flight--;
+    }
+    pthread_mutex_unlock(&async->lock);
+
+#ifdef BACK_STORE_IO_URING
+    //then whatever the ring has finished, only waiting if there's nothing yet
+    while(polled < max && async->in_flight) {
+        struct io_uring_cqe *cqe;
+        int result = (wait && !polled) ? io_uring_wait_cqe(&async->ring, &cqe) : io_uring_peek_cqe(&async->ring, &cqe);
+        if(result < 0) {
+            break;
+        }
+        completions[polled].tag = io_uring_cqe_get_data64(cqe);
+        completions[polled].success = cqe->res == (int)bs->block_size;
+        polled++;
+        io_uring_cqe_seen(&async->ring, cqe);
+        async->in_flight--;
+    }
+#endif
+
+    return polled;
+}
+
+///
+/// Hints that these blocks are about to be read, so they can start coming in now
+///  The kernel reads each run in the background, the preads later on come out of the page cache
+///  Blocks already in a frame don't need it, but it's cheaper to just ask than to look
+/// \param bs the back_store
+/// \param block_ids the blocks
+/// \param count number of blocks
+/// \return bool indicating the hint was taken, false if any block id is bad
+///
+bool back_store_prefetch(back_store_t *const bs, const unsigned *const block_ids, const unsigned count) {
+
+    if(!bs || !block_ids) {
+        return false;
+    }
+    for(unsigned i = 0; i < count; i++) {
+        if(block_ids[i] < bs->data_start || block_ids[i] >= bs->block_count) {
+            return false;
+        }
+    }
+
+    for(unsigned i = 0, run; i < count; i += run) {
+        run = 1;
+        while(i + run < count && block_ids[i + run] == block_ids[i] + run) {
+            run++;
+        }
+        posix_fadvise(bs->fd, (off_t)block_ids[i] * bs->block_size, (off_t)run * bs->block_size, POSIX_FADV_WILLNEED);
+    }
 
-    //write src out to block
-    write(bs->fd, (const uint8_t*)src, BLOCK_SIZE);
-    
     return true;
 }
@@ -0,0 +1,117 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+// Using a C library requires extern "C" to prevent function managling
+extern "C" {
+#include "../src/back_store.c"
+}
+
+/*
+ * SYNC VS ASYNC READ BENCHMARK
+ * Reads every data block of a store once, in random order
+ * First one at a time with back_store_read, then keeping the queue full with submit/poll
+ * The cache is cut down to one frame so the sync side is really doing a pread per block
+ **/
+
+#define BENCH_FILE "bench.bs"
+#define BENCH_PASSES 3
+
+// one pass of blocking reads, MB/s
+static double time_sync(back_store_t *bs, const std::vector<unsigned> &blocks, uint8_t *buffer) {
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned block_id : blocks) {
+        if(!back_store_read(bs, block_id, buffer)) {
+            fprintf(stderr, "sync read of %u failed\n", block_id);
+            exit(1);
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return blocks.size() * 1024.0 / std::chrono::duration<double>(stop - start).count() / (1024 * 1024);
+}
+
+// one pass with up to depth reads in flight, MB/s
+static double time_async(back_store_t *bs, const std::vector<unsigned> &blocks, uint8_t *buffers,
+                         const unsigned depth) {
+    std::vector<unsigned> free_slots;
+    for(unsigned i = 0; i < depth; ++i) {
+        free_slots.push_back(i);
+    }
+    back_store_completion_t done[BACK_STORE_ASYNC_DEPTH];
+    size_t next = 0, finished = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while(finished < blocks.size()) {
+        // top the queue up, the tag is which buffer it's using
+        while(next < blocks.size() && !free_slots.empty()) {
+            unsigned slot = free_slots.back();
+            if(!back_store_submit_read(bs, blocks[next], buffers + slot * 1024, slot)) {
+                break;
+            }
+            free_slots.pop_back();
+            ++next;
+        }
+        unsigned count = back_store_poll(bs, done, BACK_STORE_ASYNC_DEPTH, true);
+        for(unsigned i = 0; i < count; ++i) {
+            if(!done[i].success) {
+                fprintf(stderr, "async read failed\n");
+                exit(1);
+            }
+            free_slots.push_back(done[i].tag);
+        }
+        finished += count;
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return blocks.size() * 1024.0 / std::chrono::duration<double>(stop - start).count() / (1024 * 1024);
+}
+
+int main() {
+    back_store_t *bs = back_store_create(BENCH_FILE);
+    if(!bs) {
+        fprintf(stderr, "couldn't make %s\n", BENCH_FILE);
+        return 1;
+    }
+
+    // fill every block so nothing is a hole
+    std::vector<unsigned> blocks(65536);
+    unsigned count = back_store_allocate_range(bs, 65536, blocks.data());
+    blocks.resize(count);
+    static uint8_t block[1024];
+    for(unsigned block_id : blocks) {
+        memset(block, block_id & 0xFF, sizeof(block));
+        back_store_write(bs, block_id, block);
+    }
+    back_store_flush(bs);
+    back_store_cache_resize(bs, 1);
+
+    std::mt19937 rng(42);
+    std::shuffle(blocks.begin(), blocks.end(), rng);
+
+    static uint8_t buffers[BACK_STORE_ASYNC_DEPTH * 1024];
+    printf("%u random 1 KiB reads, best of %d passes (MB/s)\n", count, BENCH_PASSES);
+    printf("%-14s %10s\n", "mode", "MB/s");
+
+    double best = 0;
+    for(int pass = 0; pass < BENCH_PASSES; ++pass) {
+        best = std::max(best, time_sync(bs, blocks, block));
+    }
+    printf("%-14s %10.1f\n", "sync pread", best);
+
+    for(unsigned depth : {1u, 8u, 64u, (unsigned)BACK_STORE_ASYNC_DEPTH}) {
+        best = 0;
+        for(int pass = 0; pass < BENCH_PASSES; ++pass) {
+            best = std::max(best, time_async(bs, blocks, buffers, depth));
+        }
+        char mode[32];
+        snprintf(mode, sizeof(mode), "async qd %u", depth);
+        printf("%-14s %10.1f\n", mode, best);
+    }
+
+    back_store_close(bs);
+    remove(BENCH_FILE);
+    return 0;
+}
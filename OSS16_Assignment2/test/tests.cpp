@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cstddef>
 #include <cstring>
+#include <sys/stat.h>
 #include "gtest/gtest.h"
 
 // Using a C library requires extern "C" to prevent function managling
@@ -170,6 +171,490 @@ TEST(bs_request, fill_device) {
     score += 6;
 }
 
+TEST(bs_allocate, reuse_after_fill) {
+    back_store_t *bs = back_store_create("test_m.bs");
+    ASSERT_NE(nullptr, bs);
+    for (unsigned i = 8; i < 65536; ++i) {
+        ASSERT_EQ(i, back_store_allocate(bs));
+    }
+    ASSERT_EQ(back_store_allocate(bs), 0);
+
+    // a hole way up high has to be found without anything below it being free
+    back_store_release(bs, 60001);
+    ASSERT_EQ(60001, back_store_allocate(bs));
+    back_store_release(bs, 65535);
+    back_store_release(bs, 4242);
+    ASSERT_EQ(4242, back_store_allocate(bs));
+    back_store_close(bs);
+
+    // and it still works off a saved FBM
+    bs = back_store_open("test_m.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(65535, back_store_allocate(bs));
+    ASSERT_EQ(back_store_allocate(bs), 0);
+    back_store_close(bs);
+}
+
+TEST(bs_allocate, near_and_contiguous) {
+    back_store_t *bs = back_store_create("test_n.bs");
+    ASSERT_NE(nullptr, bs);
+
+    // next free at or after the hint
+    ASSERT_EQ(1000, back_store_allocate_near(bs, 1000));
+    ASSERT_EQ(1001, back_store_allocate_near(bs, 1000));
+    ASSERT_TRUE(back_store_request(bs, 1002));
+    ASSERT_EQ(1003, back_store_allocate_near(bs, 1001));
+
+    // nothing past the hint, wraps to the front
+    ASSERT_TRUE(back_store_request(bs, 65535));
+    ASSERT_EQ(8, back_store_allocate_near(bs, 65535));
+    ASSERT_EQ(9, back_store_allocate_near(bs, 70000));
+
+    // runs skip over anything that's too short
+    ASSERT_TRUE(back_store_request(bs, 14));
+    ASSERT_EQ(15, back_store_allocate_contiguous(bs, 8));
+    for (unsigned i = 15; i < 23; ++i) {
+        ASSERT_FALSE(back_store_request(bs, i));
+    }
+    ASSERT_EQ(10, back_store_allocate_contiguous(bs, 4));
+    ASSERT_EQ(0, back_store_allocate_contiguous(bs, 65536));
+    ASSERT_EQ(0, back_store_allocate_contiguous(bs, 0));
+    ASSERT_EQ(0, back_store_allocate_near(NULL, 12));
+    ASSERT_EQ(0, back_store_allocate_contiguous(NULL, 12));
+
+    back_store_close(bs);
+}
+
+TEST(bs_allocate, range) {
+    back_store_t *bs = back_store_create("test_o.bs");
+    ASSERT_NE(nullptr, bs);
+
+    // a few holes to make it interesting
+    ASSERT_TRUE(back_store_request(bs, 10));
+    ASSERT_TRUE(back_store_request(bs, 70));
+    ASSERT_TRUE(back_store_request(bs, 71));
+
+    unsigned ptrs[200];
+    ASSERT_EQ(200, back_store_allocate_range(bs, 200, ptrs));
+    unsigned expected = 8;
+    for (unsigned i = 0; i < 200; ++i, ++expected) {
+        while (expected == 10 || expected == 70 || expected == 71) {
+            ++expected;
+        }
+        ASSERT_EQ(expected, ptrs[i]);
+        ASSERT_FALSE(back_store_request(bs, ptrs[i]));
+    }
+
+    // give half back, they come out again the same way
+    back_store_release_range(bs, 100, ptrs + 50);
+    unsigned again[100];
+    ASSERT_EQ(100, back_store_allocate_range(bs, 100, again));
+    ASSERT_EQ(0, memcmp(ptrs + 50, again, sizeof(again)));
+
+    // hint goes high first, then wraps
+    ASSERT_EQ(3, back_store_allocate_range_near(bs, 65533, 3, ptrs));
+    ASSERT_EQ(65533, ptrs[0]);
+    ASSERT_EQ(65535, ptrs[2]);
+    ASSERT_EQ(2, back_store_allocate_range_near(bs, 65534, 2, ptrs));
+    ASSERT_EQ(expected, ptrs[0]);
+    ASSERT_EQ(expected + 1, ptrs[1]);
+
+    // runs out part way
+    static unsigned everything[65536];
+    unsigned left = 65536 - 8 - 3 - 200 - 3 - 2;
+    ASSERT_EQ(left, back_store_allocate_range(bs, 65536, everything));
+    ASSERT_EQ(0, back_store_allocate_range(bs, 1, ptrs));
+    ASSERT_EQ(0, back_store_allocate_range(NULL, 1, ptrs));
+    ASSERT_EQ(0, back_store_allocate_range(bs, 1, NULL));
+
+    back_store_close(bs);
+}
+
+TEST(bs_readv_writev, basic) {
+    back_store_t *bs = back_store_create("test_p.bs");
+    ASSERT_NE(nullptr, bs);
+
+    // 4 back to back blocks and one off on its own
+    unsigned ids[5];
+    ASSERT_EQ(4, back_store_allocate_range(bs, 4, ids));
+    ids[4] = 500;
+    ASSERT_TRUE(back_store_request(bs, ids[4]));
+
+    static uint8_t out[5][1024], in[5][1024];
+    struct iovec out_iov[5], in_iov[5];
+    for (unsigned i = 0; i < 5; ++i) {
+        memset(out[i], 0x10 + i, 1024);
+        out_iov[i] = {out[i], 1024};
+        // read back with the buffers out of order so they can't all be one copy
+        in_iov[i] = {in[4 - i], 1024};
+    }
+
+    ASSERT_TRUE(back_store_writev(bs, ids, out_iov, 5));
+    ASSERT_TRUE(back_store_readv(bs, ids, in_iov, 5));
+    for (unsigned i = 0; i < 5; ++i) {
+        ASSERT_EQ(0, memcmp(out[i], in[4 - i], 1024));
+    }
+
+    // matches what single block reads see
+    uint8_t block[1024];
+    ASSERT_TRUE(back_store_read(bs, ids[4], block));
+    ASSERT_EQ(0, memcmp(out[4], block, 1024));
+
+    // any bad entry fails the whole thing
+    ids[2] = 3;
+    ASSERT_FALSE(back_store_readv(bs, ids, in_iov, 5));
+    ASSERT_FALSE(back_store_writev(bs, ids, out_iov, 5));
+    ids[2] = ids[1] + 1;
+    out_iov[3].iov_len = 512;
+    ASSERT_FALSE(back_store_writev(bs, ids, out_iov, 5));
+    ASSERT_FALSE(back_store_readv(NULL, ids, in_iov, 5));
+    ASSERT_FALSE(back_store_readv(bs, NULL, in_iov, 5));
+    ASSERT_FALSE(back_store_writev(bs, ids, NULL, 5));
+
+    back_store_close(bs);
+}
+
+TEST(bs_map_block, basic) {
+    back_store_t *bs = back_store_create("test_q.bs");
+    ASSERT_NE(nullptr, bs);
+
+    unsigned block_id = back_store_allocate(bs);
+    ASSERT_NE(0, block_id);
+
+    uint8_t block[1024], check[1024];
+    memset(block, 0x5A, 1024);
+    ASSERT_TRUE(back_store_write(bs, block_id, block));
+
+    // a read-only borrow sees what's there
+    const uint8_t *view = (const uint8_t *) back_store_map_block(bs, block_id);
+    ASSERT_NE(nullptr, view);
+    ASSERT_EQ(0, memcmp(view, block, 1024));
+
+    // a mutable borrow of the same block is the same memory
+    uint8_t *edit = (uint8_t *) back_store_map_block_mut(bs, block_id);
+    ASSERT_NE(nullptr, edit);
+    memset(edit + 100, 0xA5, 24);
+    memset(block + 100, 0xA5, 24);
+    ASSERT_EQ(0, memcmp(view, block, 1024));
+
+    // plain reads see changes made through a mapping
+    ASSERT_TRUE(back_store_read(bs, block_id, check));
+    ASSERT_EQ(0, memcmp(check, block, 1024));
+
+    back_store_unmap_block(bs, edit);
+    back_store_unmap_block(bs, view);
+
+    // and they stick after the last unmap and a reopen
+    back_store_close(bs);
+    bs = back_store_open("test_q.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_TRUE(back_store_read(bs, block_id, check));
+    ASSERT_EQ(0, memcmp(check, block, 1024));
+
+    // can't borrow the FBM
+    ASSERT_EQ(nullptr, back_store_map_block(bs, 0));
+    ASSERT_EQ(nullptr, back_store_map_block_mut(bs, 7));
+    ASSERT_EQ(nullptr, back_store_map_block(NULL, block_id));
+    back_store_unmap_block(bs, NULL);
+
+    back_store_close(bs);
+}
+
+TEST(bs_cache, write_back) {
+    back_store_t *bs = back_store_create("test_r.bs");
+    ASSERT_NE(nullptr, bs);
+
+    unsigned ids[4];
+    ASSERT_EQ(4, back_store_allocate_range(bs, 4, ids));
+
+    uint64_t hits = 0, misses = 0;
+    ASSERT_TRUE(back_store_cache_stats(bs, &hits, &misses));
+    ASSERT_EQ(0, hits);
+    ASSERT_EQ(0, misses);
+
+    // first touch misses, everything after hits
+    uint8_t block[1024], check[1024];
+    memset(block, 0x33, 1024);
+    ASSERT_TRUE(back_store_write(bs, ids[0], block));
+    ASSERT_TRUE(back_store_read(bs, ids[0], check));
+    ASSERT_TRUE(back_store_read(bs, ids[0], check));
+    ASSERT_TRUE(back_store_cache_stats(bs, &hits, &misses));
+    ASSERT_EQ(2, hits);
+    ASSERT_EQ(1, misses);
+    ASSERT_EQ(0, memcmp(block, check, 1024));
+
+    // two frames and four blocks, dirty blocks have to survive eviction
+    ASSERT_TRUE(back_store_cache_resize(bs, 2));
+    for (unsigned i = 0; i < 4; ++i) {
+        memset(block, 0x40 + i, 1024);
+        ASSERT_TRUE(back_store_write(bs, ids[i], block));
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        memset(block, 0x40 + i, 1024);
+        ASSERT_TRUE(back_store_read(bs, ids[i], check));
+        ASSERT_EQ(0, memcmp(block, check, 1024));
+    }
+
+    // can't resize out from under a mapping
+    const void *view = back_store_map_block(bs, ids[0]);
+    ASSERT_NE(nullptr, view);
+    ASSERT_FALSE(back_store_cache_resize(bs, 8));
+    back_store_unmap_block(bs, view);
+    ASSERT_FALSE(back_store_cache_resize(bs, 0));
+    ASSERT_FALSE(back_store_cache_resize(NULL, 8));
+    ASSERT_FALSE(back_store_cache_stats(NULL, &hits, &misses));
+
+    // flush puts it all on disk, a fresh open sees it
+    ASSERT_TRUE(back_store_write(bs, ids[3], block));
+    ASSERT_TRUE(back_store_flush(bs));
+    ASSERT_FALSE(back_store_flush(NULL));
+    back_store_close(bs);
+
+    bs = back_store_open("test_r.bs");
+    ASSERT_NE(nullptr, bs);
+    for (unsigned i = 0; i < 4; ++i) {
+        memset(block, 0x40 + i, 1024);
+        ASSERT_TRUE(back_store_read(bs, ids[i], check));
+        ASSERT_EQ(0, memcmp(block, check, 1024));
+    }
+    back_store_close(bs);
+}
+
+TEST(bs_create, sparse) {
+    back_store_t *bs = back_store_create("test_s.bs");
+    ASSERT_NE(nullptr, bs);
+
+    // full size, but nothing's been written so nearly none of it is on disk
+    struct stat file_info;
+    ASSERT_EQ(0, stat("test_s.bs", &file_info));
+    ASSERT_EQ(65536 * 1024, file_info.st_size);
+    ASSERT_LT(file_info.st_blocks * 512, 1024 * 1024);
+
+    // never-written blocks are zero
+    unsigned block_id = back_store_allocate(bs);
+    ASSERT_NE(0, block_id);
+    uint8_t block[1024], zero[1024];
+    memset(block, 0xFF, 1024);
+    memset(zero, 0x00, 1024);
+    ASSERT_TRUE(back_store_read(bs, block_id, block));
+    ASSERT_EQ(0, memcmp(zero, block, 1024));
+
+    back_store_close(bs);
+}
+
+TEST(bs_create_ex, geometry) {
+    // original layout
+    back_store_t *bs = back_store_create("test_t.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(1024, back_store_block_size(bs));
+    ASSERT_EQ(65536, back_store_block_count(bs));
+    back_store_close(bs);
+    bs = back_store_open("test_t.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(1024, back_store_block_size(bs));
+    ASSERT_EQ(65536, back_store_block_count(bs));
+    back_store_close(bs);
+
+    // 4 KiB blocks, 2^18 of them (1 GiB, but it's all a hole)
+    const unsigned count = 1U << 18;
+    bs = back_store_create_ex("test_t.bs", 4096, count);
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(4096, back_store_block_size(bs));
+    ASSERT_EQ(count, back_store_block_count(bs));
+
+    // superblock + 8 FBM blocks are taken
+    unsigned first = back_store_allocate(bs);
+    ASSERT_EQ(9, first);
+    const unsigned far = count - 1;
+    ASSERT_TRUE(back_store_request(bs, far));
+
+    static uint8_t block[4096], check[4096];
+    memset(block, 0x6B, 4096);
+    ASSERT_TRUE(back_store_write(bs, far, block));
+    back_store_close(bs);
+
+    // geometry comes back from the superblock
+    bs = back_store_open("test_t.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(4096, back_store_block_size(bs));
+    ASSERT_EQ(count, back_store_block_count(bs));
+    ASSERT_TRUE(back_store_read(bs, far, check));
+    ASSERT_EQ(0, memcmp(block, check, 4096));
+    ASSERT_FALSE(back_store_request(bs, first));
+    ASSERT_EQ(first + 1, back_store_allocate(bs));
+    back_store_close(bs);
+
+    // 64 KiB blocks
+    bs = back_store_create_ex("test_t.bs", 65536, 4096);
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(65536, back_store_block_size(bs));
+    ASSERT_EQ(2, back_store_allocate(bs));
+    back_store_close(bs);
+
+    // bad geometry
+    ASSERT_EQ(nullptr, back_store_create_ex("test_t.bs", 1000, 65536));
+    ASSERT_EQ(nullptr, back_store_create_ex("test_t.bs", 512, 65536));
+    ASSERT_EQ(nullptr, back_store_create_ex("test_t.bs", 131072, 65536));
+    ASSERT_EQ(nullptr, back_store_create_ex("test_t.bs", 1024, 100));
+    ASSERT_EQ(nullptr, back_store_create_ex("test_t.bs", 1024, 0));
+    ASSERT_EQ(nullptr, back_store_create_ex(NULL, 1024, 65536));
+    ASSERT_EQ(0, back_store_block_size(NULL));
+    ASSERT_EQ(0, back_store_block_count(NULL));
+}
+
+TEST(bs_async, submit_poll) {
+    back_store_t *bs = back_store_create("test_u.bs");
+    ASSERT_NE(nullptr, bs);
+
+    unsigned ids[8];
+    ASSERT_EQ(8, back_store_allocate_range(bs, 8, ids));
+
+    static uint8_t out[8][1024], in[8][1024];
+    back_store_completion_t done[BACK_STORE_ASYNC_DEPTH];
+
+    // nothing in flight, nothing to poll (and waiting doesn't hang)
+    ASSERT_EQ(0, back_store_poll(bs, done, 8, true));
+
+    for (unsigned i = 0; i < 8; ++i) {
+        memset(out[i], 0x70 + i, 1024);
+        ASSERT_TRUE(back_store_submit_write(bs, ids[i], out[i], 100 + i));
+    }
+    bool seen[8] = {false};
+    for (unsigned polled = 0; polled < 8;) {
+        unsigned count = back_store_poll(bs, done, 3, true);
+        ASSERT_NE(0, count);
+        ASSERT_LE(count, 3);
+        for (unsigned i = 0; i < count; ++i) {
+            ASSERT_TRUE(done[i].success);
+            ASSERT_GE(done[i].tag, 100);
+            ASSERT_LT(done[i].tag, 108);
+            seen[done[i].tag - 100] = true;
+        }
+        polled += count;
+    }
+    for (unsigned i = 0; i < 8; ++i) {
+        ASSERT_TRUE(seen[i]);
+    }
+
+    // read back async, and a sync read agrees
+    for (unsigned i = 0; i < 8; ++i) {
+        ASSERT_TRUE(back_store_submit_read(bs, ids[i], in[i], i));
+    }
+    for (unsigned polled = 0; polled < 8;) {
+        unsigned count = back_store_poll(bs, done, BACK_STORE_ASYNC_DEPTH, true);
+        ASSERT_NE(0, count);
+        for (unsigned i = 0; i < count; ++i) {
+            ASSERT_TRUE(done[i].success);
+        }
+        polled += count;
+    }
+    uint8_t block[1024];
+    for (unsigned i = 0; i < 8; ++i) {
+        ASSERT_EQ(0, memcmp(out[i], in[i], 1024));
+        ASSERT_TRUE(back_store_read(bs, ids[i], block));
+        ASSERT_EQ(0, memcmp(out[i], block, 1024));
+    }
+
+    // can't have more than BACK_STORE_ASYNC_DEPTH out at once
+    for (unsigned i = 0; i < BACK_STORE_ASYNC_DEPTH; ++i) {
+        ASSERT_TRUE(back_store_submit_read(bs, ids[i % 8], in[i % 8], i));
+    }
+    ASSERT_FALSE(back_store_submit_read(bs, ids[0], in[0], 0));
+    for (unsigned polled = 0; polled < BACK_STORE_ASYNC_DEPTH;) {
+        polled += back_store_poll(bs, done, BACK_STORE_ASYNC_DEPTH, true);
+    }
+    ASSERT_TRUE(back_store_submit_read(bs, ids[0], in[0], 0));
+    ASSERT_EQ(1, back_store_poll(bs, done, 1, true));
+
+    // bad requests don't get queued
+    ASSERT_FALSE(back_store_submit_read(bs, 0, in[0], 0));
+    ASSERT_FALSE(back_store_submit_write(bs, 7, out[0], 0));
+    ASSERT_FALSE(back_store_submit_read(NULL, ids[0], in[0], 0));
+    ASSERT_FALSE(back_store_submit_read(bs, ids[0], NULL, 0));
+    ASSERT_EQ(0, back_store_poll(bs, done, 8, false));
+    ASSERT_EQ(0, back_store_poll(NULL, done, 8, false));
+
+    // closing with something still in flight is fine
+    ASSERT_TRUE(back_store_submit_write(bs, ids[0], out[0], 0));
+    back_store_close(bs);
+}
+
+TEST(bs_prefetch, basic) {
+    back_store_t *bs = back_store_create("test_v.bs");
+    ASSERT_NE(nullptr, bs);
+
+    unsigned ids[8];
+    ASSERT_EQ(8, back_store_allocate_range(bs, 8, ids));
+    static uint8_t out[8][1024];
+    for (unsigned i = 0; i < 8; ++i) {
+        memset(out[i], 0x30 + i, 1024);
+        ASSERT_TRUE(back_store_write(bs, ids[i], out[i]));
+    }
+    ASSERT_TRUE(back_store_flush(bs));
+
+    // a run and some stragglers, then the reads still see the right data
+    unsigned scattered[5] = {ids[7], ids[0], ids[1], ids[2], ids[5]};
+    ASSERT_TRUE(back_store_prefetch(bs, scattered, 5));
+    ASSERT_TRUE(back_store_prefetch(bs, ids, 0));
+    uint8_t block[1024];
+    for (unsigned i = 0; i < 8; ++i) {
+        ASSERT_TRUE(back_store_read(bs, ids[i], block));
+        ASSERT_EQ(0, memcmp(out[i], block, 1024));
+    }
+
+    // bad blocks get the whole hint turned down
+    unsigned bad[2] = {ids[0], 65536};
+    ASSERT_FALSE(back_store_prefetch(bs, bad, 2));
+    bad[1] = 0;
+    ASSERT_FALSE(back_store_prefetch(bs, bad, 2));
+    ASSERT_FALSE(back_store_prefetch(NULL, ids, 1));
+    ASSERT_FALSE(back_store_prefetch(bs, NULL, 1));
+
+    back_store_close(bs);
+}
+
+TEST(bs_fbm, export_import) {
+    back_store_t *bs = back_store_create("test_w.bs");
+    ASSERT_NE(nullptr, bs);
+
+    static uint8_t saved[65536 / 8], now[65536 / 8];
+    const unsigned a = back_store_allocate(bs);
+    ASSERT_NE(0U, a);
+    ASSERT_TRUE(back_store_export_fbm(bs, saved));
+    ASSERT_EQ(0xFF, saved[0]);  // the map's own blocks
+    ASSERT_TRUE(saved[a >> 3] & (1 << (a & 7)));
+
+    // things change, then the saved map goes back in
+    const unsigned b = back_store_allocate(bs);
+    ASSERT_NE(0U, b);
+    back_store_release(bs, a);
+    ASSERT_TRUE(back_store_import_fbm(bs, saved));
+    ASSERT_TRUE(back_store_export_fbm(bs, now));
+    ASSERT_EQ(0, memcmp(saved, now, sizeof(saved)));
+    ASSERT_FALSE(back_store_request(bs, a));
+    ASSERT_TRUE(back_store_request(bs, b));
+
+    // a blank map can't give away the map's blocks, and allocating picks up where the new map says
+    memset(now, 0x00, sizeof(now));
+    ASSERT_TRUE(back_store_import_fbm(bs, now));
+    ASSERT_EQ(8U, back_store_allocate(bs));
+
+    // and it's what gets flushed
+    ASSERT_TRUE(back_store_export_fbm(bs, saved));
+    back_store_close(bs);
+    bs = back_store_open("test_w.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_TRUE(back_store_export_fbm(bs, now));
+    ASSERT_EQ(0, memcmp(saved, now, sizeof(saved)));
+
+    ASSERT_FALSE(back_store_export_fbm(NULL, now));
+    ASSERT_FALSE(back_store_export_fbm(bs, NULL));
+    ASSERT_FALSE(back_store_import_fbm(NULL, now));
+    ASSERT_FALSE(back_store_import_fbm(bs, NULL));
+
+    back_store_close(bs);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     ::testing::AddGlobalTestEnvironment(new GradeEnvironment);
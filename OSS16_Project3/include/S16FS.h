@@ -11,6 +11,8 @@ typedef enum { FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END } seek_t;
 
 typedef enum { FS_REGULAR, FS_DIRECTORY } file_t;
 
+typedef enum { FS_LAYOUT_BLOCKS, FS_LAYOUT_EXTENTS } layout_t;
+
 #define FS_FNAME_MAX (64)
 // INCLUDING null terminator
 
@@ -28,8 +30,34 @@ typedef struct {
 ///
 S16FS_t *fs_format(const char *path);
 
+///
+/// Formats (and mounts) an S16FS file for use, picking how regular files keep track of their blocks
+///   FS_LAYOUT_BLOCKS is what fs_format does, direct/indirect/double indirect block pointers
+///   FS_LAYOUT_EXTENTS keeps (start, length) runs instead, so a file laid out in order maps with a handful
+///   Directories are the same either way. The layout sticks, fs_mount picks it back up
+/// \param fname The file to format
+/// \param layout How regular files map their data
+/// \return Mounted S16FS object, NULL on error
+///
+S16FS_t *fs_format_layout(const char *path, layout_t layout);
+
+///
+/// Formats (and mounts) an S16FS file like fs_format_layout, with a metadata journal
+///   Inodes, directories and indirect blocks get logged before they go home, so a crash
+///   leaves the tree as of the last commit instead of half updated. fs_mount replays the log
+///   Commits happen on their own as changes pile up, and on fs_sync and fs_unmount
+///   Blocks a remove frees can't be reused until the commit that frees them
+///   The log takes 256 blocks of data space
+/// \param fname The file to format
+/// \param layout How regular files map their data
+/// \return Mounted S16FS object, NULL on error
+///
+S16FS_t *fs_format_journaled(const char *path, layout_t layout);
+
 ///
 /// Mounts an S16FS object and prepares it for use
+///   One that wasn't cleanly unmounted gets checked first (in parallel): entries pointing at nothing
+///   and files nothing points at are dropped, and leaked blocks are freed
 /// \param fname The file to mount
 /// \return Mounted F16FS object, NULL on error
 ///
@@ -37,11 +65,21 @@ S16FS_t *fs_mount(const char *path);
 
 ///
 /// Unmounts the given object and frees all related resources
+///   Marks it clean once everything's out, so the next mount can skip checking it
 /// \param fs The S16FS object to unmount
 /// \return 0 on success, < 0 on failure
 ///
 int fs_unmount(S16FS_t *fs);
 
+///
+/// Writes everything that's only in memory (changed inodes, cached blocks) out to disk
+///   On a journaled S16FS this is a commit
+///   Unmounting does this too
+/// \param fs The S16FS object to sync
+/// \return 0 on success, < 0 on failure
+///
+int fs_sync(S16FS_t *fs);
+
 ///
 /// Creates a new file at the specified location
 ///   Directories along the path that do not exist are not created
@@ -72,8 +110,8 @@ int fs_close(S16FS_t *fs, int fd);
 
 ///
 /// Moves the R/W position of the given descriptor to the given location
-///   Files cannot be seeked past EOF or before BOF (beginning of file)
-///   Seeking past EOF will seek to EOF, seeking before BOF will seek to BOF
+///   Files cannot be seeked before BOF (beginning of file), seeking before BOF will seek to BOF
+///   Seeking past EOF is allowed, a write there leaves a hole (reads as zeros) between EOF and the write
 /// \param fs The S16FS containing the file
 /// \param fd The descriptor to seek
 /// \param offset Desired offset relative to whence
@@ -96,7 +134,7 @@ ssize_t fs_read(S16FS_t *fs, int fd, void *dst, size_t nbyte);
 
 ///
 /// Writes data from given buffer to the file linked to the descriptor
-///   Writing past EOF extends the file
+///   Writing past EOF extends the file, starting past EOF leaves a hole
 ///   Writing inside a file overwrites existing data
 ///   R/W position in incremented by the number of bytes written
 /// \param fs The S16FS containing the file
@@ -138,4 +176,68 @@ dyn_array_t *fs_get_dir(S16FS_t *fs, const char *path);
 ///
 int fs_move(S16FS_t *fs, const char *src, const char *dst);
 
+///
+/// Frees the blocks backing part of a file, leaving a hole that reads as zeros
+///   The file size doesn't change. Blocks only partly inside the range get zeroed instead
+///   (Seeking past EOF and writing makes holes too)
+/// \param fs The S16FS containing the file
+/// \param fd The file to punch the hole in
+/// \param offset Where the hole starts
+/// \param length How long the hole is, anything past EOF is ignored
+/// \return 0 on success, < 0 on error
+///
+int fs_punch_hole(S16FS_t *fs, int fd, size_t offset, size_t length);
+
+///
+/// Sets the size of a file
+///   Shrinking frees every block past the new EOF (indirect blocks included)
+///   Growing leaves a hole, the new part reads as zeros
+///   Open descriptors keep their positions, even if that's past the new EOF now
+/// \param fs The S16FS containing the file
+/// \param path Absolute path to the file
+/// \param size The new size
+/// \return 0 on success, < 0 on error
+///
+int fs_truncate(S16FS_t *fs, const char *path, size_t size);
+
+///
+/// fs_truncate on an open descriptor instead of a path
+/// \param fs The S16FS containing the file
+/// \param fd The file to resize
+/// \param size The new size
+/// \return 0 on success, < 0 on error
+///
+int fs_ftruncate(S16FS_t *fs, int fd, size_t size);
+
+///
+/// Reserves blocks for part of a file ahead of time, so writing there later doesn't have to allocate
+///   New blocks come out of one contiguous run when the store has one
+///   The file size doesn't change (reserved blocks past EOF get freed by fs_truncate or fs_remove)
+/// \param fs The S16FS containing the file
+/// \param fd The file to reserve blocks for
+/// \param offset Where the range starts
+/// \param length How long the range is
+/// \return 0 on success, < 0 on error (out of space, some blocks may have been reserved)
+///
+int fs_fallocate(S16FS_t *fs, int fd, size_t offset, size_t length);
+
+///
+/// Sets how far ahead front to back reads get prefetched
+///   A descriptor's window starts at min_blocks once its reads look sequential
+///   and doubles each time it's used up, up to max_blocks. Any jump resets it
+/// \param fs The S16FS to tune
+/// \param min_blocks Starting window, in blocks
+/// \param max_blocks Biggest window, in blocks (up to 1024). 0 (with min 0) turns read-ahead off
+/// \return 0 on success, < 0 on error
+///
+int fs_set_readahead(S16FS_t *fs, size_t min_blocks, size_t max_blocks);
+
+///
+/// Gets the current read-ahead window of a descriptor
+/// \param fs The S16FS containing the file
+/// \param fd The descriptor to check
+/// \return window size in blocks (0 if its reads aren't sequential), < 0 on error
+///
+ssize_t fs_get_readahead(S16FS_t *fs, int fd);
+
 #endif
\ No newline at end of file
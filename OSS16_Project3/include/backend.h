@@ -6,6 +6,8 @@
 #include <back_store.h>
 #include <bitmap.h>
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -17,14 +19,33 @@
 // INCLUDING null terminator
 
 #define DIR_REC_MAX (15)
-// can't have more than 15 records in a directory because space
-// And you're limited to one directory block because we're nice :)
+// can't have more than 15 records in a directory block because space
+// Directories that outgrow their one block get indexed, see dir_index_t
+
+// Bucket slots in a directory index, power of 2 so the name hash can just be masked
+#define DIR_INDEX_DEPTH_MAX (8)
+#define DIR_INDEX_SLOTS (1 << DIR_INDEX_DEPTH_MAX)
 
 // It's actually... 16321 + 1 since we run out of inodes
 // (that's 63 * 255 + 256 + 1 = 255 (additional) dirs, begin, end, intermediary slashes, and null terminator)
 #define FS_PATH_MAX (16322)
 
-#define DESCRIPTOR_MAX (256)
+// Descriptors come in chunks of FD_CHUNK, a chunk gets allocated the first time fs_open needs it
+#define FD_CHUNK_BITS (8)
+#define FD_CHUNK (1 << FD_CHUNK_BITS)
+#define DESCRIPTOR_MAX (65536)
+#define FD_CHUNKS_MAX (DESCRIPTOR_MAX / FD_CHUNK)
+// End of a descriptor list (free list, an inode's open descriptors)
+#define FD_NONE (-1)
+
+// End of the free inode list
+#define INODE_NONE (-1)
+
+// Slots in the dentry cache, power of 2 so the hash can just be masked
+#define DENTRY_CACHE_SIZE (1024)
+
+// Most blocks handed to back_store in one vectored call
+#define VECTOR_MAX (256)
 
 #define BLOCK_SIZE (1024)
 
@@ -52,7 +73,9 @@
 
 #define DBL_INDIRECT_TOTAL ((INDIRECT_TOTAL) * (INDIRECT_TOTAL))
 
-#define FILE_SIZE_MAX ((DIRECT_TOTAL + INDIRECT_TOTAL + DBL_INDIRECT_TOTAL) * BLOCK_SIZE)
+#define FILE_BLOCKS_MAX (DIRECT_TOTAL + INDIRECT_TOTAL + DBL_INDIRECT_TOTAL)
+
+#define FILE_SIZE_MAX ((FILE_BLOCKS_MAX) * BLOCK_SIZE)
 
 #define DATA_BLOCK_MAX (65536)
 
@@ -76,6 +99,22 @@
 // Well it avoids the tautology... btu I don't like it.
 #define BLOCK_PTR_VALID(block_idx) ((block_idx) >= DATA_BLOCK_OFFSET)
 
+// Index slot a name hash lands in, for an index using depth bits
+#define DIR_INDEX_SLOT(hash, depth) ((hash) & ((1U << (depth)) - 1))
+
+// mdata.flags
+// Directory's data_ptrs[0] is a dir_index_t, not a dir_block_t
+#define INODE_DIR_INDEXED (0x01)
+// Regular file's data_ptrs[0] is its extent map (nothing else in data_ptrs is used)
+// On root it means the whole fs was formatted for it, every new regular file gets it
+#define INODE_EXTENTS (0x02)
+// Extent map's data_ptrs[0] is an extent_index_t, not a single extent_block_t
+#define INODE_EXTENT_INDEXED (0x04)
+// Regular file small enough to live in its inode, see INODE_INLINE_DATA. Every new file starts out this way
+#define INODE_INLINE (0x08)
+// Root only, the fs was formatted with a metadata journal (fs_format_journaled), see journal_t
+#define INODE_JOURNALED (0x10)
+
 // Checks that an inode is the specified type
 #define INODE_IS_TYPE(inode_ptr, file_type) ((inode_ptr)->mdata.type & (file_type))
 
@@ -99,10 +138,11 @@ typedef struct {
     uint8_t type;
     // Would be nice to just use the actual enum, but that's not going to go well
     // Figuring out why is an excercise for the reader (or just ask...)
+    uint8_t flags;
 
-    // And, uhh, 26 bytes left and I'm already probably going
+    // And, uhh, 25 bytes left and I'm already probably going
     // to forget to update the times appropriately
-    uint8_t padding[26];
+    uint8_t padding[25];
 } mdata_t;
 
 
@@ -112,6 +152,12 @@ typedef struct {
     block_ptr_t data_ptrs[8];
 } inode_t;
 
+// An inline file's data is everything from mdata.padding to the end of the inode (data_ptrs too)
+// Bytes past EOF are kept zeros, so growing the file just shows them
+#define INODE_INLINE_OFFSET (offsetof(inode_t, mdata) + offsetof(mdata_t, padding))
+#define INLINE_DATA_MAX (sizeof(inode_t) - INODE_INLINE_OFFSET)
+#define INODE_INLINE_DATA(inode_ptr) INCREMENT_VOID(inode_ptr, INODE_INLINE_OFFSET)
+
 typedef struct {
     char fname[FS_FNAME_MAX];
     inode_ptr_t inode;
@@ -120,22 +166,276 @@ typedef struct {
 typedef struct {
     mdata_t mdata;
     dir_ent_t entries[DIR_REC_MAX];
-    uint8_t padding;  // SO CLOSE, but there was one left over byte.
+    uint8_t depth;  // SO CLOSE, but there was one left over byte. Hash bits every entry agrees on, if it's a bucket
 } dir_block_t;
 
+// First block of a directory that outgrew one dir_block_t (extendible hashing)
+// The low depth bits of an entry's fname_hash pick a slot, the slot says which dir_block_t bucket it's in
+// A full bucket splits in two on the next bit, doubling the index first if it's already using that many bits
+// So a lookup is always the index and one bucket, no matter how big the directory gets
+typedef struct {
+    mdata_t mdata;  // size counts the whole directory, same spot as in a dir_block_t so empty checks work on either
+    uint8_t depth;
+    uint8_t padding_a;
+    block_ptr_t buckets[DIR_INDEX_SLOTS];  // only the first 1 << depth are in use
+    uint8_t padding[BLOCK_SIZE - sizeof(mdata_t) - 2 - DIR_INDEX_SLOTS * sizeof(block_ptr_t)];
+} dir_index_t;
+
+// One run of a file's blocks, logical blocks [logical, logical + length) are blocks [start, start + length)
+typedef struct {
+    uint32_t logical;
+    block_ptr_t start;
+    uint16_t length;
+} extent_t;
+
+#define EXTENTS_PER_BLOCK ((BLOCK_SIZE - 8) / sizeof(extent_t))
+
+// A leaf of an extent map, sorted by logical and never overlapping. Anything not in one is a hole
+typedef struct {
+    uint32_t count;
+    uint32_t padding;
+    extent_t extents[EXTENTS_PER_BLOCK];
+} extent_block_t;
+
+// Where one leaf's part of the file starts, it runs up to where the next entry's does
+// Anything before the first entry's logical is a hole
+typedef struct {
+    uint32_t logical;
+    block_ptr_t leaf;
+    uint16_t padding;
+} extent_index_entry_t;
+
+// Extent map that outgrew one leaf, sorted by logical. A full leaf splits in two, so a lookup is
+// always the index and one leaf. A file whose map won't fit in this many leaves is out of space
+typedef struct {
+    uint32_t count;
+    uint32_t padding;
+    extent_index_entry_t entries[EXTENTS_PER_BLOCK];
+} extent_index_t;
+
+// Metadata journal, only on an fs formatted with one
+// The log is JOURNAL_BLOCK_TOTAL blocks right after root's dir block, and holds one transaction at a time:
+// a journal_header_t, the free block map, then the block images, all in one sequential write
+// Every metadata block a transaction changed goes in whole (inode table blocks, directory blocks,
+// indirect and extent blocks), so replaying is just writing them back where they go
+#define JOURNAL_BLOCK_OFFSET ((ROOT_DIR_BLOCK) + 1)
+#define JOURNAL_BLOCK_TOTAL (256)
+#define JOURNAL_FBM_BLOCKS ((DATA_BLOCK_MAX) / 8 / (BLOCK_SIZE))
+// Most images one commit can log, the rest of the log after the header and free block map
+#define JOURNAL_IMAGE_MAX ((JOURNAL_BLOCK_TOTAL) - 1 - (JOURNAL_FBM_BLOCKS))
+// Group commit: operations add to the running transaction until it gets this big
+// (or this many blocks are waiting to be freed), then the next one to finish commits it
+#define JOURNAL_COMMIT_AT ((JOURNAL_IMAGE_MAX) / 2)
+#define JOURNAL_FREES_AT (1024)
+// Blocks one transaction can hold in memory. Way more than the fs has metadata blocks
+#define JOURNAL_SLOT_MAX (4096)
+#define JOURNAL_MAGIC (0x4C4E524A)  // "JRNL" on disk
+
+// First block of the log
+typedef struct {
+    uint32_t magic;     // JOURNAL_MAGIC while there's a commit to replay, cleared once it's all home
+    uint32_t sequence;  // goes up every commit
+    uint32_t count;     // images logged
+    uint32_t checksum;  // over the free block map and the images, a log write that didn't finish won't match
+    block_ptr_t homes[JOURNAL_IMAGE_MAX];  // where each image goes
+    uint8_t padding[BLOCK_SIZE - 16 - JOURNAL_IMAGE_MAX * sizeof(block_ptr_t)];
+} journal_header_t;
+
+// The running transaction
+// Metadata writes land in an image here instead of on disk, reads look here first (meta_read/meta_map)
+// Nothing reaches its home block until the transaction is in the log, so a crash always finds either
+// the last commit (replayed at mount) or what was home before it, never half of an operation
+// Freed blocks wait here too, the last commit could still be using them (see release_blocks)
+typedef struct {
+    // Slots, frees and wanted. Taken last, nothing else gets locked under it
+    // Images belong to whoever owns their block (its inode lock, or namespace_lock for directories)
+    pthread_mutex_t lock;
+    uint32_t sequence;
+    size_t count;                       // slots in use
+    uint16_t slot_of[DATA_BLOCK_MAX];   // slot + 1 of each block in the transaction, 0 if it isn't
+    block_ptr_t homes[JOURNAL_SLOT_MAX];
+    uint8_t *images[JOURNAL_SLOT_MAX];  // allocated the first time a slot gets used, kept after that
+    unsigned *frees;                    // blocks to release once this commits
+    size_t free_count, free_capacity;
+    bitmap_t *freeing;                  // frees, as a map
+    bool wanted;                        // past JOURNAL_COMMIT_AT or JOURNAL_FREES_AT, commit when you can
+    uint8_t fbm[DATA_BLOCK_MAX / 8];    // snapshot of back_store's free block map being logged
+    journal_header_t header;
+} journal_t;
+
+// Superblock. There's no block left over for one, so it lives in root's mdata.padding
+// (root's a directory, nothing else uses those bytes). Unaligned in there, so it's memcpy'd in and out
+// clean is only set from the end of fs_unmount until the next mount, so anything that didn't unmount
+// (or a volume from before there was a superblock) gets a check_fs at mount instead of being trusted
+#define SUPERBLOCK_MAGIC (0x3153)  // "S1" on disk
+typedef struct {
+    uint16_t magic;
+    uint8_t clean;
+    uint8_t padding;
+    uint32_t free_blocks;  // as of the clean unmount
+    uint32_t free_inodes;
+} superblock_t;
+
+// check_fs workers, inodes at a time off a shared counter, so one big file doesn't hold up the rest
+#define CHECK_THREADS_MAX (8)
+
+// Shared between check_fs workers
+typedef struct {
+    S16FS_t *fs;
+    unsigned next;                          // next inode to walk, handed out with __atomic_fetch_add
+    const bool *walk;                       // which inodes get walked
+    bool bad[INODE_TOTAL];                  // block map is broken (or shares a block), only its walker writes it
+    uint8_t claimed[DATA_BLOCK_MAX / 8];    // blocks some walked inode uses, set with __atomic_fetch_or
+                                            // laid out like back_store's free block map, so it can become it
+} fs_check_t;
+
+// Logical blocks a descriptor remembers the physical block for
+#define FD_MAP_WINDOW (64)
+
+// Read-ahead window defaults and the most fs_set_readahead allows, in blocks
+#define READAHEAD_MIN (4)
+#define READAHEAD_MAX (256)
+#define READAHEAD_LIMIT (1024)
+
+// A descriptor's cached slice of its file's block map, so streaming through a file
+// doesn't go back to the indirect blocks for every read
 typedef struct {
-    bitmap_t *fd_status;
-    size_t fd_pos[DESCRIPTOR_MAX];
-    inode_ptr_t fd_inode[DESCRIPTOR_MAX];
+    size_t first;  // logical index of ptrs[0]
+    size_t count;  // 0 means nothing's cached
+    block_ptr_t ptrs[FD_MAP_WINDOW];
+} fd_map_t;
+
+// A descriptor's read-ahead state
+typedef struct {
+    size_t next;    // where the next read starts if it's picking up where the last left off
+    size_t window;  // blocks to keep prefetched ahead, 0 until reads look sequential
+    size_t ahead;   // logical block index prefetching has gotten up to
+    uint32_t gen;   // readahead_limits_t gen the window was sized with
+} fd_readahead_t;
+
+// fs_set_readahead settings, one 8 byte word so a read can load them without a lock
+// gen goes up on every change, a descriptor that's behind starts its window over
+typedef struct __attribute__((aligned(8))) {
+    uint16_t min, max;
+    uint32_t gen;
+} readahead_limits_t;
+
+// FD_CHUNK descriptors, a struct of arrays so the small hot fields (pos, inode) of neighboring
+// descriptors share cache lines instead of being spread out between fd_maps
+// Chunks never move once they're allocated, threads are holding pointers to the locks
+typedef struct {
+    size_t pos[FD_CHUNK];
+    inode_ptr_t inode[FD_CHUNK];
+    bool open[FD_CHUNK];
+    int32_t next[FD_CHUNK];  // open: next descriptor on the same inode. closed: next one on the free list
+    int32_t prev[FD_CHUNK];  // open: previous descriptor on the same inode, FD_NONE for the first
+    fd_readahead_t ra[FD_CHUNK];
+    fd_map_t map[FD_CHUNK];
+    pthread_mutex_t lock[FD_CHUNK];
+} fd_chunk_t;
+
+typedef struct {
+    // open, next, prev, and everything below only change (and get looked at) under status_lock
+    // Everything else about a descriptor belongs to whoever holds its lock, see fd_acquire
+    pthread_mutex_t status_lock;
+    // NULL until needed. Stored with __atomic_store_n so fd_acquire can load one without status_lock
+    fd_chunk_t *chunks[FD_CHUNKS_MAX];
+    int32_t free;                    // most recently closed descriptor, FD_NONE if there aren't any
+    int32_t unused;                  // descriptors from here up have never been handed out
+    int32_t inode_fds[INODE_TOTAL];  // first descriptor open on each inode, FD_NONE if there aren't any
 } fd_table_t;
 
+// A descriptor's fields, for a descriptor that's been handed out (so its chunk exists)
+#define FD_CHUNK_OF(fs, fd) ((fs)->fd_table.chunks[(fd) >> FD_CHUNK_BITS])
+#define FD_SLOT(fd) ((fd) & (FD_CHUNK - 1))
+#define FD_POS(fs, fd) (FD_CHUNK_OF(fs, fd)->pos[FD_SLOT(fd)])
+#define FD_INODE(fs, fd) (FD_CHUNK_OF(fs, fd)->inode[FD_SLOT(fd)])
+#define FD_MAP(fs, fd) (FD_CHUNK_OF(fs, fd)->map[FD_SLOT(fd)])
+#define FD_RA(fs, fd) (FD_CHUNK_OF(fs, fd)->ra[FD_SLOT(fd)])
+
+// A free inode's neighbors on the free inode list, INODE_NONE at either end
+typedef struct {
+    int16_t next, prev;
+} inode_link_t;
+
+// One remembered directory lookup, (parent, fname) -> inode
+// found = false is a negative entry, the name was looked for and isn't there
+typedef struct {
+    char fname[FS_FNAME_MAX];
+    inode_ptr_t parent;
+    inode_ptr_t inode;
+    bool used;
+    bool found;
+} dentry_t;
+
+// Direct mapped, a new entry just bumps whatever hashed to the same slot
+typedef struct {
+    dentry_t entries[DENTRY_CACHE_SIZE];
+    uint64_t hits;
+    uint64_t misses;
+    // Lookups happen under a shared namespace_lock, so they need this to fill the cache in
+    pthread_mutex_t lock;
+} dentry_cache_t;
+
 struct S16FS {
     back_store_t *bs;
     fd_table_t fd_table;
+    // In-use map of the inode table, built at mount
+    // Kept up to date by write_inode/clear_inode, so find_free_inode never has to touch disk
+    bitmap_t *inode_map;
+    // Free inodes, a list linked through inode_links: most recently freed first, lowest first right after mount
+    // Changes along with inode_map (under table_lock), so find_free_inode just takes the head
+    int16_t inode_free;  // INODE_NONE if there aren't any
+    size_t inode_free_count;
+    inode_link_t inode_links[INODE_TOTAL];
+    // The whole inode table, read in at mount. It's only 32k
+    // read_inode/write_inode work on this, changed inodes get marked in inode_dirty
+    // and their blocks go back out in flush_inode_table (unmount/sync)
+    inode_t inode_table[INODE_TOTAL];
+    bitmap_t *inode_dirty;
+    // Path lookups that already happened. locate_file fills it, create/remove/move invalidate it
+    // It's a pointer so lookups through a const fs can still fill it in
+    dentry_cache_t *dentry_cache;
+    // fs_set_readahead settings, every descriptor's window lives between these
+    // Only ever loaded and stored whole (__atomic_load/__atomic_store), no lock
+    readahead_limits_t readahead;
+    // Regular files get extent maps (fs_format_layout), it's on root's flags so mount knows too
+    bool extent_files;
+    // NULL unless the fs was formatted with a journal (fs_format_journaled)
+    journal_t *journal;
+
+    // Locks, always taken in this order (skipping any you don't need):
+    //   journal_lock     - commits own it, every operation that reads or writes metadata shares it (journaled only)
+    //   namespace_lock   - the directory tree. Path lookups share it, create/remove/move own it
+    //   descriptor lock  - one descriptor (fd_chunk_t)
+    //   inode_locks[i]   - one file's inode and data. fs_read shares it, anything that changes the file owns it
+    //   status_lock      - which descriptors are open, and on what (fd_table_t)
+    //   table_lock       - inode_map, the free list, inode_dirty, and the inode table as flush_inode_table sees it
+    //   dentry_cache     - its own lock
+    //   alloc_lock       - back_store's free block map. allocate/request/release/flush all go through it
+    //   async_lock       - back_store's async queue, whoever polls gets everyone's completions
+    //   journal->lock    - the running transaction's bookkeeping
+    // Reads and writes of blocks themselves don't need any of them, back_store handles that
+    pthread_rwlock_t journal_lock;
+    pthread_rwlock_t namespace_lock;
+    pthread_rwlock_t inode_locks[INODE_TOTAL];
+    pthread_mutex_t table_lock;
+    pthread_mutex_t alloc_lock;
+    pthread_mutex_t async_lock;
 };
 
 typedef struct { block_ptr_t block_ptrs[INDIRECT_TOTAL]; } indir_block_t;
 
+// Most blocks claimed at once when a write needs new ones
+#define BLOCK_POOL_MAX (256)
+
+// Blocks claimed ahead of time for one get_data_block_ptrs call
+// Anything not handed out by the end gets released
+typedef struct {
+    unsigned ptrs[BLOCK_POOL_MAX];
+    unsigned count, next;
+} block_pool_t;
+
 /*
 typedef struct {
     // You can add more if you want
@@ -181,15 +481,48 @@ bool partial_read(const S16FS_t *fs, void *data, const block_ptr_t block, const
 bool partial_write(S16FS_t *fs, const void *data, const block_ptr_t block, const unsigned offset, const unsigned bytes);
 bool full_read(const S16FS_t *fs, void *data, const block_ptr_t block);
 bool full_write(S16FS_t *fs, const void *data, const block_ptr_t block);
+bool full_readv_run(const S16FS_t *fs, void *data, const block_ptr_t *blocks, const size_t n_blocks);
+bool full_readv(const S16FS_t *fs, void *data, const block_ptr_t *blocks, const size_t n_blocks);
+bool full_read_extent(const S16FS_t *fs, void *data, const block_ptr_t start, const size_t n_blocks);
+bool full_writev(S16FS_t *fs, const void *data, const block_ptr_t *blocks, const size_t n_blocks);
+bool meta_read(const S16FS_t *fs, void *data, const block_ptr_t block);
+bool meta_write(S16FS_t *fs, const void *data, const block_ptr_t block);
+const void *meta_map(const S16FS_t *fs, const block_ptr_t block);
+void *meta_map_mut(S16FS_t *fs, const block_ptr_t block);
+void meta_unmap(const S16FS_t *fs, const block_ptr_t block, const void *mapped);
+void release_blocks(S16FS_t *fs, const block_ptr_t *blocks, const size_t count);
 bool read_inode(const S16FS_t *fs, void *data, const inode_ptr_t inode_number);
 bool write_inode(S16FS_t *fs, const void *data, const inode_ptr_t inode_number);
 bool clear_inode(S16FS_t *fs, const inode_ptr_t inode_number);
+void inode_list_build(S16FS_t *fs);
 
 void locate_file(const S16FS_t *const fs, const char *abs_path, result_t *res);
 void scan_directory(const S16FS_t *const fs, const char *fname, const inode_ptr_t inode, result_t *res);
 
+bool dentry_lookup(const S16FS_t *const fs, const char *fname, const inode_ptr_t parent, result_t *res);
+void dentry_insert(const S16FS_t *const fs, const char *fname, const inode_ptr_t parent, const result_t *res);
+void dentry_invalidate(const S16FS_t *const fs, const char *fname, const inode_ptr_t parent);
+
+uint32_t fname_hash(const char *fname);
+bool dir_add_entry(S16FS_t *fs, const inode_ptr_t dir_inode_ptr, const char *fname, const inode_ptr_t entry_inode);
+bool dir_remove_entry(S16FS_t *fs, const inode_ptr_t dir_inode_ptr, const char *fname);
+size_t dir_entry_blocks(const S16FS_t *fs, const inode_t *dir_inode, block_ptr_t *blocks);
+
 inode_ptr_t find_free_inode(const S16FS_t *const fs);
+bool load_inode_table(S16FS_t *fs);
+bool flush_inode_table(S16FS_t *fs);
+
+journal_t *journal_create(void);
+void journal_destroy(journal_t *journal);
+bool journal_commit(S16FS_t *fs);
+bool journal_replay(S16FS_t *fs);
+
+void superblock_read(const S16FS_t *fs, superblock_t *super);
+bool superblock_write(S16FS_t *fs, const bool clean);
+// In S16FS.c, it has to know how files map their blocks
+bool check_fs(S16FS_t *fs);
 
-S16FS_t *ready_file(const char *path, const bool format);
+S16FS_t *ready_file(const char *path, const bool format, const layout_t layout, const bool journaled);
+void destroy_locks(S16FS_t *fs);
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "S16FS.h"
 
@@ -16,7 +17,52 @@
 #define FD_VALID(fd) ((fd) >= 0 && (fd) < DESCRIPTOR_MAX)
 
 void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t n_blocks, block_ptr_t *ptrs);
+void fill_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t n_blocks, block_ptr_t *ptrs,
+                          block_pool_t *pool);
+int resize_file(S16FS_t *fs, inode_ptr_t f_inode_ptr, size_t size);
+size_t map_data_blocks(const S16FS_t *fs, const inode_t *f_inode, size_t first, size_t n_blocks, block_ptr_t *ptrs);
+size_t fd_map_lookup(S16FS_t *fs, int fd, const inode_t *f_inode, size_t first, size_t n_blocks, block_ptr_t *ptrs);
+void fd_map_invalidate(S16FS_t *fs, inode_ptr_t f_inode_ptr);
+void readahead(S16FS_t *fs, int fd, const inode_t *f_inode, size_t position, size_t end);
+bool release_file_blocks(S16FS_t *fs, inode_t *f_inode, size_t first, size_t n_blocks);
+bool zero_file_range(S16FS_t *fs, const inode_t *f_inode, size_t position, size_t nbyte);
+bool block_write(S16FS_t *fs, const void *data, block_ptr_t block, size_t offset, size_t bytes, bool fresh);
+block_ptr_t allocate_file_block(S16FS_t *fs, block_pool_t *pool, block_ptr_t prev, size_t remaining);
 void print_file(S16FS_t *fs, inode_t *f_inode);
+bool extent_lookup(const S16FS_t *fs, const inode_t *f_inode, size_t logical, block_ptr_t *start, size_t *length);
+bool extent_insert(S16FS_t *fs, inode_t *f_inode, size_t logical, block_ptr_t start, size_t length);
+bool extent_release(S16FS_t *fs, inode_t *f_inode, size_t first, size_t end);
+void fill_extent_ptrs(S16FS_t *fs, inode_t *f_inode, size_t first, size_t n_blocks, block_ptr_t *ptrs,
+                      block_pool_t *pool);
+size_t read_extents(S16FS_t *fs, const inode_t *f_inode, size_t position, void *dst, size_t nbyte);
+bool load_extent_index(const S16FS_t *fs, const inode_t *f_inode, extent_index_t *index);
+bool store_extent_index(S16FS_t *fs, inode_t *f_inode, const extent_index_t *index);
+size_t extent_upper(const extent_block_t *leaf, size_t logical);
+size_t extent_index_upper(const extent_index_t *index, size_t logical);
+bool uninline_file(S16FS_t *fs, inode_t *f_inode);
+bool fd_acquire(S16FS_t *fs, int fd);
+int fd_claim(S16FS_t *fs, inode_ptr_t f_inode_ptr);
+void fd_free(S16FS_t *fs, int fd);
+void fd_table_destroy(S16FS_t *fs);
+void fd_release(S16FS_t *fs, int fd);
+pthread_rwlock_t *fd_inode_lock(S16FS_t *fs, int fd);
+int create_locked(S16FS_t *fs, const char *path, file_t type);
+ssize_t write_locked(S16FS_t *fs, int fd, const void *src, size_t nbyte);
+int remove_locked(S16FS_t *fs, const char *path);
+off_t seek_locked(S16FS_t *fs, int fd, off_t offset, seek_t whence);
+ssize_t read_locked(S16FS_t *fs, int fd, void *dst, size_t nbyte);
+dyn_array_t *get_dir_locked(S16FS_t *fs, const char *path);
+int move_locked(S16FS_t *fs, const char *src, const char *dst);
+int punch_hole_locked(S16FS_t *fs, int fd, size_t offset, size_t length);
+int fallocate_locked(S16FS_t *fs, int fd, size_t offset, size_t length);
+void journal_enter(S16FS_t *fs);
+void journal_leave(S16FS_t *fs);
+bool check_claim(fs_check_t *check, size_t block);
+bool check_ptrs(fs_check_t *check, const block_ptr_t *ptrs, size_t count);
+bool check_file_blocks(fs_check_t *check, const inode_t *f_inode);
+bool check_dir_blocks(fs_check_t *check, const inode_t *dir_inode);
+void *check_worker(void *arg);
+void check_walk(fs_check_t *check, const bool *walk);
 
 ///
 /// Formats (and mounts) an S16FS file for use
@@ -24,7 +70,33 @@ void print_file(S16FS_t *fs, inode_t *f_inode);
 /// \return Mounted S16FS object, NULL on error
 ///
 S16FS_t *fs_format(const char *path) {
-    return ready_file(path, true);
+    return ready_file(path, true, FS_LAYOUT_BLOCKS, false);
+}
+
+///
+/// Formats (and mounts) an S16FS file for use, picking how regular files keep track of their blocks
+/// \param fname The file to format
+/// \param layout How regular files map their data
+/// \return Mounted S16FS object, NULL on error
+///
+S16FS_t *fs_format_layout(const char *path, layout_t layout) {
+    if(layout == FS_LAYOUT_BLOCKS || layout == FS_LAYOUT_EXTENTS) {
+        return ready_file(path, true, layout, false);
+    }
+    return NULL;
+}
+
+///
+/// Formats (and mounts) an S16FS file that keeps a metadata journal
+/// \param fname The file to format
+/// \param layout How regular files map their data
+/// \return Mounted S16FS object, NULL on error
+///
+S16FS_t *fs_format_journaled(const char *path, layout_t layout) {
+    if (layout == FS_LAYOUT_BLOCKS || layout == FS_LAYOUT_EXTENTS) {
+        return ready_file(path, true, layout, true);
+    }
+    return NULL;
 }
 
 ///
@@ -33,7 +105,7 @@ S16FS_t *fs_format(const char *path) {
 /// \return Mounted F16FS object, NULL on error
 ///
 S16FS_t *fs_mount(const char *path) {
-    return ready_file(path, false);
+    return ready_file(path, false, FS_LAYOUT_BLOCKS, false);
 }
 
 ///
@@ -43,10 +115,43 @@ S16FS_t *fs_mount(const char *path) {
 ///
 int fs_unmount(S16FS_t *fs) {
     if (fs) {
+        // changed inodes are only in memory until now (and with a journal, everything else that changed too)
+        // and only once all of that's out can the superblock say it's clean
+        const bool flushed = (fs->journal ? journal_commit(fs) : flush_inode_table(fs)) && superblock_write(fs, true);
         back_store_close(fs->bs);
-        bitmap_destroy(fs->fd_table.fd_status);
+        journal_destroy(fs->journal);
+        fd_table_destroy(fs);
+        bitmap_destroy(fs->inode_map);
+        bitmap_destroy(fs->inode_dirty);
+        destroy_locks(fs);
+        free(fs->dentry_cache);
         free(fs);
-        return 0;
+        return flushed ? 0 : -1;
+    }
+    return -1;
+}
+
+///
+/// Writes everything that's only in memory (changed inodes, back_store's dirty blocks) out to disk
+/// \param fs The S16FS object to sync
+/// \return 0 on success, < 0 on failure
+///
+int fs_sync(S16FS_t *fs) {
+    if (fs && fs->journal) {
+        // a commit is a flush and then some, it just needs everyone else out of the way
+        pthread_rwlock_wrlock(&fs->journal_lock);
+        const bool committed = journal_commit(fs);
+        pthread_rwlock_unlock(&fs->journal_lock);
+        return committed ? 0 : -1;
+    }
+    if (fs && flush_inode_table(fs)) {
+        // the free block map goes out too, can't have it changing underneath
+        pthread_mutex_lock(&fs->alloc_lock);
+        const bool flushed = back_store_flush(fs->bs);
+        pthread_mutex_unlock(&fs->alloc_lock);
+        if (flushed) {
+            return 0;
+        }
     }
     return -1;
 }
@@ -60,6 +165,21 @@ int fs_unmount(S16FS_t *fs) {
 /// \return 0 on success, < 0 on failure
 ///
 int fs_create(S16FS_t *fs, const char *path, file_t type) {
+    if (fs && path) {
+        journal_enter(fs);
+        pthread_rwlock_wrlock(&fs->namespace_lock);
+        const int result = create_locked(fs, path, type);
+        pthread_rwlock_unlock(&fs->namespace_lock);
+        journal_leave(fs);
+        return result;
+    }
+    return -1;
+}
+
+///
+/// fs_create with namespace_lock held (write)
+///
+int create_locked(S16FS_t *fs, const char *path, file_t type) {
     if (fs && path) {
         if (type == FS_REGULAR || type == FS_DIRECTORY) {
             // WHOOPS. Should make sure desired file doesn't already exist.
@@ -106,95 +226,83 @@ int fs_create(S16FS_t *fs, const char *path, file_t type) {
                             if (file_status.success && file_status.found && file_status.type == FS_DIRECTORY) {
                                 // parent exists, is a directory. Cool.
                                 // (added block to locate_file if file is a dir. Handy.)
-                                dir_block_t parent_dir;
                                 inode_t new_inode;
                                 dir_block_t new_dir;
                                 uint32_t now = time(NULL);
-                                // load dir, check it has space.
-                                if (full_read(fs, &parent_dir, file_status.block)
-                                    && parent_dir.mdata.size < DIR_REC_MAX) {
-                                    // try to grab all new resources (inode, optionally data block)
-                                    // if we get all that, commit it.
-                                    inode_ptr_t new_inode_idx = find_free_inode(fs);
-                                    if (new_inode_idx != 0) {
-                                        bool success            = false;
-                                        block_ptr_t new_dir_ptr = 0;
-                                        switch (type) {
-                                            case FS_REGULAR:
-                                                // We're all good.
+                                // try to grab all new resources (inode, optionally data block)
+                                // if we get all that, commit it.
+                                inode_ptr_t new_inode_idx = find_free_inode(fs);
+                                if (new_inode_idx != 0) {
+                                    bool success            = false;
+                                    block_ptr_t new_dir_ptr = 0;
+                                    switch (type) {
+                                        case FS_REGULAR:
+                                            // We're all good.
+                                            // (extent map or block ptrs, whichever the fs was formatted for)
+                                            // It starts out inline, until it's too big for the inode
+                                            new_inode = (inode_t){
+                                                {0},
+                                                {0, 0777, now, now, now, file_status.inode, FS_REGULAR,
+                                                 (uint8_t)((fs->extent_files ? INODE_EXTENTS : 0) | INODE_INLINE),
+                                                 {0}},
+                                                {0}};
+                                            strncpy(new_inode.fname, fname_copy, fname_len + 1);
+                                            // I'm so deep now that my formatter is very upset with every line
+                                            // inode = ready
+                                            success = write_inode(fs, &new_inode, new_inode_idx);
+                                            // Uhh, if that didn't work we could, worst case, have a partial inode
+                                            // And that's a "file system is now kinda busted" sort of error
+                                            // This is why "real" (read: modern) file systems have backups all over
+                                            // (and why the occasional chkdsk is so important)
+                                            break;
+                                        case FS_DIRECTORY:
+                                            // following line keeps being all "Expected expression"
+                                            // SOMETHING is messed up SOMEWHERE.
+                                            // Or it's trying to protect me by preventing new variables in a switch
+                                            // Which is super undefined, but only sometimes (not in this case...)
+                                            // Idk, man.
+                                            // block_ptr_t new_dir_ptr = back_store_allocate(fs->bs);
+                                            pthread_mutex_lock(&fs->alloc_lock);
+                                            new_dir_ptr = back_store_allocate(fs->bs);
+                                            pthread_mutex_unlock(&fs->alloc_lock);
+                                            if (new_dir_ptr != 0) {
+                                                // Resources = obtained
+                                                // write dir block first, inode is the final step
+                                                // that's more transaction-safe (still not process safe)
                                                 new_inode = (inode_t){
                                                     {0},
-                                                    {0, 0777, now, now, now, file_status.inode, FS_REGULAR, {0}},
-                                                    {0}};
+                                                    {0, 0777, now, now, now, file_status.inode, FS_DIRECTORY, 0, {0}},
+                                                    {new_dir_ptr, 0, 0, 0, 0, 0}};
                                                 strncpy(new_inode.fname, fname_copy, fname_len + 1);
-                                                // I'm so deep now that my formatter is very upset with every line
-                                                // inode = ready
-                                                success = write_inode(fs, &new_inode, new_inode_idx);
-                                                // Uhh, if that didn't work we could, worst case, have a partial inode
-                                                // And that's a "file system is now kinda busted" sort of error
-                                                // This is why "real" (read: modern) file systems have backups all over
-                                                // (and why the occasional chkdsk is so important)
-                                                break;
-                                            case FS_DIRECTORY:
-                                                // following line keeps being all "Expected expression"
-                                                // SOMETHING is messed up SOMEWHERE.
-                                                // Or it's trying to protect me by preventing new variables in a switch
-                                                // Which is super undefined, but only sometimes (not in this case...)
-                                                // Idk, man.
-                                                // block_ptr_t new_dir_ptr = back_store_allocate(fs->bs);
-                                                new_dir_ptr = back_store_allocate(fs->bs);
-                                                if (new_dir_ptr != 0) {
-                                                    // Resources = obtained
-                                                    // write dir block first, inode is the final step
-                                                    // that's more transaction-safe... but it's not like we're thread
-                                                    // safe
-                                                    // in the slightest (or process safe, for that matter)
-                                                    new_inode = (inode_t){
-                                                        {0},
-                                                        {0, 0777, now, now, now, file_status.inode, FS_DIRECTORY, {0}},
-                                                        {new_dir_ptr, 0, 0, 0, 0, 0}};
-                                                    strncpy(new_inode.fname, fname_copy, fname_len + 1);
-
-                                                    memset(&new_dir, 0x00, sizeof(dir_block_t));
-
-                                                    if (!(success = full_write(fs, &new_dir, new_dir_ptr)
-                                                                    && write_inode(fs, &new_inode, new_inode_idx))) {
-                                                        // transation: if it didn't work, release the allocated block
-                                                        back_store_release(fs->bs, new_dir_ptr);
-                                                    }
+
+                                                memset(&new_dir, 0x00, sizeof(dir_block_t));
+
+                                                if (!(success = meta_write(fs, &new_dir, new_dir_ptr)
+                                                                && write_inode(fs, &new_inode, new_inode_idx))) {
+                                                    // transation: if it didn't work, release the allocated block
+                                                    release_blocks(fs, &new_dir_ptr, 1);
                                                 }
-                                                break;
-                                            default:
-                                                // HOW.
-                                                break;
-                                        }
-                                        if (success) {
-                                            // whoops. forgot the part where I actually save the file to the dir tree
-                                            // Mildly important.
-                                            unsigned i = 0;
-                                            // This is technically a potential infinite loop. But we validated contents
-                                            // earlier
-                                            for (; parent_dir.entries[i].fname[0] != '\0'; ++i) {
-                                            }
-                                            strncpy(parent_dir.entries[i].fname, fname_copy, fname_len + 1);
-                                            parent_dir.entries[i].inode = new_inode_idx;
-                                            ++parent_dir.mdata.size;
-                                            if (full_write(fs, &parent_dir, file_status.block)) {
-                                                free(path_copy);
-                                                return 0;
-                                            } else {
-                                                // Oh man. These surely are the end times.
-                                                // Our file exists. Kinda. But not entirely.
-                                                // The final tree link failed.
-                                                // We SHOULD:
-                                                //  Wipe inode
-                                                //  Release dir block (if making a dir)
-                                                // But I'm lazy. And if a write failed, why would others work?
-                                                // back_store won't actually do that to us, anyway.
-                                                // Like, even if the file was deleted while using it, we're mmap'd so
-                                                // the kernel has no real way to tell us, as far as I know.
-                                                puts("Infinite sadness. New file stuck in limbo.");
                                             }
+                                            break;
+                                        default:
+                                            // HOW.
+                                            break;
+                                    }
+                                    if (success) {
+                                        // whoops. forgot the part where I actually save the file to the dir tree
+                                        // Mildly important.
+                                        // there's probably a negative entry for it from the check up top
+                                        dentry_invalidate(fs, fname_copy, file_status.inode);
+                                        if (dir_add_entry(fs, file_status.inode, fname_copy, new_inode_idx)) {
+                                            free(path_copy);
+                                            return 0;
+                                        }
+                                        // Directory's maxed out (or there was no block for it to grow into)
+                                        // Wipe the inode, release the dir block (if making a dir)
+                                        // I used to be too lazy for this, but full directories are a normal failure now
+                                        clear_inode(fs, new_inode_idx);
+                                        if (new_dir_ptr != 0) {
+                                            release_blocks(fs, &new_dir_ptr, 1);
                                         }
                                     }
                                 }
@@ -218,25 +326,30 @@ int fs_create(S16FS_t *fs, const char *path, file_t type) {
 /// \return file descriptor to the requested file, < 0 on error
 ///
 int fs_open(S16FS_t *fs, const char *path) {
+    int opened = -1;
     if(fs && path) {
         //first we have to find the file
+        //(and keep fs_remove from getting it out from under us until the descriptor's in the table)
         result_t res;
+        journal_enter(fs);
+        pthread_rwlock_rdlock(&fs->namespace_lock);
         locate_file(fs, path, &res);
         if(res.success && res.found && res.type == FS_REGULAR) {
             //congratulations, file found
             //  also you wanted to open a FS_REGULAR file
-            //find an open fd to use
-            size_t fd = bitmap_ffz(fs->fd_table.fd_status);
-            if(fd != SIZE_MAX) {
-                //got one, set the status bit and table values and return it
-                bitmap_set(fs->fd_table.fd_status, fd);
-                fs->fd_table.fd_pos[fd] = 0;
-                fs->fd_table.fd_inode[fd] = res.inode;
-                return fd;
+            //find an open fd to use (the last one closed, or the table grows)
+            pthread_mutex_lock(&fs->fd_table.status_lock);
+            int fd = fd_claim(fs, res.inode);
+            if(fd != FD_NONE) {
+                //got one, fd_claim set the table values so return it
+                opened = fd;
             } //else fd_table is full
+            pthread_mutex_unlock(&fs->fd_table.status_lock);
         } //else bad path or you tried to open a directory... /glare
+        pthread_rwlock_unlock(&fs->namespace_lock);
+        journal_leave(fs);
     } //else bad parameter
-    return -1;
+    return opened;
 }
 
 ///
@@ -246,12 +359,19 @@ int fs_open(S16FS_t *fs, const char *path) {
 /// \return 0 on success, < 0 on failure
 ///
 int fs_close(S16FS_t *fs, int fd) {
-    if(fs && FD_VALID(fd) && bitmap_test(fs->fd_table.fd_status, fd)) {
-        //to close a file it's enough to clear the status bit
-        bitmap_reset(fs->fd_table.fd_status, fd);
+    //holding the descriptor means nothing else is using it, so it's safe to pull out
+    if(fs && fd_acquire(fs, fd)) {
+        //to close a file it's enough to put it back on the free list (and off its file's list)
+        //fs_open and fd_map_invalidate look at the rest of the table under status_lock, so it all goes in there
+        pthread_mutex_lock(&fs->fd_table.status_lock);
+        fd_free(fs, fd);
         //but for funsies i'm going to clear the table right quick
-        fs->fd_table.fd_pos[fd] = 0;
-        fs->fd_table.fd_inode[fd] = 0;
+        FD_POS(fs, fd) = 0;
+        FD_INODE(fs, fd) = 0;
+        FD_MAP(fs, fd).count = 0;
+        FD_RA(fs, fd) = (fd_readahead_t){0, 0, 0, 0};
+        pthread_mutex_unlock(&fs->fd_table.status_lock);
+        fd_release(fs, fd);
         return 0;
     } //else bad parameter
     return -1;
@@ -259,7 +379,7 @@ int fs_close(S16FS_t *fs, int fd) {
 
 ///
 /// Writes data from given buffer to the file linked to the descriptor
-///   Writing past EOF extends the file
+///   Writing past EOF extends the file, starting past EOF leaves a hole
 ///   Writing inside a file overwrites existing data
 ///   R/W position in incremented by the number of bytes written
 /// \param fs The S16FS containing the file
@@ -269,14 +389,49 @@ int fs_close(S16FS_t *fs, int fd) {
 /// \return number of bytes written (< nbyte IFF out of space), < 0 on error
 ///
 ssize_t fs_write(S16FS_t *fs, int fd, const void *src, size_t nbyte) {
-    if(fs && FD_VALID(fd) && bitmap_test(fs->fd_table.fd_status, fd) && src) {
+    ssize_t result = -1;
+    if(fs && src) {
+        journal_enter(fs);
+        if(fd_acquire(fs, fd)) {
+            pthread_rwlock_t *inode_lock = fd_inode_lock(fs, fd);
+            pthread_rwlock_wrlock(inode_lock);
+            result = write_locked(fs, fd, src, nbyte);
+            pthread_rwlock_unlock(inode_lock);
+            fd_release(fs, fd);
+        }
+        journal_leave(fs);
+    }
+    return result;
+}
+
+///
+/// fs_write with the descriptor and the file's inode (write) locked
+///
+ssize_t write_locked(S16FS_t *fs, int fd, const void *src, size_t nbyte) {
+    if(fs && src) {
         if(nbyte == 0) {return 0;}
         //let's do this... hopefully... maybe???? -- so this was hard... but i did it!!
         //extract the inode number from fd_table and get the inode
-        inode_ptr_t f_inode_ptr = fs->fd_table.fd_inode[fd];
+        inode_ptr_t f_inode_ptr = FD_INODE(fs, fd);
         inode_t f_inode;
         if(read_inode(fs, &f_inode, f_inode_ptr)) {
-            size_t position = fs->fd_table.fd_pos[fd]; //postion in file to start writing
+            size_t position = FD_POS(fs, fd); //postion in file to start writing
+            if(f_inode.mdata.flags & INODE_INLINE) {
+                if(position + nbyte <= INLINE_DATA_MAX) {
+                    //still fits, the inode is the whole file
+                    //(inline bytes past EOF are zeros, so a gap before position is already a hole)
+                    memcpy(INCREMENT_VOID(INODE_INLINE_DATA(&f_inode), position), src, nbyte);
+                    FD_POS(fs, fd) += nbyte;
+                    if(FD_POS(fs, fd) > f_inode.mdata.size) {
+                        f_inode.mdata.size = FD_POS(fs, fd);
+                    }
+                    return write_inode(fs, &f_inode, f_inode_ptr) ? (ssize_t)nbyte : -1;
+                }
+                //outgrew the inode, what's there goes out to a block and the write carries on like normal
+                if(!uninline_file(fs, &f_inode)) {
+                    return -1;
+                }
+            }
             size_t log_block_offset = POSITION_TO_INNER_OFFSET(position); //position offset within logical block
             
             //cut up nbyte into chunks for logical block, full blocks, and last block
@@ -308,8 +463,22 @@ ssize_t fs_write(S16FS_t *fs, int fd, const void *src, size_t nbyte) {
                 writable_ptrs[i] = 0;
             }
             
+            //writing past EOF leaves a hole, and the gap in the old last block has to read as zeros
+            //(released blocks come back with whatever was in them)
+            if(position > f_inode.mdata.size &&
+               !zero_file_range(fs, &f_inode, f_inode.mdata.size, position - f_inode.mdata.size)) {
+                return -1;
+            }
+
+            //the first and last blocks only get partly written, if they're new the rest has to be zeros
+            block_ptr_t existing[2] = {0, 0};
+            map_data_blocks(fs, &f_inode, POSITION_TO_BLOCK_INDEX(position), 1, &existing[0]);
+            map_data_blocks(fs, &f_inode, POSITION_TO_BLOCK_INDEX(position) + n_write_blocks - 1, 1, &existing[1]);
+
             //fill array of block ptrs with existing or newly allocated ptrs
             get_data_block_ptrs(fs, &f_inode, position, n_write_blocks, writable_ptrs);
+            //any descriptor on this file could have cached a block as missing that just got allocated
+            fd_map_invalidate(fs, f_inode_ptr);
 
             ssize_t bytes_written = 0;
 
@@ -318,23 +487,32 @@ ssize_t fs_write(S16FS_t *fs, int fd, const void *src, size_t nbyte) {
                 if(i == 0) {
                     //special handling for first block to write in case it's partially full
                     //THANKS FOR FIXING PARTIAL WRITE.. this is better than doing it manually
-                    if(!partial_write(fs, INCREMENT_VOID(src, 0), writable_ptrs[i], log_block_offset, log_block_writable)) {
+                    if(!block_write(fs, INCREMENT_VOID(src, 0), writable_ptrs[i], log_block_offset, log_block_writable,
+                                    !existing[0])) {
                         break;
                     }
                     bytes_written += log_block_writable;
                 } else if(i == n_write_blocks - 1 && last_block_writable) {
                     //special handling for last block to write in case we have a non-full block at the end
-                    if(!partial_write(fs, INCREMENT_VOID(src, bytes_written), writable_ptrs[i], 0, last_block_writable)) {
+                    if(!block_write(fs, INCREMENT_VOID(src, bytes_written), writable_ptrs[i], 0, last_block_writable,
+                                    !existing[1])) {
                         break;
                     }
                     bytes_written += last_block_writable;
                 } else {
                     //full blocks in between the first block and last block
-                    if(!full_write(fs, INCREMENT_VOID(src, bytes_written), writable_ptrs[i])){
+                    //all of them go out together so back_store can merge neighboring blocks
+                    size_t run = 1;
+                    while(i + run < n_write_blocks && writable_ptrs[i + run] &&
+                          !(i + run == n_write_blocks - 1 && last_block_writable)) {
+                        ++run;
+                    }
+                    if(!full_writev(fs, INCREMENT_VOID(src, bytes_written), &writable_ptrs[i], run)){
                         //some writing happened, get out of loop
                         break;
                     }
-                    bytes_written += BLOCK_SIZE;
+                    bytes_written += run * BLOCK_SIZE;
+                    i += run - 1;
                 }
             }
             //if we broke out of the loop because of an error, we still have a problem...
@@ -344,9 +522,9 @@ ssize_t fs_write(S16FS_t *fs, int fd, const void *src, size_t nbyte) {
             //however they are in the inode so subsequent writes could/would use those blocks
 
             //update offset in fd_table and file size
-            fs->fd_table.fd_pos[fd] += bytes_written;
-            if(fs->fd_table.fd_pos[fd] > f_inode.mdata.size) {
-                f_inode.mdata.size = fs->fd_table.fd_pos[fd];
+            FD_POS(fs, fd) += bytes_written;
+            if(FD_POS(fs, fd) > f_inode.mdata.size) {
+                f_inode.mdata.size = FD_POS(fs, fd);
             }
 
             //just need to write out the inode to make sure data_ptrs are updated
@@ -367,6 +545,21 @@ ssize_t fs_write(S16FS_t *fs, int fd, const void *src, size_t nbyte) {
 /// \return 0 on success, < 0 on error
 ///
 int fs_remove(S16FS_t *fs, const char *path) {
+    if(fs && path) {
+        journal_enter(fs);
+        pthread_rwlock_wrlock(&fs->namespace_lock);
+        const int result = remove_locked(fs, path);
+        pthread_rwlock_unlock(&fs->namespace_lock);
+        journal_leave(fs);
+        return result;
+    }
+    return -1;
+}
+
+///
+/// fs_remove with namespace_lock held (write)
+///
+int remove_locked(S16FS_t *fs, const char *path) {
     if(fs && path) {
         //first have to find the file to remove
         result_t file_status;
@@ -377,30 +570,30 @@ int fs_remove(S16FS_t *fs, const char *path) {
             if(read_inode(fs, &f_inode, file_status.inode) && read_inode(fs, &parent_inode, file_status.parent)) {
                 //
                 dir_block_t dir;
-                size_t f_blocks;
                 //do different things based on type
                 switch(file_status.type) {
                     case FS_REGULAR:
-                        //calculate number of data blocks for getting list of blocks later
-                        f_blocks = f_inode.mdata.size / BLOCK_SIZE;
-                        if(f_inode.mdata.size % BLOCK_SIZE) {
-                            ++f_blocks;
-                        }
                         //remove all possible occurrences from fd_table
-                        for(int i = 0; i < DESCRIPTOR_MAX; i++) {
-                            //if the inode number appears in the fd_table, close it 
-                            if(bitmap_test(fs->fd_table.fd_status, i) && fs->fd_table.fd_inode[i] == file_status.inode) {
-                                fs_close(fs, i);
+                        //the inode has a list of them, so no looking through every descriptor there is
+                        //nothing new can get opened on it, we own namespace_lock
+                        for(bool more = true; more;) {
+                            pthread_mutex_lock(&fs->fd_table.status_lock);
+                            const int fd = fs->fd_table.inode_fds[file_status.inode];
+                            pthread_mutex_unlock(&fs->fd_table.status_lock);
+                            more = fd != FD_NONE;
+                            if(more) {
+                                //waits on anything still using the descriptor, and takes it off the list
+                                fs_close(fs, fd);
                             }
                         }
+                        //one of those could have been in the middle of a write, so get the inode as it ended up
+                        if(!read_inode(fs, &f_inode, file_status.inode)) {
+                            return -1;
+                        }
                         break;
                     case FS_DIRECTORY:
-                        //directories only have one data block
-                        if(file_status.type == FS_DIRECTORY) {
-                            f_blocks = 1;
-                        }
                         //make sure directory is empty
-                        if(!full_read(fs, &dir, file_status.block)) {
+                        if(!meta_read(fs, &dir, file_status.block)) {
                             return -1;
                         }
                         if(dir.mdata.size) {
@@ -411,77 +604,44 @@ int fs_remove(S16FS_t *fs, const char *path) {
                         break;
                 }
                 
-                //let's free some blocks.. since that's like the point of removing files
-                //don't bother file has no blocks
-                if(f_blocks) {
-                    //get list of data blocks
-                    block_ptr_t data_ptrs[f_blocks];
-                    get_data_block_ptrs(fs, &f_inode, 0, f_blocks, data_ptrs);
-                    //and release them all
-                    for(size_t i = 0; i < f_blocks && data_ptrs[i]; i++) {
-                        back_store_release(fs->bs, data_ptrs[i]);
+                //an indexed directory's buckets are only listed in its index, release_file_blocks won't see them
+                //(the index itself is data_ptrs[0], that one it gets)
+                if(file_status.type == FS_DIRECTORY && (f_inode.mdata.flags & INODE_DIR_INDEXED)) {
+                    block_ptr_t buckets[DIR_INDEX_SLOTS];
+                    const size_t n_buckets = dir_entry_blocks(fs, &f_inode, buckets);
+                    if(!n_buckets) {
+                        return -1;
                     }
+                    release_blocks(fs, buckets, n_buckets);
+                }
 
-                    //now the interesting part.. gotta free those indirection blocks
-                    //check single indirect
-                    if(f_inode.data_ptrs[6]) {
-                        //single indirect block is easy because data ptrs are released already
-                        back_store_release(fs->bs, f_inode.data_ptrs[6]);
-                    }
-                    //check double indirect
-                    if(f_inode.data_ptrs[7]) {
-                        //damn.. now we have to loop through double indirect to release single indirect blocks
-                        block_ptr_t d_block[INDIRECT_TOTAL];
-                        if(!full_read(fs, &d_block, f_inode.data_ptrs[7])) {
-                            //god forbid this happens, because the data blocks are gone
-                            //so we would just have random blocks that are marked as used
-                            //but are completely useless
-                            //that's what chkdsk is for
-                            return -1;
-                        }
-                        bool stop = false;
-                        for(size_t i = 0; i < INDIRECT_TOTAL && !stop; i++) {
-                            if(d_block[i]) {
-                                //but at least the data blocks are all realeased
-                                back_store_release(fs->bs, d_block[i]);
-                            } else {
-                                //just to kill the loop rather than loop all the way through when we don't need to
-                                stop = true;
-                            }
-                        }
-                    }
+                //let's free some blocks.. since that's like the point of removing files
+                //release_file_blocks walks whatever the file has, holes and indirect blocks included
+                if(!release_file_blocks(fs, &f_inode, 0, FILE_BLOCKS_MAX)) {
+                    //that's what chkdsk is for
+                    return -1;
                 }
                 
                 //clear the inode
                 memset(&f_inode, 0x00, sizeof(inode_t));
                 //that was easy...
 
-                //remove dir_entry from parent directory block
-                dir_block_t parent_dir;
-                if(write_inode(fs, &f_inode, file_status.inode) && full_read(fs, &parent_dir, parent_inode.data_ptrs[0])) {
-                    //if write_inode works, but reading the parenty dir_block doesn't we have an intersting situation
+                //remove dir_entry from parent directory
+                //directories are hashed by name, so the entry gets found by name (the last token of the path)
+                char fname[FS_FNAME_MAX] = {0};
+                const size_t fname_len = strcspn((const char *) file_status.data, "/");
+                if(fname_len < FS_FNAME_MAX && write_inode(fs, &f_inode, file_status.inode)) {
+                    //if write_inode works, but fixing the parent directory doesn't we have an intersting situation
                     //because the file has been completely eradicated from the system
                     //HOWEVER the parent directory wouldn't know... that's sad
-                    //but that didn't happen so lets finish this
-                    //find the entry in the parent directory block
-                    for(size_t i = 0; i < DIR_REC_MAX; i++) {
-                        //at first i got here and hated myself because i already cleared the inode
-                        //then i remembered that i still know which inode we're killing
-                        if(file_status.inode == parent_dir.entries[i].inode) {
-                            //found you!
-                            //NOW DIE!!! or you know.. just destroy the entry
-                            parent_dir.entries[i].fname[0] = '\0';
-                            parent_dir.entries[i].inode = 0;
-                            //and reduce size
-                            --parent_dir.mdata.size;
-                        }
-                    }
-                    //write parent directory block back out
-                    if(full_write(fs, &parent_dir, parent_inode.data_ptrs[0])) {
+                    memcpy(fname, file_status.data, fname_len);
+                    //and make sure the dentry cache forgets it too
+                    dentry_invalidate(fs, fname, file_status.parent);
+                    if(dir_remove_entry(fs, file_status.parent, fname)) {
                         //congratulations, file removal complete
                         return 0;
-                    } //else failed to write back updated parent directory block
-                } //else failed to get parent directory block
+                    } //else failed to update the parent directory
+                } //else failed to clear the inode
             } //else failed to get file or parent inode
         } //else failed to locate file
     } //else bad parameter
@@ -490,8 +650,8 @@ int fs_remove(S16FS_t *fs, const char *path) {
 
 ///
 /// Moves the R/W position of the given descriptor to the given location
-///   Files cannot be seeked past EOF or before BOF (beginning of file)
-///   Seeking past EOF will seek to EOF, seeking before BOF will seek to BOF
+///   Files cannot be seeked before BOF (beginning of file), seeking before BOF will seek to BOF
+///   Seeking past EOF is allowed, a write there leaves a hole (reads as zeros) between EOF and the write
 /// \param fs The S16FS containing the file
 /// \param fd The descriptor to seek
 /// \param offset Desired offset relative to whence
@@ -499,14 +659,29 @@ int fs_remove(S16FS_t *fs, const char *path) {
 /// \return offset from BOF, < 0 on error
 ///
 off_t fs_seek(S16FS_t *fs, int fd, off_t offset, seek_t whence) {
-    if(fs && FD_VALID(fd) && bitmap_test(fs->fd_table.fd_status, fd)) {
-        //need the inode for limiting seeks to EOF
+    if(fs && fd_acquire(fs, fd)) {
+        pthread_rwlock_t *inode_lock = fd_inode_lock(fs, fd);
+        pthread_rwlock_rdlock(inode_lock);
+        const off_t result = seek_locked(fs, fd, offset, whence);
+        pthread_rwlock_unlock(inode_lock);
+        fd_release(fs, fd);
+        return result;
+    }
+    return -1;
+}
+
+///
+/// fs_seek with the descriptor and the file's inode (read) locked
+///
+off_t seek_locked(S16FS_t *fs, int fd, off_t offset, seek_t whence) {
+    if(fs) {
+        //need the inode for seeking relative to EOF
         inode_t f_inode;
-        if(read_inode(fs, &f_inode, fs->fd_table.fd_inode[fd])) {
+        if(read_inode(fs, &f_inode, FD_INODE(fs, fd))) {
             //
             off_t bof = 0;
             off_t eof = f_inode.mdata.size;
-            off_t position = fs->fd_table.fd_pos[fd];
+            off_t position = FD_POS(fs, fd);
 
             switch(whence) {
                 case FS_SEEK_SET: //set position to offset
@@ -523,15 +698,16 @@ off_t fs_seek(S16FS_t *fs, int fd, off_t offset, seek_t whence) {
                     break;
             }
 
-            //disable seeking before BOF or past EOF
+            //disable seeking before BOF or past the biggest file there can be
+            //past EOF is fine, writing there leaves a hole
             if(position < bof) {
                 position = bof;
-            } else if(position > eof) {
-                position = eof;
+            } else if(position > (off_t)FILE_SIZE_MAX) {
+                position = FILE_SIZE_MAX;
             }
 
             //update fd_table
-            fs->fd_table.fd_pos[fd] = position;
+            FD_POS(fs, fd) = position;
 
             return position;
 
@@ -551,16 +727,40 @@ off_t fs_seek(S16FS_t *fs, int fd, off_t offset, seek_t whence) {
 /// \return number of bytes read (< nbyte IFF read passes EOF), < 0 on error
 ///
 ssize_t fs_read(S16FS_t *fs, int fd, void *dst, size_t nbyte) {
-    if(fs && FD_VALID(fd) && bitmap_test(fs->fd_table.fd_status, fd) && dst) {
+    ssize_t result = -1;
+    if(fs && dst) {
+        journal_enter(fs);
+        if(fd_acquire(fs, fd)) {
+            pthread_rwlock_t *inode_lock = fd_inode_lock(fs, fd);
+            pthread_rwlock_rdlock(inode_lock);
+            result = read_locked(fs, fd, dst, nbyte);
+            pthread_rwlock_unlock(inode_lock);
+            fd_release(fs, fd);
+        }
+        journal_leave(fs);
+    }
+    return result;
+}
+
+///
+/// fs_read with the descriptor and the file's inode (read) locked
+///     other descriptors can be reading the same file at the same time
+///
+ssize_t read_locked(S16FS_t *fs, int fd, void *dst, size_t nbyte) {
+    if(fs && dst) {
         //so this is the exact same as fs_write except for two THINGs labeled below
         //extract the inode number from fd_table and get the inode
-        inode_ptr_t f_inode_ptr = fs->fd_table.fd_inode[fd];
+        inode_ptr_t f_inode_ptr = FD_INODE(fs, fd);
         inode_t f_inode;
         if(read_inode(fs, &f_inode, f_inode_ptr)) {
-            size_t position = fs->fd_table.fd_pos[fd]; //postion in file to start writing
+            size_t position = FD_POS(fs, fd); //postion in file to start writing
             size_t log_block_offset = POSITION_TO_INNER_OFFSET(position); //position offset within logical block
             
             //THING 1: limit reading to EOF
+            //(seeking past EOF is allowed, so there might not be anything to read at all)
+            if(position >= f_inode.mdata.size) {
+                return 0;
+            }
             size_t limit = nbyte;
             if(position + nbyte > f_inode.mdata.size) {
                 //nbyte is more than there is left in the file
@@ -568,6 +768,13 @@ ssize_t fs_read(S16FS_t *fs, int fd, void *dst, size_t nbyte) {
                 limit = f_inode.mdata.size - position;
             }
 
+            //an inline file's all right there in the inode, no blocks to look at
+            if(f_inode.mdata.flags & INODE_INLINE) {
+                memcpy(dst, INCREMENT_VOID(INODE_INLINE_DATA(&f_inode), position), limit);
+                FD_POS(fs, fd) += limit;
+                return limit;
+            }
+
             //cut up limit into chunks for logical block, full blocks, and last block
             size_t log_block_readable = BLOCK_SIZE - log_block_offset; //bytes left in logical block
             size_t full_block_readable; //number of full blocks to read
@@ -591,6 +798,16 @@ ssize_t fs_read(S16FS_t *fs, int fd, void *dst, size_t nbyte) {
                 ++n_read_blocks;
             }
 
+            //if this picks up where the last read left off, get the blocks after it coming in
+            readahead(fs, fd, &f_inode, position, position + limit);
+
+            //an extent map gets read a whole extent at a time, no ptrs needed
+            if(f_inode.mdata.flags & INODE_EXTENTS) {
+                const size_t extent_read = read_extents(fs, &f_inode, position, dst, limit);
+                FD_POS(fs, fd) += extent_read;
+                return extent_read;
+            }
+
             //initialize array of data block ptrs
             block_ptr_t readable_ptrs[n_read_blocks];
             for(size_t i = 0; i < n_read_blocks; i++) {
@@ -598,36 +815,54 @@ ssize_t fs_read(S16FS_t *fs, int fd, void *dst, size_t nbyte) {
             }
             
             //can you tell what this function does.. IT GETS DATA BLOCK PTRS!!
-            get_data_block_ptrs(fs, &f_inode, position, n_read_blocks, readable_ptrs);
+            //out of the descriptor's cached block map, which only goes to the indirect blocks when it runs out
+            //read only, so a 0 ptr is a hole, not something to allocate
+            size_t n_mapped = fd_map_lookup(fs, fd, &f_inode, POSITION_TO_BLOCK_INDEX(position), n_read_blocks,
+                                            readable_ptrs);
 
             ssize_t bytes_read = 0;
 
             //THING 2: this is actually mostly the same as fs_write except we're reading instead of writing
             //loop through all the blocks and copy data to the buffer
-            for(size_t i = 0; i < n_read_blocks && readable_ptrs[i]; i++) {
+            for(size_t i = 0; i < n_mapped; i++) {
                 if(i == 0) {
                     //special handling for first block to read in case it's partially full
-                    if(!partial_read(fs, INCREMENT_VOID(dst, 0), readable_ptrs[i], log_block_offset, log_block_readable)) {
+                    if(!readable_ptrs[i]) {
+                        memset(dst, 0x00, log_block_readable);
+                    } else if(!partial_read(fs, INCREMENT_VOID(dst, 0), readable_ptrs[i], log_block_offset, log_block_readable)) {
                         break;
                     }
                     bytes_read += log_block_readable;
                 } else if(i == n_read_blocks - 1 && last_block_readable) {
                     //special handling for last block to read in case we have a non-full block at the end
-                    if(!partial_read(fs, INCREMENT_VOID(dst, bytes_read), readable_ptrs[i], 0, last_block_readable)) {
+                    if(!readable_ptrs[i]) {
+                        memset(INCREMENT_VOID(dst, bytes_read), 0x00, last_block_readable);
+                    } else if(!partial_read(fs, INCREMENT_VOID(dst, bytes_read), readable_ptrs[i], 0, last_block_readable)) {
                         break;
                     }
                     bytes_read += last_block_readable;
+                } else if(!readable_ptrs[i]) {
+                    //hole in the middle, reads as a block of zeros
+                    memset(INCREMENT_VOID(dst, bytes_read), 0x00, BLOCK_SIZE);
+                    bytes_read += BLOCK_SIZE;
                 } else {
                     //full blocks in between the first block and last block
-                    if(!full_read(fs, INCREMENT_VOID(dst, bytes_read), readable_ptrs[i])) {
+                    //all in one go, back to back blocks turn into one big read
+                    size_t run = 1;
+                    while(i + run < n_read_blocks && readable_ptrs[i + run] &&
+                          !(i + run == n_read_blocks - 1 && last_block_readable)) {
+                        ++run;
+                    }
+                    if(!full_readv(fs, INCREMENT_VOID(dst, bytes_read), &readable_ptrs[i], run)) {
                         break;
                     }
-                    bytes_read += BLOCK_SIZE;
+                    bytes_read += run * BLOCK_SIZE;
+                    i += run - 1;
                 }
             }
 
             //update offset in fd_table
-            fs->fd_table.fd_pos[fd] += bytes_read;
+            FD_POS(fs, fd) += bytes_read;
 
             return bytes_read;
         } //else failed to read inode
@@ -637,12 +872,27 @@ ssize_t fs_read(S16FS_t *fs, int fd, void *dst, size_t nbyte) {
 
 ///
 /// Populates a dyn_array with information about the files in a directory
-///   Array contains up to 15 file_record_t structures
+///   Array contains a file_record_t for every file in the directory
 /// \param fs The S16FS containing the file
 /// \param path Absolute path to the directory to inspect
 /// \return dyn_array of file records, NULL on error
 ///
 dyn_array_t *fs_get_dir(S16FS_t *fs, const char *path) {
+    if(fs && path) {
+        journal_enter(fs);
+        pthread_rwlock_rdlock(&fs->namespace_lock);
+        dyn_array_t *entries = get_dir_locked(fs, path);
+        pthread_rwlock_unlock(&fs->namespace_lock);
+        journal_leave(fs);
+        return entries;
+    }
+    return NULL;
+}
+
+///
+/// fs_get_dir with namespace_lock held (read)
+///
+dyn_array_t *get_dir_locked(S16FS_t *fs, const char *path) {
     if(fs && path) {
         //find the directory
         result_t file_status;
@@ -650,28 +900,34 @@ dyn_array_t *fs_get_dir(S16FS_t *fs, const char *path) {
         if(file_status.success && file_status.found && file_status.type == FS_DIRECTORY) {
             //got the directory (and it is a directory) now get the inode and block
             inode_t f_inode;
-            dir_block_t dir;
-            if(read_inode(fs, &f_inode, file_status.inode) && full_read(fs, &dir, file_status.block)) {
-                //got the inode and block now create the dyn_array and get all (if any) entries
+            block_ptr_t blocks[DIR_INDEX_SLOTS];
+            size_t n_blocks = 0;
+            if(read_inode(fs, &f_inode, file_status.inode) && (n_blocks = dir_entry_blocks(fs, &f_inode, blocks))) {
+                //got the inode and the blocks the entries are in (just the one unless it's indexed)
+                //now create the dyn_array and get all (if any) entries
                 dyn_array_t *entries = dyn_array_create(0, sizeof(dir_ent_t), NULL);
                 if(entries) {
                     bool good = true;
-                    for(int i = 0; i < DIR_REC_MAX && good; i++) {
-                        if(dir.entries[i].fname[0]) {
-                            //don't you just LOVE pointers.. i kinda do right now
-                            //better than creating a dir_ent_t, copying the entry and then pushing
-                            if(!dyn_array_push_back(entries, &dir.entries[i])) {
-                                good = false;
+                    for(size_t b = 0; b < n_blocks && good; b++) {
+                        dir_block_t dir;
+                        good = meta_read(fs, &dir, blocks[b]);
+                        for(int i = 0; i < DIR_REC_MAX && good; i++) {
+                            if(dir.entries[i].fname[0]) {
+                                //don't you just LOVE pointers.. i kinda do right now
+                                //better than creating a dir_ent_t, copying the entry and then pushing
+                                if(!dyn_array_push_back(entries, &dir.entries[i])) {
+                                    good = false;
+                                }
                             }
                         }
                     }
                     //aaaaaaaaaannnnnnndddddd... we're done (if all is well that is)
                     if(good) {
                         return entries;
-                    } //else failed to push an entry to the dyn_array
+                    } //else failed to read a directory block or push an entry to the dyn_array
                     dyn_array_destroy(entries);
                 } //else failed to create dyn_array
-            } //else failed to read inode or directory block
+            } //else failed to read inode or find the directory's blocks
         } //else bad path to directory or not a directory
     } //else bad parameter
     return NULL;
@@ -689,6 +945,21 @@ dyn_array_t *fs_get_dir(S16FS_t *fs, const char *path) {
 /// \return 0 on success, < 0 on error
 ///
 int fs_move(S16FS_t *fs, const char *src, const char *dst) {
+    if(fs && src && dst) {
+        journal_enter(fs);
+        pthread_rwlock_wrlock(&fs->namespace_lock);
+        const int result = move_locked(fs, src, dst);
+        pthread_rwlock_unlock(&fs->namespace_lock);
+        journal_leave(fs);
+        return result;
+    }
+    return -1;
+}
+
+///
+/// fs_move with namespace_lock held (write)
+///
+int move_locked(S16FS_t *fs, const char *src, const char *dst) {
     if(fs && src && dst) {
         //find the file to move and make sure the dst file doesn't already exist
         result_t source_status;
@@ -729,45 +1000,38 @@ int fs_move(S16FS_t *fs, const char *src, const char *dst) {
                     if(read_inode(fs, &f_inode, source_status.inode) && read_inode(fs, &parent_inode, source_status.parent) &&
                         read_inode(fs, &dst_inode, destination_status.inode)) {
 
-                        //have all the inodes, now get parent and destination directory blocks
-                        dir_block_t parent_block;
-                        dir_block_t destination_block;
-                        if(full_read(fs, &parent_block, parent_inode.data_ptrs[0]) && 
-                            full_read(fs, &destination_block, dst_inode.data_ptrs[0]) && 
-                            destination_block.mdata.size < DIR_REC_MAX) {
-
-                            bool dstupdate = false;
-                            bool parentupdate = false;
-                            //add to destination_block and remove from parent_block
-                            for(int i = 0; i < DIR_REC_MAX; i++) {
-                                //find available entry in destination and set
-                                if(destination_block.entries[i].inode == 0 && !dstupdate) {
-                                    memcpy(destination_block.entries[i].fname, dst_fname, fname_len);
-                                    destination_block.entries[i].inode = source_status.inode;
-                                    ++destination_block.mdata.size;
-                                    dstupdate = true;
-                                }
-                                //find entry in parent and unset
-                                if(parent_block.entries[i].inode == source_status.inode && !parentupdate) {
-                                    parent_block.entries[i].fname[0] = '\0';
-                                    parent_block.entries[i].inode = 0;
-                                    --parent_block.mdata.size;
-                                    parentupdate = true;
-                                }
-                            }
+                        //have all the inodes, directories are hashed by name so grab the src fname too
+                        //(the last token of src)
+                        char src_fname[FS_FNAME_MAX] = {0};
+                        const size_t src_fname_len = strcspn((const char *) source_status.data, "/");
+                        if(src_fname_len < FS_FNAME_MAX) {
+                            memcpy(src_fname, source_status.data, src_fname_len);
 
-                            //update inode so it knows its new mommy
-                            f_inode.mdata.parent = destination_status.parent;
-
-                            //write f_inode, parent_block and destination_block
-                            if(write_inode(fs, &f_inode, source_status.inode) && 
-                                full_write(fs, &parent_block, parent_inode.data_ptrs[0]) && 
-                                full_write(fs, &destination_block, dst_inode.data_ptrs[0])) {
-                                //oh crap better free that stupid copy.. lest ye be leaking memory
-                                free(dst_copy);
-                                return 0;
-                            } //else failed to write src inode or directory blocks back out
-                        } //else failed to read parent or destination directory block OR destination is full
+                            //add to destination first, so if that doesn't work (destination full) nothing changed
+                            //then remove from parent
+                            if(dir_add_entry(fs, destination_status.inode, dst_fname, source_status.inode)) {
+                                dentry_invalidate(fs, dst_fname, destination_status.inode);
+                                dentry_invalidate(fs, src_fname, source_status.parent);
+                                if(dir_remove_entry(fs, source_status.parent, src_fname)) {
+                                    //update inode so it knows its new mommy
+                                    //it could be open and getting written to, so get it again under its lock
+                                    pthread_rwlock_t *inode_lock = &fs->inode_locks[source_status.inode];
+                                    pthread_rwlock_wrlock(inode_lock);
+                                    bool moved = read_inode(fs, &f_inode, source_status.inode);
+                                    if(moved) {
+                                        f_inode.mdata.parent = destination_status.parent;
+                                        //write f_inode
+                                        moved = write_inode(fs, &f_inode, source_status.inode);
+                                    }
+                                    pthread_rwlock_unlock(inode_lock);
+                                    if(moved) {
+                                        //oh crap better free that stupid copy.. lest ye be leaking memory
+                                        free(dst_copy);
+                                        return 0;
+                                    } //else failed to write src inode back out
+                                } //else failed to take the entry out of the parent directory
+                            } //else failed to add to destination (full or bad name)
+                        } //else src fname is somehow too long
                     } //else failed to read src, src parent or destination directory inode
                 } //else failed to find destination directory OR destination is same as src (trying to move file into itself)
                 free(dst_copy); //better free copy here too in case it got created but something else went wrong
@@ -777,37 +1041,329 @@ int fs_move(S16FS_t *fs, const char *src, const char *dst) {
     return -1;
 }
 
+///
+/// Frees the blocks backing part of a file, leaving a hole that reads as zeros
+///   The file size doesn't change. Blocks only partly inside the range get zeroed instead
+/// \param fs The S16FS containing the file
+/// \param fd The file to punch the hole in
+/// \param offset Where the hole starts
+/// \param length How long the hole is, anything past EOF is ignored
+/// \return 0 on success, < 0 on error
+///
+int fs_punch_hole(S16FS_t *fs, int fd, size_t offset, size_t length) {
+    int result = -1;
+    if(fs) {
+        journal_enter(fs);
+        if(fd_acquire(fs, fd)) {
+            pthread_rwlock_t *inode_lock = fd_inode_lock(fs, fd);
+            pthread_rwlock_wrlock(inode_lock);
+            result = punch_hole_locked(fs, fd, offset, length);
+            pthread_rwlock_unlock(inode_lock);
+            fd_release(fs, fd);
+        }
+        journal_leave(fs);
+    }
+    return result;
+}
+
+///
+/// fs_punch_hole with the descriptor and the file's inode (write) locked
+///
+int punch_hole_locked(S16FS_t *fs, int fd, size_t offset, size_t length) {
+    if(fs) {
+        inode_ptr_t f_inode_ptr = FD_INODE(fs, fd);
+        inode_t f_inode;
+        if(read_inode(fs, &f_inode, f_inode_ptr)) {
+            //nothing past EOF to punch
+            if(offset >= f_inode.mdata.size || !length) {
+                return 0;
+            }
+            if(length > f_inode.mdata.size - offset) {
+                length = f_inode.mdata.size - offset;
+            }
+            if(f_inode.mdata.flags & INODE_INLINE) {
+                //no blocks, just bytes in the inode
+                memset(INCREMENT_VOID(INODE_INLINE_DATA(&f_inode), offset), 0x00, length);
+                return write_inode(fs, &f_inode, f_inode_ptr) ? 0 : -1;
+            }
+            //whole blocks inside the range go back to back_store, the ragged ends just get zeroed
+            size_t first_whole = POSITION_TO_BLOCK_INDEX(offset + BLOCK_SIZE - 1);
+            size_t end_whole = POSITION_TO_BLOCK_INDEX(offset + length);
+            //the last block of the file counts as whole if the hole runs to EOF
+            if(offset + length == f_inode.mdata.size && POSITION_TO_INNER_OFFSET(offset + length)) {
+                ++end_whole;
+            }
+            bool success;
+            if(first_whole >= end_whole) {
+                //all inside one block
+                success = zero_file_range(fs, &f_inode, offset, length);
+            } else {
+                success = zero_file_range(fs, &f_inode, offset, first_whole * BLOCK_SIZE - offset) &&
+                          release_file_blocks(fs, &f_inode, first_whole, end_whole - first_whole) &&
+                          (offset + length <= end_whole * BLOCK_SIZE ||
+                           zero_file_range(fs, &f_inode, end_whole * BLOCK_SIZE, offset + length - end_whole * BLOCK_SIZE));
+            }
+            //descriptors could have the released blocks cached
+            fd_map_invalidate(fs, f_inode_ptr);
+            if(write_inode(fs, &f_inode, f_inode_ptr) && success) {
+                return 0;
+            } //else failed to release or zero something
+        } //else failed to read inode
+    } //else bad parameter
+    return -1;
+}
+
+///
+/// Sets the size of a file
+///   Shrinking frees every block past the new EOF (indirect blocks included)
+///   Growing leaves a hole, the new part reads as zeros
+///   Open descriptors keep their positions, even if that's past the new EOF now
+/// \param fs The S16FS containing the file
+/// \param path Absolute path to the file
+/// \param size The new size
+/// \return 0 on success, < 0 on error
+///
+int fs_truncate(S16FS_t *fs, const char *path, size_t size) {
+    int result = -1;
+    if(fs && path) {
+        result_t file_status;
+        journal_enter(fs);
+        pthread_rwlock_rdlock(&fs->namespace_lock);
+        locate_file(fs, path, &file_status);
+        if(file_status.success && file_status.found && file_status.type == FS_REGULAR) {
+            pthread_rwlock_wrlock(&fs->inode_locks[file_status.inode]);
+            result = resize_file(fs, file_status.inode, size);
+            pthread_rwlock_unlock(&fs->inode_locks[file_status.inode]);
+        } //else bad path or it's a directory
+        pthread_rwlock_unlock(&fs->namespace_lock);
+        journal_leave(fs);
+    } //else bad parameter
+    return result;
+}
+
+///
+/// fs_truncate on an open descriptor instead of a path
+/// \param fs The S16FS containing the file
+/// \param fd The file to resize
+/// \param size The new size
+/// \return 0 on success, < 0 on error
+///
+int fs_ftruncate(S16FS_t *fs, int fd, size_t size) {
+    int result = -1;
+    if(fs) {
+        journal_enter(fs);
+        if(fd_acquire(fs, fd)) {
+            pthread_rwlock_t *inode_lock = fd_inode_lock(fs, fd);
+            pthread_rwlock_wrlock(inode_lock);
+            result = resize_file(fs, FD_INODE(fs, fd), size);
+            pthread_rwlock_unlock(inode_lock);
+            fd_release(fs, fd);
+        }
+        journal_leave(fs);
+    } //else bad parameter
+    return result;
+}
+
+///
+/// Reserves blocks for part of a file ahead of time, so writing there later doesn't have to allocate
+///   New blocks come out of one contiguous run when the store has one
+///   The file size doesn't change (reserved blocks past EOF get freed by fs_truncate or fs_remove)
+/// \param fs The S16FS containing the file
+/// \param fd The file to reserve blocks for
+/// \param offset Where the range starts
+/// \param length How long the range is
+/// \return 0 on success, < 0 on error (out of space, some blocks may have been reserved)
+///
+int fs_fallocate(S16FS_t *fs, int fd, size_t offset, size_t length) {
+    int result = -1;
+    if(fs) {
+        journal_enter(fs);
+        if(fd_acquire(fs, fd)) {
+            pthread_rwlock_t *inode_lock = fd_inode_lock(fs, fd);
+            pthread_rwlock_wrlock(inode_lock);
+            result = fallocate_locked(fs, fd, offset, length);
+            pthread_rwlock_unlock(inode_lock);
+            fd_release(fs, fd);
+        }
+        journal_leave(fs);
+    }
+    return result;
+}
+
+///
+/// fs_fallocate with the descriptor and the file's inode (write) locked
+///
+int fallocate_locked(S16FS_t *fs, int fd, size_t offset, size_t length) {
+    if(fs && length && offset < FILE_SIZE_MAX) {
+        inode_ptr_t f_inode_ptr = FD_INODE(fs, fd);
+        inode_t f_inode;
+        if(read_inode(fs, &f_inode, f_inode_ptr)) {
+            if(length > FILE_SIZE_MAX - offset) {
+                length = FILE_SIZE_MAX - offset;
+            }
+            if(f_inode.mdata.flags & INODE_INLINE) {
+                //inside the inode there's nothing to reserve, past it the file needs real blocks
+                if(offset + length <= INLINE_DATA_MAX) {
+                    return 0;
+                }
+                if(!uninline_file(fs, &f_inode)) {
+                    return -1;
+                }
+            }
+            size_t first = POSITION_TO_BLOCK_INDEX(offset);
+            size_t end = POSITION_TO_BLOCK_INDEX(offset + length - 1) + 1;
+            const size_t eof_blocks = POSITION_TO_BLOCK_INDEX(f_inode.mdata.size + BLOCK_SIZE - 1);
+            bool success = true;
+            //a pool's worth at a time, leaving room for the indirect blocks a chunk could need
+            for(size_t i = first; i < end && success;) {
+                size_t chunk = end - i;
+                if(chunk > BLOCK_POOL_MAX - 3) {
+                    chunk = BLOCK_POOL_MAX - 3;
+                }
+                //count what's missing so the pool can be one run of exactly that many
+                block_ptr_t ptrs[BLOCK_POOL_MAX];
+                size_t n_mapped = map_data_blocks(fs, &f_inode, i, chunk, ptrs);
+                unsigned missing = 0;
+                for(size_t k = 0; k < n_mapped; k++) {
+                    missing += !ptrs[k];
+                }
+                if(missing) {
+                    block_pool_t pool = {{0}, 0, 0};
+                    //indirect blocks come out of the pool too, so they end up in the run right before their data
+                    //ask for 3 extra, that's the most a chunk could need (double indirect + 2 indirect)
+                    pthread_mutex_lock(&fs->alloc_lock);
+                    unsigned run = back_store_allocate_contiguous(fs->bs, missing + 3);
+                    pthread_mutex_unlock(&fs->alloc_lock);
+                    if(run) {
+                        for(unsigned k = 0; k < missing + 3; k++) {
+                            pool.ptrs[k] = run + k;
+                        }
+                        pool.count = missing + 3;
+                    } //else no run that long, fill_data_block_ptrs grabs whatever's near
+                    block_ptr_t holes[BLOCK_POOL_MAX];
+                    memcpy(holes, ptrs, n_mapped * sizeof(block_ptr_t));
+                    fill_data_block_ptrs(fs, &f_inode, i * BLOCK_SIZE, chunk, ptrs, &pool);
+                    pthread_mutex_lock(&fs->alloc_lock);
+                    back_store_release_range(fs->bs, pool.count - pool.next, pool.ptrs + pool.next);
+                    pthread_mutex_unlock(&fs->alloc_lock);
+                    //out of space leaves 0's at the end
+                    success = ptrs[chunk - 1] != 0;
+                    //holes under EOF read as zeros, the blocks filling them have to too
+                    //(past EOF doesn't matter, writing or growing the file out there zeros it)
+                    static const uint8_t zeros[BLOCK_SIZE] = {0};
+                    for(size_t k = 0; k < n_mapped && i + k < eof_blocks && success; k++) {
+                        if(!holes[k] && ptrs[k]) {
+                            success = full_write(fs, zeros, ptrs[k]);
+                        }
+                    }
+                }
+                i += chunk;
+            }
+            //descriptors could have the old holes cached
+            fd_map_invalidate(fs, f_inode_ptr);
+            if(write_inode(fs, &f_inode, f_inode_ptr) && success) {
+                return 0;
+            } //else ran out of space or failed to write the inode
+        } //else failed to read inode
+    } //else bad parameter
+    return -1;
+}
+
+///
+/// Sets how far ahead front to back reads get prefetched
+///   A descriptor's window starts at min_blocks once its reads look sequential
+///   and doubles each time it's used up, up to max_blocks. Any jump resets it
+/// \param fs The S16FS to tune
+/// \param min_blocks Starting window, in blocks
+/// \param max_blocks Biggest window, in blocks (up to 1024). 0 (with min 0) turns read-ahead off
+/// \return 0 on success, < 0 on error
+///
+int fs_set_readahead(S16FS_t *fs, size_t min_blocks, size_t max_blocks) {
+    if(fs && min_blocks <= max_blocks && max_blocks <= READAHEAD_LIMIT && (min_blocks || !max_blocks)) {
+        //reads are going on without any lock on these, so they get swapped in all at once
+        //windows already going get redone with the new limits on their next read, the new gen tells them
+        readahead_limits_t old, limits;
+        __atomic_load(&fs->readahead, &old, __ATOMIC_RELAXED);
+        do {
+            limits = (readahead_limits_t){(uint16_t)min_blocks, (uint16_t)max_blocks, old.gen + 1};
+        } while(!__atomic_compare_exchange(&fs->readahead, &old, &limits, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return 0;
+    } //else bad parameter
+    return -1;
+}
+
+///
+/// Gets the current read-ahead window of a descriptor
+/// \param fs The S16FS containing the file
+/// \param fd The descriptor to check
+/// \return window size in blocks (0 if its reads aren't sequential), < 0 on error
+///
+ssize_t fs_get_readahead(S16FS_t *fs, int fd) {
+    if(fs && fd_acquire(fs, fd)) {
+        readahead_limits_t limits;
+        __atomic_load(&fs->readahead, &limits, __ATOMIC_ACQUIRE);
+        //a window sized before the last fs_set_readahead is as good as gone
+        const fd_readahead_t *ra = &FD_RA(fs, fd);
+        const ssize_t window = ra->gen == limits.gen ? (ssize_t)ra->window : 0;
+        fd_release(fs, fd);
+        return window;
+    } //else bad parameter
+    return -1;
+}
+
 ///
 /// Fills array of block_ptr_t with ptrs to data blocks requested
 ///     write can request blocks past EOF allocating new blocks as available
-///     remove gets all the data block ptrs already allocated to a file
-///     read requests blocks up to (not past) EOF
+///     indirect blocks only get written back if something in them got allocated
+///     read and remove use map_data_blocks instead, which never allocates
 /// \param fs - The S16FS containing the file
 /// \param f_inode - pointer to the file's inode in memory
 /// \param position - byte offset in file to start getting blocks
-///     read/write use position from fd_table
-///     remove uses 0
+///     write uses position from fd_table
 /// \param n_blocks - number of blocks to get
-///     read/write only need enough blocks to read/write requested number of bytes
-///     remove needs all the blocks
+///     write only needs enough blocks to write requested number of bytes
 /// \param ptrs - block_ptr_t array to be filled
 ///
 void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t n_blocks, block_ptr_t *ptrs) {
+    //new blocks get claimed in batches instead of one back_store_allocate each
+    block_pool_t pool = {{0}, 0, 0};
+    fill_data_block_ptrs(fs, f_inode, position, n_blocks, ptrs, &pool);
+    //hand back whatever we claimed and didn't end up needing
+    //(nothing ever pointed at them, so they go straight back even with a journal)
+    pthread_mutex_lock(&fs->alloc_lock);
+    back_store_release_range(fs->bs, pool.count - pool.next, pool.ptrs + pool.next);
+    pthread_mutex_unlock(&fs->alloc_lock);
+}
+
+///
+/// get_data_block_ptrs with new blocks coming out of a pool the caller already filled
+///     (fs_fallocate fills it with a contiguous run). Whatever the pool runs out of gets refilled
+///     like normal, anything left over stays in the pool for the caller to release
+/// \param pool - blocks already claimed for this request
+///
+void fill_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t n_blocks, block_ptr_t *ptrs,
+                          block_pool_t *pool) {
     //do we really need to error check parameters to helper functions?
     //they've all been validated already...
+    if(f_inode->mdata.flags & INODE_EXTENTS) {
+        fill_extent_ptrs(fs, f_inode, POSITION_TO_BLOCK_INDEX(position), n_blocks, ptrs, pool);
+        return;
+    }
 
     size_t log_block_index = POSITION_TO_BLOCK_INDEX(position); //logical index for first block requested
     size_t j = 0; //for ptrs array indexing
     size_t i = log_block_index; //logical file block indexing
     bool good = true; //to keep track of how things are going
     //if anything goes wrong "good = false" and we'll pretty much just skip all the way to return
+    //last block we handed out or walked past, new blocks get allocated right after it
+    block_ptr_t prev = (i > 0 && i <= DIRECT_TOTAL) ? f_inode->data_ptrs[i - 1] : 0;
 
     //get direct data block ptrs if requested
     while(i < DIRECT_TOTAL && j < n_blocks && good) {
         //check if we need to allocate ith direct block
         if(!(f_inode->data_ptrs[i])) {
             //request new direct block and validate
-            f_inode->data_ptrs[i] = back_store_allocate(fs->bs);
+            f_inode->data_ptrs[i] = allocate_file_block(fs, pool, prev, n_blocks - j);
             if(!(f_inode->data_ptrs[i])) {
                 good = false;
             }
@@ -816,6 +1372,7 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
             //either we had a ptr already or allocation was successful
             //get data block ptr and increment indices
             ptrs[j] = f_inode->data_ptrs[i];
+            prev = ptrs[j];
             ++j;
             ++i;
         }
@@ -824,16 +1381,19 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
     //get single indirect data block ptrs if requested
     if(i < (DIRECT_TOTAL + INDIRECT_TOTAL) && j < n_blocks && good) {
         block_ptr_t i_block[INDIRECT_TOTAL] = {0};
+        bool i_changed = false; //only write it back if it changed
         //check if we need to allocate new indirect block
         if(!(f_inode->data_ptrs[6])) {
+            i_changed = true;
             //request new indirect block and validate
-            f_inode->data_ptrs[6] = back_store_allocate(fs->bs);
+            f_inode->data_ptrs[6] = allocate_file_block(fs, pool, prev, n_blocks - j);
+            prev = f_inode->data_ptrs[6];
             if(!(f_inode->data_ptrs[6])) {
                 good = false;
             }
         } else {
             //get existing indirect block
-            if(!full_read(fs, i_block, f_inode->data_ptrs[6])) {
+            if(!meta_read(fs, i_block, f_inode->data_ptrs[6])) {
                 good = false;
             }
         }
@@ -844,11 +1404,15 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
             //  is somewhere in the middle of the indirect block
             //side note: i've never been so thankful that array indexing starts at 0
             size_t h = (i-DIRECT_TOTAL) % INDIRECT_TOTAL;
+            if(h > 0 && i_block[h - 1]) {
+                prev = i_block[h - 1];
+            }
             for(; h < INDIRECT_TOTAL && j < n_blocks && good; h++) {
                 //check if we need to allocate a new data block
                 if(!i_block[h]) {
                     //request new data block and validate
-                    i_block[h] = back_store_allocate(fs->bs);
+                    i_block[h] = allocate_file_block(fs, pool, prev, n_blocks - j);
+                    i_changed = true;
                     if(!i_block[h]) {
                         good = false;
                     }
@@ -856,12 +1420,13 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
                 if(good) {
                     //get data block ptr
                     ptrs[j] = i_block[h];
+                    prev = ptrs[j];
                     ++j;
                     ++i;
                 }
             }
             //write out the i_block to save any changes
-            if(!full_write(fs, i_block, f_inode->data_ptrs[6])) {
+            if(i_changed && !meta_write(fs, i_block, f_inode->data_ptrs[6])) {
                 good = false;
             }
         }
@@ -870,16 +1435,19 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
     //get double indirect data block ptrs if requested
     if(j < n_blocks && good) {
         block_ptr_t d_block[INDIRECT_TOTAL] = {0};
+        bool d_changed = false;
         //check if we need to allocate double indirect block
         if(!(f_inode->data_ptrs[7])) {
+            d_changed = true;
             //request new double indirect block
-            f_inode->data_ptrs[7] = back_store_allocate(fs->bs);
+            f_inode->data_ptrs[7] = allocate_file_block(fs, pool, prev, n_blocks - j);
+            prev = f_inode->data_ptrs[7];
             if(!(f_inode->data_ptrs[7])) {
                 good = false;
             }
         } else {
             //get existing double indirect block
-            if(!full_read(fs, d_block, f_inode->data_ptrs[7])) {
+            if(!meta_read(fs, d_block, f_inode->data_ptrs[7])) {
                 good = false;
             }
         }
@@ -893,16 +1461,20 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
             size_t k = (i-(DIRECT_TOTAL + INDIRECT_TOTAL)) / INDIRECT_TOTAL;
             for(; j < n_blocks && good && k < INDIRECT_TOTAL; k++) {
                 block_ptr_t i_block[INDIRECT_TOTAL] = {0};
+                bool i_changed = false;
                 //check if we need to allocate kth indirect block
                 if(!d_block[k]) {
                     //request new indirect block
-                    d_block[k] = back_store_allocate(fs->bs);
+                    d_block[k] = allocate_file_block(fs, pool, prev, n_blocks - j);
+                    d_changed = true;
+                    i_changed = true;
+                    prev = d_block[k];
                     if(!d_block[k]) {
                         good = false;
                     }
                 } else {
                     //get existing indirect block
-                    if(!full_read(fs, i_block, d_block[k])) {
+                    if(!meta_read(fs, i_block, d_block[k])) {
                         good = false;
                     }
                 }
@@ -911,11 +1483,15 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
                     //again with the loop counters...
                     //go straight to first block requested
                     size_t h = (i-(DIRECT_TOTAL + INDIRECT_TOTAL)) % INDIRECT_TOTAL;
+                    if(h > 0 && i_block[h - 1]) {
+                        prev = i_block[h - 1];
+                    }
                     for(; j < n_blocks && good && h < INDIRECT_TOTAL; h++) {
                         //check if we need to allocate hth data block
                         if(!i_block[h]) {
                             //request new data block and validate
-                            i_block[h] = back_store_allocate(fs->bs);
+                            i_block[h] = allocate_file_block(fs, pool, prev, n_blocks - j);
+                            i_changed = true;
                             if(!i_block[h]) {
                                 good = false;
                             }
@@ -923,19 +1499,20 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
                         //get data block ptr
                         if(good) {
                             ptrs[j] = i_block[h];
+                            prev = ptrs[j];
                             ++j;
                             ++i; //don't really need 'i' anymore, but whatever
                         }
                     }
                     //write kth indirect block back out to save any changes
-                    if(!full_write(fs, i_block, d_block[k])) {
+                    if(i_changed && !meta_write(fs, i_block, d_block[k])) {
                         good = false;
                     }
                 }
             }
         }
         //write double indirect block back out to save any changes
-        if(!full_write(fs, d_block, f_inode->data_ptrs[7])) {
+        if(d_changed && !meta_write(fs, d_block, f_inode->data_ptrs[7])) {
             good = false;
         }
     }
@@ -944,3 +1521,1350 @@ void get_data_block_ptrs(S16FS_t *fs, inode_t *f_inode, size_t position, size_t
     //calling functions need to check all the ptrs they try to use (especially write)
     return;
 }
+
+///
+/// Looks up data block ptrs for a range of logical blocks without changing anything
+///     nothing gets allocated and no indirect block gets written back
+///     indirect blocks are borrowed from back_store (or the journal), not copied
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory
+/// \param first - logical index of the first block wanted
+/// \param n_blocks - number of blocks wanted
+/// \param ptrs - block_ptr_t array to be filled, 0 where the file has no block
+/// \return number of ptrs filled in, less than n_blocks if it ran past the biggest file or a read failed
+///
+size_t map_data_blocks(const S16FS_t *fs, const inode_t *f_inode, size_t first, size_t n_blocks, block_ptr_t *ptrs) {
+    size_t j = 0;
+    if(f_inode->mdata.flags & INODE_INLINE) {
+        //no blocks at all, those bytes aren't ptrs
+        memset(ptrs, 0x00, n_blocks * sizeof(block_ptr_t));
+        return n_blocks;
+    }
+    if(f_inode->mdata.flags & INODE_EXTENTS) {
+        //an extent (or hole) at a time
+        while(j < n_blocks) {
+            block_ptr_t start;
+            size_t length;
+            if(!extent_lookup(fs, f_inode, first + j, &start, &length)) {
+                break;
+            }
+            for(size_t k = 0; k < length && j < n_blocks; k++) {
+                ptrs[j++] = start ? start + k : 0;
+            }
+        }
+        return j;
+    }
+    while(j < n_blocks) {
+        size_t i = first + j;
+        if(i < DIRECT_TOTAL) {
+            ptrs[j++] = f_inode->data_ptrs[i];
+            continue;
+        }
+        //find the indirect block holding i, and the logical index its first entry is for
+        block_ptr_t indirect;
+        size_t base;
+        if(i < DIRECT_TOTAL + INDIRECT_TOTAL) {
+            indirect = f_inode->data_ptrs[6];
+            base = DIRECT_TOTAL;
+        } else if(i < DIRECT_TOTAL + INDIRECT_TOTAL + DBL_INDIRECT_TOTAL) {
+            size_t k = (i - (DIRECT_TOTAL + INDIRECT_TOTAL)) / INDIRECT_TOTAL;
+            indirect = 0;
+            if(f_inode->data_ptrs[7]) {
+                const block_ptr_t *d_block = (const block_ptr_t *)meta_map(fs, f_inode->data_ptrs[7]);
+                if(!d_block) {
+                    break;
+                }
+                indirect = d_block[k];
+                meta_unmap(fs, f_inode->data_ptrs[7], d_block);
+            }
+            base = DIRECT_TOTAL + INDIRECT_TOTAL + k * INDIRECT_TOTAL;
+        } else {
+            //past the biggest file there can be
+            break;
+        }
+        //everything left that this indirect block covers
+        size_t chunk = base + INDIRECT_TOTAL - i;
+        if(chunk > n_blocks - j) {
+            chunk = n_blocks - j;
+        }
+        if(indirect) {
+            const block_ptr_t *i_block = (const block_ptr_t *)meta_map(fs, indirect);
+            if(!i_block) {
+                break;
+            }
+            memcpy(ptrs + j, i_block + (i - base), chunk * sizeof(block_ptr_t));
+            meta_unmap(fs, indirect, i_block);
+        } else {
+            //no indirect block, so none of the blocks it would have had either
+            memset(ptrs + j, 0x00, chunk * sizeof(block_ptr_t));
+        }
+        j += chunk;
+    }
+    return j;
+}
+
+///
+/// Fills ptrs from the descriptor's block map window, refilling the window with map_data_blocks
+///     whenever the range walks off of it. A front to back read refills once every FD_MAP_WINDOW blocks
+/// \param fs - The S16FS containing the file
+/// \param fd - descriptor doing the read
+/// \param f_inode - pointer to the file's inode in memory
+/// \param first - logical index of the first block wanted
+/// \param n_blocks - number of blocks wanted
+/// \param ptrs - block_ptr_t array to be filled, left alone past anything that couldn't be looked up
+/// \return number of ptrs filled in, same as map_data_blocks
+///
+size_t fd_map_lookup(S16FS_t *fs, int fd, const inode_t *f_inode, size_t first, size_t n_blocks, block_ptr_t *ptrs) {
+    fd_map_t *map = &FD_MAP(fs, fd);
+    size_t j = 0;
+    while(j < n_blocks) {
+        size_t i = first + j;
+        if(!(map->count && i >= map->first && i < map->first + map->count)) {
+            map->first = i;
+            map->count = map_data_blocks(fs, f_inode, i, FD_MAP_WINDOW, map->ptrs);
+            if(!map->count) {
+                return j;
+            }
+        }
+        size_t chunk = map->first + map->count - i;
+        if(chunk > n_blocks - j) {
+            chunk = n_blocks - j;
+        }
+        memcpy(ptrs + j, map->ptrs + (i - map->first), chunk * sizeof(block_ptr_t));
+        j += chunk;
+    }
+    return j;
+}
+
+///
+/// Drops the cached block map of every descriptor open on the file
+///     anything that changes the file's blocks has to call this
+/// \param fs - The S16FS containing the file
+/// \param f_inode_ptr - inode number of the file that changed
+///
+void fd_map_invalidate(S16FS_t *fs, inode_ptr_t f_inode_ptr) {
+    //just the file's own descriptor list, which only changes under status_lock
+    pthread_mutex_lock(&fs->fd_table.status_lock);
+    for(int fd = fs->fd_table.inode_fds[f_inode_ptr]; fd != FD_NONE; fd = FD_CHUNK_OF(fs, fd)->next[FD_SLOT(fd)]) {
+        FD_MAP(fs, fd).count = 0;
+    }
+    pthread_mutex_unlock(&fs->fd_table.status_lock);
+}
+
+///
+/// fs_truncate/fs_ftruncate once they've found the inode
+/// \param fs - The S16FS containing the file
+/// \param f_inode_ptr - inode number of the file
+/// \param size - the new size
+/// \return 0 on success, < 0 on error
+///
+int resize_file(S16FS_t *fs, inode_ptr_t f_inode_ptr, size_t size) {
+    inode_t f_inode;
+    if(size <= FILE_SIZE_MAX && read_inode(fs, &f_inode, f_inode_ptr)) {
+        bool success;
+        if((f_inode.mdata.flags & INODE_INLINE) && size <= INLINE_DATA_MAX) {
+            //stays inline, whatever gets cut off goes back to zeros (growing just shows zeros that are already there)
+            if(size < f_inode.mdata.size) {
+                memset(INCREMENT_VOID(INODE_INLINE_DATA(&f_inode), size), 0x00, f_inode.mdata.size - size);
+            }
+            success = true;
+        } else if((f_inode.mdata.flags & INODE_INLINE) && !uninline_file(fs, &f_inode)) {
+            success = false;
+        } else if(size > f_inode.mdata.size) {
+            //the bytes past the old EOF could be anything, they have to read as zeros now
+            success = zero_file_range(fs, &f_inode, f_inode.mdata.size, size - f_inode.mdata.size);
+        } else {
+            //everything past the block holding the new EOF goes (reserved blocks past EOF too)
+            success = release_file_blocks(fs, &f_inode, POSITION_TO_BLOCK_INDEX(size + BLOCK_SIZE - 1), FILE_BLOCKS_MAX);
+            fd_map_invalidate(fs, f_inode_ptr);
+        }
+        if(success) {
+            f_inode.mdata.size = size;
+            f_inode.mdata.m_time = time(NULL);
+        }
+        if(write_inode(fs, &f_inode, f_inode_ptr) && success) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+///
+/// Releases the blocks behind a range of logical blocks and zeros their ptrs
+///     indirect blocks left with nothing in them get released too
+///     holes in the range are skipped, so it's fine to hand it the biggest range there is
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory, the caller writes it back
+/// \param first - logical index of the first block to release
+/// \param n_blocks - number of blocks to release
+/// \return true on success, false if an indirect block couldn't be read (some blocks may be released)
+///
+bool release_file_blocks(S16FS_t *fs, inode_t *f_inode, size_t first, size_t n_blocks) {
+    size_t end = first + n_blocks;
+    if(end > FILE_BLOCKS_MAX || end < first) {
+        end = FILE_BLOCKS_MAX;
+    }
+    if(f_inode->mdata.flags & INODE_INLINE) {
+        //nothing to release, those bytes aren't ptrs
+        return true;
+    }
+    if(f_inode->mdata.flags & INODE_EXTENTS) {
+        return extent_release(fs, f_inode, first, end);
+    }
+
+    //direct
+    for(size_t i = first; i < end && i < DIRECT_TOTAL; i++) {
+        if(f_inode->data_ptrs[i]) {
+            release_blocks(fs, &f_inode->data_ptrs[i], 1);
+            f_inode->data_ptrs[i] = 0;
+        }
+    }
+
+    //single indirect, and then each indirect block under the double indirect one, same deal
+    //slot 0 is data_ptrs[6], slot k + 1 is the kth entry of the double indirect block
+    block_ptr_t *d_block = NULL;
+    bool d_empty = true;
+    if(f_inode->data_ptrs[7] && end > DIRECT_TOTAL + INDIRECT_TOTAL) {
+        d_block = (block_ptr_t *)meta_map_mut(fs, f_inode->data_ptrs[7]);
+        if(!d_block) {
+            return false;
+        }
+    }
+    bool success = true;
+    for(size_t slot = 0; slot <= INDIRECT_TOTAL && success; slot++) {
+        size_t base = DIRECT_TOTAL + slot * INDIRECT_TOTAL;
+        block_ptr_t *owner = slot ? (d_block ? &d_block[slot - 1] : NULL) : &f_inode->data_ptrs[6];
+        if(!owner || !*owner) {
+            continue;
+        }
+        if(base + INDIRECT_TOTAL <= first || base >= end) {
+            //out of range, but the double indirect block isn't empty if this is still around
+            d_empty &= slot == 0;
+            continue;
+        }
+        block_ptr_t *i_block = (block_ptr_t *)meta_map_mut(fs, *owner);
+        if(!i_block) {
+            success = false;
+            break;
+        }
+        bool empty = true;
+        //one release_blocks per indirect block, not per data block
+        block_ptr_t freed[INDIRECT_TOTAL];
+        size_t n_freed = 0;
+        for(size_t h = 0; h < INDIRECT_TOTAL; h++) {
+            if(base + h >= first && base + h < end && i_block[h]) {
+                freed[n_freed++] = i_block[h];
+                i_block[h] = 0;
+            }
+            empty &= !i_block[h];
+        }
+        release_blocks(fs, freed, n_freed);
+        meta_unmap(fs, *owner, i_block);
+        if(empty) {
+            release_blocks(fs, owner, 1);
+            *owner = 0;
+        } else {
+            d_empty &= slot == 0;
+        }
+    }
+    if(d_block) {
+        meta_unmap(fs, f_inode->data_ptrs[7], d_block);
+        if(d_empty && success) {
+            release_blocks(fs, &f_inode->data_ptrs[7], 1);
+            f_inode->data_ptrs[7] = 0;
+        }
+    }
+    return success;
+}
+
+///
+/// Writes zeros over a byte range of a file, only where it has blocks (holes are already zeros)
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory
+/// \param position - byte offset to start at
+/// \param nbyte - number of bytes to zero
+/// \return true on success
+///
+bool zero_file_range(S16FS_t *fs, const inode_t *f_inode, size_t position, size_t nbyte) {
+    static const uint8_t zeros[BLOCK_SIZE] = {0};
+    while(nbyte) {
+        //a window of ptrs at a time, a big gap is mostly holes and shouldn't take a lookup per block
+        block_ptr_t ptrs[FD_MAP_WINDOW];
+        size_t n_mapped = map_data_blocks(fs, f_inode, POSITION_TO_BLOCK_INDEX(position), FD_MAP_WINDOW, ptrs);
+        if(!n_mapped) {
+            return false;
+        }
+        for(size_t k = 0; k < n_mapped && nbyte; k++) {
+            size_t offset = POSITION_TO_INNER_OFFSET(position);
+            size_t bytes = BLOCK_SIZE - offset;
+            if(bytes > nbyte) {
+                bytes = nbyte;
+            }
+            if(ptrs[k] && !partial_write(fs, zeros, ptrs[k], offset, bytes)) {
+                return false;
+            }
+            position += bytes;
+            nbyte -= bytes;
+        }
+    }
+    return true;
+}
+
+///
+/// Writes part of a block, zeroing the rest of it first if the block was just allocated
+///     a new block still has whatever the last file to use it left behind
+/// \param fs - The S16FS containing the file
+/// \param data - bytes to write
+/// \param block - the block
+/// \param offset - where in the block they go
+/// \param bytes - how many
+/// \param fresh - whether the block was just allocated
+/// \return true on success
+///
+bool block_write(S16FS_t *fs, const void *data, block_ptr_t block, size_t offset, size_t bytes, bool fresh) {
+    if(fresh && bytes < BLOCK_SIZE) {
+        uint8_t padded[BLOCK_SIZE] = {0};
+        memcpy(padded + offset, data, bytes);
+        return full_write(fs, padded, block);
+    }
+    return partial_write(fs, data, block, offset, bytes);
+}
+
+///
+/// Sequential detection and prefetch for one fs_read
+///     a read that starts where the descriptor's last one ended is sequential, anything else resets the window
+///     the window opens at the min and doubles every time reads eat through half of what was prefetched,
+///     up to the max, so a long front to back read ends up with big batches in flight
+///     the prefetch is just a hint to back_store, it doesn't wait on anything
+/// \param fs - The S16FS containing the file
+/// \param fd - descriptor doing the read
+/// \param f_inode - pointer to the file's inode in memory
+/// \param position - byte offset the read starts at
+/// \param end - byte offset the read stops at (already limited to EOF)
+///
+void readahead(S16FS_t *fs, int fd, const inode_t *f_inode, size_t position, size_t end) {
+    fd_readahead_t *ra = &FD_RA(fs, fd);
+    //fs_set_readahead can change them from another thread, so one copy for the whole call
+    readahead_limits_t limits;
+    __atomic_load(&fs->readahead, &limits, __ATOMIC_ACQUIRE);
+    if(ra->gen != limits.gen) {
+        //sized with old limits, start over with the new ones
+        ra->window = 0;
+        ra->gen = limits.gen;
+    }
+    if(position != ra->next || !limits.max) {
+        //random access (or read-ahead is off), nothing to guess at
+        ra->window = 0;
+        ra->ahead = 0;
+        ra->next = end;
+        return;
+    }
+    ra->next = end;
+    if(end == position) {
+        return;
+    }
+
+    size_t after = POSITION_TO_BLOCK_INDEX(end - 1) + 1; //first block past this read
+    size_t file_blocks = POSITION_TO_BLOCK_INDEX(f_inode->mdata.size + BLOCK_SIZE - 1);
+    if(!ra->window || ra->ahead < after) {
+        //just started, or reads got past everything prefetched
+        ra->window = limits.min;
+        ra->ahead = after;
+    } else if(ra->ahead - after > ra->window / 2) {
+        //plenty still coming
+        return;
+    } else if(ra->window < limits.max) {
+        //used up half the window and still going, so go bigger
+        ra->window *= 2;
+        if(ra->window > limits.max) {
+            ra->window = limits.max;
+        }
+    }
+
+    size_t stop = after + ra->window;
+    if(stop > file_blocks) {
+        stop = file_blocks;
+    }
+    if(stop <= ra->ahead) {
+        return;
+    }
+    block_ptr_t ptrs[READAHEAD_LIMIT];
+    unsigned ids[READAHEAD_LIMIT];
+    unsigned count = 0;
+    size_t n_mapped = map_data_blocks(fs, f_inode, ra->ahead, stop - ra->ahead, ptrs);
+    for(size_t i = 0; i < n_mapped; i++) {
+        //holes don't need prefetching
+        if(ptrs[i]) {
+            ids[count++] = ptrs[i];
+        }
+    }
+    back_store_prefetch(fs->bs, ids, count);
+    ra->ahead = stop;
+}
+
+///
+/// Allocates a new block for a file out of the pool, right after prev when it can
+///     an empty pool gets refilled with one back_store_allocate_range_near call
+///     big enough for the rest of the request, so a big write is a handful of bitmap passes
+///     and a file that grows front to back is laid out front to back
+/// \param fs - The S16FS containing the file
+/// \param pool - blocks already claimed for this request
+/// \param prev - block before the new one in the file, 0 if there isn't one
+/// \param remaining - data blocks left in the request, including this one
+/// \return the new block, 0 if the file system is full
+///
+block_ptr_t allocate_file_block(S16FS_t *fs, block_pool_t *pool, block_ptr_t prev, size_t remaining) {
+    if(pool->next == pool->count) {
+        //room for the data blocks plus any indirect blocks they could need
+        size_t wanted = remaining + remaining / INDIRECT_TOTAL + 2;
+        if(wanted > BLOCK_POOL_MAX) {
+            wanted = BLOCK_POOL_MAX;
+        }
+        pthread_mutex_lock(&fs->alloc_lock);
+        pool->count = back_store_allocate_range_near(fs->bs, prev ? prev + 1 : 0, wanted, pool->ptrs);
+        pthread_mutex_unlock(&fs->alloc_lock);
+        pool->next = 0;
+        if(!pool->count) {
+            return 0;
+        }
+    }
+    return pool->ptrs[pool->next++];
+}
+
+///
+/// Finds the run of a file's blocks (or the hole) a logical block is in, for an extent mapped file
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory
+/// \param logical - logical index of the block wanted
+/// \param start - set to the block logical is in, 0 if it's a hole
+/// \param length - set to how many blocks the run (or hole) has left, starting at logical
+/// \return true on success, false if logical is past the biggest file or the map couldn't be read
+///
+bool extent_lookup(const S16FS_t *fs, const inode_t *f_inode, size_t logical, block_ptr_t *start, size_t *length) {
+    if(logical >= FILE_BLOCKS_MAX) {
+        return false;
+    }
+    //find the leaf that would have it, and where the next leaf's part starts
+    block_ptr_t leaf_ptr = f_inode->data_ptrs[0];
+    size_t leaf_end = FILE_BLOCKS_MAX;
+    if(leaf_ptr && (f_inode->mdata.flags & INODE_EXTENT_INDEXED)) {
+        const extent_index_t *index = (const extent_index_t *)meta_map(fs, leaf_ptr);
+        if(!index) {
+            return false;
+        }
+        size_t e = extent_index_upper(index, logical);
+        if(e) {
+            leaf_ptr = index->entries[e - 1].leaf;
+            if(e < index->count) {
+                leaf_end = index->entries[e].logical;
+            }
+        } else {
+            //before the first leaf
+            leaf_ptr = 0;
+            leaf_end = index->entries[0].logical;
+        }
+        meta_unmap(fs, f_inode->data_ptrs[0], index);
+    }
+    *start = 0;
+    *length = leaf_end - logical;
+    if(leaf_ptr) {
+        const extent_block_t *leaf = (const extent_block_t *)meta_map(fs, leaf_ptr);
+        if(!leaf) {
+            return false;
+        }
+        size_t x = extent_upper(leaf, logical);
+        if(x && leaf->extents[x - 1].logical + leaf->extents[x - 1].length > logical) {
+            //in the one before
+            const extent_t *extent = &leaf->extents[x - 1];
+            *start = extent->start + (logical - extent->logical);
+            *length = extent->logical + extent->length - logical;
+        } else if(x < leaf->count) {
+            //a hole up to the next one
+            *length = leaf->extents[x].logical - logical;
+        }
+        meta_unmap(fs, leaf_ptr, leaf);
+    }
+    return true;
+}
+
+///
+/// Adds a run of blocks to a file's extent map, merging it into the extent on either side when it can
+///     a full leaf splits in two, a file's first blocks get it its first leaf
+///     the blocks themselves are already allocated, new leaves (and the index) get allocated near them
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory, the caller writes it back
+/// \param logical - logical index of the first block in the run
+/// \param start - first block of the run
+/// \param length - blocks in the run (a uint16_t's worth at most)
+/// \return true on success, false if a block couldn't be read/written or allocated (nothing was added)
+///
+bool extent_insert(S16FS_t *fs, inode_t *f_inode, size_t logical, block_ptr_t start, size_t length) {
+    extent_index_t index;
+    if(!load_extent_index(fs, f_inode, &index)) {
+        return false;
+    }
+    bool index_changed = false;
+    extent_block_t leaf = {0, 0, {{0, 0, 0}}};
+    block_ptr_t leaf_ptr;
+    size_t e = extent_index_upper(&index, logical);
+    e = e ? e - 1 : 0; //before the first leaf goes in the first leaf
+    if(!index.count) {
+        //first blocks the file's had
+        pthread_mutex_lock(&fs->alloc_lock);
+        leaf_ptr = back_store_allocate_near(fs->bs, start);
+        pthread_mutex_unlock(&fs->alloc_lock);
+        if(!leaf_ptr) {
+            return false;
+        }
+        index.entries[0] = (extent_index_entry_t){(uint32_t)logical, leaf_ptr, 0};
+        index.count = 1;
+        index_changed = true;
+    } else {
+        leaf_ptr = index.entries[e].leaf;
+        if(!meta_read(fs, &leaf, leaf_ptr)) {
+            return false;
+        }
+        if(logical < index.entries[e].logical) {
+            index.entries[e].logical = logical;
+            index_changed = true;
+        }
+    }
+
+    size_t x = extent_upper(&leaf, logical);
+    extent_t *prev = x ? &leaf.extents[x - 1] : NULL;
+    extent_t *next = x < leaf.count ? &leaf.extents[x] : NULL;
+    //merging needs them back to back in the file and on disk both
+    const bool with_prev = prev && prev->logical + prev->length == logical && prev->start + prev->length == start &&
+                           prev->length + length <= UINT16_MAX;
+    const bool with_next = next && logical + length == next->logical && start + length == next->start &&
+                           (with_prev ? prev->length : 0) + length + next->length <= UINT16_MAX;
+    if(with_prev && with_next) {
+        //fills the gap between them, all three are one now
+        prev->length += length + next->length;
+        memmove(next, next + 1, (leaf.count - x - 1) * sizeof(extent_t));
+        leaf.count--;
+    } else if(with_prev) {
+        prev->length += length;
+    } else if(with_next) {
+        next->logical = logical;
+        next->start = start;
+        next->length += length;
+    } else {
+        if(leaf.count == EXTENTS_PER_BLOCK) {
+            //full, the top half moves to a new leaf right after this one
+            if(index.count == EXTENTS_PER_BLOCK) {
+                //the map's as big as it gets
+                return false;
+            }
+            pthread_mutex_lock(&fs->alloc_lock);
+            block_ptr_t split_ptr = back_store_allocate_near(fs->bs, leaf_ptr);
+            pthread_mutex_unlock(&fs->alloc_lock);
+            if(!split_ptr) {
+                return false;
+            }
+            extent_block_t split = {0, 0, {{0, 0, 0}}};
+            const size_t half = leaf.count / 2;
+            split.count = leaf.count - half;
+            memcpy(split.extents, leaf.extents + half, split.count * sizeof(extent_t));
+            leaf.count = half;
+            memmove(index.entries + e + 2, index.entries + e + 1, (index.count - e - 1) * sizeof(extent_index_entry_t));
+            index.entries[e + 1] = (extent_index_entry_t){split.extents[0].logical, split_ptr, 0};
+            index.count++;
+            index_changed = true;
+            //whichever half the new one doesn't go in is done
+            bool written;
+            if(logical >= split.extents[0].logical) {
+                written = meta_write(fs, &leaf, leaf_ptr);
+                leaf = split;
+                leaf_ptr = split_ptr;
+                x -= half;
+            } else {
+                written = meta_write(fs, &split, split_ptr);
+            }
+            if(!written) {
+                release_blocks(fs, &split_ptr, 1);
+                return false;
+            }
+        }
+        memmove(leaf.extents + x + 1, leaf.extents + x, (leaf.count - x) * sizeof(extent_t));
+        leaf.extents[x] = (extent_t){(uint32_t)logical, start, (uint16_t)length};
+        leaf.count++;
+    }
+    return meta_write(fs, &leaf, leaf_ptr) && (!index_changed || store_extent_index(fs, f_inode, &index));
+}
+
+///
+/// Releases the blocks behind a range of logical blocks in an extent mapped file
+///     extents get trimmed (or split, for a range in the middle of one) and leaves left empty get released
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory, the caller writes it back
+/// \param first - logical index of the first block to release
+/// \param end - logical index past the last block to release
+/// \return true on success, false if part of the map couldn't be read/written (some blocks may be released)
+///
+bool extent_release(S16FS_t *fs, inode_t *f_inode, size_t first, size_t end) {
+    extent_index_t index;
+    if(!load_extent_index(fs, f_inode, &index)) {
+        return false;
+    }
+    bool index_changed = false;
+    bool success = true;
+    size_t e = extent_index_upper(&index, first);
+    e = e ? e - 1 : 0;
+    while(e < index.count && index.entries[e].logical < end && success) {
+        extent_block_t leaf;
+        if(!meta_read(fs, &leaf, index.entries[e].leaf)) {
+            success = false;
+            break;
+        }
+        bool changed = false;
+        extent_t tail = {0, 0, 0}; //the back of an extent the range went through the middle of
+        size_t kept = 0;
+        for(size_t x = 0; x < leaf.count; x++) {
+            extent_t extent = leaf.extents[x];
+            const size_t extent_end = extent.logical + extent.length;
+            const size_t from = first > extent.logical ? first : extent.logical;
+            const size_t to = end < extent_end ? end : extent_end;
+            if(from < to) {
+                changed = true;
+                //a batch at a time through release_blocks, not a lock trip per block
+                block_ptr_t freed[VECTOR_MAX];
+                for(size_t b = from; b < to;) {
+                    size_t n_freed = 0;
+                    for(; b < to && n_freed < VECTOR_MAX; b++) {
+                        freed[n_freed++] = extent.start + (b - extent.logical);
+                    }
+                    release_blocks(fs, freed, n_freed);
+                }
+                if(from == extent.logical && to == extent_end) {
+                    //all of it
+                    continue;
+                }
+                if(from > extent.logical && to < extent_end) {
+                    //through the middle, the front stays and the back goes in after
+                    tail = (extent_t){(uint32_t)to, (block_ptr_t)(extent.start + (to - extent.logical)),
+                                      (uint16_t)(extent_end - to)};
+                }
+                if(from > extent.logical) {
+                    extent.length = from - extent.logical;
+                } else {
+                    extent.start += to - extent.logical;
+                    extent.length = extent_end - to;
+                    extent.logical = to;
+                }
+            }
+            leaf.extents[kept++] = extent;
+        }
+        leaf.count = kept;
+        if(!kept) {
+            //nothing left in the leaf, it and its index entry go
+            release_blocks(fs, &index.entries[e].leaf, 1);
+            memmove(index.entries + e, index.entries + e + 1, (index.count - e - 1) * sizeof(extent_index_entry_t));
+            index.count--;
+            index_changed = true;
+            continue;
+        }
+        if(changed && !meta_write(fs, &leaf, index.entries[e].leaf)) {
+            success = false;
+        } else if(tail.length) {
+            //the range was all inside that one extent, so there's nothing else to look at
+            //the index has to be saved first, extent_insert loads it
+            return (!index_changed || store_extent_index(fs, f_inode, &index)) &&
+                   extent_insert(fs, f_inode, tail.logical, tail.start, tail.length);
+        }
+        ++e;
+    }
+    return (!index_changed || store_extent_index(fs, f_inode, &index)) && success;
+}
+
+///
+/// fill_data_block_ptrs for an extent mapped file
+///     new blocks go into the map a run at a time, so a write into a hole is one extent_insert per run
+///     (and a file growing front to back usually just makes its last extent longer)
+///
+void fill_extent_ptrs(S16FS_t *fs, inode_t *f_inode, size_t first, size_t n_blocks, block_ptr_t *ptrs,
+                      block_pool_t *pool) {
+    //new blocks get allocated right after the block before, if there is one
+    block_ptr_t prev = 0;
+    size_t prev_length;
+    if(first && !extent_lookup(fs, f_inode, first - 1, &prev, &prev_length)) {
+        return;
+    }
+    if(!f_inode->data_ptrs[0] && n_blocks) {
+        //the map's first leaf comes out of the pool ahead of the data
+        //allocated any later it would land right after the data, and the next write couldn't extend the run
+        block_ptr_t leaf_ptr = allocate_file_block(fs, pool, prev, n_blocks + 1);
+        const extent_block_t leaf = {0, 0, {{0, 0, 0}}};
+        if(!leaf_ptr) {
+            return;
+        }
+        if(!meta_write(fs, &leaf, leaf_ptr)) {
+            release_blocks(fs, &leaf_ptr, 1);
+            return;
+        }
+        f_inode->data_ptrs[0] = leaf_ptr;
+        prev = leaf_ptr;
+    }
+    size_t j = 0;
+    bool good = true;
+    while(j < n_blocks && good) {
+        block_ptr_t start;
+        size_t length;
+        if(!extent_lookup(fs, f_inode, first + j, &start, &length)) {
+            return;
+        }
+        if(length > n_blocks - j) {
+            length = n_blocks - j;
+        }
+        if(start) {
+            //already there
+            for(size_t k = 0; k < length; k++) {
+                ptrs[j++] = start + k;
+            }
+            prev = ptrs[j - 1];
+            continue;
+        }
+        //a hole, ptrs[run..j) are new blocks back to back that aren't in the map yet
+        size_t run = j;
+        const size_t hole_end = j + length;
+        while(good && run < hole_end) {
+            block_ptr_t block = j < hole_end ? allocate_file_block(fs, pool, prev, n_blocks - j) : 0;
+            if(block && j > run && block == ptrs[j - 1] + 1 && j - run < UINT16_MAX) {
+                ptrs[j++] = prev = block;
+                continue;
+            }
+            //the run ended (or nothing's left to allocate), put it in the map
+            if(j > run && !extent_insert(fs, f_inode, first + run, ptrs[run], j - run)) {
+                //it's not in the file, so it goes back
+                release_blocks(fs, ptrs + run, j - run);
+                memset(ptrs + run, 0x00, (j - run) * sizeof(block_ptr_t));
+                if(block) {
+                    release_blocks(fs, &block, 1);
+                }
+                good = false;
+            } else if(block) {
+                run = j;
+                ptrs[j++] = prev = block;
+            } else {
+                //full (or done with the hole)
+                good = j == hole_end;
+                run = j;
+            }
+        }
+    }
+    //same as the block pointers, a full fs leaves 0's from that point on
+}
+
+///
+/// read_locked for an extent mapped file, a whole extent (or hole) at a time
+///     the ragged first and last blocks are partial reads, everything in between is one vectored read per extent
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory
+/// \param position - byte offset to start at
+/// \param dst - buffer to fill
+/// \param nbyte - bytes to read (already limited to EOF)
+/// \return bytes read, less than nbyte if something couldn't be read
+///
+size_t read_extents(S16FS_t *fs, const inode_t *f_inode, size_t position, void *dst, size_t nbyte) {
+    size_t done = 0;
+    while(done < nbyte) {
+        block_ptr_t start;
+        size_t length;
+        if(!extent_lookup(fs, f_inode, POSITION_TO_BLOCK_INDEX(position + done), &start, &length)) {
+            break;
+        }
+        const size_t offset = POSITION_TO_INNER_OFFSET(position + done);
+        size_t bytes = length * BLOCK_SIZE - offset;
+        if(bytes > nbyte - done) {
+            bytes = nbyte - done;
+        }
+        if(!start) {
+            //hole
+            memset(INCREMENT_VOID(dst, done), 0x00, bytes);
+        } else if(offset || bytes < BLOCK_SIZE) {
+            //ragged block, just the part of it that's wanted
+            if(bytes > BLOCK_SIZE - offset) {
+                bytes = BLOCK_SIZE - offset;
+            }
+            if(!partial_read(fs, INCREMENT_VOID(dst, done), start, offset, bytes)) {
+                break;
+            }
+        } else {
+            //whole blocks, however many of the extent that is
+            bytes -= POSITION_TO_INNER_OFFSET(bytes);
+            if(!full_read_extent(fs, INCREMENT_VOID(dst, done), start, POSITION_TO_BLOCK_INDEX(bytes))) {
+                break;
+            }
+        }
+        done += bytes;
+    }
+    return done;
+}
+
+///
+/// Gets a file's extent index, one is made up for a map that's a single leaf (or nothing)
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory
+/// \param index - filled in
+/// \return true on success
+///
+bool load_extent_index(const S16FS_t *fs, const inode_t *f_inode, extent_index_t *index) {
+    if(f_inode->mdata.flags & INODE_EXTENT_INDEXED) {
+        return meta_read(fs, index, f_inode->data_ptrs[0]);
+    }
+    memset(index, 0x00, sizeof(extent_index_t));
+    if(f_inode->data_ptrs[0]) {
+        index->count = 1;
+        index->entries[0].leaf = f_inode->data_ptrs[0];
+    }
+    return true;
+}
+
+///
+/// Saves a file's extent index, allocating a block for it when it outgrows one leaf
+///     and going back to the leaf hanging right off the inode when it shrinks back down to one
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory, the caller writes it back
+/// \param index - the index to save
+/// \return true on success
+///
+bool store_extent_index(S16FS_t *fs, inode_t *f_inode, const extent_index_t *index) {
+    if(index->count > 1) {
+        if(!(f_inode->mdata.flags & INODE_EXTENT_INDEXED)) {
+            pthread_mutex_lock(&fs->alloc_lock);
+            block_ptr_t index_ptr = back_store_allocate_near(fs->bs, index->entries[0].leaf);
+            pthread_mutex_unlock(&fs->alloc_lock);
+            if(!index_ptr) {
+                return false;
+            }
+            f_inode->data_ptrs[0] = index_ptr;
+            f_inode->mdata.flags |= INODE_EXTENT_INDEXED;
+        }
+        return meta_write(fs, index, f_inode->data_ptrs[0]);
+    }
+    if(f_inode->mdata.flags & INODE_EXTENT_INDEXED) {
+        release_blocks(fs, &f_inode->data_ptrs[0], 1);
+        f_inode->mdata.flags &= ~INODE_EXTENT_INDEXED;
+    }
+    f_inode->data_ptrs[0] = index->count ? index->entries[0].leaf : 0;
+    return true;
+}
+
+///
+/// Binary search of a leaf
+/// \return index of the first extent starting past logical, count if there isn't one
+///
+size_t extent_upper(const extent_block_t *leaf, size_t logical) {
+    size_t lo = 0, hi = leaf->count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(leaf->extents[mid].logical > logical) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+///
+/// Binary search of an extent index
+/// \return index of the first entry starting past logical, count if there isn't one
+///
+size_t extent_index_upper(const extent_index_t *index, size_t logical) {
+    size_t lo = 0, hi = index->count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(index->entries[mid].logical > logical) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+///
+/// Moves an inline file's data out of its inode and into a block, for when it's outgrowing the inode
+///     (or about to need real blocks for something else). The caller writes the inode back
+/// \param fs - The S16FS containing the file
+/// \param f_inode - pointer to the file's inode in memory
+/// \return true on success, false if there was no block for it (the inode's left inline)
+///
+bool uninline_file(S16FS_t *fs, inode_t *f_inode) {
+    uint8_t data[INLINE_DATA_MAX];
+    memcpy(data, INODE_INLINE_DATA(f_inode), INLINE_DATA_MAX);
+    //those bytes are block ptrs (or the extent map) again, and they all start out 0
+    memset(INODE_INLINE_DATA(f_inode), 0x00, INLINE_DATA_MAX);
+    f_inode->mdata.flags &= ~INODE_INLINE;
+    if(!f_inode->mdata.size) {
+        return true;
+    }
+    block_ptr_t block = 0;
+    get_data_block_ptrs(fs, f_inode, 0, 1, &block);
+    if(block && block_write(fs, data, block, 0, f_inode->mdata.size, true)) {
+        return true;
+    }
+    //put it back how it was
+    release_file_blocks(fs, f_inode, 0, FILE_BLOCKS_MAX);
+    memcpy(INODE_INLINE_DATA(f_inode), data, INLINE_DATA_MAX);
+    f_inode->mdata.flags |= INODE_INLINE;
+    return false;
+}
+
+///
+/// Locks a descriptor for one call, its fd_table entries belong to the caller until fd_release
+///     close has to get the lock too, so a descriptor can't close in the middle of a read or write
+/// \param fs - The S16FS containing the file
+/// \param fd - the descriptor
+/// \return true if it's open (and now locked), false (and nothing locked) if it's not
+///
+bool fd_acquire(S16FS_t *fs, int fd) {
+    if(!FD_VALID(fd)) {
+        return false;
+    }
+    //fs_open could be putting the chunk in right now, if it isn't there yet the descriptor can't be open
+    fd_chunk_t *chunk = __atomic_load_n(&FD_CHUNK_OF(fs, fd), __ATOMIC_ACQUIRE);
+    if(!chunk) {
+        return false;
+    }
+    pthread_mutex_lock(&chunk->lock[FD_SLOT(fd)]);
+    pthread_mutex_lock(&fs->fd_table.status_lock);
+    bool open = chunk->open[FD_SLOT(fd)];
+    pthread_mutex_unlock(&fs->fd_table.status_lock);
+    if(!open) {
+        pthread_mutex_unlock(&chunk->lock[FD_SLOT(fd)]);
+    }
+    return open;
+}
+
+///
+/// Unlocks a descriptor fd_acquire locked
+/// \param fs - The S16FS containing the file
+/// \param fd - the descriptor
+///
+void fd_release(S16FS_t *fs, int fd) {
+    pthread_mutex_unlock(&FD_CHUNK_OF(fs, fd)->lock[FD_SLOT(fd)]);
+}
+
+///
+/// Gets the lock of the file a descriptor is open on
+///     fd_inode can't change while the caller holds the descriptor, so neither can the lock
+/// \param fs - The S16FS containing the file
+/// \param fd - the descriptor, already acquired
+/// \return the file's inode lock
+///
+pthread_rwlock_t *fd_inode_lock(S16FS_t *fs, int fd) {
+    return &fs->inode_locks[FD_INODE(fs, fd)];
+}
+
+///
+/// Hands out a descriptor for a file: the last one closed if there is one, otherwise the next one never used
+///     (allocating its chunk if it's the first in one). Either way it's O(1), no searching
+///     The descriptor goes on the front of the file's list so fs_remove can find it. Caller holds status_lock
+/// \param fs - The S16FS containing the file
+/// \param f_inode_ptr - inode number of the file being opened
+/// \return the descriptor, set up at BOF, FD_NONE if they're all taken (or a chunk couldn't be allocated)
+///
+int fd_claim(S16FS_t *fs, inode_ptr_t f_inode_ptr) {
+    fd_table_t *table = &fs->fd_table;
+    int fd = table->free;
+    if(fd != FD_NONE) {
+        table->free = FD_CHUNK_OF(fs, fd)->next[FD_SLOT(fd)];
+    } else if(table->unused < DESCRIPTOR_MAX) {
+        fd = table->unused;
+        if(FD_SLOT(fd) == 0) {
+            //first one in a chunk that isn't there yet
+            fd_chunk_t *chunk = (fd_chunk_t *)calloc(1, sizeof(fd_chunk_t));
+            if(!chunk) {
+                return FD_NONE;
+            }
+            for(int i = 0; i < FD_CHUNK; i++) {
+                pthread_mutex_init(&chunk->lock[i], NULL);
+            }
+            //fd_acquire looks for it without status_lock, the locks have to be ready before it can see it
+            __atomic_store_n(&FD_CHUNK_OF(fs, fd), chunk, __ATOMIC_RELEASE);
+        }
+        table->unused++;
+    } else {
+        return FD_NONE;
+    }
+
+    fd_chunk_t *chunk = FD_CHUNK_OF(fs, fd);
+    const int slot = FD_SLOT(fd);
+    chunk->open[slot] = true;
+    chunk->pos[slot] = 0;
+    chunk->inode[slot] = f_inode_ptr;
+    chunk->map[slot].count = 0;
+    chunk->ra[slot] = (fd_readahead_t){0, 0, 0, 0};
+    //front of the file's list
+    const int next = table->inode_fds[f_inode_ptr];
+    chunk->prev[slot] = FD_NONE;
+    chunk->next[slot] = next;
+    if(next != FD_NONE) {
+        FD_CHUNK_OF(fs, next)->prev[FD_SLOT(next)] = fd;
+    }
+    table->inode_fds[f_inode_ptr] = fd;
+    return fd;
+}
+
+///
+/// Takes a descriptor off its file's list and puts it on the free list, fd_claim undone
+///     Caller holds status_lock (and the descriptor)
+/// \param fs - The S16FS containing the file
+/// \param fd - the open descriptor
+///
+void fd_free(S16FS_t *fs, int fd) {
+    fd_table_t *table = &fs->fd_table;
+    fd_chunk_t *chunk = FD_CHUNK_OF(fs, fd);
+    const int slot = FD_SLOT(fd);
+    const int prev = chunk->prev[slot];
+    const int next = chunk->next[slot];
+    if(prev != FD_NONE) {
+        FD_CHUNK_OF(fs, prev)->next[FD_SLOT(prev)] = next;
+    } else {
+        table->inode_fds[chunk->inode[slot]] = next;
+    }
+    if(next != FD_NONE) {
+        FD_CHUNK_OF(fs, next)->prev[FD_SLOT(next)] = prev;
+    }
+    chunk->open[slot] = false;
+    chunk->next[slot] = table->free;
+    table->free = fd;
+}
+
+///
+/// Frees every descriptor chunk, for unmount
+///     chunks get allocated in order, so the first missing one is the end
+/// \param fs - The S16FS being unmounted
+///
+void fd_table_destroy(S16FS_t *fs) {
+    for(int c = 0; c < FD_CHUNKS_MAX && fs->fd_table.chunks[c]; c++) {
+        for(int i = 0; i < FD_CHUNK; i++) {
+            pthread_mutex_destroy(&fs->fd_table.chunks[c]->lock[i]);
+        }
+        free(fs->fd_table.chunks[c]);
+    }
+}
+
+///
+/// Keeps a commit from happening in the middle of an operation
+///     every public call that reads or writes metadata goes between this and journal_leave
+///     it's the first lock they take, so nothing that's holding it is waiting on a commit
+///     does nothing if the fs doesn't have a journal
+/// \param fs - The S16FS being worked on
+///
+void journal_enter(S16FS_t *fs) {
+    if(fs->journal) {
+        pthread_rwlock_rdlock(&fs->journal_lock);
+    }
+}
+
+///
+/// Lets commits happen again, and does one if the running transaction has gotten big enough (group commit)
+///     whoever's finishing when it fills up pays for everyone's, and fs_sync picks up whatever's left
+///     a commit that fails here just leaves the transaction running, the next one tries it all again
+/// \param fs - The S16FS being worked on
+///
+void journal_leave(S16FS_t *fs) {
+    if(fs->journal) {
+        pthread_rwlock_unlock(&fs->journal_lock);
+        if(__atomic_load_n(&fs->journal->wanted, __ATOMIC_RELAXED)) {
+            pthread_rwlock_wrlock(&fs->journal_lock);
+            //someone else could have gotten to it first
+            if(fs->journal->wanted) {
+                journal_commit(fs);
+            }
+            pthread_rwlock_unlock(&fs->journal_lock);
+        }
+    }
+}
+
+///
+/// Marks a block as used by the inode being walked
+/// \param check - The check going on
+/// \param block - block the inode points at
+/// \return false if it can't be a file's block (reserved, the log, off the end) or another inode already has it
+///
+bool check_claim(fs_check_t *check, size_t block) {
+    if(!BLOCK_IDX_VALID(block)) {
+        return false;
+    }
+    if(check->fs->journal && block >= JOURNAL_BLOCK_OFFSET && block < JOURNAL_BLOCK_OFFSET + JOURNAL_BLOCK_TOTAL) {
+        return false;
+    }
+    const uint8_t bit = (uint8_t)(1U << (block & 0x07));
+    return !(__atomic_fetch_or(&check->claimed[block >> 3], bit, __ATOMIC_RELAXED) & bit);
+}
+
+///
+/// check_claim on every ptr that isn't a hole
+/// \param check - The check going on
+/// \param ptrs - block ptrs, 0 for a hole
+/// \param count - how many
+/// \return false if any of them can't be claimed
+///
+bool check_ptrs(fs_check_t *check, const block_ptr_t *ptrs, size_t count) {
+    for(size_t i = 0; i < count; i++) {
+        if(ptrs[i] && !check_claim(check, ptrs[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+///
+/// Claims every block a regular file uses, data and map (indirect blocks, extent leaves and index)
+/// \param check - The check going on
+/// \param f_inode - the file's inode
+/// \return false if the map is broken somewhere, or points at a block that isn't its to use
+///
+bool check_file_blocks(fs_check_t *check, const inode_t *f_inode) {
+    const S16FS_t *fs = check->fs;
+    if(f_inode->mdata.flags & INODE_INLINE) {
+        return f_inode->mdata.size <= INLINE_DATA_MAX;
+    }
+    if(f_inode->mdata.size > FILE_SIZE_MAX) {
+        return false;
+    }
+    if(f_inode->mdata.flags & INODE_EXTENTS) {
+        extent_index_t index;
+        if((f_inode->mdata.flags & INODE_EXTENT_INDEXED) && !check_claim(check, f_inode->data_ptrs[0])) {
+            return false;
+        }
+        if(!load_extent_index(fs, f_inode, &index) || index.count > EXTENTS_PER_BLOCK) {
+            return false;
+        }
+        for(size_t e = 0; e < index.count; e++) {
+            extent_block_t leaf;
+            if(!check_claim(check, index.entries[e].leaf) || !meta_read(fs, &leaf, index.entries[e].leaf)
+               || leaf.count > EXTENTS_PER_BLOCK) {
+                return false;
+            }
+            for(size_t x = 0; x < leaf.count; x++) {
+                const extent_t *extent = &leaf.extents[x];
+                if((size_t)extent->logical + extent->length > FILE_BLOCKS_MAX) {
+                    return false;
+                }
+                for(size_t b = 0; b < extent->length; b++) {
+                    if(!check_claim(check, (size_t)extent->start + b)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+    //direct, then single indirect, then the double indirect block and each indirect block under it
+    indir_block_t indirect, d_indirect;
+    if(!check_ptrs(check, f_inode->data_ptrs, DIRECT_TOTAL)) {
+        return false;
+    }
+    if(f_inode->data_ptrs[6]
+       && !(check_claim(check, f_inode->data_ptrs[6]) && meta_read(fs, &indirect, f_inode->data_ptrs[6])
+            && check_ptrs(check, indirect.block_ptrs, INDIRECT_TOTAL))) {
+        return false;
+    }
+    if(f_inode->data_ptrs[7]) {
+        if(!check_claim(check, f_inode->data_ptrs[7]) || !meta_read(fs, &d_indirect, f_inode->data_ptrs[7])) {
+            return false;
+        }
+        for(size_t i = 0; i < INDIRECT_TOTAL; i++) {
+            block_ptr_t owner = d_indirect.block_ptrs[i];
+            if(owner && !(check_claim(check, owner) && meta_read(fs, &indirect, owner)
+                          && check_ptrs(check, indirect.block_ptrs, INDIRECT_TOTAL))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+///
+/// Claims every block a directory uses, its index and buckets (or its one block)
+///     the entries get looked at later, going down from root
+/// \param check - The check going on
+/// \param dir_inode - the directory's inode
+/// \return false if the index is broken, or points at a block that isn't its to use
+///
+bool check_dir_blocks(fs_check_t *check, const inode_t *dir_inode) {
+    if(!check_claim(check, dir_inode->data_ptrs[0])) {
+        return false;
+    }
+    if(dir_inode->mdata.flags & INODE_DIR_INDEXED) {
+        //depth has to make sense before dir_entry_blocks goes by it
+        dir_index_t index;
+        block_ptr_t buckets[DIR_INDEX_SLOTS];
+        if(!meta_read(check->fs, &index, dir_inode->data_ptrs[0]) || index.depth > DIR_INDEX_DEPTH_MAX) {
+            return false;
+        }
+        const size_t n_buckets = dir_entry_blocks(check->fs, dir_inode, buckets);
+        return n_buckets && check_ptrs(check, buckets, n_buckets);
+    }
+    return true;
+}
+
+///
+/// One of check_walk's threads, walks inodes until there aren't any left
+/// \param arg - the fs_check_t
+/// \return NULL
+///
+void *check_worker(void *arg) {
+    fs_check_t *check = (fs_check_t *)arg;
+    unsigned i;
+    while((i = __atomic_fetch_add(&check->next, 1, __ATOMIC_RELAXED)) < INODE_TOTAL) {
+        if(check->walk[i]) {
+            const inode_t *inode = &check->fs->inode_table[i];
+            check->bad[i] = INODE_IS_TYPE(inode, FS_DIRECTORY) ? !check_dir_blocks(check, inode)
+                                                               : !check_file_blocks(check, inode);
+        }
+    }
+    return NULL;
+}
+
+///
+/// Claims the blocks of every inode in walk, and finds the ones with broken maps, across CHECK_THREADS_MAX threads
+///     (or however many cores there are, if that's fewer)
+///     which of two inodes sharing a block gets called bad depends on which got there first
+/// \param check - The check going on, claimed and bad get filled in
+/// \param walk - which inodes to walk
+///
+void check_walk(fs_check_t *check, const bool *walk) {
+    memset(check->claimed, 0x00, sizeof(check->claimed));
+    memset(check->bad, 0x00, sizeof(check->bad));
+    check->next = 0;
+    check->walk = walk;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n_threads = cpus > 1 ? (size_t)cpus : 1;
+    if(n_threads > CHECK_THREADS_MAX) {
+        n_threads = CHECK_THREADS_MAX;
+    }
+    //this thread's one of them, and it picks up the slack if any of the others don't start
+    pthread_t threads[CHECK_THREADS_MAX];
+    size_t started = 0;
+    while(started + 1 < n_threads && pthread_create(&threads[started], NULL, check_worker, check) == 0) {
+        started++;
+    }
+    check_worker(check);
+    for(size_t t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+///
+/// Consistency check for a mount that can't trust what's on disk (not cleanly unmounted)
+///     every inode's block map gets walked in parallel, then the tree is walked down from root:
+///     entries pointing at nothing (or at a directory whose index is broken) come out,
+///     inodes nothing points at get freed, and files with broken maps are emptied
+///     The free block map is rebuilt from what's left, so leaked blocks come back and nothing in use stays free
+///     Runs before anything else can get at the fs, no locks needed
+/// \param fs - The S16FS being mounted
+/// \return true if it's consistent now, false if root's broken or something couldn't be read/written
+///
+bool check_fs(S16FS_t *fs) {
+    fs_check_t *check = (fs_check_t *)calloc(1, sizeof(fs_check_t));
+    if(!check) {
+        return false;
+    }
+    check->fs = fs;
+    bool walk[INODE_TOTAL];
+    for(size_t i = 0; i < INODE_TOTAL; i++) {
+        const inode_t *inode = &fs->inode_table[i];
+        walk[i] = inode->fname[0] != '\0' && inode->mdata.type <= FS_DIRECTORY;
+    }
+    bool success = walk[0] && INODE_IS_TYPE(&fs->inode_table[0], FS_DIRECTORY);
+    if(success) {
+        check_walk(check, walk);
+        success = !check->bad[0];
+    }
+
+    //down from root, whatever an entry in a live directory reaches is live
+    //entries that don't reach anything come out right there, not through dir_remove_entry,
+    //a name in the wrong bucket would never be found by hash
+    bool live[INODE_TOTAL] = {true};
+    inode_ptr_t queue[INODE_TOTAL] = {0};
+    size_t head = 0, tail = 1;
+    while(success && head < tail) {
+        const inode_ptr_t dir = queue[head++];
+        const inode_t *dir_inode = &fs->inode_table[dir];
+        block_ptr_t buckets[DIR_INDEX_SLOTS];
+        const size_t n_buckets = dir_entry_blocks(fs, dir_inode, buckets);
+        size_t removed = 0;
+        success = n_buckets != 0;
+        for(size_t b = 0; b < n_buckets && success; b++) {
+            dir_block_t bucket;
+            if(!(success = meta_read(fs, &bucket, buckets[b]))) {
+                break;
+            }
+            bool changed = false;
+            for(size_t e = 0; e < DIR_REC_MAX; e++) {
+                const inode_ptr_t child = bucket.entries[e].inode;
+                if(bucket.entries[e].fname[0] == '\0') {
+                    continue;
+                }
+                const bool is_dir = INODE_IS_TYPE(&fs->inode_table[child], FS_DIRECTORY);
+                if(child && walk[child] && !live[child] && !(is_dir && check->bad[child])) {
+                    live[child] = true;
+                    if(is_dir) {
+                        queue[tail++] = child;
+                    }
+                } else {
+                    memset(&bucket.entries[e], 0x00, sizeof(dir_ent_t));
+                    bucket.mdata.size -= bucket.mdata.size != 0;
+                    changed = true;
+                    removed++;
+                }
+            }
+            if(changed) {
+                success = meta_write(fs, &bucket, buckets[b]);
+            }
+        }
+        if(success && removed && (dir_inode->mdata.flags & INODE_DIR_INDEXED)) {
+            dir_index_t index;
+            success = meta_read(fs, &index, dir_inode->data_ptrs[0]);
+            index.mdata.size = index.mdata.size > removed ? index.mdata.size - removed : 0;
+            success = success && meta_write(fs, &index, dir_inode->data_ptrs[0]);
+        }
+    }
+
+    //anything that didn't get reached, or can't be trusted, changes what's in use
+    bool dropped = false;
+    for(size_t i = 1; i < INODE_TOTAL && success; i++) {
+        if(fs->inode_table[i].fname[0] != '\0' && !live[i]) {
+            success = clear_inode(fs, i);
+            dropped = true;
+        } else if(live[i] && check->bad[i]) {
+            //a regular file, a bad directory wouldn't be live. What's left is a new, empty file
+            inode_t emptied = fs->inode_table[i];
+            emptied.mdata.size = 0;
+            emptied.mdata.flags = (fs->inode_table[0].mdata.flags & INODE_EXTENTS) | INODE_INLINE;
+            memset(INODE_INLINE_DATA(&emptied), 0x00, INLINE_DATA_MAX);
+            success = write_inode(fs, &emptied, i);
+            dropped = true;
+        }
+    }
+    if(success && dropped) {
+        //blocks the dropped ones claimed shouldn't count, walk just the ones that are left
+        check_walk(check, live);
+        for(size_t i = 0; i < INODE_TOTAL; i++) {
+            success &= !check->bad[i];
+        }
+    }
+
+    if(success) {
+        //the inode table (and the log) aren't any file's, but they're not free either
+        for(size_t block = 0; block < DATA_BLOCK_OFFSET; block++) {
+            check->claimed[block >> 3] |= (uint8_t)(1U << (block & 0x07));
+        }
+        const size_t log_end = JOURNAL_BLOCK_OFFSET + (fs->journal ? JOURNAL_BLOCK_TOTAL : 0);
+        for(size_t block = JOURNAL_BLOCK_OFFSET; block < log_end; block++) {
+            check->claimed[block >> 3] |= (uint8_t)(1U << (block & 0x07));
+        }
+        pthread_mutex_lock(&fs->alloc_lock);
+        success = back_store_import_fbm(fs->bs, check->claimed);
+        pthread_mutex_unlock(&fs->alloc_lock);
+        success = success && (fs->journal ? journal_commit(fs) : flush_inode_table(fs) && back_store_flush(fs->bs));
+    }
+    free(check);
+    return success;
+}
@@ -3,56 +3,89 @@
 #include <string.h>
 #include <time.h>
 
-// Ok, less worse than a RMW, but it isn't very space efficient
-// One neat idea would be to make a shared buffer a global so both can use it
-// Since we're soooooo not thread safe anyway, it could save some space... kinda?
-// Maybe not since it would be a constant 1k being taken up as opposed to the occasional 1k
-// Hmm.
+// Borrows the block from back_store instead of copying the whole 1k out first
 bool partial_read(const S16FS_t *fs, void *data, const block_ptr_t block, const unsigned offset, const unsigned bytes) {
     if (fs && data && BLOCK_PTR_VALID(block) && offset < BLOCK_SIZE && bytes) {
-        data_block_t buffer;
-        if (back_store_read(fs->bs, block, &buffer)) {
-            memcpy(data, INCREMENT_VOID(&buffer, offset), bytes);
+        const void *mapped = back_store_map_block(fs->bs, block);
+        if (mapped) {
+            memcpy(data, INCREMENT_VOID(mapped, offset), bytes);
+            back_store_unmap_block(fs->bs, mapped);
             return true;
         }
     }
     return false;
 }
 
-// THE DREADED READ MODIFY WRITE. Avoid it at all costs. Generally. Unless it's just the one thing. That's cool.
+// No more dreaded read modify write, the block gets edited in place
 bool partial_write(S16FS_t *fs, const void *data, const block_ptr_t block, const unsigned offset,
                    const unsigned bytes) {
     if (fs && data && BLOCK_PTR_VALID(block) && offset < BLOCK_SIZE && bytes) {
         // if (bytes == 0) return true; // just in case my logic gets weird somewhere
         // but that won't "allow" ofset = 1024 and bytes = 0
         // Scratch that, return false. If it actually happens, it should be reported
-        data_block_t buffer;
-        if (back_store_read(fs->bs, block, &buffer)) {
-            memcpy(INCREMENT_VOID(&buffer, offset), data, bytes);
-            return back_store_write(fs->bs, block, &buffer);
+        void *mapped = back_store_map_block_mut(fs->bs, block);
+        if (mapped) {
+            memcpy(INCREMENT_VOID(mapped, offset), data, bytes);
+            back_store_unmap_block(fs->bs, mapped);
+            return true;
         }
     }
     return false;
 }
 
+// The inode table lives in memory, see flush_inode_table for how it gets back to disk
 bool read_inode(const S16FS_t *fs, void *data, const inode_ptr_t inode_number) {
     if (fs && data) {
-        inode_t buffer[INODES_PER_BOCK];
-        if (back_store_read(fs->bs, INODE_TO_BLOCK(inode_number), buffer)) {
-            memcpy(data, &buffer[INODE_INNER_IDX(inode_number)], sizeof(inode_t));
-            return true;
-        }
+        memcpy(data, &fs->inode_table[inode_number], sizeof(inode_t));
+        return true;
     }
     return false;
 }
 
+// Taking an inode and giving one back, inode_map and the free list together. table_lock held
+static void inode_take(S16FS_t *fs, const inode_ptr_t inode_number) {
+    if (!bitmap_test(fs->inode_map, inode_number)) {
+        bitmap_set(fs->inode_map, inode_number);
+        const inode_link_t link = fs->inode_links[inode_number];
+        if (link.prev == INODE_NONE) {
+            fs->inode_free = link.next;
+        } else {
+            fs->inode_links[link.prev].next = link.next;
+        }
+        if (link.next != INODE_NONE) {
+            fs->inode_links[link.next].prev = link.prev;
+        }
+        --fs->inode_free_count;
+    }
+}
+
+static void inode_give(S16FS_t *fs, const inode_ptr_t inode_number) {
+    if (bitmap_test(fs->inode_map, inode_number)) {
+        bitmap_reset(fs->inode_map, inode_number);
+        fs->inode_links[inode_number] = (inode_link_t){fs->inode_free, INODE_NONE};
+        if (fs->inode_free != INODE_NONE) {
+            fs->inode_links[fs->inode_free].prev = inode_number;
+        }
+        fs->inode_free = inode_number;
+        ++fs->inode_free_count;
+    }
+}
+
+// Callers own the inode (its write lock, or namespace_lock for one that isn't linked in yet)
+// table_lock is just for the bitmaps, and so a flush never sees half an inode
 bool write_inode(S16FS_t *fs, const void *data, const inode_ptr_t inode_number) {
     if (fs && data) {  // checking if the inode number is valid is a tautology :/
-        inode_t buffer[INODES_PER_BOCK];
-        if (back_store_read(fs->bs, INODE_TO_BLOCK(inode_number), buffer)) {
-            memcpy(&buffer[INODE_INNER_IDX(inode_number)], data, sizeof(inode_t));
-            return back_store_write(fs->bs, INODE_TO_BLOCK(inode_number), buffer);
+        pthread_mutex_lock(&fs->table_lock);
+        memcpy(&fs->inode_table[inode_number], data, sizeof(inode_t));
+        bitmap_set(fs->inode_dirty, inode_number);
+        // removal writes out a blanked inode, so this catches that too
+        if (((const inode_t *) data)->fname[0] != '\0') {
+            inode_take(fs, inode_number);
+        } else {
+            inode_give(fs, inode_number);
         }
+        pthread_mutex_unlock(&fs->table_lock);
+        return true;
     }
     return false;
 }
@@ -61,15 +94,33 @@ bool clear_inode(S16FS_t *fs, const inode_ptr_t inode_number) {
     // Just going to blank the first fname character.
     // Allows for easier post-mortem debugging than completely blanking it
     if (fs) {
-        inode_t buffer[INODES_PER_BOCK];
-        if (back_store_read(fs->bs, INODE_TO_BLOCK(inode_number), buffer)) {
-            buffer[INODE_INNER_IDX(inode_number)].fname[0] = '\0';
-            return back_store_write(fs->bs, INODE_TO_BLOCK(inode_number), buffer);
-        }
+        pthread_mutex_lock(&fs->table_lock);
+        fs->inode_table[inode_number].fname[0] = '\0';
+        bitmap_set(fs->inode_dirty, inode_number);
+        inode_give(fs, inode_number);
+        pthread_mutex_unlock(&fs->table_lock);
+        return true;
     }
     return false;
 }
 
+// Lays the free list out from inode_map, lowest free inode at the head
+// Only when nothing else can be using it (formatting, mounting)
+void inode_list_build(S16FS_t *fs) {
+    fs->inode_free       = INODE_NONE;
+    fs->inode_free_count = 0;
+    for (size_t i = INODE_TOTAL; i-- > 0;) {
+        if (!bitmap_test(fs->inode_map, i)) {
+            fs->inode_links[i] = (inode_link_t){fs->inode_free, INODE_NONE};
+            if (fs->inode_free != INODE_NONE) {
+                fs->inode_links[fs->inode_free].prev = (int16_t) i;
+            }
+            fs->inode_free = (int16_t) i;
+            ++fs->inode_free_count;
+        }
+    }
+}
+
 // might as well make versions that do whole blocks. Better encapsulation?
 // All calls are verified a bit more before happening, which is good.
 bool full_read(const S16FS_t *fs, void *data, const block_ptr_t block) {
@@ -88,9 +139,274 @@ bool full_write(S16FS_t *fs, const void *data, const block_ptr_t block) {
 }
 
 
-S16FS_t *ready_file(const char *path, const bool format) {
+// Metadata blocks (directories, indirect blocks, extent maps) go through these instead of full_read/full_write
+// Without a journal they're the same thing. With one, a block the running transaction changed
+// only exists as its image until the commit, so that's what has to be read
+static uint8_t *journal_image(const journal_t *journal, const block_ptr_t block) {
+    // slot_of gets set once the slot's ready, the acquire pairs with that
+    const uint16_t slot = __atomic_load_n(&journal->slot_of[block], __ATOMIC_ACQUIRE);
+    return slot ? journal->images[slot - 1] : NULL;
+}
+
+// Gets the block into the running transaction, starting its image off as a copy of what's on disk if load is set
+// NULL if the transaction is out of slots (or memory)
+static uint8_t *journal_claim(S16FS_t *fs, const block_ptr_t block, const bool load) {
+    journal_t *journal = fs->journal;
+    uint8_t *image     = journal_image(journal, block);
+    if (image) {
+        return image;
+    }
+    pthread_mutex_lock(&journal->lock);
+    if (journal->count < JOURNAL_SLOT_MAX) {
+        const size_t slot = journal->count;
+        if (!journal->images[slot]) {
+            journal->images[slot] = (uint8_t *) malloc(BLOCK_SIZE);
+        }
+        image = journal->images[slot];
+        // the caller owns the block, nobody else can be claiming it, the lock's just for the slot
+        if (image && (!load || back_store_read(fs->bs, block, image))) {
+            journal->homes[slot] = block;
+            ++journal->count;
+            if (journal->count >= JOURNAL_COMMIT_AT) {
+                // journal_leave peeks at this without the lock
+                __atomic_store_n(&journal->wanted, true, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&journal->slot_of[block], (uint16_t)(slot + 1), __ATOMIC_RELEASE);
+        } else {
+            image = NULL;
+        }
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return image;
+}
+
+bool meta_read(const S16FS_t *fs, void *data, const block_ptr_t block) {
+    if (fs && data && fs->journal) {
+        const uint8_t *image = journal_image(fs->journal, block);
+        if (image) {
+            memcpy(data, image, BLOCK_SIZE);
+            return true;
+        }
+    }
+    return full_read(fs, data, block);
+}
+
+bool meta_write(S16FS_t *fs, const void *data, const block_ptr_t block) {
+    if (fs && data && fs->journal) {
+        uint8_t *image = block >= DATA_BLOCK_OFFSET ? journal_claim(fs, block, false) : NULL;
+        if (image) {
+            memcpy(image, data, BLOCK_SIZE);
+        }
+        return image != NULL;
+    }
+    return full_write(fs, data, block);
+}
+
+// back_store_map_block, or the image if the transaction has one. Hand it back with meta_unmap
+const void *meta_map(const S16FS_t *fs, const block_ptr_t block) {
+    if (fs && fs->journal) {
+        const uint8_t *image = journal_image(fs->journal, block);
+        if (image) {
+            return image;
+        }
+    }
+    return fs ? back_store_map_block(fs->bs, block) : NULL;
+}
+
+// back_store_map_block_mut, but with a journal the block comes into the transaction and it's the image you get
+void *meta_map_mut(S16FS_t *fs, const block_ptr_t block) {
+    if (fs && fs->journal) {
+        return block >= DATA_BLOCK_OFFSET ? journal_claim(fs, block, true) : NULL;
+    }
+    return fs ? back_store_map_block_mut(fs->bs, block) : NULL;
+}
+
+// Nothing to do for an image, it stays where it is until the commit
+void meta_unmap(const S16FS_t *fs, const block_ptr_t block, const void *mapped) {
+    if (fs && mapped && (!fs->journal || journal_image(fs->journal, block) != mapped)) {
+        back_store_unmap_block(fs->bs, mapped);
+    }
+}
+
+// Gives blocks a file or directory was using back to back_store
+// With a journal they wait for the next commit instead. Until then the last commit is what a crash
+// goes back to, and it could still have them in use (a block handed out again now could get written over)
+void release_blocks(S16FS_t *fs, const block_ptr_t *blocks, const size_t count) {
+    if (fs && blocks && count) {
+        journal_t *journal = fs->journal;
+        if (!journal) {
+            pthread_mutex_lock(&fs->alloc_lock);
+            for (size_t i = 0; i < count; ++i) {
+                back_store_release(fs->bs, blocks[i]);
+            }
+            pthread_mutex_unlock(&fs->alloc_lock);
+            return;
+        }
+        pthread_mutex_lock(&journal->lock);
+        if (journal->free_count + count > journal->free_capacity) {
+            size_t capacity = journal->free_capacity ? journal->free_capacity : JOURNAL_FREES_AT;
+            while (capacity < journal->free_count + count) {
+                capacity <<= 1;
+            }
+            unsigned *frees = (unsigned *) realloc(journal->frees, capacity * sizeof(unsigned));
+            if (!frees) {
+                // leaking them beats handing them out early
+                pthread_mutex_unlock(&journal->lock);
+                return;
+            }
+            journal->frees         = frees;
+            journal->free_capacity = capacity;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (blocks[i] >= DATA_BLOCK_OFFSET && !bitmap_test(journal->freeing, blocks[i])) {
+                bitmap_set(journal->freeing, blocks[i]);
+                journal->frees[journal->free_count++] = blocks[i];
+            }
+        }
+        if (journal->free_count >= JOURNAL_FREES_AT) {
+            __atomic_store_n(&journal->wanted, true, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&journal->lock);
+    }
+}
+
+// Whole blocks to/from one contiguous buffer. Neighboring blocks get merged by back_store
+// so a file that's laid out in order is read in a few big chunks instead of 1k at a time
+bool full_readv_run(const S16FS_t *fs, void *data, const block_ptr_t *blocks, const size_t n_blocks) {
+    unsigned ids[VECTOR_MAX];
+    struct iovec iov[VECTOR_MAX];
+    for (size_t done = 0; done < n_blocks;) {
+        const size_t batch = (n_blocks - done) < VECTOR_MAX ? (n_blocks - done) : VECTOR_MAX;
+        for (size_t i = 0; i < batch; ++i) {
+            ids[i]          = blocks[done + i];
+            iov[i].iov_base = INCREMENT_VOID(data, (done + i) * BLOCK_SIZE);
+            iov[i].iov_len  = BLOCK_SIZE;
+        }
+        if (!back_store_readv(fs->bs, ids, iov, batch)) {
+            return false;
+        }
+        done += batch;
+    }
+    return true;
+}
+
+// Runs of back to back blocks are one vectored read each
+// Blocks on their own are submitted async instead, so a fragmented file has them all in flight at once
+// rather than waiting on each 1k read in turn
+// back_store's completions aren't per thread, so the whole submit/poll round holds async_lock
+bool full_readv(const S16FS_t *fs, void *data, const block_ptr_t *blocks, const size_t n_blocks) {
+    if (fs && data && blocks) {
+        pthread_mutex_t *async_lock = (pthread_mutex_t *) &fs->async_lock;
+        bool success                = true;
+        unsigned in_flight          = 0;
+        pthread_mutex_lock(async_lock);
+        for (size_t i = 0, run; i < n_blocks && success; i += run) {
+            run = 1;
+            while (i + run < n_blocks && blocks[i + run] == blocks[i] + run) {
+                ++run;
+            }
+            if (run > 1) {
+                success = full_readv_run(fs, INCREMENT_VOID(data, i * BLOCK_SIZE), &blocks[i], run);
+            } else if (back_store_submit_read(fs->bs, blocks[i], INCREMENT_VOID(data, i * BLOCK_SIZE), i)) {
+                ++in_flight;
+            } else {
+                // queue's full (or the block's bad, and this will say so)
+                success = full_read(fs, INCREMENT_VOID(data, i * BLOCK_SIZE), blocks[i]);
+            }
+        }
+        // everything submitted has to land before the buffer goes back to the caller, even on failure
+        back_store_completion_t done[VECTOR_MAX];
+        while (in_flight) {
+            const unsigned polled = back_store_poll(fs->bs, done, VECTOR_MAX, true);
+            if (!polled) {
+                success = false;
+                break;
+            }
+            for (unsigned i = 0; i < polled; ++i) {
+                success &= done[i].success;
+            }
+            in_flight -= polled;
+        }
+        pthread_mutex_unlock(async_lock);
+        return success;
+    }
+    return false;
+}
+
+// One extent, n_blocks starting at start, straight into one buffer
+// Same as full_readv_run without needing an array of ptrs that just count up
+bool full_read_extent(const S16FS_t *fs, void *data, const block_ptr_t start, const size_t n_blocks) {
+    if (fs && data) {
+        unsigned ids[VECTOR_MAX];
+        struct iovec iov[VECTOR_MAX];
+        for (size_t done = 0; done < n_blocks;) {
+            const size_t batch = (n_blocks - done) < VECTOR_MAX ? (n_blocks - done) : VECTOR_MAX;
+            for (size_t i = 0; i < batch; ++i) {
+                ids[i]          = start + done + i;
+                iov[i].iov_base = INCREMENT_VOID(data, (done + i) * BLOCK_SIZE);
+                iov[i].iov_len  = BLOCK_SIZE;
+            }
+            if (!back_store_readv(fs->bs, ids, iov, batch)) {
+                return false;
+            }
+            done += batch;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool full_writev(S16FS_t *fs, const void *data, const block_ptr_t *blocks, const size_t n_blocks) {
+    if (fs && data && blocks) {
+        unsigned ids[VECTOR_MAX];
+        struct iovec iov[VECTOR_MAX];
+        for (size_t done = 0; done < n_blocks;) {
+            const size_t batch = (n_blocks - done) < VECTOR_MAX ? (n_blocks - done) : VECTOR_MAX;
+            for (size_t i = 0; i < batch; ++i) {
+                if (blocks[done + i] < DATA_BLOCK_OFFSET) {
+                    return false;  // same as full_write, no bulk writes to the inode table
+                }
+                ids[i]          = blocks[done + i];
+                iov[i].iov_base = (void *) INCREMENT_VOID(data, (done + i) * BLOCK_SIZE);
+                iov[i].iov_len  = BLOCK_SIZE;
+            }
+            if (!back_store_writev(fs->bs, ids, iov, batch)) {
+                return false;
+            }
+            done += batch;
+        }
+        return true;
+    }
+    return false;
+}
+
+S16FS_t *ready_file(const char *path, const bool format, const layout_t layout, const bool journaled) {
     S16FS_t *fs = (S16FS_t *) malloc(sizeof(S16FS_t));
     if (fs) {
+        // write_inode keeps these up to date, so they have to exist before formatting writes root
+        fs->inode_map    = bitmap_create(INODE_TOTAL);
+        fs->inode_dirty  = bitmap_create(INODE_TOTAL);
+        fs->dentry_cache = (dentry_cache_t *) calloc(1, sizeof(dentry_cache_t));
+        if (!fs->inode_map || !fs->inode_dirty || !fs->dentry_cache) {
+            bitmap_destroy(fs->inode_map);
+            bitmap_destroy(fs->inode_dirty);
+            free(fs->dentry_cache);
+            free(fs);
+            return NULL;
+        }
+        inode_list_build(fs);
+        // Default attributes everywhere, none of these can fail then
+        fs->journal = NULL;
+        pthread_rwlock_init(&fs->journal_lock, NULL);
+        pthread_rwlock_init(&fs->namespace_lock, NULL);
+        for (size_t i = 0; i < INODE_TOTAL; ++i) {
+            pthread_rwlock_init(&fs->inode_locks[i], NULL);
+        }
+        pthread_mutex_init(&fs->fd_table.status_lock, NULL);
+        pthread_mutex_init(&fs->table_lock, NULL);
+        pthread_mutex_init(&fs->alloc_lock, NULL);
+        pthread_mutex_init(&fs->async_lock, NULL);
+        pthread_mutex_init(&fs->dentry_cache->lock, NULL);
         if (format) {
             // get inode table
             // format root
@@ -100,23 +416,36 @@ S16FS_t *ready_file(const char *path, const bool format) {
             fs->bs = back_store_create(path);
             if (fs->bs) {
                 bool valid = true;
-                // + 1 to snag the root dir block because lazy
-                for (int i = INODE_BLOCK_OFFSET; i < (DATA_BLOCK_OFFSET + 1) && valid; ++i) {
-                    valid &= back_store_request(fs->bs, i);
+                // + 1 to snag the root dir block because lazy, and the log right after it if there is one
+                const int reserved = DATA_BLOCK_OFFSET + 1 + (journaled ? JOURNAL_BLOCK_TOTAL : 0);
+                for (int i = INODE_BLOCK_OFFSET; i < reserved && valid; ++i) {
+                    valid &= back_store_request(fs->bs, i);  // nobody else has this fs yet, no alloc_lock
                 }
                 // inode table is already blanked because back_store blanks all data (woo)
+                // so the copy in memory starts out blank too
+                memset(fs->inode_table, 0x00, sizeof(fs->inode_table));
                 if (valid) {
                     // I'm actually not sure how to do this
                     // It's going to look like a mess
                     uint32_t right_now = time(NULL);
-                    inode_t root_inode = {"/",
-                                          {0, 0777, right_now, right_now, right_now, 0, FS_DIRECTORY, {0}},
-                                          {DATA_BLOCK_OFFSET, 0, 0, 0, 0, 0, 0, 0}};
+                    // root's flags are where the layout gets saved (and whether there's a journal)
+                    const uint8_t flags =
+                        (layout == FS_LAYOUT_EXTENTS ? INODE_EXTENTS : 0) | (journaled ? INODE_JOURNALED : 0);
+                    inode_t root_inode  = {"/",
+                                           {0, 0777, right_now, right_now, right_now, 0, FS_DIRECTORY, flags, {0}},
+                                           {DATA_BLOCK_OFFSET, 0, 0, 0, 0, 0, 0, 0}};
                     // fname technically invalid, but it's root so deal
                     // mdata actually might not be used in a dir record. Idk.
                     // block pointer set, rest are invalid
                     // break point HERE to make sure that constructed right
-                    valid &= write_inode(fs, &root_inode, 0);
+                    // superblock goes in root's padding, and it's mounted, so not clean
+                    const superblock_t super = {SUPERBLOCK_MAGIC, false, 0, 0, 0};
+                    memcpy(root_inode.mdata.padding, &super, sizeof(super));
+                    // the log's blank too, so there's nothing to replay
+                    valid &= write_inode(fs, &root_inode, 0) && flush_inode_table(fs);
+                    if (valid && journaled) {
+                        valid = (fs->journal = journal_create()) != NULL;
+                    }
                 }
                 if (!valid) {
                     // weeeeeeeh
@@ -127,19 +456,69 @@ S16FS_t *ready_file(const char *path, const bool format) {
         } else {
             fs->bs = back_store_open(path);
             // ... that's it?
+            // Well, that and figuring out which inodes are taken
+            // And making sure it's a back_store in our geometry, everything here is 1k blocks and 16 bit ptrs
+            if (fs->bs && (back_store_block_size(fs->bs) != BLOCK_SIZE
+                           || back_store_block_count(fs->bs) != DATA_BLOCK_MAX || !load_inode_table(fs))) {
+                back_store_close(fs->bs);
+                fs->bs = NULL;
+            }
+            // A journaled fs might have crashed with a commit that didn't all make it home
+            if (fs->bs && (fs->inode_table[0].mdata.flags & INODE_JOURNALED)
+                && (!(fs->journal = journal_create()) || !journal_replay(fs) || !load_inode_table(fs))) {
+                back_store_close(fs->bs);
+                fs->bs = NULL;
+            }
+            // Anything but a clean unmount could have leaked blocks or left entries pointing at nothing
+            // A clean one whose inode count is off got changed after it unmounted, so that's no good either
+            // Either way it's not clean again until the next fs_unmount
+            if (fs->bs) {
+                superblock_t super;
+                superblock_read(fs, &super);
+                const bool trusted =
+                    super.magic == SUPERBLOCK_MAGIC && super.clean && super.free_inodes == fs->inode_free_count;
+                if (!(trusted || check_fs(fs)) || !superblock_write(fs, false)) {
+                    back_store_close(fs->bs);
+                    fs->bs = NULL;
+                }
+            }
         }
         if (fs->bs) {
-            fs->fd_table.fd_status = bitmap_create(DESCRIPTOR_MAX);
-            // Eh, won't bother blanking out tables, since that's the point of the bitmap
-            if (fs->fd_table.fd_status) {
-                return fs;
-            }
+            fs->readahead    = (readahead_limits_t){READAHEAD_MIN, READAHEAD_MAX, 0};
+            fs->extent_files = fs->inode_table[0].mdata.flags & INODE_EXTENTS;
+            // No descriptors yet, fs_open allocates chunks as it goes
+            memset(fs->fd_table.chunks, 0x00, sizeof(fs->fd_table.chunks));
+            memset(fs->fd_table.inode_fds, 0xFF, sizeof(fs->fd_table.inode_fds));  // FD_NONE all over
+            fs->fd_table.free   = FD_NONE;
+            fs->fd_table.unused = 0;
+            return fs;
         }
+        journal_destroy(fs->journal);
+        destroy_locks(fs);
+        bitmap_destroy(fs->inode_map);
+        bitmap_destroy(fs->inode_dirty);
+        free(fs->dentry_cache);
         free(fs);
     }
     return NULL;
 }
 
+// Everything ready_file set up, for unmount (or ready_file failing)
+void destroy_locks(S16FS_t *fs) {
+    if (fs) {
+        pthread_rwlock_destroy(&fs->journal_lock);
+        pthread_rwlock_destroy(&fs->namespace_lock);
+        for (size_t i = 0; i < INODE_TOTAL; ++i) {
+            pthread_rwlock_destroy(&fs->inode_locks[i]);
+        }
+        pthread_mutex_destroy(&fs->fd_table.status_lock);
+        pthread_mutex_destroy(&fs->table_lock);
+        pthread_mutex_destroy(&fs->alloc_lock);
+        pthread_mutex_destroy(&fs->async_lock);
+        pthread_mutex_destroy(&fs->dentry_cache->lock);
+    }
+}
+
 /*
 hunts down the requested file, if it exists, filling out all sorts of little bits of data
 
@@ -184,7 +563,12 @@ void locate_file(const S16FS_t *const fs, const char *abs_path, result_t *res) {
                         res->data = (void *) (abs_path + (token - path_copy));
 
                         // Cool. Does the next token exist in the current directory?
-                        scan_directory(fs, token, scan_results.inode, &scan_results);
+                        // Ask the dentry cache first, only go to the directory block if it hasn't seen it
+                        const inode_ptr_t dir_inode = scan_results.inode;
+                        if (!dentry_lookup(fs, token, dir_inode, &scan_results)) {
+                            scan_directory(fs, token, dir_inode, &scan_results);
+                            dentry_insert(fs, token, dir_inode, &scan_results);
+                        }
 
                         if (scan_results.success && scan_results.found) {
                             // Good. It existed. Cycle.
@@ -198,8 +582,13 @@ void locate_file(const S16FS_t *const fs, const char *abs_path, result_t *res) {
                         break;
                     }
                     if (res->found) {
+                        // could be a file someone's writing to
+                        pthread_rwlock_t *inode_lock = (pthread_rwlock_t *) &fs->inode_locks[res->inode];
                         inode_t found_file;
-                        if (read_inode(fs, &found_file, res->inode)) {
+                        pthread_rwlock_rdlock(inode_lock);
+                        const bool read = read_inode(fs, &found_file, res->inode);
+                        pthread_rwlock_unlock(inode_lock);
+                        if (read) {
                             res->type = found_file.mdata.type;
                             if (res->type == FS_DIRECTORY) {
                                 res->block = found_file.data_ptrs[0];
@@ -227,7 +616,7 @@ typedef struct {
     bool valid; - Was the filename valid?
     inode_ptr_t inode; - IF FOUND: inode of file
     inode_ptr_t parent; - IF SUCCESS: Literally the inode number you fed us
-    block_ptr_t block; - IF SUCCESS: Data block of directory.
+    block_ptr_t block; - IF SUCCESS: Data block of directory (its index, if it's indexed).
                             Shouldn't never need it, but we know it, so we'll share
     file_t type; - IF FOUND: type of the file found
     uint64_t total; - IF SUCCESS: Number of files in the given directory
@@ -240,12 +629,12 @@ void scan_directory(const S16FS_t *const fs, const char *fname, const inode_ptr_
         if (fs && fname) {
             // inode number is always valid - tbh, that may mask errors and could be considered bad
             inode_t dir_inode;
-            dir_block_t dir_data;
+            const dir_block_t *first_block;
             if (read_inode(fs, &dir_inode, inode) && INODE_IS_TYPE(&dir_inode, FS_DIRECTORY)
-                && full_read(fs, &dir_data, dir_inode.data_ptrs[0])) {
+                && (first_block = (const dir_block_t *) meta_map(fs, dir_inode.data_ptrs[0]))) {
                 res->success = true;
                 res->block   = dir_inode.data_ptrs[0];
-                res->total   = dir_data.mdata.size;
+                res->total   = first_block->mdata.size;
                 res->parent  = inode;
                 // let's validate the fname
                 const size_t fname_len = strnlen(fname, FS_FNAME_MAX);
@@ -253,37 +642,585 @@ void scan_directory(const S16FS_t *const fs, const char *fname, const inode_ptr_
                     // Alrighty, we got the inode and block read in.
                     // fname is vaguely validated
                     res->valid = true;
-                    for (unsigned i = 0; i < DIR_REC_MAX; ++i) {
-                        if (strncmp(fname, dir_data.entries[i].fname, FS_FNAME_MAX) == 0) {
-                            // found it!
-                            res->found = true;
-                            res->inode = dir_data.entries[i].inode;
-                            return;
+                    // If it's indexed, the first block just says which bucket to look in
+                    const dir_block_t *dir_data = first_block;
+                    block_ptr_t bucket_ptr      = dir_inode.data_ptrs[0];
+                    if (dir_inode.mdata.flags & INODE_DIR_INDEXED) {
+                        const dir_index_t *index = (const dir_index_t *) first_block;
+                        bucket_ptr               = index->buckets[DIR_INDEX_SLOT(fname_hash(fname), index->depth)];
+                        dir_data                 = (const dir_block_t *) meta_map(fs, bucket_ptr);
+                    }
+                    if (dir_data) {
+                        for (unsigned i = 0; i < DIR_REC_MAX; ++i) {
+                            if (strncmp(fname, dir_data->entries[i].fname, FS_FNAME_MAX) == 0) {
+                                // found it!
+                                res->found = true;
+                                res->inode = dir_data->entries[i].inode;
+                                break;
+                            }
                         }
+                        if (dir_data != first_block) {
+                            meta_unmap(fs, bucket_ptr, dir_data);
+                        }
+                    } else {
+                        res->success = false;
                     }
                 }
+                meta_unmap(fs, dir_inode.data_ptrs[0], first_block);
             }
         }
     }
 }
 
-// Just what it sounds like. 0 on error
-inode_ptr_t find_free_inode(const S16FS_t *const fs) {
-    if (fs) {
-        inode_t inode_block[INODES_PER_BOCK];
-        inode_ptr_t free_inode = 0;
-        for (unsigned blk = INODE_BLOCK_OFFSET; blk < DATA_BLOCK_OFFSET; ++blk) {
-            if (full_read(fs, &inode_block, blk)) {
-                for (unsigned i = 0; i < INODES_PER_BOCK; ++i, ++free_inode) {
-                    if (inode_block[i].fname[0] == '\0') {
-                        return free_inode;
-                        // potentially a conversion warning because integer truncation/depromotion
+// FNV-1a over a name
+// Directory indexes file entries by this, so it's part of the disk format now. Don't touch it
+uint32_t fname_hash(const char *fname) {
+    uint32_t hash = 2166136261U;
+    for (unsigned i = 0; i < FS_FNAME_MAX && fname[i]; ++i) {
+        hash = (hash ^ (uint8_t) fname[i]) * 16777619U;
+    }
+    return hash;
+}
+
+// The name's hash with the parent folded in, masked down to a slot
+static size_t dentry_slot(const char *fname, const inode_ptr_t parent) {
+    return (fname_hash(fname) ^ parent * 2654435761U) & (DENTRY_CACHE_SIZE - 1);
+}
+
+// Fills res like scan_directory would (minus block and total, locate_file doesn't need them)
+// Returns false on a miss, res is left alone then
+// The parent gets checked against the inode table, in case its inode went and got reused for a file
+bool dentry_lookup(const S16FS_t *const fs, const char *fname, const inode_ptr_t parent, result_t *res) {
+    bool hit = false;
+    if (fs && fname && res && INODE_IS_TYPE(&fs->inode_table[parent], FS_DIRECTORY)) {
+        pthread_mutex_lock(&fs->dentry_cache->lock);
+        const dentry_t *entry = &fs->dentry_cache->entries[dentry_slot(fname, parent)];
+        if (entry->used && entry->parent == parent && strncmp(fname, entry->fname, FS_FNAME_MAX) == 0) {
+            memset(res, 0x00, sizeof(result_t));
+            res->success = true;
+            res->valid   = true;
+            res->found   = entry->found;
+            res->inode   = entry->inode;
+            res->parent  = parent;
+            ++fs->dentry_cache->hits;
+            hit = true;
+        } else {
+            ++fs->dentry_cache->misses;
+        }
+        pthread_mutex_unlock(&fs->dentry_cache->lock);
+    }
+    return hit;
+}
+
+// Remembers a scan_directory result. Only good scans get in, positive or negative
+void dentry_insert(const S16FS_t *const fs, const char *fname, const inode_ptr_t parent, const result_t *res) {
+    if (fs && fname && res && res->success && res->valid) {
+        pthread_mutex_lock(&fs->dentry_cache->lock);
+        dentry_t *entry = &fs->dentry_cache->entries[dentry_slot(fname, parent)];
+        strncpy(entry->fname, fname, FS_FNAME_MAX);
+        entry->parent = parent;
+        entry->inode  = res->found ? res->inode : 0;
+        entry->found  = res->found;
+        entry->used   = true;
+        pthread_mutex_unlock(&fs->dentry_cache->lock);
+    }
+}
+
+// Anything that adds or drops a directory entry has to call this for that name
+void dentry_invalidate(const S16FS_t *const fs, const char *fname, const inode_ptr_t parent) {
+    if (fs && fname) {
+        pthread_mutex_lock(&fs->dentry_cache->lock);
+        dentry_t *entry = &fs->dentry_cache->entries[dentry_slot(fname, parent)];
+        if (entry->used && entry->parent == parent && strncmp(fname, entry->fname, FS_FNAME_MAX) == 0) {
+            entry->used = false;
+        }
+        pthread_mutex_unlock(&fs->dentry_cache->lock);
+    }
+}
+
+// Drops an entry into the first empty spot of a directory block that has one
+static void dir_block_insert(dir_block_t *dir, const char *fname, const inode_ptr_t entry_inode) {
+    unsigned i = 0;
+    for (; dir->entries[i].fname[0] != '\0'; ++i) {
+    }
+    strncpy(dir->entries[i].fname, fname, FS_FNAME_MAX);
+    dir->entries[i].inode = entry_inode;
+    ++dir->mdata.size;
+}
+
+// Turns a directory with one full block into an indexed one
+// The index starts at depth 0, its one slot pointing at the old block, so the next split is what spreads it out
+static bool index_directory(S16FS_t *fs, const inode_ptr_t dir_inode_ptr, inode_t *dir_inode, const dir_block_t *dir) {
+    pthread_mutex_lock(&fs->alloc_lock);
+    const block_ptr_t index_ptr = back_store_allocate_near(fs->bs, dir_inode->data_ptrs[0]);
+    pthread_mutex_unlock(&fs->alloc_lock);
+    if (index_ptr) {
+        dir_index_t index;
+        memset(&index, 0x00, sizeof(dir_index_t));
+        index.mdata.size = dir->mdata.size;
+        index.buckets[0] = dir_inode->data_ptrs[0];
+        dir_inode->data_ptrs[0] = index_ptr;
+        dir_inode->mdata.flags |= INODE_DIR_INDEXED;
+        // index goes out first, the inode is what makes it real
+        if (meta_write(fs, &index, index_ptr) && write_inode(fs, dir_inode, dir_inode_ptr)) {
+            return true;
+        }
+        release_blocks(fs, &index_ptr, 1);
+    }
+    return false;
+}
+
+// Splits a full bucket on its next hash bit, half the slots that pointed at it go to a new bucket
+// Doubles the index first if the bucket's already using every bit the index is
+// false if the index is maxed out (15 names that agree on all 8 bits, unlucky) or there's no block for it
+static bool split_dir_bucket(S16FS_t *fs, const block_ptr_t index_ptr, dir_index_t *index,
+                             const block_ptr_t bucket_ptr, dir_block_t *bucket) {
+    if (bucket->depth == index->depth) {
+        if (index->depth == DIR_INDEX_DEPTH_MAX) {
+            return false;
+        }
+        const unsigned in_use = 1U << index->depth;
+        memcpy(index->buckets + in_use, index->buckets, in_use * sizeof(block_ptr_t));
+        ++index->depth;
+    }
+    pthread_mutex_lock(&fs->alloc_lock);
+    const block_ptr_t new_ptr = back_store_allocate_near(fs->bs, bucket_ptr);
+    pthread_mutex_unlock(&fs->alloc_lock);
+    if (new_ptr) {
+        dir_block_t new_bucket;
+        memset(&new_bucket, 0x00, sizeof(dir_block_t));
+        const uint32_t bit = 1U << bucket->depth;
+        new_bucket.depth   = ++bucket->depth;
+        for (unsigned i = 0; i < DIR_REC_MAX; ++i) {
+            if (bucket->entries[i].fname[0] != '\0' && (fname_hash(bucket->entries[i].fname) & bit)) {
+                new_bucket.entries[new_bucket.mdata.size++] = bucket->entries[i];
+                memset(&bucket->entries[i], 0x00, sizeof(dir_ent_t));
+                --bucket->mdata.size;
+            }
+        }
+        for (unsigned slot = 0; slot < (1U << index->depth); ++slot) {
+            if (index->buckets[slot] == bucket_ptr && (slot & bit)) {
+                index->buckets[slot] = new_ptr;
+            }
+        }
+        // New bucket, then the index pointing at it, then the old bucket losing its copies
+        // Dying in the middle leaves duplicates instead of losing anything
+        if (meta_write(fs, &new_bucket, new_ptr) && meta_write(fs, index, index_ptr)
+            && meta_write(fs, bucket, bucket_ptr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds an entry to a directory, indexing it when its one block fills and splitting buckets after that
+// Doesn't look for the name already being there, callers already did that
+// false if the name's bad, the directory can't take any more, or there's no block for it to grow into
+bool dir_add_entry(S16FS_t *fs, const inode_ptr_t dir_inode_ptr, const char *fname, const inode_ptr_t entry_inode) {
+    if (fs && fname) {
+        const size_t fname_len = strnlen(fname, FS_FNAME_MAX);
+        inode_t dir_inode;
+        dir_block_t bucket;
+        if (fname_len == 0 || fname_len >= FS_FNAME_MAX || !read_inode(fs, &dir_inode, dir_inode_ptr)
+            || !INODE_IS_TYPE(&dir_inode, FS_DIRECTORY)) {
+            return false;
+        }
+        if (!(dir_inode.mdata.flags & INODE_DIR_INDEXED)) {
+            if (!meta_read(fs, &bucket, dir_inode.data_ptrs[0])) {
+                return false;
+            }
+            if (bucket.mdata.size < DIR_REC_MAX) {
+                dir_block_insert(&bucket, fname, entry_inode);
+                return meta_write(fs, &bucket, dir_inode.data_ptrs[0]);
+            }
+            if (!index_directory(fs, dir_inode_ptr, &dir_inode, &bucket)) {
+                return false;
+            }
+        }
+        dir_index_t index;
+        if (!meta_read(fs, &index, dir_inode.data_ptrs[0])) {
+            return false;
+        }
+        const uint32_t hash = fname_hash(fname);
+        while (true) {
+            const block_ptr_t bucket_ptr = index.buckets[DIR_INDEX_SLOT(hash, index.depth)];
+            if (!meta_read(fs, &bucket, bucket_ptr)) {
+                return false;
+            }
+            if (bucket.mdata.size < DIR_REC_MAX) {
+                dir_block_insert(&bucket, fname, entry_inode);
+                ++index.mdata.size;
+                return meta_write(fs, &bucket, bucket_ptr) && meta_write(fs, &index, dir_inode.data_ptrs[0]);
+            }
+            // might take more than one if everything in it went the same way
+            if (!split_dir_bucket(fs, dir_inode.data_ptrs[0], &index, bucket_ptr, &bucket)) {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+// Takes an entry out of a directory
+// Indexes never shrink back down, an emptied bucket just stays where it is for the next names that hash there
+bool dir_remove_entry(S16FS_t *fs, const inode_ptr_t dir_inode_ptr, const char *fname) {
+    if (fs && fname) {
+        inode_t dir_inode;
+        dir_index_t index;
+        dir_block_t bucket;
+        if (!read_inode(fs, &dir_inode, dir_inode_ptr) || !INODE_IS_TYPE(&dir_inode, FS_DIRECTORY)) {
+            return false;
+        }
+        const bool indexed     = dir_inode.mdata.flags & INODE_DIR_INDEXED;
+        block_ptr_t bucket_ptr = dir_inode.data_ptrs[0];
+        if (indexed) {
+            if (!meta_read(fs, &index, dir_inode.data_ptrs[0])) {
+                return false;
+            }
+            bucket_ptr = index.buckets[DIR_INDEX_SLOT(fname_hash(fname), index.depth)];
+        }
+        if (meta_read(fs, &bucket, bucket_ptr)) {
+            for (unsigned i = 0; i < DIR_REC_MAX; ++i) {
+                if (strncmp(fname, bucket.entries[i].fname, FS_FNAME_MAX) == 0) {
+                    memset(&bucket.entries[i], 0x00, sizeof(dir_ent_t));
+                    --bucket.mdata.size;
+                    if (indexed) {
+                        --index.mdata.size;
+                    }
+                    return meta_write(fs, &bucket, bucket_ptr)
+                           && (!indexed || meta_write(fs, &index, dir_inode.data_ptrs[0]));
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Every block holding a directory's entries, each once. Needs room for DIR_INDEX_SLOTS
+// Slots sharing a bucket are the same mod 2^(bucket's depth), so a slot's bucket is new
+// unless dropping the slot's top bit lands on the same one
+// Returns how many, 0 on error
+size_t dir_entry_blocks(const S16FS_t *fs, const inode_t *dir_inode, block_ptr_t *blocks) {
+    if (fs && dir_inode && blocks && INODE_IS_TYPE(dir_inode, FS_DIRECTORY)) {
+        if (!(dir_inode->mdata.flags & INODE_DIR_INDEXED)) {
+            blocks[0] = dir_inode->data_ptrs[0];
+            return 1;
+        }
+        dir_index_t index;
+        if (meta_read(fs, &index, dir_inode->data_ptrs[0])) {
+            size_t count    = 0;
+            blocks[count++] = index.buckets[0];
+            for (unsigned top = 1; top < (1U << index.depth); top <<= 1) {
+                for (unsigned slot = top; slot < (top << 1); ++slot) {
+                    if (index.buckets[slot] != index.buckets[slot - top]) {
+                        blocks[count++] = index.buckets[slot];
                     }
                 }
-            } else {
-                return 0;  // :/
             }
+            return count;
+        }
+    }
+    return 0;
+}
+
+// Just what it sounds like, the head of the free list. 0 on error
+// Root is always in use, so 0 can't be on the list
+// It stays free until it's written, creates are one at a time under namespace_lock so nobody else gets it
+inode_ptr_t find_free_inode(const S16FS_t *const fs) {
+    if (fs) {
+        pthread_mutex_t *table_lock = (pthread_mutex_t *) &fs->table_lock;
+        pthread_mutex_lock(table_lock);
+        const int16_t free_inode = fs->inode_free;
+        pthread_mutex_unlock(table_lock);
+        if (free_inode != INODE_NONE) {
+            return (inode_ptr_t) free_inode;
         }
     }
     return 0;
 }
+
+// Reads the whole inode table in at mount (it's contiguous, so it's one vectored read)
+// and marks every inode with a name as taken (and every other one free, a journal replay loads it twice)
+bool load_inode_table(S16FS_t *fs) {
+    if (fs) {
+        block_ptr_t inode_blocks[INODE_BLOCK_TOTAL];
+        for (unsigned i = 0; i < INODE_BLOCK_TOTAL; ++i) {
+            inode_blocks[i] = INODE_BLOCK_OFFSET + i;
+        }
+        if (!full_readv_run(fs, fs->inode_table, inode_blocks, INODE_BLOCK_TOTAL)) {
+            return false;
+        }
+        for (size_t inode_number = 0; inode_number < INODE_TOTAL; ++inode_number) {
+            if (fs->inode_table[inode_number].fname[0] != '\0') {
+                bitmap_set(fs->inode_map, inode_number);
+            } else {
+                bitmap_reset(fs->inode_map, inode_number);
+            }
+        }
+        inode_list_build(fs);
+        return true;
+    }
+    return false;
+}
+
+// Writes back every inode block with a changed inode in it
+// The table in memory is the real copy, so it's a straight block write, no read-modify-write
+// Holds table_lock the whole way, write_inode can't be halfway through an inode we're writing out
+bool flush_inode_table(S16FS_t *fs) {
+    if (fs) {
+        bool success = true;
+        pthread_mutex_lock(&fs->table_lock);
+        for (unsigned blk = 0; blk < INODE_BLOCK_TOTAL && success; ++blk) {
+            bool dirty = false;
+            for (unsigned i = 0; i < INODES_PER_BOCK; ++i) {
+                dirty |= bitmap_test(fs->inode_dirty, blk * INODES_PER_BOCK + i);
+            }
+            if (dirty) {
+                // full_write won't touch the inode table on purpose, so straight to back_store
+                if (!back_store_write(fs->bs, INODE_BLOCK_OFFSET + blk, &fs->inode_table[blk * INODES_PER_BOCK])) {
+                    success = false;
+                    break;
+                }
+                for (unsigned i = 0; i < INODES_PER_BOCK; ++i) {
+                    bitmap_reset(fs->inode_dirty, blk * INODES_PER_BOCK + i);
+                }
+            }
+        }
+        pthread_mutex_unlock(&fs->table_lock);
+        return success;
+    }
+    return false;
+}
+
+void superblock_read(const S16FS_t *fs, superblock_t *super) {
+    memcpy(super, fs->inode_table[0].mdata.padding, sizeof(superblock_t));
+}
+
+// Saves the superblock straight to root's inode block, around the journal (there's nothing else in flight
+// at mount and unmount, the only times this happens). Everything else gets flushed out first, so clean
+// can't land before what it's vouching for. Clean takes the counts too, export + popcount, it's just 8k
+bool superblock_write(S16FS_t *fs, const bool clean) {
+    superblock_t super;
+    superblock_read(fs, &super);
+    super.magic = SUPERBLOCK_MAGIC;
+    super.clean = clean;
+    if (clean) {
+        uint64_t fbm[DATA_BLOCK_MAX / 64];
+        pthread_mutex_lock(&fs->alloc_lock);
+        const bool exported = back_store_export_fbm(fs->bs, fbm);
+        pthread_mutex_unlock(&fs->alloc_lock);
+        if (!exported) {
+            return false;
+        }
+        super.free_blocks = DATA_BLOCK_MAX;
+        for (size_t i = 0; i < DATA_BLOCK_MAX / 64; ++i) {
+            super.free_blocks -= __builtin_popcountll(fbm[i]);
+        }
+        pthread_mutex_lock(&fs->table_lock);
+        super.free_inodes = fs->inode_free_count;
+        pthread_mutex_unlock(&fs->table_lock);
+    }
+    pthread_mutex_lock(&fs->table_lock);
+    memcpy(fs->inode_table[0].mdata.padding, &super, sizeof(super));
+    pthread_mutex_unlock(&fs->table_lock);
+    return back_store_flush(fs->bs) && back_store_write(fs->bs, INODE_BLOCK_OFFSET, &fs->inode_table[0])
+           && back_store_flush(fs->bs);
+}
+
+journal_t *journal_create(void) {
+    journal_t *journal = (journal_t *) calloc(1, sizeof(journal_t));
+    if (journal) {
+        journal->freeing = bitmap_create(DATA_BLOCK_MAX);
+        if (journal->freeing) {
+            pthread_mutex_init(&journal->lock, NULL);
+            return journal;
+        }
+        free(journal);
+    }
+    return NULL;
+}
+
+void journal_destroy(journal_t *journal) {
+    if (journal) {
+        for (size_t i = 0; i < JOURNAL_SLOT_MAX && journal->images[i]; ++i) {
+            free(journal->images[i]);
+        }
+        free(journal->frees);
+        bitmap_destroy(journal->freeing);
+        pthread_mutex_destroy(&journal->lock);
+        free(journal);
+    }
+}
+
+// 64 bits at a time version of FNV-1a, bytes has to be a multiple of 8
+static uint64_t journal_checksum(uint64_t hash, const void *data, const size_t bytes) {
+    for (size_t i = 0; i < bytes; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, INCREMENT_VOID(data, i), sizeof(word));
+        hash = (hash ^ word) * UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+// Commits the running transaction: dirty inode table blocks, every block image, and the free block map
+// (with the transaction's frees already taken out) go to the log in one write, then home
+// Then the frees go back to back_store, and the log gets marked empty
+// Needs journal_lock held for writing, nothing else can be in the middle of changing metadata
+// Doubles as the flush for fs_sync/unmount, back_store_flush gets everything else out on the way
+// A transaction too big for the log (JOURNAL_IMAGE_MAX) goes straight home instead, same as an fs without one
+bool journal_commit(S16FS_t *fs) {
+    if (!fs || !fs->journal) {
+        return false;
+    }
+    journal_t *journal = fs->journal;
+    // blocks going home, and where their data is
+    static const size_t home_max = INODE_BLOCK_TOTAL + JOURNAL_SLOT_MAX;
+    block_ptr_t *homes           = (block_ptr_t *) malloc(home_max * sizeof(block_ptr_t));
+    const void **images          = (const void **) malloc(home_max * sizeof(void *));
+    if (!homes || !images) {
+        free(homes);
+        free(images);
+        return false;
+    }
+    size_t count = 0;
+    pthread_mutex_lock(&fs->table_lock);
+    for (unsigned blk = 0; blk < INODE_BLOCK_TOTAL; ++blk) {
+        bool dirty = false;
+        for (unsigned i = 0; i < INODES_PER_BOCK; ++i) {
+            dirty |= bitmap_test(fs->inode_dirty, blk * INODES_PER_BOCK + i);
+        }
+        if (dirty) {
+            homes[count]    = INODE_BLOCK_OFFSET + blk;
+            images[count++] = &fs->inode_table[blk * INODES_PER_BOCK];
+        }
+    }
+    pthread_mutex_unlock(&fs->table_lock);
+    // a block that got freed doesn't need to go anywhere
+    for (size_t slot = 0; slot < journal->count; ++slot) {
+        if (!bitmap_test(journal->freeing, journal->homes[slot])) {
+            homes[count]    = journal->homes[slot];
+            images[count++] = journal->images[slot];
+        }
+    }
+
+    bool success = true, logged = false;
+    if (count || journal->free_count) {
+        pthread_mutex_lock(&fs->alloc_lock);
+        success = back_store_export_fbm(fs->bs, journal->fbm);
+        pthread_mutex_unlock(&fs->alloc_lock);
+        for (size_t i = 0; i < journal->free_count; ++i) {
+            journal->fbm[journal->frees[i] >> 3] &= ~(1U << (journal->frees[i] & 0x07));
+        }
+        if (success && count <= JOURNAL_IMAGE_MAX) {
+            journal_header_t *header = &journal->header;
+            memset(header, 0x00, sizeof(journal_header_t));
+            header->magic    = JOURNAL_MAGIC;
+            header->sequence = ++journal->sequence;
+            header->count    = count;
+            uint64_t hash    = journal_checksum(UINT64_C(14695981039346656037), journal->fbm, sizeof(journal->fbm));
+            for (size_t i = 0; i < count; ++i) {
+                header->homes[i] = homes[i];
+                hash             = journal_checksum(hash, images[i], BLOCK_SIZE);
+            }
+            header->checksum = (uint32_t)(hash ^ (hash >> 32));
+            // header, map, images, back to back, so it's one write
+            unsigned ids[JOURNAL_BLOCK_TOTAL];
+            struct iovec iov[JOURNAL_BLOCK_TOTAL];
+            const size_t total = 1 + JOURNAL_FBM_BLOCKS + count;
+            for (size_t i = 0; i < total; ++i) {
+                ids[i]         = JOURNAL_BLOCK_OFFSET + i;
+                iov[i].iov_len = BLOCK_SIZE;
+                if (i == 0) {
+                    iov[i].iov_base = header;
+                } else if (i <= JOURNAL_FBM_BLOCKS) {
+                    iov[i].iov_base = INCREMENT_VOID(journal->fbm, (i - 1) * BLOCK_SIZE);
+                } else {
+                    iov[i].iov_base = (void *) images[i - 1 - JOURNAL_FBM_BLOCKS];
+                }
+            }
+            // the log has to be on disk before anything goes home
+            success = logged = back_store_writev(fs->bs, ids, iov, total) && back_store_flush(fs->bs);
+        }
+        // home, the ones that failed stay in the transaction for next time
+        for (size_t i = 0; i < count && success; ++i) {
+            success = back_store_write(fs->bs, homes[i], images[i]);
+        }
+        if (success) {
+            // the frees are safe to hand out now, and the map back_store has matches the one just logged
+            pthread_mutex_lock(&fs->alloc_lock);
+            back_store_release_range(fs->bs, journal->free_count, journal->frees);
+            pthread_mutex_unlock(&fs->alloc_lock);
+            pthread_mutex_lock(&fs->table_lock);
+            for (size_t i = 0; i < INODE_TOTAL; ++i) {
+                bitmap_reset(fs->inode_dirty, i);
+            }
+            pthread_mutex_unlock(&fs->table_lock);
+            for (size_t slot = 0; slot < journal->count; ++slot) {
+                journal->slot_of[journal->homes[slot]] = 0;
+            }
+            for (size_t i = 0; i < journal->free_count; ++i) {
+                bitmap_reset(journal->freeing, journal->frees[i]);
+            }
+            journal->count      = 0;
+            journal->free_count = 0;
+        }
+    }
+    __atomic_store_n(&journal->wanted, false, __ATOMIC_RELAXED);
+    free(homes);
+    free(images);
+    // home has to be on disk before the log can be let go
+    // (if it doesn't make it out, replaying the same commit again is harmless)
+    success = success && back_store_flush(fs->bs);
+    if (success && logged) {
+        journal->header.magic = 0;
+        success = back_store_write(fs->bs, JOURNAL_BLOCK_OFFSET, &journal->header);
+    }
+    return success;
+}
+
+// Mount time. If the log has a commit in it, it might not have all made it home, so it goes home again
+// A log that doesn't check out never finished being written, and nothing went home before it was
+// The inode table could be one of the things that changes, so it needs loading again after
+bool journal_replay(S16FS_t *fs) {
+    if (!fs || !fs->journal) {
+        return false;
+    }
+    journal_t *journal       = fs->journal;
+    journal_header_t *header = &journal->header;
+    if (!back_store_read(fs->bs, JOURNAL_BLOCK_OFFSET, header)) {
+        return false;
+    }
+    journal->sequence = header->sequence;
+    if (header->magic != JOURNAL_MAGIC || header->count > JOURNAL_IMAGE_MAX) {
+        return true;  // clean
+    }
+    const size_t total = JOURNAL_FBM_BLOCKS + header->count;
+    uint8_t *log       = (uint8_t *) malloc(total * BLOCK_SIZE);
+    block_ptr_t ids[JOURNAL_BLOCK_TOTAL];
+    for (size_t i = 0; i < total; ++i) {
+        ids[i] = JOURNAL_BLOCK_OFFSET + 1 + i;
+    }
+    if (!log || !full_readv_run(fs, log, ids, total)) {
+        free(log);
+        return false;
+    }
+    bool success        = true;
+    const uint64_t hash = journal_checksum(UINT64_C(14695981039346656037), log, total * BLOCK_SIZE);
+    if (header->checksum == (uint32_t)(hash ^ (hash >> 32))) {
+        for (size_t i = 0; i < header->count && success; ++i) {
+            const block_ptr_t home = header->homes[i];
+            // anything outside the inode table and data blocks (or inside the log) means it's not really a log
+            success = home >= INODE_BLOCK_OFFSET
+                      && (home < JOURNAL_BLOCK_OFFSET || home >= JOURNAL_BLOCK_OFFSET + JOURNAL_BLOCK_TOTAL)
+                      && back_store_write(fs->bs, home, log + (JOURNAL_FBM_BLOCKS + i) * BLOCK_SIZE);
+        }
+        // whatever the live map picked up after the commit was never used by anything that survived
+        success = success && back_store_import_fbm(fs->bs, log) && back_store_flush(fs->bs);
+    }
+    free(log);
+    if (success) {
+        header->magic = 0;
+        success       = back_store_write(fs->bs, JOURNAL_BLOCK_OFFSET, header);
+    }
+    return success;
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+extern "C" {
+#include "S16FS.h"
+}
+
+/*
+    READ IOPS BENCHMARK
+    Random and front to back 4k reads out of one big file
+    The file's big enough to go through the indirect and double indirect blocks
+    Then one cold front to back pass with read-ahead off and on, the file gets dropped
+    from the page cache first so the reads really have to wait on the disk
+    ./fs_bench extents does it all again with the file mapped by extents instead of block pointers
+    Only uses the public API
+*/
+
+#define BENCH_FILE "bench.s16fs"
+#define BENCH_FILE_BLOCKS (32768)
+#define BENCH_READ_SIZE (4096)
+#define BENCH_READS (200000)
+#define BENCH_PASSES (3)
+
+// one pass of reads at the given offsets, reads per second
+static double time_reads(S16FS_t *fs, int fd, const std::vector<off_t> &offsets) {
+    static uint8_t buffer[BENCH_READ_SIZE];
+    auto start = std::chrono::steady_clock::now();
+    for (off_t offset : offsets) {
+        if (fs_seek(fs, fd, offset, FS_SEEK_SET) != offset
+            || fs_read(fs, fd, buffer, BENCH_READ_SIZE) != BENCH_READ_SIZE) {
+            fprintf(stderr, "read at %ld failed\n", (long) offset);
+            exit(1);
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return offsets.size() / std::chrono::duration<double>(stop - start).count();
+}
+
+// kicks the whole store out of the page cache, it has to be unmounted so nothing's dirty or mapped
+static void drop_cache() {
+    int fd = open(BENCH_FILE, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// one cold front to back pass, reads per second
+static double time_cold(size_t readahead_max, const std::vector<off_t> &offsets) {
+    drop_cache();
+    S16FS_t *fs = fs_mount(BENCH_FILE);
+    if (!fs || fs_set_readahead(fs, readahead_max ? 4 : 0, readahead_max) != 0) {
+        fprintf(stderr, "couldn't remount %s\n", BENCH_FILE);
+        exit(1);
+    }
+    int fd = fs_open(fs, "/big");
+    double reads = time_reads(fs, fd, offsets);
+    fs_close(fs, fd);
+    fs_unmount(fs);
+    return reads;
+}
+
+int main(int argc, char **argv) {
+    const bool extents = argc > 1 && strcmp(argv[1], "extents") == 0;
+    S16FS_t *fs = fs_format_layout(BENCH_FILE, extents ? FS_LAYOUT_EXTENTS : FS_LAYOUT_BLOCKS);
+    if (!fs || fs_create(fs, "/big", FS_REGULAR) != 0) {
+        fprintf(stderr, "couldn't set up %s\n", BENCH_FILE);
+        return 1;
+    }
+    int fd = fs_open(fs, "/big");
+    static uint8_t chunk[BENCH_READ_SIZE];
+    for (size_t i = 0; i < (size_t) BENCH_FILE_BLOCKS * 1024 / BENCH_READ_SIZE; ++i) {
+        memset(chunk, i & 0xFF, sizeof(chunk));
+        if (fs_write(fs, fd, chunk, sizeof(chunk)) != (ssize_t) sizeof(chunk)) {
+            fprintf(stderr, "fill failed\n");
+            return 1;
+        }
+    }
+
+    const off_t last = (off_t) BENCH_FILE_BLOCKS * 1024 - BENCH_READ_SIZE;
+    std::vector<off_t> sequential, random;
+    for (size_t i = 0; i < BENCH_READS; ++i) {
+        sequential.push_back((off_t)(i * BENCH_READ_SIZE) % (last + BENCH_READ_SIZE));
+    }
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<off_t> pick(0, last / BENCH_READ_SIZE);
+    for (size_t i = 0; i < BENCH_READS; ++i) {
+        random.push_back(pick(rng) * BENCH_READ_SIZE);
+    }
+
+    printf("%d 4k reads from a %d KiB file (%s), best of %d passes\n", BENCH_READS, BENCH_FILE_BLOCKS,
+           extents ? "extents" : "block pointers", BENCH_PASSES);
+    printf("%-12s %12s\n", "pattern", "reads/s");
+    double best = 0;
+    for (int pass = 0; pass < BENCH_PASSES; ++pass) {
+        best = std::max(best, time_reads(fs, fd, sequential));
+    }
+    printf("%-12s %12.0f\n", "sequential", best);
+    best = 0;
+    for (int pass = 0; pass < BENCH_PASSES; ++pass) {
+        best = std::max(best, time_reads(fs, fd, random));
+    }
+    printf("%-12s %12.0f\n", "random", best);
+
+    fs_close(fs, fd);
+    fs_unmount(fs);
+
+    // just the one pass through the file, it's only cold once
+    sequential.resize((size_t) BENCH_FILE_BLOCKS * 1024 / BENCH_READ_SIZE);
+    printf("%-12s %12.0f\n", "cold, no ra", time_cold(0, sequential));
+    for (size_t readahead_max : {64, 256, 1024}) {
+        char pattern[32];
+        snprintf(pattern, sizeof(pattern), "cold, ra %zu", readahead_max);
+        printf("%-12s %12.0f\n", pattern, time_cold(readahead_max, sequential));
+    }
+
+    remove(BENCH_FILE);
+    return 0;
+}
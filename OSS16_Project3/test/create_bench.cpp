@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include "S16FS.h"
+}
+
+/*
+    CREATE/REMOVE BENCHMARK
+    Fills the whole inode table with empty files in the root, then removes them all again, round after round
+    Every create has to find a free inode and every remove hands one back, so this is mostly the inode allocator
+    and the directory index
+    ./fs_create_bench extents formats with extents, ./fs_create_bench journal formats with a journal
+    Only uses the public API
+*/
+
+#define BENCH_FILE "create_bench.s16fs"
+#define BENCH_FILES (255)
+#define BENCH_ROUNDS (200)
+#define BENCH_PASSES (3)
+
+// one timed round, every file created and then every file removed, seconds taken by each half
+static void time_round(S16FS_t *fs, char paths[][16], double *create_time, double *remove_time) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < BENCH_FILES; ++i) {
+        if (fs_create(fs, paths[i], FS_REGULAR) != 0) {
+            fprintf(stderr, "create of %s failed\n", paths[i]);
+            exit(1);
+        }
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < BENCH_FILES; ++i) {
+        if (fs_remove(fs, paths[i]) != 0) {
+            fprintf(stderr, "remove of %s failed\n", paths[i]);
+            exit(1);
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    *create_time += std::chrono::duration<double>(middle - start).count();
+    *remove_time += std::chrono::duration<double>(stop - middle).count();
+}
+
+int main(int argc, char **argv) {
+    bool extents = false, journal = false;
+    for (int i = 1; i < argc; ++i) {
+        extents |= strcmp(argv[i], "extents") == 0;
+        journal |= strcmp(argv[i], "journal") == 0;
+    }
+    const layout_t layout = extents ? FS_LAYOUT_EXTENTS : FS_LAYOUT_BLOCKS;
+    S16FS_t *fs = journal ? fs_format_journaled(BENCH_FILE, layout) : fs_format_layout(BENCH_FILE, layout);
+    if (!fs) {
+        fprintf(stderr, "couldn't set up %s\n", BENCH_FILE);
+        return 1;
+    }
+    static char paths[BENCH_FILES][16];
+    for (size_t i = 0; i < BENCH_FILES; ++i) {
+        snprintf(paths[i], sizeof(paths[i]), "/f%03zu", i);
+    }
+
+    printf("%d rounds of %d creates then %d removes (%s%s), best of %d passes\n", BENCH_ROUNDS, BENCH_FILES,
+           BENCH_FILES, extents ? "extents" : "block pointers", journal ? ", journaled" : "", BENCH_PASSES);
+    double best_creates = 0, best_removes = 0;
+    for (int pass = 0; pass < BENCH_PASSES; ++pass) {
+        double create_time = 0, remove_time = 0;
+        for (int round = 0; round < BENCH_ROUNDS; ++round) {
+            time_round(fs, paths, &create_time, &remove_time);
+        }
+        best_creates = std::max(best_creates, BENCH_ROUNDS * BENCH_FILES / create_time);
+        best_removes = std::max(best_removes, BENCH_ROUNDS * BENCH_FILES / remove_time);
+    }
+    printf("%-12s %12s\n", "op", "ops/s");
+    printf("%-12s %12.0f\n", "create", best_creates);
+    printf("%-12s %12.0f\n", "remove", best_removes);
+
+    fs_unmount(fs);
+    remove(BENCH_FILE);
+    return 0;
+}
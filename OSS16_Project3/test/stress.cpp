@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "S16FS.h"
+}
+
+/*
+    MULTITHREADED STRESS
+    First a mixed run: writers rewriting their own files and checking them, readers checking a shared file,
+    and a thread creating and removing files, all at once. Any mismatch is a failure
+    Then random 4k read throughput out of one big file with 1, 2, 4 and 8 threads, a descriptor each
+    Only uses the public API
+*/
+
+#define STRESS_FILE "stress.s16fs"
+#define STRESS_FILE_BLOCKS (16384)
+#define STRESS_READ_SIZE (4096)
+#define STRESS_READS (200000)
+#define STRESS_PASSES (3)
+#define STRESS_ROUNDS (200)
+
+static uint8_t pattern(size_t offset, unsigned seed) {
+    return (uint8_t)(offset * 7 + offset / 1024 + seed * 31);
+}
+
+// everybody at once, returns the number of mismatches/failed calls
+static int mixed(S16FS_t *fs) {
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < 4; ++t) {
+        threads.emplace_back([fs, t, &failures]() {
+            char path[32];
+            snprintf(path, sizeof(path), "/writer_%u", t);
+            int fd = fs_create(fs, path, FS_REGULAR) == 0 ? fs_open(fs, path) : -1;
+            std::vector<uint8_t> data(64 * 1024 + 321), back(data.size());
+            for (unsigned round = 0; round < STRESS_ROUNDS && fd >= 0; ++round) {
+                for (size_t i = 0; i < data.size(); ++i) {
+                    data[i] = pattern(i, t * STRESS_ROUNDS + round);
+                }
+                if (fs_seek(fs, fd, 0, FS_SEEK_SET) != 0
+                    || fs_write(fs, fd, data.data(), data.size()) != (ssize_t) data.size()
+                    || fs_seek(fs, fd, 0, FS_SEEK_SET) != 0
+                    || fs_read(fs, fd, back.data(), back.size()) != (ssize_t) back.size() || back != data) {
+                    ++failures;
+                }
+            }
+            if (fd < 0 || fs_close(fs, fd) != 0 || fs_remove(fs, path) != 0) {
+                ++failures;
+            }
+        });
+    }
+    for (unsigned t = 0; t < 4; ++t) {
+        threads.emplace_back([fs, t, &failures]() {
+            int fd = fs_open(fs, "/big");
+            std::mt19937 rng(t);
+            std::uniform_int_distribution<size_t> pick(0, (size_t) STRESS_FILE_BLOCKS * 1024 - STRESS_READ_SIZE);
+            uint8_t buffer[STRESS_READ_SIZE];
+            for (unsigned round = 0; round < STRESS_ROUNDS * 20 && fd >= 0; ++round) {
+                const size_t offset = pick(rng);
+                if (fs_seek(fs, fd, offset, FS_SEEK_SET) != (off_t) offset
+                    || fs_read(fs, fd, buffer, sizeof(buffer)) != (ssize_t) sizeof(buffer)) {
+                    ++failures;
+                    continue;
+                }
+                for (size_t i = 0; i < sizeof(buffer); ++i) {
+                    if (buffer[i] != pattern(offset + i, 0)) {
+                        ++failures;
+                        break;
+                    }
+                }
+            }
+            if (fd < 0 || fs_close(fs, fd) != 0) {
+                ++failures;
+            }
+        });
+    }
+    threads.emplace_back([fs, &failures]() {
+        char path[32];
+        for (unsigned round = 0; round < STRESS_ROUNDS * 10; ++round) {
+            snprintf(path, sizeof(path), "/churn/f%u", round % 50);
+            if ((round >= 50 && fs_remove(fs, path) != 0) || fs_create(fs, path, FS_REGULAR) != 0) {
+                ++failures;
+            }
+        }
+    });
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    return failures;
+}
+
+// random 4k reads split across the threads, reads per second
+static double time_reads(S16FS_t *fs, unsigned n_threads) {
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed(false);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < n_threads; ++t) {
+        threads.emplace_back([fs, t, n_threads, &failed]() {
+            int fd = fs_open(fs, "/big");
+            std::mt19937 rng(42 + t);
+            std::uniform_int_distribution<off_t> pick(0, STRESS_FILE_BLOCKS * 1024 / STRESS_READ_SIZE - 1);
+            uint8_t buffer[STRESS_READ_SIZE];
+            for (size_t i = 0; i < STRESS_READS / n_threads && fd >= 0; ++i) {
+                const off_t offset = pick(rng) * STRESS_READ_SIZE;
+                if (fs_seek(fs, fd, offset, FS_SEEK_SET) != offset
+                    || fs_read(fs, fd, buffer, STRESS_READ_SIZE) != STRESS_READ_SIZE) {
+                    failed = true;
+                    break;
+                }
+            }
+            if (fd < 0 || fs_close(fs, fd) != 0) {
+                failed = true;
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    if (failed) {
+        fprintf(stderr, "reads with %u threads failed\n", n_threads);
+        exit(1);
+    }
+    return (STRESS_READS / n_threads) * n_threads / std::chrono::duration<double>(stop - start).count();
+}
+
+int main() {
+    S16FS_t *fs = fs_format(STRESS_FILE);
+    if (!fs || fs_create(fs, "/big", FS_REGULAR) != 0 || fs_create(fs, "/churn", FS_DIRECTORY) != 0) {
+        fprintf(stderr, "couldn't set up %s\n", STRESS_FILE);
+        return 1;
+    }
+    int fd = fs_open(fs, "/big");
+    static uint8_t chunk[STRESS_READ_SIZE];
+    for (size_t offset = 0; offset < (size_t) STRESS_FILE_BLOCKS * 1024; offset += sizeof(chunk)) {
+        for (size_t i = 0; i < sizeof(chunk); ++i) {
+            chunk[i] = pattern(offset + i, 0);
+        }
+        if (fs_write(fs, fd, chunk, sizeof(chunk)) != (ssize_t) sizeof(chunk)) {
+            fprintf(stderr, "fill failed\n");
+            return 1;
+        }
+    }
+    fs_close(fs, fd);
+
+    const int failures = mixed(fs);
+    printf("mixed readers/writers/create-remove: %s (%d failures)\n", failures ? "FAILED" : "ok", failures);
+
+    printf("%d random 4k reads from a %d KiB file, best of %d passes\n", STRESS_READS, STRESS_FILE_BLOCKS,
+           STRESS_PASSES);
+    printf("%-8s %12s %8s\n", "threads", "reads/s", "scaling");
+    double single = 0;
+    for (unsigned n_threads : {1, 2, 4, 8}) {
+        double best = 0;
+        for (int pass = 0; pass < STRESS_PASSES; ++pass) {
+            best = std::max(best, time_reads(fs, n_threads));
+        }
+        if (n_threads == 1) {
+            single = best;
+        }
+        printf("%-8u %12.0f %7.2fx\n", n_threads, best, best / single);
+    }
+
+    fs_unmount(fs);
+    remove(STRESS_FILE);
+    return failures ? 1 : 0;
+}
@@ -1,6 +1,8 @@
+#include <atomic>
 #include <cstdlib>
 #include <iostream>
 #include <new>
+#include <thread>
 #include <vector>
 using std::vector;
 using std::string;
@@ -112,7 +114,7 @@ int fs_create(S16FS_t *const fs, const char *const fname, const ftype_t ftype);
     16. Error, path has trailing slash (no name for desired file)
     17. Error, bad path, path part too long
     18. Error, bad path, desired filename too long
-    19. Error, directory full.
+    19. Normal, directory past one block (used to be Error, directory full)
     20. Error, out of inodes.
     21. Error, out of data blocks & file is directory (requires functional write)
 
@@ -230,7 +232,9 @@ TEST(b_tests, file_creation_two) {
     }
 
     // CREATE_FILE 19
-    ASSERT_LT(fs_create(fs, "/a/z", FS_REGULAR), 0);
+    // Directories don't fill up at 15 anymore, they get indexed. Take it back out so the inode count still works
+    ASSERT_EQ(fs_create(fs, "/a/z", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/a/z"), 0);
     // Catch up to finish creation
     fname[2] = '\0';
     // printf("File: %s\n", fname);
@@ -387,8 +391,8 @@ TEST(c_tests, open_close_file) {
     fs = fs_mount(test_fname);
     ASSERT_NE(fs, nullptr);
 
-    for (int i = 0; i < 256; ++i) {
-        fd_array[i] = fs_open(fs, filenames[0]);
+    for (int i = 0; i < DESCRIPTOR_MAX; ++i) {
+        ASSERT_GE(fs_open(fs, filenames[0]), 0);
     }
 
     int err = fs_open(fs, filenames[0]);
@@ -781,7 +785,7 @@ TEST(f_tests, get_dir) {
     off_t fs_seek(S16FS_t *fs, int fd, off_t offset, seek_t whence)
     1. Normal, wherever, really - make sure it doesn't change a second fd to the file
     2. Normal, seek past beginning - resulting location unspecified by our api, can't really test?
-    3. Normal, seek past end - resulting location unspecified by our api, can't really test?
+    3. Normal, seek past end - allowed, it's where a sparse write would go
     4. Error, FS null
     5. Error, fd invalid
     6. Error, whence not a valid value
@@ -821,7 +825,7 @@ TEST(g_tests, seek) {
 
     // FS_SEEK 3
     position = fs_seek(fs, fd_one, 98675309, FS_SEEK_CUR);
-    ASSERT_EQ(position, 66934784);
+    ASSERT_EQ(position, 98675309);
 
     // while we're at it, make sure seek didn't break the other one
     position = fs_seek(fs, fd_two, 0, FS_SEEK_CUR);
@@ -944,7 +948,9 @@ TEST(h_tests, read) {
     ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_CUR), (512 * 10 + 511 + 6) * 1024 + 2048);
 
     // FS_READ 11
-    ASSERT_EQ(fs_seek(fs, fd, 98675309, FS_SEEK_CUR), 66934784);
+    ASSERT_EQ(fs_seek(fs, fd, 98675309, FS_SEEK_CUR), (512 * 10 + 511 + 6) * 1024 + 2048 + 98675309);
+    nbyte = fs_read(fs, fd, write_space, 1024);
+    ASSERT_EQ(nbyte, 0);
     ASSERT_EQ(fs_seek(fs, fd, -500, FS_SEEK_END), 66934284);
     nbyte = fs_read(fs, fd, write_space, 1024);
     ASSERT_EQ(nbyte, 500);
@@ -1131,6 +1137,1325 @@ TEST(i_tests, move) {
 }
 #endif
 
+/*
+    Block layout
+    1. Appending to a file goes after its last block, not into a lower hole left by another file
+*/
+
+TEST(j_tests, sequential_layout) {
+    const char *test_fname = "j_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    uint8_t chunk[4096];
+    memset(chunk, 0x5A, sizeof(chunk));
+
+    // file_b takes the low blocks, file_a goes after it, then file_b goes away
+    ASSERT_EQ(fs_create(fs, "/file_b", FS_REGULAR), 0);
+    int fd_b = fs_open(fs, "/file_b");
+    ASSERT_GE(fd_b, 0);
+    ASSERT_EQ(fs_write(fs, fd_b, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+
+    ASSERT_EQ(fs_create(fs, "/file_a", FS_REGULAR), 0);
+    int fd_a = fs_open(fs, "/file_a");
+    ASSERT_GE(fd_a, 0);
+    ASSERT_EQ(fs_write(fs, fd_a, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+    ASSERT_EQ(fs_remove(fs, "/file_b"), 0);
+
+    ASSERT_EQ(fs_write(fs, fd_a, chunk, 2048), 2048);
+
+    inode_t f_inode;
+    block_ptr_t ptrs[6];
+    ASSERT_TRUE(read_inode(fs, &f_inode, FD_INODE(fs, fd_a)));
+    get_data_block_ptrs(fs, &f_inode, 0, 6, ptrs);
+    for (int i = 1; i < 6; ++i) {
+        ASSERT_EQ(ptrs[i], ptrs[i - 1] + 1);
+    }
+
+    fs_unmount(fs);
+}
+
+/*
+    Inode table cache
+    1. Changes stay in memory until sync, then the on-disk inode matches
+    2. Unmount writes them too, so a remount sees the file
+*/
+
+TEST(k_tests, inode_cache_sync) {
+    const char *test_fname = "k_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    ASSERT_EQ(fs_create(fs, "/cached", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/cached");
+    ASSERT_GE(fd, 0);
+    uint8_t chunk[3000];
+    memset(chunk, 0x3C, sizeof(chunk));
+    ASSERT_EQ(fs_write(fs, fd, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+    const inode_ptr_t inode_number = FD_INODE(fs, fd);
+    ASSERT_TRUE(bitmap_test(fs->inode_dirty, inode_number));
+
+    ASSERT_EQ(fs_sync(fs), 0);
+    ASSERT_FALSE(bitmap_test(fs->inode_dirty, inode_number));
+    inode_t disk_inodes[INODES_PER_BOCK];
+    ASSERT_TRUE(back_store_read(fs->bs, INODE_TO_BLOCK(inode_number), disk_inodes));
+    ASSERT_EQ(memcmp(&disk_inodes[INODE_INNER_IDX(inode_number)], &fs->inode_table[inode_number], sizeof(inode_t)), 0);
+    ASSERT_EQ(fs_sync(NULL), -1);
+
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    fd = fs_open(fs, "/cached");
+    ASSERT_GE(fd, 0);
+    uint8_t check[3000];
+    ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), (ssize_t) sizeof(check));
+    ASSERT_EQ(memcmp(chunk, check, sizeof(check)), 0);
+
+    fs_unmount(fs);
+}
+
+/*
+    Dentry cache
+    1. A second lookup of the same path is all hits
+    2. Misses are cached too, and create/remove/move don't leave stale entries behind
+*/
+
+TEST(l_tests, dentry_cache) {
+    const char *test_fname = "l_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    ASSERT_EQ(fs_create(fs, "/deep", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/deep/er", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/deep/er/file", FS_REGULAR), 0);
+
+    int fd = fs_open(fs, "/deep/er/file");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    const uint64_t misses = fs->dentry_cache->misses;
+    const uint64_t hits   = fs->dentry_cache->hits;
+    fd = fs_open(fs, "/deep/er/file");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs->dentry_cache->misses, misses);
+    ASSERT_EQ(fs->dentry_cache->hits, hits + 3);
+
+    // negative entry, then it has to go away once the file exists
+    ASSERT_LT(fs_open(fs, "/deep/er/later"), 0);
+    ASSERT_LT(fs_open(fs, "/deep/er/later"), 0);
+    ASSERT_EQ(fs_create(fs, "/deep/er/later", FS_REGULAR), 0);
+    fd = fs_open(fs, "/deep/er/later");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+
+    ASSERT_EQ(fs_remove(fs, "/deep/er/later"), 0);
+    ASSERT_LT(fs_open(fs, "/deep/er/later"), 0);
+
+    ASSERT_EQ(fs_move(fs, "/deep/er/file", "/deep/file"), 0);
+    ASSERT_LT(fs_open(fs, "/deep/er/file"), 0);
+    fd = fs_open(fs, "/deep/file");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+
+    fs_unmount(fs);
+}
+
+/*
+    Descriptor block map
+    1. Streaming a file in 4k reads, through direct, indirect and double indirect, comes out of the window
+    2. A write through another descriptor drops the stale window
+*/
+
+TEST(m_tests, fd_block_map) {
+    const char *test_fname = "m_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    // far enough to get into the double indirect blocks
+    const size_t file_size = (DIRECT_TOTAL + INDIRECT_TOTAL + 100) * BLOCK_SIZE;
+    uint8_t *data = new uint8_t[file_size];
+    for (size_t i = 0; i < file_size; ++i) {
+        data[i] = (uint8_t)(i * 7 + i / BLOCK_SIZE);
+    }
+    ASSERT_EQ(fs_create(fs, "/stream", FS_REGULAR), 0);
+    int fd_w = fs_open(fs, "/stream");
+    ASSERT_GE(fd_w, 0);
+    ASSERT_EQ(fs_write(fs, fd_w, data, file_size), (ssize_t) file_size);
+
+    int fd_r = fs_open(fs, "/stream");
+    ASSERT_GE(fd_r, 0);
+    uint8_t chunk[4096];
+    for (size_t pos = 0; pos < file_size; pos += sizeof(chunk)) {
+        const size_t expected = (file_size - pos < sizeof(chunk)) ? file_size - pos : sizeof(chunk);
+        ASSERT_EQ(fs_read(fs, fd_r, chunk, sizeof(chunk)), (ssize_t) expected);
+        ASSERT_EQ(memcmp(chunk, data + pos, expected), 0);
+        const fd_map_t *map = &FD_MAP(fs, fd_r);
+        ASSERT_NE(map->count, 0u);
+        ASSERT_LE(map->first, POSITION_TO_BLOCK_INDEX(pos));
+    }
+
+    // rewrite the start through the other descriptor, reader has to see it
+    ASSERT_EQ(fs_seek(fs, fd_r, 0, FS_SEEK_SET), 0);
+    ASSERT_EQ(fs_read(fs, fd_r, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+    ASSERT_EQ(fs_seek(fs, fd_w, 0, FS_SEEK_END), (off_t) file_size);
+    memset(chunk, 0xEE, sizeof(chunk));
+    ASSERT_EQ(fs_write(fs, fd_w, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+    ASSERT_EQ(FD_MAP(fs, fd_r).count, 0u);
+    ASSERT_EQ(fs_seek(fs, fd_r, file_size, FS_SEEK_SET), (off_t) file_size);
+    uint8_t check[4096];
+    ASSERT_EQ(fs_read(fs, fd_r, check, sizeof(check)), (ssize_t) sizeof(check));
+    ASSERT_EQ(memcmp(chunk, check, sizeof(check)), 0);
+
+    delete[] data;
+    fs_unmount(fs);
+}
+
+/*
+    Read-only block lookup
+    1. A block the file doesn't have reads back as zeros, and reading doesn't go and allocate it
+*/
+
+TEST(n_tests, read_hole) {
+    const char *test_fname = "n_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    uint8_t chunk[3 * BLOCK_SIZE];
+    memset(chunk, 0x77, sizeof(chunk));
+    ASSERT_EQ(fs_create(fs, "/holey", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/holey");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+
+    // punch out the middle block by hand
+    const inode_ptr_t inode_number = FD_INODE(fs, fd);
+    back_store_release(fs->bs, fs->inode_table[inode_number].data_ptrs[1]);
+    fs->inode_table[inode_number].data_ptrs[1] = 0;
+
+    uint8_t check[3 * BLOCK_SIZE];
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+    ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), (ssize_t) sizeof(check));
+    ASSERT_EQ(memcmp(check, chunk, BLOCK_SIZE), 0);
+    for (size_t i = BLOCK_SIZE; i < 2 * BLOCK_SIZE; ++i) {
+        ASSERT_EQ(check[i], 0);
+    }
+    ASSERT_EQ(memcmp(check + 2 * BLOCK_SIZE, chunk, BLOCK_SIZE), 0);
+    ASSERT_EQ(fs->inode_table[inode_number].data_ptrs[1], 0);
+
+    // starting inside the hole too
+    ASSERT_EQ(fs_seek(fs, fd, BLOCK_SIZE + 10, FS_SEEK_SET), BLOCK_SIZE + 10);
+    ASSERT_EQ(fs_read(fs, fd, check, 20), 20);
+    for (size_t i = 0; i < 20; ++i) {
+        ASSERT_EQ(check[i], 0);
+    }
+
+    ASSERT_EQ(fs_remove(fs, "/holey"), 0);
+    fs_unmount(fs);
+}
+
+/*
+    Read-ahead
+    1. Small front to back reads grow the window up to the max
+    2. Jumping around closes it, and turning it off keeps it closed
+    3. Bad settings get turned down
+*/
+
+TEST(o_tests, readahead) {
+    const char *test_fname = "o_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    const size_t file_size = 200 * BLOCK_SIZE;
+    uint8_t *data = new uint8_t[file_size];
+    for (size_t i = 0; i < file_size; ++i) {
+        data[i] = (uint8_t)(i * 13 + i / BLOCK_SIZE);
+    }
+    ASSERT_EQ(fs_create(fs, "/log", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/log");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, data, file_size), (ssize_t) file_size);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+
+    ASSERT_EQ(fs_set_readahead(fs, 4, 32), 0);
+    fd = fs_open(fs, "/log");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_get_readahead(fs, fd), 0);
+    uint8_t chunk[300];
+    ssize_t window = 0;
+    for (size_t pos = 0; pos < file_size; pos += sizeof(chunk)) {
+        const size_t expected = (file_size - pos < sizeof(chunk)) ? file_size - pos : sizeof(chunk);
+        ASSERT_EQ(fs_read(fs, fd, chunk, sizeof(chunk)), (ssize_t) expected);
+        ASSERT_EQ(memcmp(chunk, data + pos, expected), 0);
+        ASSERT_GE(fs_get_readahead(fs, fd), window);
+        window = fs_get_readahead(fs, fd);
+    }
+    ASSERT_EQ(window, 32);
+
+    ASSERT_EQ(fs_seek(fs, fd, 50 * BLOCK_SIZE, FS_SEEK_SET), 50 * BLOCK_SIZE);
+    ASSERT_EQ(fs_read(fs, fd, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+    ASSERT_EQ(memcmp(chunk, data + 50 * BLOCK_SIZE, sizeof(chunk)), 0);
+    ASSERT_EQ(fs_get_readahead(fs, fd), 0);
+    ASSERT_EQ(fs_read(fs, fd, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+    ASSERT_EQ(fs_get_readahead(fs, fd), 4);
+
+    ASSERT_EQ(fs_set_readahead(fs, 0, 0), 0);
+    ASSERT_EQ(fs_read(fs, fd, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+    ASSERT_EQ(fs_get_readahead(fs, fd), 0);
+
+    ASSERT_LT(fs_set_readahead(fs, 8, 4), 0);
+    ASSERT_LT(fs_set_readahead(fs, 0, 4), 0);
+    ASSERT_LT(fs_set_readahead(fs, 4, READAHEAD_LIMIT + 1), 0);
+    ASSERT_LT(fs_set_readahead(NULL, 4, 8), 0);
+    ASSERT_LT(fs_get_readahead(fs, DESCRIPTOR_MAX), 0);
+    ASSERT_LT(fs_get_readahead(NULL, fd), 0);
+
+    delete[] data;
+    fs_unmount(fs);
+}
+
+/*
+    Sparse files
+    1. Writing past EOF leaves a hole, only the written blocks get allocated, the rest reads as zeros
+       (even though the blocks it gets were just full of some other file's data)
+    2. Punching a hole releases whole blocks, zeros ragged ends, and keeps the size
+    3. Punching out everything under an indirect block releases the indirect block too
+*/
+
+TEST(p_tests, sparse) {
+    const char *test_fname = "p_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    // leave junk in a bunch of free blocks
+    uint8_t junk[64 * BLOCK_SIZE];
+    memset(junk, 0xFF, sizeof(junk));
+    ASSERT_EQ(fs_create(fs, "/junk", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/junk");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, junk, sizeof(junk)), (ssize_t) sizeof(junk));
+    ASSERT_EQ(fs_remove(fs, "/junk"), 0);
+
+    ASSERT_EQ(fs_create(fs, "/index", FS_REGULAR), 0);
+    fd = fs_open(fs, "/index");
+    ASSERT_GE(fd, 0);
+    uint8_t stamp[10];
+    memset(stamp, 0x42, sizeof(stamp));
+    ASSERT_EQ(fs_write(fs, fd, stamp, sizeof(stamp)), (ssize_t) sizeof(stamp));
+    const size_t far = (DIRECT_TOTAL + INDIRECT_TOTAL + 3) * BLOCK_SIZE + 100;
+    ASSERT_EQ(fs_seek(fs, fd, far, FS_SEEK_SET), (off_t) far);
+    ASSERT_EQ(fs_write(fs, fd, stamp, sizeof(stamp)), (ssize_t) sizeof(stamp));
+    const inode_ptr_t inode_number = FD_INODE(fs, fd);
+    const inode_t *f_inode = &fs->inode_table[inode_number];
+    ASSERT_EQ(f_inode->mdata.size, far + sizeof(stamp));
+    for (int i = 1; i < 7; ++i) {
+        ASSERT_EQ(f_inode->data_ptrs[i], 0);
+    }
+    ASSERT_NE(f_inode->data_ptrs[7], 0);
+
+    uint8_t block[BLOCK_SIZE];
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+    for (size_t pos = 0; pos < far + sizeof(stamp); pos += sizeof(block)) {
+        const size_t expected = std::min(sizeof(block), (size_t)(far + sizeof(stamp) - pos));
+        ASSERT_EQ(fs_read(fs, fd, block, sizeof(block)), (ssize_t) expected);
+        for (size_t i = 0; i < expected; ++i) {
+            const bool stamped = pos + i < sizeof(stamp) || pos + i >= far;
+            ASSERT_EQ(block[i], stamped ? 0x42 : 0x00);
+        }
+    }
+    ASSERT_EQ(fs_read(fs, fd, block, sizeof(block)), 0);
+
+    // punch a hole in a plain file
+    ASSERT_EQ(fs_create(fs, "/punch", FS_REGULAR), 0);
+    int fd_p = fs_open(fs, "/punch");
+    ASSERT_GE(fd_p, 0);
+    ASSERT_EQ(fs_write(fs, fd_p, junk, 20 * BLOCK_SIZE), 20 * BLOCK_SIZE);
+    ASSERT_EQ(fs_punch_hole(fs, fd_p, BLOCK_SIZE + 512, 4 * BLOCK_SIZE), 0);
+    const inode_t *p_inode = &fs->inode_table[FD_INODE(fs, fd_p)];
+    ASSERT_EQ(p_inode->mdata.size, 20u * BLOCK_SIZE);
+    ASSERT_NE(p_inode->data_ptrs[1], 0);
+    ASSERT_EQ(p_inode->data_ptrs[2], 0);
+    ASSERT_EQ(p_inode->data_ptrs[4], 0);
+    ASSERT_NE(p_inode->data_ptrs[5], 0);
+    ASSERT_EQ(fs_seek(fs, fd_p, 0, FS_SEEK_SET), 0);
+    for (size_t pos = 0; pos < 20 * BLOCK_SIZE; pos += sizeof(block)) {
+        ASSERT_EQ(fs_read(fs, fd_p, block, sizeof(block)), (ssize_t) sizeof(block));
+        for (size_t i = 0; i < sizeof(block); ++i) {
+            const bool punched = pos + i >= BLOCK_SIZE + 512 && pos + i < 5 * BLOCK_SIZE + 512;
+            ASSERT_EQ(block[i], punched ? 0x00 : 0xFF);
+        }
+    }
+
+    // everything the indirect block covers, to EOF
+    ASSERT_EQ(fs_punch_hole(fs, fd_p, DIRECT_TOTAL * BLOCK_SIZE, 1 << 30), 0);
+    ASSERT_EQ(p_inode->data_ptrs[6], 0);
+    ASSERT_EQ(p_inode->mdata.size, 20u * BLOCK_SIZE);
+    ASSERT_EQ(fs_seek(fs, fd_p, 19 * BLOCK_SIZE, FS_SEEK_SET), 19 * BLOCK_SIZE);
+    ASSERT_EQ(fs_read(fs, fd_p, block, sizeof(block)), (ssize_t) sizeof(block));
+    for (size_t i = 0; i < sizeof(block); ++i) {
+        ASSERT_EQ(block[i], 0x00);
+    }
+
+    ASSERT_LT(fs_punch_hole(NULL, fd_p, 0, 10), 0);
+    ASSERT_LT(fs_punch_hole(fs, DESCRIPTOR_MAX, 0, 10), 0);
+    ASSERT_EQ(fs_remove(fs, "/index"), 0);
+    ASSERT_EQ(fs_remove(fs, "/punch"), 0);
+    fs_unmount(fs);
+}
+
+/*
+    Truncate and fallocate
+    1. Shrinking frees direct, indirect and double indirect blocks past the new EOF
+    2. Growing back reads as zeros, not what used to be there
+    3. fallocate reserves a contiguous run without changing the size, and writes land in it
+    4. Errors: directories, bad descriptors, too big
+*/
+
+TEST(q_tests, truncate_fallocate) {
+    const char *test_fname = "q_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    const size_t file_size = (DIRECT_TOTAL + INDIRECT_TOTAL + 50) * BLOCK_SIZE;
+    uint8_t *data = new uint8_t[file_size];
+    memset(data, 0xC3, file_size);
+    ASSERT_EQ(fs_create(fs, "/shrink", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/shrink");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, data, file_size), (ssize_t) file_size);
+
+    ASSERT_EQ(fs_truncate(fs, "/shrink", 3000), 0);
+    const inode_t *f_inode = &fs->inode_table[FD_INODE(fs, fd)];
+    ASSERT_EQ(f_inode->mdata.size, 3000u);
+    ASSERT_NE(f_inode->data_ptrs[2], 0);
+    for (int i = 3; i < 8; ++i) {
+        ASSERT_EQ(f_inode->data_ptrs[i], 0);
+    }
+    // descriptor stays where it was, past EOF now
+    uint8_t block[BLOCK_SIZE];
+    ASSERT_EQ(fs_read(fs, fd, block, sizeof(block)), 0);
+
+    ASSERT_EQ(fs_ftruncate(fs, fd, 10000), 0);
+    ASSERT_EQ(f_inode->mdata.size, 10000u);
+    ASSERT_EQ(fs_seek(fs, fd, 2048, FS_SEEK_SET), 2048);
+    ASSERT_EQ(fs_read(fs, fd, block, sizeof(block)), (ssize_t) sizeof(block));
+    for (size_t i = 0; i < sizeof(block); ++i) {
+        ASSERT_EQ(block[i], 2048 + i < 3000 ? 0xC3 : 0x00);
+    }
+    ASSERT_EQ(fs_ftruncate(fs, fd, 0), 0);
+    ASSERT_EQ(f_inode->data_ptrs[0], 0);
+
+    // fallocate, then write it all
+    ASSERT_EQ(fs_create(fs, "/prealloc", FS_REGULAR), 0);
+    int fd_p = fs_open(fs, "/prealloc");
+    ASSERT_GE(fd_p, 0);
+    ASSERT_EQ(fs_fallocate(fs, fd_p, 0, 100 * BLOCK_SIZE), 0);
+    const inode_t *p_inode = &fs->inode_table[FD_INODE(fs, fd_p)];
+    ASSERT_EQ(p_inode->mdata.size, 0u);
+    block_ptr_t before[100];
+    ASSERT_EQ(map_data_blocks(fs, p_inode, 0, 100, before), 100u);
+    for (int i = 1; i < 100; ++i) {
+        // the indirect block sits right before its first data block
+        ASSERT_EQ(before[i], before[i - 1] + (i == DIRECT_TOTAL ? 2 : 1));
+    }
+    ASSERT_EQ(fs_write(fs, fd_p, data, 100 * BLOCK_SIZE), 100 * BLOCK_SIZE);
+    block_ptr_t after[100];
+    ASSERT_EQ(map_data_blocks(fs, p_inode, 0, 100, after), 100u);
+    ASSERT_EQ(memcmp(before, after, sizeof(before)), 0);
+    // already there, nothing to do
+    ASSERT_EQ(fs_fallocate(fs, fd_p, 10, 50 * BLOCK_SIZE), 0);
+
+    // reserved past EOF, truncate takes it back
+    ASSERT_EQ(fs_fallocate(fs, fd_p, 100 * BLOCK_SIZE, 10 * BLOCK_SIZE), 0);
+    ASSERT_EQ(p_inode->mdata.size, 100u * BLOCK_SIZE);
+    ASSERT_EQ(map_data_blocks(fs, p_inode, 105, 1, after), 1u);
+    ASSERT_NE(after[0], 0);
+    ASSERT_EQ(fs_ftruncate(fs, fd_p, 100 * BLOCK_SIZE), 0);
+    ASSERT_EQ(map_data_blocks(fs, p_inode, 105, 1, after), 1u);
+    ASSERT_EQ(after[0], 0);
+
+    // a hole under EOF still reads as zeros once it's reserved, even landing on the blocks it used to have
+    ASSERT_EQ(fs_punch_hole(fs, fd_p, 20 * BLOCK_SIZE, 10 * BLOCK_SIZE), 0);
+    ASSERT_EQ(fs_fallocate(fs, fd_p, 20 * BLOCK_SIZE, 10 * BLOCK_SIZE), 0);
+    ASSERT_EQ(fs_seek(fs, fd_p, 25 * BLOCK_SIZE, FS_SEEK_SET), 25 * BLOCK_SIZE);
+    ASSERT_EQ(fs_read(fs, fd_p, block, sizeof(block)), (ssize_t) sizeof(block));
+    for (size_t i = 0; i < sizeof(block); ++i) {
+        ASSERT_EQ(block[i], 0x00);
+    }
+
+    ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+    ASSERT_LT(fs_truncate(fs, "/dir", 0), 0);
+    ASSERT_LT(fs_truncate(fs, "/nope", 0), 0);
+    ASSERT_LT(fs_truncate(NULL, "/shrink", 0), 0);
+    ASSERT_LT(fs_ftruncate(fs, DESCRIPTOR_MAX, 0), 0);
+    ASSERT_LT(fs_ftruncate(fs, fd, (size_t) FILE_SIZE_MAX + 1), 0);
+    ASSERT_LT(fs_fallocate(fs, fd, 0, 0), 0);
+    ASSERT_LT(fs_fallocate(NULL, fd, 0, 10), 0);
+
+    delete[] data;
+    fs_unmount(fs);
+}
+
+/*
+    Indexed directories
+    1. A directory past 15 entries gets indexed, every bucket stays within one block
+    2. Lookups, listing, removes and moves all work through the index
+    3. It's all still there after a remount
+    4. Removing the emptied directory frees its index and every bucket
+*/
+
+TEST(r_tests, indexed_directory) {
+    const char *test_fname = "r_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    const int file_count = 200;
+    char path[32];
+    ASSERT_EQ(fs_create(fs, "/big", FS_DIRECTORY), 0);
+    for (int i = 0; i < file_count; ++i) {
+        snprintf(path, sizeof(path), "/big/file_%03d", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+    }
+    ASSERT_LT(fs_create(fs, "/big/file_007", FS_REGULAR), 0);
+
+    result_t res;
+    locate_file(fs, "/big", &res);
+    ASSERT_TRUE(res.found);
+    const inode_ptr_t big = res.inode;
+    const inode_t *big_inode = &fs->inode_table[big];
+    ASSERT_TRUE(big_inode->mdata.flags & INODE_DIR_INDEXED);
+
+    block_ptr_t buckets[DIR_INDEX_SLOTS];
+    size_t n_buckets = dir_entry_blocks(fs, big_inode, buckets);
+    ASSERT_GT(n_buckets, (size_t) file_count / DIR_REC_MAX);
+    size_t total = 0;
+    for (size_t i = 0; i < n_buckets; ++i) {
+        dir_block_t bucket;
+        ASSERT_TRUE(full_read(fs, &bucket, buckets[i]));
+        ASSERT_LE(bucket.mdata.size, (uint32_t) DIR_REC_MAX);
+        total += bucket.mdata.size;
+    }
+    ASSERT_EQ(total, (size_t) file_count);
+    dir_index_t index;
+    ASSERT_TRUE(full_read(fs, &index, big_inode->data_ptrs[0]));
+    ASSERT_EQ(index.mdata.size, (uint32_t) file_count);
+
+    // straight to the directory, no dentry cache
+    for (int i = 0; i < file_count; ++i) {
+        snprintf(path, sizeof(path), "file_%03d", i);
+        scan_directory(fs, path, big, &res);
+        ASSERT_TRUE(res.success && res.found);
+        ASSERT_STREQ(fs->inode_table[res.inode].fname, path);
+    }
+    scan_directory(fs, "file_200", big, &res);
+    ASSERT_TRUE(res.success && res.valid);
+    ASSERT_FALSE(res.found);
+
+    dyn_array_t *record_results = fs_get_dir(fs, "/big");
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_EQ(dyn_array_size(record_results), (size_t) file_count);
+    ASSERT_TRUE(find_in_directory(record_results, "file_000"));
+    ASSERT_TRUE(find_in_directory(record_results, "file_199"));
+    dyn_array_destroy(record_results);
+
+    for (int i = 0; i < file_count; i += 2) {
+        snprintf(path, sizeof(path), "/big/file_%03d", i);
+        ASSERT_EQ(fs_remove(fs, path), 0);
+    }
+    ASSERT_EQ(fs_move(fs, "/big/file_001", "/moved"), 0);
+    ASSERT_EQ(fs_move(fs, "/big/file_003", "/big/renamed"), 0);
+    ASSERT_LT(fs_open(fs, "/big/file_001"), 0);
+    ASSERT_LT(fs_open(fs, "/big/file_003"), 0);
+
+    fs_unmount(fs);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    record_results = fs_get_dir(fs, "/big");
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_EQ(dyn_array_size(record_results), (size_t) file_count / 2 - 1);
+    ASSERT_TRUE(find_in_directory(record_results, "renamed"));
+    ASSERT_FALSE(find_in_directory(record_results, "file_000"));
+    dyn_array_destroy(record_results);
+    for (int i = 0; i < file_count; ++i) {
+        snprintf(path, sizeof(path), "/big/file_%03d", i);
+        int fd = fs_open(fs, path);
+        if (i % 2 == 0 || i == 1 || i == 3) {
+            ASSERT_LT(fd, 0);
+        } else {
+            ASSERT_GE(fd, 0);
+            ASSERT_EQ(fs_close(fs, fd), 0);
+            ASSERT_EQ(fs_remove(fs, path), 0);
+        }
+    }
+    ASSERT_LT(fs_remove(fs, "/big"), 0);
+    ASSERT_EQ(fs_remove(fs, "/big/renamed"), 0);
+
+    n_buckets = dir_entry_blocks(fs, &fs->inode_table[big], buckets);
+    ASSERT_GT(n_buckets, 1u);
+    const block_ptr_t index_ptr = fs->inode_table[big].data_ptrs[0];
+    ASSERT_EQ(fs_remove(fs, "/big"), 0);
+    ASSERT_TRUE(back_store_request(fs->bs, index_ptr));
+    for (size_t i = 0; i < n_buckets; ++i) {
+        ASSERT_TRUE(back_store_request(fs->bs, buckets[i]));
+    }
+
+    fs_unmount(fs);
+}
+
+TEST(s_tests, threads) {
+    const char *test_fname = "s_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    // one file everybody reads, written up front
+    const size_t shared_size = 300 * BLOCK_SIZE;  // into the double indirect blocks
+    vector<uint8_t> shared(shared_size);
+    for (size_t i = 0; i < shared_size; ++i) {
+        shared[i] = (uint8_t)(i * 7 + i / BLOCK_SIZE);
+    }
+    ASSERT_EQ(fs_create(fs, "/shared", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/shared");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, shared.data(), shared_size), (ssize_t) shared_size);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_create(fs, "/churn", FS_DIRECTORY), 0);
+
+    const int writers = 4, readers = 4, rounds = 20;
+    std::atomic<int> failures(0);
+    vector<std::thread> threads;
+
+    // writers: their own file each, write it in odd sized pieces, read it back
+    for (int t = 0; t < writers; ++t) {
+        threads.emplace_back([fs, t, &failures]() {
+            char path[32];
+            snprintf(path, sizeof(path), "/file_%d", t);
+            if (fs_create(fs, path, FS_REGULAR) != 0) {
+                ++failures;
+                return;
+            }
+            const int wfd = fs_open(fs, path);
+            vector<uint8_t> data(20 * BLOCK_SIZE + 123), back(data.size());
+            for (int round = 0; round < rounds && wfd >= 0; ++round) {
+                for (size_t i = 0; i < data.size(); ++i) {
+                    data[i] = (uint8_t)(t * 31 + round * 3 + i);
+                }
+                fs_seek(fs, wfd, 0, FS_SEEK_SET);
+                for (size_t done = 0, piece = 777; done < data.size(); done += piece) {
+                    piece = std::min(piece, data.size() - done);
+                    if (fs_write(fs, wfd, data.data() + done, piece) != (ssize_t) piece) {
+                        ++failures;
+                    }
+                }
+                fs_seek(fs, wfd, 0, FS_SEEK_SET);
+                if (fs_read(fs, wfd, back.data(), back.size()) != (ssize_t) back.size() || back != data) {
+                    ++failures;
+                }
+            }
+            if (wfd < 0 || fs_close(fs, wfd) != 0) {
+                ++failures;
+            }
+        });
+    }
+    // readers: all on the shared file at once, each through its own descriptor
+    for (int t = 0; t < readers; ++t) {
+        threads.emplace_back([fs, t, &shared, &failures]() {
+            const int rfd = fs_open(fs, "/shared");
+            vector<uint8_t> back(4096);
+            for (int round = 0; round < rounds * 4 && rfd >= 0; ++round) {
+                const size_t offset = ((size_t)(t * 5 + round * 13) * 1000) % (shared.size() - back.size());
+                if (fs_seek(fs, rfd, offset, FS_SEEK_SET) != (off_t) offset
+                    || fs_read(fs, rfd, back.data(), back.size()) != (ssize_t) back.size()
+                    || memcmp(back.data(), shared.data() + offset, back.size()) != 0) {
+                    ++failures;
+                }
+            }
+            if (rfd < 0 || fs_close(fs, rfd) != 0) {
+                ++failures;
+            }
+        });
+    }
+    // and somebody making and removing files the whole time
+    threads.emplace_back([fs, &failures]() {
+        char path[32];
+        for (int round = 0; round < rounds * 5; ++round) {
+            snprintf(path, sizeof(path), "/churn/tmp_%d", round % 20);
+            if (round >= 20 && fs_remove(fs, path) != 0) {
+                ++failures;
+            }
+            if (fs_create(fs, path, round % 3 ? FS_REGULAR : FS_DIRECTORY) != 0) {
+                ++failures;
+            }
+        }
+    });
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(failures.load(), 0);
+
+    dyn_array_t *record_results = fs_get_dir(fs, "/churn");
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_EQ(dyn_array_size(record_results), 20u);
+    dyn_array_destroy(record_results);
+    record_results = fs_get_dir(fs, "/");
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_EQ(dyn_array_size(record_results), (size_t)(writers + 2));
+    dyn_array_destroy(record_results);
+
+    // everything made it to disk in one piece
+    fs_unmount(fs);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    vector<uint8_t> back(shared_size);
+    fd = fs_open(fs, "/shared");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_read(fs, fd, back.data(), shared_size), (ssize_t) shared_size);
+    ASSERT_TRUE(back == shared);
+    for (int t = 0; t < writers; ++t) {
+        char path[32];
+        snprintf(path, sizeof(path), "/file_%d", t);
+        fd = fs_open(fs, path);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_read(fs, fd, back.data(), shared_size), (ssize_t)(20 * BLOCK_SIZE + 123));
+        ASSERT_EQ(back[0], (uint8_t)(t * 31 + (rounds - 1) * 3));
+    }
+    fs_unmount(fs);
+}
+
+TEST(t_tests, descriptor_table) {
+    const char *test_fname = "t_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/a", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/b", FS_REGULAR), 0);
+
+    // well past a chunk, alternating files
+    const int count = 5 * FD_CHUNK + 17;
+    vector<int> fds(count);
+    for (int i = 0; i < count; ++i) {
+        fds[i] = fs_open(fs, i % 2 ? "/b" : "/a");
+        ASSERT_EQ(fds[i], i);
+    }
+    ASSERT_EQ(fs->fd_table.unused, count);
+    ASSERT_NE(fs->fd_table.chunks[count / FD_CHUNK], nullptr);
+    ASSERT_EQ(fs->fd_table.chunks[count / FD_CHUNK + 1], nullptr);
+
+    // closed ones get handed back out, last closed first, and the table doesn't grow
+    ASSERT_EQ(fs_close(fs, fds[10]), 0);
+    ASSERT_EQ(fs_close(fs, fds[700]), 0);
+    ASSERT_EQ(fs_open(fs, "/a"), fds[700]);
+    ASSERT_EQ(fs_open(fs, "/a"), fds[10]);
+    ASSERT_EQ(fs->fd_table.unused, count);
+
+    // a write through one of /b's is seen by another of /b's
+    const char data[] = "descriptor";
+    ASSERT_EQ(fs_write(fs, fds[1], data, sizeof(data)), (ssize_t) sizeof(data));
+    char back[sizeof(data)];
+    ASSERT_EQ(fs_read(fs, fds[count - 2], back, sizeof(back)), (ssize_t) sizeof(back));
+    ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+
+    // removing /b closes exactly its descriptors, by way of its list
+    ASSERT_EQ(fs_remove(fs, "/b"), 0);
+    ASSERT_EQ(fs->fd_table.inode_fds[2], FD_NONE);
+    for (int i = 0; i < count; ++i) {
+        if (i % 2) {
+            ASSERT_LT(fs_seek(fs, fds[i], 0, FS_SEEK_SET), 0);
+        } else {
+            ASSERT_EQ(fs_seek(fs, fds[i], 0, FS_SEEK_SET), 0);
+        }
+    }
+
+    // /a still has its whole list, closing them all empties it
+    for (int i = 0; i < count; i += 2) {
+        ASSERT_EQ(fs_close(fs, fds[i]), 0);
+    }
+    ASSERT_EQ(fs->fd_table.inode_fds[1], FD_NONE);
+    ASSERT_LT(fs_close(fs, fds[0]), 0);
+    ASSERT_LT(fs_close(fs, DESCRIPTOR_MAX), 0);
+    ASSERT_LT(fs_close(fs, count + FD_CHUNK), 0);
+
+    fs_unmount(fs);
+}
+
+TEST(u_tests, extents) {
+    const char *test_fname = "u_tests.s16fs";
+    ASSERT_EQ(fs_format_layout(test_fname, (layout_t) 7), nullptr);
+    S16FS_t *fs = fs_format_layout(test_fname, FS_LAYOUT_EXTENTS);
+    ASSERT_NE(fs, nullptr);
+
+    // a big file written front to back is a handful of extents, no index
+    const size_t big_size = 3000 * BLOCK_SIZE + 77;
+    vector<uint8_t> data(big_size);
+    for (size_t i = 0; i < big_size; ++i) {
+        data[i] = (uint8_t)(i * 13 + i / BLOCK_SIZE);
+    }
+    ASSERT_EQ(fs_create(fs, "/big", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/big");
+    ASSERT_GE(fd, 0);
+    for (size_t done = 0; done < big_size; done += 4096) {
+        const size_t bytes = std::min((size_t) 4096, big_size - done);
+        ASSERT_EQ(fs_write(fs, fd, data.data() + done, bytes), (ssize_t) bytes);
+    }
+    const inode_t *big_inode = &fs->inode_table[FD_INODE(fs, fd)];
+    ASSERT_TRUE(big_inode->mdata.flags & INODE_EXTENTS);
+    ASSERT_FALSE(big_inode->mdata.flags & INODE_EXTENT_INDEXED);
+    extent_block_t leaf;
+    ASSERT_TRUE(full_read(fs, &leaf, big_inode->data_ptrs[0]));
+    ASSERT_GE(leaf.count, 1u);
+    ASSERT_LE(leaf.count, 4u);
+    block_ptr_t start;
+    size_t length;
+    ASSERT_TRUE(extent_lookup(fs, big_inode, 0, &start, &length));
+    ASSERT_NE(start, 0);
+    ASSERT_GT(length, (size_t) 256);
+
+    vector<uint8_t> back(big_size);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+    ASSERT_EQ(fs_read(fs, fd, back.data(), big_size), (ssize_t) big_size);
+    ASSERT_TRUE(back == data);
+    // ragged both ends
+    ASSERT_EQ(fs_seek(fs, fd, 1500, FS_SEEK_SET), 1500);
+    ASSERT_EQ(fs_read(fs, fd, back.data(), 5000), 5000);
+    ASSERT_EQ(memcmp(back.data(), data.data() + 1500, 5000), 0);
+
+    // a hole through the middle of an extent splits it, and reads as zeros
+    const size_t leaf_count = leaf.count;
+    ASSERT_EQ(fs_punch_hole(fs, fd, 100 * BLOCK_SIZE, 10 * BLOCK_SIZE), 0);
+    ASSERT_TRUE(full_read(fs, &leaf, big_inode->data_ptrs[0]));
+    ASSERT_EQ(leaf.count, leaf_count + 1);
+    memset(data.data() + 100 * BLOCK_SIZE, 0x00, 10 * BLOCK_SIZE);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+    ASSERT_EQ(fs_read(fs, fd, back.data(), big_size), (ssize_t) big_size);
+    ASSERT_TRUE(back == data);
+    // and writing it back fills it in
+    ASSERT_EQ(fs_seek(fs, fd, 100 * BLOCK_SIZE + 10, FS_SEEK_SET), 100 * BLOCK_SIZE + 10);
+    ASSERT_EQ(fs_write(fs, fd, "filled", 6), 6);
+    memcpy(data.data() + 100 * BLOCK_SIZE + 10, "filled", 6);
+
+    // two files growing a block at a time in turn end up fragmented, enough to split leaves
+    ASSERT_EQ(fs_create(fs, "/a", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/b", FS_REGULAR), 0);
+    int fd_a = fs_open(fs, "/a");
+    int fd_b = fs_open(fs, "/b");
+    uint8_t block[BLOCK_SIZE];
+    const int rounds = 600;
+    for (int i = 0; i < rounds; ++i) {
+        memset(block, i & 0xFF, sizeof(block));
+        ASSERT_EQ(fs_write(fs, fd_a, block, sizeof(block)), (ssize_t) sizeof(block));
+        memset(block, ~i & 0xFF, sizeof(block));
+        ASSERT_EQ(fs_write(fs, fd_b, block, sizeof(block)), (ssize_t) sizeof(block));
+    }
+    const inode_t *a_inode = &fs->inode_table[FD_INODE(fs, fd_a)];
+    ASSERT_TRUE(a_inode->mdata.flags & INODE_EXTENT_INDEXED);
+    extent_index_t index;
+    ASSERT_TRUE(full_read(fs, &index, a_inode->data_ptrs[0]));
+    ASSERT_GT(index.count, 1u);
+
+    // everything's still there after a remount, and new files still get extents
+    fs_unmount(fs);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/new", FS_REGULAR), 0);
+    result_t res;
+    locate_file(fs, "/new", &res);
+    ASSERT_TRUE(res.found);
+    ASSERT_TRUE(fs->inode_table[res.inode].mdata.flags & INODE_EXTENTS);
+
+    fd = fs_open(fs, "/big");
+    ASSERT_EQ(fs_read(fs, fd, back.data(), big_size), (ssize_t) big_size);
+    ASSERT_TRUE(back == data);
+    fd_a = fs_open(fs, "/a");
+    fd_b = fs_open(fs, "/b");
+    for (int i = 0; i < rounds; ++i) {
+        ASSERT_EQ(fs_read(fs, fd_a, block, sizeof(block)), (ssize_t) sizeof(block));
+        ASSERT_EQ(block[0], (uint8_t)(i & 0xFF));
+        ASSERT_EQ(block[BLOCK_SIZE - 1], (uint8_t)(i & 0xFF));
+        ASSERT_EQ(fs_read(fs, fd_b, block, sizeof(block)), (ssize_t) sizeof(block));
+        ASSERT_EQ(block[0], (uint8_t)(~i & 0xFF));
+    }
+
+    // shrinking gives back the index and leaves, down to nothing
+    ASSERT_EQ(fs_ftruncate(fs, fd_a, 10 * BLOCK_SIZE), 0);
+    a_inode = &fs->inode_table[FD_INODE(fs, fd_a)];
+    ASSERT_FALSE(a_inode->mdata.flags & INODE_EXTENT_INDEXED);
+    ASSERT_EQ(fs_seek(fs, fd_a, 9 * BLOCK_SIZE, FS_SEEK_SET), 9 * BLOCK_SIZE);
+    ASSERT_EQ(fs_read(fs, fd_a, block, 2 * BLOCK_SIZE), BLOCK_SIZE);
+    ASSERT_EQ(block[0], 9);
+    ASSERT_EQ(fs_ftruncate(fs, fd_a, 0), 0);
+    ASSERT_EQ(a_inode->data_ptrs[0], 0);
+    ASSERT_EQ(fs_remove(fs, "/b"), 0);
+    ASSERT_EQ(fs_remove(fs, "/big"), 0);
+
+    // with all that given back, a file as big as the first one fits again, in one piece
+    ASSERT_EQ(fs_create(fs, "/again", FS_REGULAR), 0);
+    fd = fs_open(fs, "/again");
+    ASSERT_EQ(fs_fallocate(fs, fd, 0, big_size), 0);
+    locate_file(fs, "/again", &res);
+    ASSERT_TRUE(extent_lookup(fs, &fs->inode_table[res.inode], 0, &start, &length));
+    ASSERT_NE(start, 0);
+    ASSERT_GE(length, big_size / BLOCK_SIZE);
+
+    fs_unmount(fs);
+}
+
+TEST(v_tests, inline_data) {
+    const char *test_fname = "v_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    // small enough to stay in the inode the whole time
+    ASSERT_EQ(fs_create(fs, "/lock", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/lock");
+    ASSERT_GE(fd, 0);
+    const inode_t *f_inode = &fs->inode_table[FD_INODE(fs, fd)];
+    ASSERT_TRUE(f_inode->mdata.flags & INODE_INLINE);
+    ASSERT_EQ(fs_write(fs, fd, "pid=12345", 9), 9);
+    ASSERT_EQ(fs_seek(fs, fd, 30, FS_SEEK_SET), 30);
+    ASSERT_EQ(fs_write(fs, fd, "tail", 4), 4);
+    ASSERT_TRUE(f_inode->mdata.flags & INODE_INLINE);
+    ASSERT_EQ(f_inode->mdata.size, 34u);
+    ASSERT_EQ(memcmp(INODE_INLINE_DATA(f_inode), "pid=12345", 9), 0);
+
+    char back[64];
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+    ASSERT_EQ(fs_read(fs, fd, back, sizeof(back)), 34);
+    ASSERT_EQ(memcmp(back, "pid=12345", 9), 0);
+    for (int i = 9; i < 30; ++i) {
+        ASSERT_EQ(back[i], 0);
+    }
+    ASSERT_EQ(memcmp(back + 30, "tail", 4), 0);
+
+    // truncate, punch, and reserving inside the inode all stay inline
+    ASSERT_EQ(fs_ftruncate(fs, fd, 5), 0);
+    ASSERT_EQ(fs_ftruncate(fs, fd, (size_t) INLINE_DATA_MAX), 0);
+    ASSERT_EQ(fs_punch_hole(fs, fd, 1, 2), 0);
+    ASSERT_EQ(fs_fallocate(fs, fd, 0, 10), 0);
+    ASSERT_TRUE(f_inode->mdata.flags & INODE_INLINE);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+    ASSERT_EQ(fs_read(fs, fd, back, sizeof(back)), (ssize_t) INLINE_DATA_MAX);
+    ASSERT_EQ(memcmp(back, "p\0\0=1", 5), 0);
+    for (size_t i = 5; i < INLINE_DATA_MAX; ++i) {
+        ASSERT_EQ(back[i], 0);
+    }
+
+    // still there after a remount
+    fs_unmount(fs);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    fd = fs_open(fs, "/lock");
+    f_inode = &fs->inode_table[FD_INODE(fs, fd)];
+    ASSERT_TRUE(f_inode->mdata.flags & INODE_INLINE);
+    ASSERT_EQ(fs_read(fs, fd, back, 5), 5);
+    ASSERT_EQ(memcmp(back, "p\0\0=1", 5), 0);
+
+    // one byte too many and it moves out to a block, same contents
+    ASSERT_EQ(fs_seek(fs, fd, INLINE_DATA_MAX, FS_SEEK_SET), (off_t) INLINE_DATA_MAX);
+    ASSERT_EQ(fs_write(fs, fd, "!", 1), 1);
+    ASSERT_FALSE(f_inode->mdata.flags & INODE_INLINE);
+    ASSERT_NE(f_inode->data_ptrs[0], 0);
+    for (int i = 1; i < 8; ++i) {
+        ASSERT_EQ(f_inode->data_ptrs[i], 0);
+    }
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+    ASSERT_EQ(fs_read(fs, fd, back, sizeof(back)), (ssize_t) INLINE_DATA_MAX + 1);
+    ASSERT_EQ(memcmp(back, "p\0\0=1", 5), 0);
+    ASSERT_EQ(back[INLINE_DATA_MAX], '!');
+
+    // inline bytes that happen to look like block ptrs don't get released with the file
+    uint8_t looks_like_ptrs[INLINE_DATA_MAX];
+    for (size_t i = 0; i < sizeof(looks_like_ptrs); ++i) {
+        looks_like_ptrs[i] = i % 2 ? 0x00 : ROOT_DIR_BLOCK;
+    }
+    ASSERT_EQ(fs_create(fs, "/ptrs", FS_REGULAR), 0);
+    fd = fs_open(fs, "/ptrs");
+    ASSERT_EQ(fs_write(fs, fd, looks_like_ptrs, sizeof(looks_like_ptrs)), (ssize_t) sizeof(looks_like_ptrs));
+    ASSERT_EQ(fs_remove(fs, "/ptrs"), 0);
+    ASSERT_FALSE(back_store_request(fs->bs, ROOT_DIR_BLOCK));
+    fs_unmount(fs);
+
+    // an extent mapped file moves out to an extent
+    fs = fs_format_layout(test_fname, FS_LAYOUT_EXTENTS);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/grow", FS_REGULAR), 0);
+    fd = fs_open(fs, "/grow");
+    f_inode = &fs->inode_table[FD_INODE(fs, fd)];
+    ASSERT_TRUE(f_inode->mdata.flags & INODE_INLINE);
+    ASSERT_EQ(fs_write(fs, fd, "small", 5), 5);
+    ASSERT_EQ(fs_ftruncate(fs, fd, 3 * BLOCK_SIZE), 0);
+    ASSERT_FALSE(f_inode->mdata.flags & INODE_INLINE);
+    ASSERT_TRUE(f_inode->mdata.flags & INODE_EXTENTS);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+    uint8_t block[3 * BLOCK_SIZE];
+    ASSERT_EQ(fs_read(fs, fd, block, sizeof(block)), (ssize_t) sizeof(block));
+    ASSERT_EQ(memcmp(block, "small", 5), 0);
+    for (size_t i = 5; i < sizeof(block); ++i) {
+        ASSERT_EQ(block[i], 0);
+    }
+    fs_unmount(fs);
+}
+
+/*
+    fs_format_journaled
+    1. Normal, the log is carved out of data space
+    2. Normal, metadata changes wait in the transaction until a commit
+    3. Normal, freed blocks can't be reused until the commit
+    4. Normal, survives unmount/mount
+    5. Crash before a commit, the tree is what the last commit left
+    6. Crash after the log went out but before anything went home, replay puts it all back
+    7. Torn log (bad checksum), ignored
+*/
+TEST(w_tests, journal) {
+    const char *test_fname = "w_tests.s16fs";
+    S16FS_t *fs = fs_format_journaled(test_fname, FS_LAYOUT_BLOCKS);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_NE(fs->journal, nullptr);
+    ASSERT_EQ(fs_format_journaled(test_fname, (layout_t) 7), nullptr);
+
+    // 1
+    for (block_ptr_t b = JOURNAL_BLOCK_OFFSET; b < JOURNAL_BLOCK_OFFSET + JOURNAL_BLOCK_TOTAL; ++b) {
+        ASSERT_FALSE(back_store_request(fs->bs, b));
+    }
+
+    // 2
+    uint8_t data[20 * BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (uint8_t)(i * 7 + i / BLOCK_SIZE);
+    }
+    ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/dir/a", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/dir/a");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t) sizeof(data));
+    ASSERT_GT(fs->journal->count, 0u);
+    ASSERT_EQ(fs_sync(fs), 0);
+    ASSERT_EQ(fs->journal->count, 0u);
+    journal_header_t header;
+    ASSERT_TRUE(back_store_read(fs->bs, JOURNAL_BLOCK_OFFSET, &header));
+    ASSERT_EQ(header.magic, 0u);
+    ASSERT_GT(header.count, 0u);
+
+    // 3
+    const block_ptr_t freed = fs->inode_table[FD_INODE(fs, fd)].data_ptrs[0];
+    ASSERT_NE(freed, 0);
+    ASSERT_EQ(fs_remove(fs, "/dir/a"), 0);
+    ASSERT_FALSE(back_store_request(fs->bs, freed));
+    ASSERT_EQ(fs_sync(fs), 0);
+    ASSERT_TRUE(back_store_request(fs->bs, freed));
+    back_store_release(fs->bs, freed);
+
+    // 4
+    ASSERT_EQ(fs_create(fs, "/dir/b", FS_REGULAR), 0);
+    fd = fs_open(fs, "/dir/b");
+    ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t) sizeof(data));
+    ASSERT_EQ(fs_move(fs, "/dir/b", "/b"), 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_NE(fs->journal, nullptr);
+    uint8_t back[sizeof(data)];
+    fd = fs_open(fs, "/b");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_read(fs, fd, back, sizeof(back)), (ssize_t) sizeof(back));
+    ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+
+    // 5
+    ASSERT_EQ(fs_create(fs, "/dir/c", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/b"), 0);
+    ASSERT_EQ(system("cp w_tests.s16fs w_tests_before.s16fs"), 0);
+    ASSERT_EQ(system("cp w_tests.s16fs w_tests_crash.s16fs"), 0);
+    S16FS_t *crashed = fs_mount("w_tests_crash.s16fs");
+    ASSERT_NE(crashed, nullptr);
+    ASSERT_EQ(fs_open(crashed, "/dir/c"), -1);
+    fd = fs_open(crashed, "/b");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_read(crashed, fd, back, sizeof(back)), (ssize_t) sizeof(back));
+    ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+    ASSERT_EQ(fs_unmount(crashed), 0);
+
+    // 6
+    // the commit unmount does, copied into the fs from before it, with nothing home yet
+    ASSERT_EQ(fs_unmount(fs), 0);
+    back_store_t *bs = back_store_open(test_fname);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_TRUE(back_store_read(bs, JOURNAL_BLOCK_OFFSET, &header));
+    ASSERT_EQ(header.magic, 0u);
+    ASSERT_GT(header.count, 0u);
+    const size_t logged = JOURNAL_FBM_BLOCKS + header.count;
+    std::vector<uint8_t> log(logged * BLOCK_SIZE);
+    for (size_t i = 0; i < logged; ++i) {
+        ASSERT_TRUE(back_store_read(bs, JOURNAL_BLOCK_OFFSET + 1 + i, &log[i * BLOCK_SIZE]));
+    }
+    back_store_close(bs);
+    header.magic = JOURNAL_MAGIC;
+    ASSERT_EQ(system("cp w_tests_before.s16fs w_tests_crash.s16fs"), 0);
+    bs = back_store_open("w_tests_crash.s16fs");
+    ASSERT_NE(bs, nullptr);
+    ASSERT_TRUE(back_store_write(bs, JOURNAL_BLOCK_OFFSET, &header));
+    for (size_t i = 0; i < logged; ++i) {
+        ASSERT_TRUE(back_store_write(bs, JOURNAL_BLOCK_OFFSET + 1 + i, &log[i * BLOCK_SIZE]));
+    }
+    back_store_close(bs);
+    crashed = fs_mount("w_tests_crash.s16fs");
+    ASSERT_NE(crashed, nullptr);
+    ASSERT_TRUE(back_store_read(crashed->bs, JOURNAL_BLOCK_OFFSET, &header));
+    ASSERT_EQ(header.magic, 0u);
+    ASSERT_EQ(fs_open(crashed, "/b"), -1);
+    ASSERT_GE(fs_open(crashed, "/dir/c"), 0);
+    dyn_array_t *record_results = fs_get_dir(crashed, "/");
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_EQ(dyn_array_size(record_results), 1u);
+    ASSERT_TRUE(find_in_directory(record_results, "dir"));
+    dyn_array_destroy(record_results);
+    // and /b's blocks came back with the map
+    ASSERT_TRUE(back_store_request(crashed->bs, freed));
+    ASSERT_EQ(fs_unmount(crashed), 0);
+
+    // 7
+    header.magic = JOURNAL_MAGIC;
+    log[JOURNAL_FBM_BLOCKS * BLOCK_SIZE] ^= 0xFF;
+    ASSERT_EQ(system("cp w_tests_before.s16fs w_tests_crash.s16fs"), 0);
+    bs = back_store_open("w_tests_crash.s16fs");
+    ASSERT_NE(bs, nullptr);
+    ASSERT_TRUE(back_store_write(bs, JOURNAL_BLOCK_OFFSET, &header));
+    for (size_t i = 0; i < logged; ++i) {
+        ASSERT_TRUE(back_store_write(bs, JOURNAL_BLOCK_OFFSET + 1 + i, &log[i * BLOCK_SIZE]));
+    }
+    back_store_close(bs);
+    crashed = fs_mount("w_tests_crash.s16fs");
+    ASSERT_NE(crashed, nullptr);
+    ASSERT_EQ(fs_open(crashed, "/dir/c"), -1);
+    ASSERT_GE(fs_open(crashed, "/b"), 0);
+    ASSERT_EQ(fs_unmount(crashed), 0);
+}
+
+/*
+    Superblock and check_fs
+    1. Normal, mounted is unclean, a clean unmount records the counts
+    2. Normal, a clean mount is trusted as is (a leaked block stays leaked)
+    3. Crash, mount checks: dangling entries, orphans, broken and cross-linked maps, leaked blocks
+    4. Crash, a journaled fs keeps its log reserved through the check
+*/
+TEST(x_tests, superblock_check) {
+    const char *test_fname = "x_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    // 1
+    superblock_t super;
+    superblock_read(fs, &super);
+    ASSERT_EQ(super.magic, SUPERBLOCK_MAGIC);
+    ASSERT_FALSE(super.clean);
+    uint8_t data[3 * BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (uint8_t)(i * 13);
+    }
+    ASSERT_EQ(fs_create(fs, "/keep", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/keep");
+    ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t) sizeof(data));
+    ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/dir/inner", FS_REGULAR), 0);
+    fd = fs_open(fs, "/dir/inner");
+    ASSERT_EQ(fs_write(fs, fd, "hi", 2), 2);
+    ASSERT_EQ(fs_unmount(fs), 0);
+    back_store_t *bs = back_store_open(test_fname);
+    ASSERT_NE(bs, nullptr);
+    inode_t disk_inodes[INODES_PER_BOCK];
+    ASSERT_TRUE(back_store_read(bs, INODE_BLOCK_OFFSET, disk_inodes));
+    memcpy(&super, disk_inodes[0].mdata.padding, sizeof(super));
+    ASSERT_TRUE(super.clean);
+    ASSERT_EQ(super.free_inodes, INODE_TOTAL - 4);
+    // root's block, /keep's 3, /dir's
+    ASSERT_EQ(super.free_blocks, DATA_BLOCK_MAX - DATA_BLOCK_OFFSET - 5);
+    back_store_close(bs);
+
+    // 2
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_TRUE(back_store_read(fs->bs, INODE_BLOCK_OFFSET, disk_inodes));
+    memcpy(&super, disk_inodes[0].mdata.padding, sizeof(super));
+    ASSERT_FALSE(super.clean);
+    const unsigned leaked = back_store_allocate(fs->bs);
+    ASSERT_NE(leaked, 0u);
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_FALSE(back_store_request(fs->bs, leaked));
+
+    // 3
+    // an inode nothing points at, holding a block
+    const unsigned orphan_block = back_store_allocate(fs->bs);
+    const inode_ptr_t orphan = find_free_inode(fs);
+    inode_t crafted = {"orphan", {BLOCK_SIZE, 0777, 0, 0, 0, 0, FS_REGULAR, 0, {0}}, {(block_ptr_t) orphan_block}};
+    ASSERT_TRUE(write_inode(fs, &crafted, orphan));
+    // an entry pointing at nothing
+    ASSERT_TRUE(dir_add_entry(fs, 0, "ghost", INODE_TOTAL - 1));
+    // a map pointing into the inode table
+    ASSERT_EQ(fs_create(fs, "/bad", FS_REGULAR), 0);
+    fd = fs_open(fs, "/bad");
+    const inode_ptr_t bad = FD_INODE(fs, fd);
+    crafted = fs->inode_table[bad];
+    crafted.mdata.size = BLOCK_SIZE;
+    crafted.mdata.flags = 0;
+    memset(crafted.data_ptrs, 0x00, sizeof(crafted.data_ptrs));
+    crafted.data_ptrs[0] = INODE_BLOCK_OFFSET;
+    ASSERT_TRUE(write_inode(fs, &crafted, bad));
+    // two files with the same block
+    ASSERT_EQ(fs_create(fs, "/shared_a", FS_REGULAR), 0);
+    fd = fs_open(fs, "/shared_a");
+    ASSERT_EQ(fs_write(fs, fd, data, BLOCK_SIZE), BLOCK_SIZE);
+    const inode_ptr_t shared_a = FD_INODE(fs, fd);
+    const block_ptr_t shared = fs->inode_table[shared_a].data_ptrs[0];
+    ASSERT_EQ(fs_create(fs, "/shared_b", FS_REGULAR), 0);
+    fd = fs_open(fs, "/shared_b");
+    const inode_ptr_t shared_b = FD_INODE(fs, fd);
+    crafted = fs->inode_table[shared_b];
+    crafted.mdata.size = BLOCK_SIZE;
+    crafted.mdata.flags = 0;
+    memset(crafted.data_ptrs, 0x00, sizeof(crafted.data_ptrs));
+    crafted.data_ptrs[0] = shared;
+    ASSERT_TRUE(write_inode(fs, &crafted, shared_b));
+    ASSERT_EQ(fs_sync(fs), 0);
+    ASSERT_EQ(system("cp x_tests.s16fs x_tests_crash.s16fs"), 0);
+
+    S16FS_t *crashed = fs_mount("x_tests_crash.s16fs");
+    ASSERT_NE(crashed, nullptr);
+    dyn_array_t *record_results = fs_get_dir(crashed, "/");
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_FALSE(find_in_directory(record_results, "ghost"));
+    ASSERT_EQ(dyn_array_size(record_results), 5u);
+    dyn_array_destroy(record_results);
+    ASSERT_FALSE(bitmap_test(crashed->inode_map, orphan));
+    ASSERT_EQ(crashed->inode_table[bad].mdata.size, 0u);
+    ASSERT_TRUE(crashed->inode_table[bad].mdata.flags & INODE_INLINE);
+    // one of them keeps it, the other's emptied
+    ASSERT_NE(crashed->inode_table[shared_a].mdata.size == 0, crashed->inode_table[shared_b].mdata.size == 0);
+    ASSERT_FALSE(back_store_request(crashed->bs, shared));
+    ASSERT_FALSE(back_store_request(crashed->bs, INODE_BLOCK_OFFSET));
+    // and everything nothing uses is free again
+    ASSERT_TRUE(back_store_request(crashed->bs, leaked));
+    ASSERT_TRUE(back_store_request(crashed->bs, orphan_block));
+    back_store_release(crashed->bs, leaked);
+    back_store_release(crashed->bs, orphan_block);
+    uint8_t back[sizeof(data)];
+    fd = fs_open(crashed, "/keep");
+    ASSERT_EQ(fs_read(crashed, fd, back, sizeof(back)), (ssize_t) sizeof(back));
+    ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+    fd = fs_open(crashed, "/dir/inner");
+    ASSERT_EQ(fs_read(crashed, fd, back, sizeof(back)), 2);
+    ASSERT_EQ(memcmp(back, "hi", 2), 0);
+    // checked, so it's all consistent, and unmounts clean
+    ASSERT_EQ(fs_unmount(crashed), 0);
+    crashed = fs_mount("x_tests_crash.s16fs");
+    ASSERT_NE(crashed, nullptr);
+    ASSERT_EQ(fs_unmount(crashed), 0);
+    fs_unmount(fs);
+
+    // 4
+    fs = fs_format_journaled(test_fname, FS_LAYOUT_EXTENTS);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/keep", FS_REGULAR), 0);
+    fd = fs_open(fs, "/keep");
+    ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t) sizeof(data));
+    ASSERT_NE(back_store_allocate(fs->bs), 0u);
+    ASSERT_EQ(fs_sync(fs), 0);
+    ASSERT_EQ(system("cp x_tests.s16fs x_tests_crash.s16fs"), 0);
+    crashed = fs_mount("x_tests_crash.s16fs");
+    ASSERT_NE(crashed, nullptr);
+    ASSERT_NE(crashed->journal, nullptr);
+    for (block_ptr_t b = JOURNAL_BLOCK_OFFSET; b < JOURNAL_BLOCK_OFFSET + JOURNAL_BLOCK_TOTAL; ++b) {
+        ASSERT_FALSE(back_store_request(crashed->bs, b));
+    }
+    fd = fs_open(crashed, "/keep");
+    ASSERT_EQ(fs_read(crashed, fd, back, sizeof(back)), (ssize_t) sizeof(back));
+    ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+    ASSERT_EQ(fs_unmount(crashed), 0);
+    crashed = fs_mount("x_tests_crash.s16fs");
+    ASSERT_NE(crashed, nullptr);
+    superblock_read(crashed, &super);
+    ASSERT_EQ(super.free_blocks, DATA_BLOCK_MAX - DATA_BLOCK_OFFSET - JOURNAL_BLOCK_TOTAL - 5);
+    ASSERT_EQ(fs_unmount(crashed), 0);
+    fs_unmount(fs);
+}
+
+/*
+    Free inode list
+    1. Normal, the most recently freed inode is the next one handed out
+    2. Normal, the table fills up and empties back out, the count follows along
+    3. Normal, an inode taken out of the middle of the list leaves the rest intact
+    4. Normal, mount lays it back out lowest first
+*/
+TEST(y_tests, free_inode_list) {
+    const char *test_fname = "y_tests.s16fs";
+    S16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs->inode_free_count, INODE_TOTAL - 1);
+    ASSERT_EQ(find_free_inode(fs), 1);
+
+    // 1
+    ASSERT_EQ(fs_create(fs, "/a", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/b", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/c", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/b"), 0);
+    ASSERT_EQ(find_free_inode(fs), 2);
+    ASSERT_EQ(fs_remove(fs, "/a"), 0);
+    ASSERT_EQ(find_free_inode(fs), 1);
+    ASSERT_EQ(fs_create(fs, "/d", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/e", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/c"), 0);
+    ASSERT_EQ(fs_remove(fs, "/d"), 0);
+    ASSERT_EQ(fs_remove(fs, "/e"), 0);
+    ASSERT_EQ(fs->inode_free_count, INODE_TOTAL - 1);
+
+    // 2
+    char path[16];
+    for (size_t i = 1; i < INODE_TOTAL; ++i) {
+        snprintf(path, sizeof(path), "/f%zu", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+    }
+    ASSERT_EQ(fs->inode_free_count, 0u);
+    ASSERT_EQ(find_free_inode(fs), 0);
+    ASSERT_LT(fs_create(fs, "/one_more", FS_REGULAR), 0);
+    for (size_t i = 1; i < INODE_TOTAL; ++i) {
+        snprintf(path, sizeof(path), "/f%zu", i);
+        ASSERT_EQ(fs_remove(fs, path), 0);
+    }
+    ASSERT_EQ(fs->inode_free_count, INODE_TOTAL - 1);
+
+    // 3
+    const inode_ptr_t head = find_free_inode(fs);
+    const inode_ptr_t middle = head == 100 ? 101 : 100;
+    inode_t crafted = {"middle", {0, 0777, 0, 0, 0, 0, FS_REGULAR, INODE_INLINE, {0}}, {0}};
+    ASSERT_TRUE(write_inode(fs, &crafted, middle));
+    ASSERT_TRUE(dir_add_entry(fs, 0, "middle", middle));
+    ASSERT_EQ(find_free_inode(fs), head);
+    std::vector<bool> handed_out(INODE_TOTAL, false);
+    for (size_t i = 2; i < INODE_TOTAL; ++i) {
+        const inode_ptr_t next = find_free_inode(fs);
+        ASSERT_NE(next, 0);
+        ASSERT_NE(next, middle);
+        ASSERT_FALSE(handed_out[next]);
+        handed_out[next] = true;
+        snprintf(path, sizeof(path), "/g%zu", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+    }
+    ASSERT_EQ(find_free_inode(fs), 0);
+
+    // 4
+    for (size_t i = 2; i < INODE_TOTAL; i += 2) {
+        snprintf(path, sizeof(path), "/g%zu", i);
+        ASSERT_EQ(fs_remove(fs, path), 0);
+    }
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs->inode_free_count, (INODE_TOTAL - 2) / 2);
+    inode_ptr_t lowest = 0;
+    while (bitmap_test(fs->inode_map, lowest)) {
+        ++lowest;
+    }
+    ASSERT_EQ(find_free_inode(fs), lowest);
+    fs_unmount(fs);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     ::testing::AddGlobalTestEnvironment(new GradeEnvironment);
@@ -70,5 +70,64 @@ size_t bitmap_get_bytes(const bitmap_t *const bitmap);
 ///
 bool bitmap_destroy(bitmap_t *bitmap);
 
+///
+/// Hierarchical bitmap
+/// Same bit layout as bitmap_t, plus a summary level with one bit per
+/// 64 bit word recording "word has a zero". ffz only descends into words
+/// whose summary bit is set, so it costs the same on a nearly full map as on an empty one.
+/// Only use the hbitmap_ functions on it so the summary stays in sync.
+///
+typedef struct hbitmap hbitmap_t;
+
+///
+/// Creates a hierarchical bitmap to contain 'n' bits (zero initialized)
+/// \param n_bits
+/// \return New hbitmap pointer, NULL on error
+///
+hbitmap_t *hbitmap_create(const size_t n_bits);
+
+///
+/// Creates a hierarchical bitmap on top of existing bit data (ex: an mmap'd FBM)
+///   The data is not copied or freed, the summary is built from its current contents
+/// \param n_bits
+/// \param data The bit data to use, at least ceil(n_bits / 8) bytes
+/// \return New hbitmap pointer, NULL on error
+///
+hbitmap_t *hbitmap_overlay(const size_t n_bits, void *const data);
+
+///
+/// Sets the requested bit, updating the summary
+/// \param bitmap The hbitmap
+/// \param bit The bit to set
+///
+bool hbitmap_set(hbitmap_t *const bitmap, const size_t bit);
+
+///
+/// Clears the requested bit, updating the summary
+/// \param bitmap The hbitmap
+/// \param bit The bit to be cleared
+///
+bool hbitmap_reset(hbitmap_t *const bitmap, const size_t bit);
+
+///
+/// Returns bit in hbitmap
+/// \param bitmap The hbitmap
+/// \param bit The bit to queried
+/// \return State of requested bit
+///
+bool hbitmap_test(const hbitmap_t *const bitmap, const size_t bit);
+
+/// Find first zero bit, using the summary
+/// \param bitmap The hbitmap
+/// \return The first zero bit address, SIZE_MAX on error/Not found
+///
+size_t hbitmap_ffz(const hbitmap_t *const bitmap);
+
+/// Destructs and destroys hbitmap object (overlaid data is left alone)
+/// \param bitmap The hbitmap
+/// \return The Success or Failure of destruct and destroy hbitmap object
+///
+bool hbitmap_destroy(hbitmap_t *bitmap);
+
 #endif
 
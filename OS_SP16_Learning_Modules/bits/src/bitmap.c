@@ -1,5 +1,11 @@
 #include "../include/bitmap.h"
 
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 // data is an array of uint8_t and needs to be allocated in bitmap_create
 //      and used in the remaining bitmap functions. You will use data for any bit operations and bit logic   
 // bit_count the number of requested bits, set in bitmap_create from n_bits
@@ -84,17 +90,74 @@ bool bitmap_test(const bitmap_t *const bitmap, const size_t bit) {
 	return false;
 }
 
+/* word-at-a-time scanning helpers for ffs/ffz
+*  data is still a byte array (bit 0 is the low bit of data[0]) so a word is
+*  assembled from up to 8 bytes, which also keeps us from reading past byte_count
+*/
+#define BITMAP_WORD_BITS 64
+#define BITMAP_WORD_BYTES 8
+
+static inline size_t bitmap_word_count(const bitmap_t *const bitmap) {
+    return (bitmap->byte_count + BITMAP_WORD_BYTES - 1) / BITMAP_WORD_BYTES;
+}
+
+static inline uint64_t bitmap_load_word(const bitmap_t *const bitmap, const size_t word) {
+    uint64_t value = 0;
+    size_t offset = word * BITMAP_WORD_BYTES;
+    if(offset + BITMAP_WORD_BYTES <= bitmap->byte_count) {
+        // fixed size copy, the compiler turns this into a single load
+        memcpy(&value, bitmap->data + offset, BITMAP_WORD_BYTES);
+    } else {
+        memcpy(&value, bitmap->data + offset, bitmap->byte_count - offset);
+    }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+// mask of the bits in a word that actually belong to the bitmap
+static inline uint64_t bitmap_valid_mask(const bitmap_t *const bitmap, const size_t word) {
+    size_t remaining = bitmap->bit_count - word * BITMAP_WORD_BITS;
+    if(remaining >= BITMAP_WORD_BITS) {
+        return ~(uint64_t)0;
+    }
+    return ((uint64_t)1 << remaining) - 1;
+}
+
+#if defined(__AVX2__)
+// skips 256 bit chunks that are all ones (skip_ones) or all zeros (!skip_ones)
+// only looks at chunks entirely inside byte_count, returns the word to resume at
+static size_t bitmap_skip_chunks(const bitmap_t *const bitmap, size_t word, const bool skip_ones) {
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    while((word + 4) * BITMAP_WORD_BYTES <= bitmap->byte_count) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(bitmap->data + word * BITMAP_WORD_BYTES));
+        if(skip_ones ? !_mm256_testc_si256(chunk, ones) : !_mm256_testz_si256(chunk, chunk)) {
+            break;
+        }
+        word += 4;
+    }
+    return word;
+}
+#endif
+
 size_t bitmap_ffs(const bitmap_t *const bitmap) {
     if(!bitmap) {
         return SIZE_MAX;
     }
-    /* iterate over each bit
-    *  test each bit until first set bit is found by bitmap_test
-    *  if/when found return bit
+    /* iterate over each 64 bit word
+    *  empty words are skipped whole (32 bytes at a time with AVX2)
+    *  first non-empty word gives us the bit with a count trailing zeros
     */
-    for(size_t bit = 0; bit < bitmap->bit_count; bit++){
-        if(bitmap_test(bitmap,bit)) {
-            return bit;
+    const size_t words = bitmap_word_count(bitmap);
+    size_t word = 0;
+#if defined(__AVX2__)
+    word = bitmap_skip_chunks(bitmap, word, false);
+#endif
+    for(; word < words; word++) {
+        uint64_t value = bitmap_load_word(bitmap, word) & bitmap_valid_mask(bitmap, word);
+        if(value) {
+            return word * BITMAP_WORD_BITS + __builtin_ctzll(value);
         }
     }
     // no set bit found, return SIZE_MAX
@@ -105,13 +168,19 @@ size_t bitmap_ffz(const bitmap_t *const bitmap) {
     if(!bitmap) {
         return SIZE_MAX;
     }
-    /* iterate over each bit
-    *  test each bit until first zero bit is found but !bitmap_test
-    *	if/when found return bit
+    /* iterate over each 64 bit word
+    *  full words are skipped whole (32 bytes at a time with AVX2)
+    *  first word with a zero gives us the bit with a count trailing zeros of the inverse
     */
-    for(size_t bit = 0; bit < bitmap->bit_count; bit++){
-        if(!bitmap_test(bitmap,bit)) {
-            return bit;
+    const size_t words = bitmap_word_count(bitmap);
+    size_t word = 0;
+#if defined(__AVX2__)
+    word = bitmap_skip_chunks(bitmap, word, true);
+#endif
+    for(; word < words; word++) {
+        uint64_t value = ~bitmap_load_word(bitmap, word) & bitmap_valid_mask(bitmap, word);
+        if(value) {
+            return word * BITMAP_WORD_BITS + __builtin_ctzll(value);
         }
     }
     // no zero bit found, return SIZE_MAX
@@ -128,4 +197,119 @@ bool bitmap_destroy(bitmap_t *bitmap) {
     free(bitmap);
     
 	return true;
-}
\ No newline at end of file
+}
+
+/* hierarchical bitmap
+*  base is a normal bitmap (so all the word scan helpers work on it)
+*  summary has one bit per base word, set when that word has a zero bit in it
+*  overlay says base.data belongs to someone else and must not be freed
+*/
+struct hbitmap {
+    bitmap_t base;
+    uint64_t *summary;
+    size_t word_count, summary_count;
+    bool overlay;
+};
+
+// recompute the summary bit for the word holding bit
+static inline void hbitmap_update(hbitmap_t *const bitmap, const size_t bit) {
+    size_t word = bit / BITMAP_WORD_BITS;
+    uint64_t flag = (uint64_t)1 << (word % BITMAP_WORD_BITS);
+    if(~bitmap_load_word(&bitmap->base, word) & bitmap_valid_mask(&bitmap->base, word)) {
+        bitmap->summary[word / BITMAP_WORD_BITS] |= flag;
+    } else {
+        bitmap->summary[word / BITMAP_WORD_BITS] &= ~flag;
+    }
+}
+
+static hbitmap_t *hbitmap_init(const size_t n_bits, void *const data) {
+    if(n_bits == 0 || n_bits == SIZE_MAX) {
+        return NULL;
+    }
+    hbitmap_t *bitmap = (hbitmap_t *)calloc(1, sizeof(hbitmap_t));
+    if(!bitmap) {
+        return NULL;
+    }
+    bitmap->base.bit_count = n_bits;
+    bitmap->base.byte_count = (n_bits + 7) / 8;
+    bitmap->word_count = bitmap_word_count(&bitmap->base);
+    bitmap->summary_count = (bitmap->word_count + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+    bitmap->overlay = (data != NULL);
+    bitmap->base.data = data ? (uint8_t *)data : (uint8_t *)calloc(bitmap->base.byte_count, sizeof(uint8_t));
+    bitmap->summary = (uint64_t *)calloc(bitmap->summary_count, sizeof(uint64_t));
+    if(!bitmap->base.data || !bitmap->summary) {
+        hbitmap_destroy(bitmap);
+        return NULL;
+    }
+    // every word gets its summary bit from whatever is in data right now
+    for(size_t word = 0; word < bitmap->word_count; word++) {
+        hbitmap_update(bitmap, word * BITMAP_WORD_BITS);
+    }
+    return bitmap;
+}
+
+hbitmap_t *hbitmap_create(const size_t n_bits) {
+    return hbitmap_init(n_bits, NULL);
+}
+
+hbitmap_t *hbitmap_overlay(const size_t n_bits, void *const data) {
+    if(!data) {
+        return NULL;
+    }
+    return hbitmap_init(n_bits, data);
+}
+
+bool hbitmap_set(hbitmap_t *const bitmap, const size_t bit) {
+    if(!bitmap || bit >= bitmap->base.bit_count) {
+        return false;
+    }
+    bitmap_set(&bitmap->base, bit);
+    hbitmap_update(bitmap, bit);
+    return true;
+}
+
+bool hbitmap_reset(hbitmap_t *const bitmap, const size_t bit) {
+    if(!bitmap || bit >= bitmap->base.bit_count) {
+        return false;
+    }
+    bitmap_reset(&bitmap->base, bit);
+    hbitmap_update(bitmap, bit);
+    return true;
+}
+
+bool hbitmap_test(const hbitmap_t *const bitmap, const size_t bit) {
+    if(!bitmap || bit >= bitmap->base.bit_count) {
+        return false;
+    }
+    return bitmap_test(&bitmap->base, bit);
+}
+
+size_t hbitmap_ffz(const hbitmap_t *const bitmap) {
+    if(!bitmap) {
+        return SIZE_MAX;
+    }
+    /* find the first summary word with a bit set (a base word with a zero in it)
+    *  then go down into just that one base word
+    */
+    for(size_t i = 0; i < bitmap->summary_count; i++) {
+        if(bitmap->summary[i]) {
+            size_t word = i * BITMAP_WORD_BITS + __builtin_ctzll(bitmap->summary[i]);
+            uint64_t value = ~bitmap_load_word(&bitmap->base, word) & bitmap_valid_mask(&bitmap->base, word);
+            return word * BITMAP_WORD_BITS + __builtin_ctzll(value);
+        }
+    }
+    // summary is empty, so every word is full
+    return SIZE_MAX;
+}
+
+bool hbitmap_destroy(hbitmap_t *bitmap) {
+    if(!bitmap) {
+        return false;
+    }
+    if(!bitmap->overlay) {
+        free(bitmap->base.data);
+    }
+    free(bitmap->summary);
+    free(bitmap);
+    return true;
+}
@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <math.h>
+#include "../src/bitmap.c"
+
+/*
+ *	BITMAP ALLOCATION BENCHMARK
+ *	back_store_allocate is a bitmap_ffz followed by a bitmap_set on a 65536 bit FBM
+ *	so that's what gets timed here, at a few different fill levels
+ **/
+
+#define BENCH_BITS 65536
+#define BENCH_ROUNDS 20000
+
+// the old bit-at-a-time scan, kept here so we have something to compare against
+static size_t naive_ffz(const bitmap_t *const bitmap) {
+	for(size_t bit = 0; bit < bitmap->bit_count; bit++) {
+		if(!bitmap_test(bitmap, bit)) {
+			return bit;
+		}
+	}
+	return SIZE_MAX;
+}
+
+// allocate (find + set) then release so the fill level stays put
+static double time_allocate(bitmap_t *bitmap, size_t (*find)(const bitmap_t *const)) {
+	volatile size_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < BENCH_ROUNDS; ++i) {
+		size_t bit = find(bitmap);
+		bitmap_set(bitmap, bit);
+		bitmap_reset(bitmap, bit);
+		sink = sink + bit;
+	}
+	auto stop = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(stop - start).count() / BENCH_ROUNDS;
+}
+
+// same thing through the summary level
+static double time_allocate_summary(hbitmap_t *bitmap) {
+	volatile size_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < BENCH_ROUNDS; ++i) {
+		size_t bit = hbitmap_ffz(bitmap);
+		hbitmap_set(bitmap, bit);
+		hbitmap_reset(bitmap, bit);
+		sink = sink + bit;
+	}
+	auto stop = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(stop - start).count() / BENCH_ROUNDS;
+}
+
+int main() {
+	// allocation always hands out the lowest block, so a store fills from the bottom up
+	const struct { const char *name; size_t used; } levels[] = {
+		{"empty", 8},
+		{"half-full", BENCH_BITS / 2},
+		{"almost-full", BENCH_BITS - 16},
+	};
+
+	printf("%-12s %14s %14s %14s\n", "fill", "bit scan (ns)", "word scan (ns)", "summary (ns)");
+	for(size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+		bitmap_t *bitmap = bitmap_create(BENCH_BITS);
+		if(!bitmap) {
+			return 1;
+		}
+		for(size_t i = 0; i < levels[l].used; ++i) {
+			bitmap_set(bitmap, i);
+		}
+		double naive = time_allocate(bitmap, naive_ffz);
+		double word = time_allocate(bitmap, bitmap_ffz);
+		hbitmap_t *summary = hbitmap_overlay(BENCH_BITS, bitmap->data);
+		if(!summary) {
+			return 1;
+		}
+		double summarized = time_allocate_summary(summary);
+		printf("%-12s %14.1f %14.1f %14.1f\n", levels[l].name, naive, word, summarized);
+		hbitmap_destroy(summary);
+		bitmap_destroy(bitmap);
+	}
+	return 0;
+}
@@ -377,6 +377,117 @@ TEST(bitmap_ffs, GoodffsC) {
 	bitmap_destroy(bitmap_A);
  }
 
+// bits in the last, partial word and words past the first one
+// make sure the word scan doesn't report padding bits
+ TEST(bitmap_ffz, GoodffzWordScan) {
+ 	bitmap_t *bitmap_A;
+	size_t test_bit_count = 65536;
+	bitmap_A = bitmap_create(test_bit_count);
+	ASSERT_NE(bitmap_A,(bitmap_t*)NULL);
+	for(size_t i = 0; i < test_bit_count; ++i) {
+		if(i == 40000)
+			continue;
+		else
+			EXPECT_EQ(true, bitmap_set(bitmap_A, i));
+	}
+	EXPECT_EQ(40000, bitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, bitmap_set(bitmap_A, 40000));
+	EXPECT_EQ(SIZE_MAX, bitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, bitmap_reset(bitmap_A, test_bit_count - 1));
+	EXPECT_EQ(test_bit_count - 1, bitmap_ffz(bitmap_A));
+	bitmap_destroy(bitmap_A);
+ }
+
+ TEST(bitmap_ffz, NoZeroBitPartialWord) {
+ 	bitmap_t *bitmap_A;
+	size_t test_bit_count = 131;
+	bitmap_A = bitmap_create(test_bit_count);
+	ASSERT_NE(bitmap_A,(bitmap_t*)NULL);
+	for(size_t i = 0; i < test_bit_count; ++i)
+		EXPECT_EQ(true, bitmap_set(bitmap_A, i));
+	EXPECT_EQ(SIZE_MAX, bitmap_ffz(bitmap_A));
+	bitmap_destroy(bitmap_A);
+ }
+
+TEST(bitmap_ffs, GoodffsWordScan) {
+	bitmap_t *bitmap_A;
+	size_t test_bit_count = 65536;
+	bitmap_A = bitmap_create(test_bit_count);
+	ASSERT_NE(bitmap_A,(bitmap_t*)NULL);
+	EXPECT_EQ(SIZE_MAX, bitmap_ffs(bitmap_A));
+	EXPECT_EQ(true, bitmap_set(bitmap_A, 50001));
+	EXPECT_EQ(true, bitmap_set(bitmap_A, 61234));
+	EXPECT_EQ(50001, bitmap_ffs(bitmap_A));
+	EXPECT_EQ(true, bitmap_set(bitmap_A, 64));
+	EXPECT_EQ(64, bitmap_ffs(bitmap_A));
+	bitmap_destroy(bitmap_A);
+}
+
+/*
+ *	HIERARCHICAL BITMAP UNIT TEST CASES
+ **/
+
+ TEST(hbitmap_create, BadBitVal) {
+ 	EXPECT_EQ(NULL, hbitmap_create(0));
+ 	EXPECT_EQ(NULL, hbitmap_create(SIZE_MAX));
+ 	EXPECT_EQ(NULL, hbitmap_overlay(64, NULL));
+ 	EXPECT_EQ(false, hbitmap_destroy(NULL));
+ }
+
+TEST(hbitmap_ffz, SummaryFollowsSetReset) {
+	hbitmap_t *bitmap_A;
+	size_t test_bit_count = 65536;
+	bitmap_A = hbitmap_create(test_bit_count);
+	ASSERT_NE(bitmap_A,(hbitmap_t*)NULL);
+	EXPECT_EQ(0, hbitmap_ffz(bitmap_A));
+	for(size_t i = 0; i < test_bit_count - 1; ++i)
+		EXPECT_EQ(true, hbitmap_set(bitmap_A, i));
+	EXPECT_EQ(test_bit_count - 1, hbitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, hbitmap_set(bitmap_A, test_bit_count - 1));
+	EXPECT_EQ(SIZE_MAX, hbitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, hbitmap_reset(bitmap_A, 4097));
+	EXPECT_EQ(false, hbitmap_test(bitmap_A, 4097));
+	EXPECT_EQ(4097, hbitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, hbitmap_reset(bitmap_A, 70));
+	EXPECT_EQ(70, hbitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, hbitmap_set(bitmap_A, 70));
+	EXPECT_EQ(4097, hbitmap_ffz(bitmap_A));
+	EXPECT_EQ(false, hbitmap_set(bitmap_A, test_bit_count));
+	hbitmap_destroy(bitmap_A);
+}
+
+TEST(hbitmap_ffz, PartialWord) {
+	hbitmap_t *bitmap_A;
+	size_t test_bit_count = 131;
+	bitmap_A = hbitmap_create(test_bit_count);
+	ASSERT_NE(bitmap_A,(hbitmap_t*)NULL);
+	for(size_t i = 0; i < test_bit_count; ++i)
+		EXPECT_EQ(true, hbitmap_set(bitmap_A, i));
+	EXPECT_EQ(SIZE_MAX, hbitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, hbitmap_reset(bitmap_A, 130));
+	EXPECT_EQ(130, hbitmap_ffz(bitmap_A));
+	hbitmap_destroy(bitmap_A);
+}
+
+TEST(hbitmap_overlay, SummaryFromData) {
+	// first 8 blocks reserved, like a back_store FBM
+	uint8_t data[8192];
+	memset(data, 0xFF, sizeof(data));
+	data[5000] = 0xEF;
+	hbitmap_t *bitmap_A = hbitmap_overlay(65536, data);
+	ASSERT_NE(bitmap_A,(hbitmap_t*)NULL);
+	EXPECT_EQ(5000 * 8 + 4, hbitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, hbitmap_set(bitmap_A, 5000 * 8 + 4));
+	EXPECT_EQ(0xFF, data[5000]);
+	EXPECT_EQ(SIZE_MAX, hbitmap_ffz(bitmap_A));
+	EXPECT_EQ(true, hbitmap_reset(bitmap_A, 12));
+	EXPECT_EQ(0xEF, data[1]);
+	EXPECT_EQ(12, hbitmap_ffz(bitmap_A));
+	// data isn't ours, destroy leaves it be
+	EXPECT_EQ(true, hbitmap_destroy(bitmap_A));
+	EXPECT_EQ(0xEF, data[1]);
+}
+
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -2,12 +2,35 @@
 #define _BACK_STORE_H__
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 // Back store object
 // It's an opaque object whose implementation is up to you
 // (and implementation DOES NOT go here)
 typedef struct back_store back_store_t;
 
+// Threads
+//  Reads, writes, maps and prefetches can come from several threads at once, as long as no two of them
+//  are on the same block at the same time (unless they're all reads)
+//  Allocate/request/release/flush, the cache calls and the free block map import/export all work on the free block
+//  map, so only one thread at a time,
+//  same for the async calls (one thread's poll would get another's completions)
+
+// Limits on the geometry back_store_create_ex will take
+#define BACK_STORE_BLOCK_SIZE_MIN (1024)
+#define BACK_STORE_BLOCK_SIZE_MAX (65536)
+#define BACK_STORE_BLOCK_COUNT_MAX (1U << 31)
+
+// Most async requests that can be in flight (submitted and not polled yet)
+#define BACK_STORE_ASYNC_DEPTH (256)
+
+// One finished async request, handed back by back_store_poll
+typedef struct {
+    uint64_t tag;  // whatever was passed to the submit call
+    bool success;
+} back_store_completion_t;
+
 ///
 /// Creates a new back_store file at the specified location
 ///  and returns a back_store object linked to it
@@ -16,6 +39,18 @@ typedef struct back_store back_store_t;
 ///
 back_store_t *back_store_create(const char *const fname);
 
+///
+/// Creates a new back_store file with the given geometry
+///  and returns a back_store object linked to it
+///  The geometry goes in a superblock at block 0 (the FBM follows it), back_store_open reads it back
+///  back_store_create is the original layout: 1 KiB blocks, 65536 of them, no superblock
+/// \param fname the file to create
+/// \param block_size bytes per block, a power of two from BACK_STORE_BLOCK_SIZE_MIN to BACK_STORE_BLOCK_SIZE_MAX
+/// \param block_count number of blocks, a multiple of 64 up to BACK_STORE_BLOCK_COUNT_MAX
+/// \return a pointer to the new object, NULL on error
+///
+back_store_t *back_store_create_ex(const char *const fname, const unsigned block_size, const unsigned block_count);
+
 ///
 /// Opens the specified back_store file
 ///  and returns a back_store object linked to it
@@ -30,6 +65,20 @@ back_store_t *back_store_open(const char *const fname);
 ///
 void back_store_close(back_store_t *const bs);
 
+///
+/// Gets the size of a block, every read/write/map works in blocks of this size
+/// \param bs the back_store
+/// \return bytes per block, 0 on error
+///
+unsigned back_store_block_size(const back_store_t *const bs);
+
+///
+/// Gets the number of blocks in the back_store, including the ones it uses for itself
+/// \param bs the back_store
+/// \return number of blocks, 0 on error
+///
+unsigned back_store_block_count(const back_store_t *const bs);
+
 ///
 /// Allocates a block of storage in the back_store
 /// \param bs the back_store to allocate from
@@ -37,6 +86,46 @@ void back_store_close(back_store_t *const bs);
 ///
 unsigned back_store_allocate(back_store_t *const bs);
 
+///
+/// Allocates the first free block at or after the given block id
+///  wrapping around to the start of the store if there's nothing past it
+///  Lets callers keep blocks that get used together next to each other
+/// \param bs the back_store to allocate from
+/// \param hint block id to start looking from
+/// \return id of the allocated block, 0 on error
+///
+unsigned back_store_allocate_near(back_store_t *const bs, const unsigned hint);
+
+///
+/// Allocates a run of contiguous blocks
+/// \param bs the back_store to allocate from
+/// \param count number of blocks in the run
+/// \return id of the first block in the run, 0 on error (nothing is allocated)
+///
+unsigned back_store_allocate_contiguous(back_store_t *const bs, const unsigned count);
+
+///
+/// Allocates count blocks in a single pass over the free block map
+///  Blocks are claimed lowest first, so free runs come back as runs
+/// \param bs the back_store to allocate from
+/// \param count number of blocks wanted
+/// \param out_ptrs array of at least count entries, filled with the allocated block ids
+/// \return number of blocks allocated, less than count only if the store filled up
+///
+unsigned back_store_allocate_range(back_store_t *const bs, const unsigned count, unsigned *const out_ptrs);
+
+///
+/// Same as back_store_allocate_range, but claims blocks at or after hint first
+///  then wraps around to the start of the store
+/// \param bs the back_store to allocate from
+/// \param hint block id to start looking from
+/// \param count number of blocks wanted
+/// \param out_ptrs array of at least count entries, filled with the allocated block ids
+/// \return number of blocks allocated, less than count only if the store filled up
+///
+unsigned back_store_allocate_range_near(back_store_t *const bs, const unsigned hint, const unsigned count,
+                                        unsigned *const out_ptrs);
+
 ///
 /// Requests the allocation of a specified block id
 /// \param bs back_store to allocate from
@@ -52,6 +141,14 @@ bool back_store_request(back_store_t *const bs, const unsigned block_id);
 ///
 void back_store_release(back_store_t *const bs, const unsigned block_id);
 
+///
+/// Releases every block id in the given array
+/// \param bs back_store object
+/// \param count number of block ids
+/// \param ptrs blocks to release
+///
+void back_store_release_range(back_store_t *const bs, const unsigned count, const unsigned *const ptrs);
+
 ///
 /// Reads data from the specified block to the given data buffer
 /// \param bs the object to read from
@@ -70,4 +167,145 @@ bool back_store_read(back_store_t *const bs, const unsigned block_id, void *cons
 ///
 bool back_store_write(back_store_t *const bs, const unsigned block_id, const void *const src);
 
+///
+/// Reads a list of blocks, one block per iovec
+///  Blocks with consecutive ids are read together, so a contiguous file is a few big reads
+/// \param bs the object to read from
+/// \param block_ids the blocks to read
+/// \param iov where each block goes, every iov_len has to be the block size
+/// \param count number of blocks (and iovecs)
+/// \return bool indicating success, nothing is read if any block id or iovec is bad
+///
+bool back_store_readv(back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                      const unsigned count);
+
+///
+/// Writes a list of blocks, one block per iovec
+///  Blocks with consecutive ids are written together
+/// \param bs the object to write to
+/// \param block_ids the blocks to write
+/// \param iov where each block comes from, every iov_len has to be the block size
+/// \param count number of blocks (and iovecs)
+/// \return bool indicating success, nothing is written if any block id or iovec is bad
+///
+bool back_store_writev(back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                       const unsigned count);
+
+///
+/// Borrows a block in place for reading, no copy into a caller buffer
+///  The block stays pinned (and the pointer stays good) until back_store_unmap_block
+///  Only a handful of blocks can be pinned at once, so unmap as soon as you're done
+/// \param bs the object to borrow from
+/// \param block_id the block to borrow
+/// \return pointer to the block's data (back_store_block_size bytes), NULL on error
+///
+const void *back_store_map_block(back_store_t *const bs, const unsigned block_id);
+
+///
+/// Same as back_store_map_block, but the block can be written through the pointer
+///  Changes show up in reads right away and reach disk the same way a back_store_write does
+/// \param bs the object to borrow from
+/// \param block_id the block to borrow
+/// \return pointer to the block's data (back_store_block_size bytes), NULL on error
+///
+void *back_store_map_block_mut(back_store_t *const bs, const unsigned block_id);
+
+///
+/// Unpins a block borrowed with back_store_map_block or back_store_map_block_mut
+/// \param bs the object the block was borrowed from
+/// \param block the pointer the map call returned
+///
+void back_store_unmap_block(back_store_t *const bs, const void *const block);
+
+///
+/// Writes every changed block and the free block map out to disk
+/// \param bs the back_store
+/// \return bool indicating success
+///
+bool back_store_flush(back_store_t *const bs);
+
+///
+/// Copies the free block map out, one bit per block (set if the block is in use)
+///  Lets a caller keep a copy of the allocation state with its own metadata, a journal say
+/// \param bs the back_store
+/// \param dst where the map goes, back_store_block_count / 8 bytes
+/// \return bool indicating success
+///
+bool back_store_export_fbm(const back_store_t *const bs, void *const dst);
+
+///
+/// Replaces the free block map with one back_store_export_fbm handed out earlier
+///  The superblock and the map's own blocks stay in use whatever src says
+///  It reaches disk with the next flush, same as any other allocation
+/// \param bs the back_store
+/// \param src the new map, back_store_block_count / 8 bytes
+/// \return bool indicating success
+///
+bool back_store_import_fbm(back_store_t *const bs, const void *const src);
+
+///
+/// Changes how many blocks the cache holds
+///  Dirty blocks are written out and the cache starts over empty
+/// \param bs the back_store
+/// \param blocks number of blocks to cache, at least 1
+/// \return bool indicating success, fails if anything is still mapped or the back_store has no cache
+///
+bool back_store_cache_resize(back_store_t *const bs, const unsigned blocks);
+
+///
+/// Gets the cache hit/miss counters
+/// \param bs the back_store
+/// \param hits where to put the number of block accesses served from the cache, can be NULL
+/// \param misses where to put the number of accesses that had to bring a block in, can be NULL
+/// \return bool indicating success, false if the back_store has no cache
+///
+bool back_store_cache_stats(const back_store_t *const bs, uint64_t *const hits, uint64_t *const misses);
+
+///
+/// Starts reading a block without waiting for it
+///  dst has to stay around (and untouched) until the completion comes back from back_store_poll
+///  Don't mix sync and async access to a block that has a request in flight
+/// \param bs the object to read from
+/// \param block_id the block to read from
+/// \param dst the buffer to write to
+/// \param tag handed back in the completion so the caller can tell requests apart
+/// \return bool indicating the request was queued, false if it's bad or BACK_STORE_ASYNC_DEPTH are in flight
+///
+bool back_store_submit_read(back_store_t *const bs, const unsigned block_id, void *const dst, const uint64_t tag);
+
+///
+/// Starts writing a block without waiting for it
+///  src has to stay around (and untouched) until the completion comes back from back_store_poll
+///  Don't mix sync and async access to a block that has a request in flight
+/// \param bs the object to write to
+/// \param block_id the block to write to
+/// \param src the buffer to read from
+/// \param tag handed back in the completion so the caller can tell requests apart
+/// \return bool indicating the request was queued, false if it's bad or BACK_STORE_ASYNC_DEPTH are in flight
+///
+bool back_store_submit_write(back_store_t *const bs, const unsigned block_id, const void *const src,
+                             const uint64_t tag);
+
+///
+/// Collects finished async requests
+/// \param bs the back_store
+/// \param completions where to put them
+/// \param max most completions to hand back
+/// \param wait whether to block until at least one is done (if anything is in flight)
+/// \return number of completions filled in
+///
+unsigned back_store_poll(back_store_t *const bs, back_store_completion_t *const completions, const unsigned max,
+                         const bool wait);
+
+///
+/// Hints that these blocks are about to be read, so they can start coming in now
+///  Doesn't wait for anything and doesn't copy anything, later reads of the blocks just find them ready
+///  Back to back block ids are requested together
+/// \param bs the back_store
+/// \param block_ids the blocks
+/// \param count number of blocks
+/// \return bool indicating the hint was taken, false if any block id is bad
+///
+bool back_store_prefetch(back_store_t *const bs, const unsigned *const block_ids, const unsigned count);
+
 #endif
\ No newline at end of file
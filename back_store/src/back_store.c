@@ -4,31 +4,123 @@
 
 #include <fcntl.h>
 #include <stdbool.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+// Geometry of back_store_create, the original layout
 #define BLOCK_COUNT 65536
 #define BLOCK_SIZE 1024
-#define FBM_BLOCK_COUNT 8
-#define BYTE_TOTAL (65536 * 1024)
-#define DATA_BLOCK_BYTE_TOTAL ((65536 - 8) * 1024)
-#define FBM_BYTE_TOTAL (1024 * 8)
-#define DATA_BLOCK_START 8
+// iov_base is a void *, can't do math on it directly
+#define INCREMENT_IOV(base, increment) ((void *) (((uint8_t *) (base)) + (increment)))
+
+// Block 0 of anything made by back_store_create_ex, the FBM follows it
+// The original layout has the FBM at block 0 instead, and its first byte is always 0xFF
+// (blocks 0-7 are the FBM, so they're always in use), so the magic can't be confused with it
+#define SUPERBLOCK_MAGIC 0x31534253  // "SBS1" on disk
+typedef struct {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t fbm_blocks;
+} superblock_t;
 
 
 struct back_store {
     int fd;
     bitmap_t *fbm;
     uint8_t *data_blocks;
+    size_t block_size;
+    size_t block_count;
+    size_t byte_total;
+    size_t data_block_start;  // superblock and FBM come before this
+    // One bit per FBM word, set if that word still has a free block in it
+    // Lets allocate go straight to a word with space instead of scanning the whole FBM
+    // Only valid as long as every FBM change goes through fbm_set/fbm_reset
+    uint64_t *fbm_summary;
+    size_t fbm_word_count;
+    size_t fbm_summary_count;
+    // Async requests finish during submit (it's just a memcpy), they wait here to be polled
+    back_store_completion_t async_done[BACK_STORE_ASYNC_DEPTH];
+    unsigned async_head;
+    unsigned async_count;
 };
 
-int create_file(const char *const fname) {
+uint64_t fbm_word(const back_store_t *const bs, const size_t word) {
+    uint64_t value;
+    memcpy(&value, bitmap_export(bs->fbm) + (word << 3), sizeof(value));
+    return value;
+}
+
+void fbm_summary_update(back_store_t *const bs, const size_t block_id) {
+    const size_t word    = block_id >> 6;
+    const uint64_t flag  = UINT64_C(1) << (word & 0x3F);
+    if (~fbm_word(bs, word)) {
+        bs->fbm_summary[word >> 6] |= flag;
+    } else {
+        bs->fbm_summary[word >> 6] &= ~flag;
+    }
+}
+
+void fbm_summary_build(back_store_t *const bs) {
+    memset(bs->fbm_summary, 0x00, bs->fbm_summary_count * sizeof(uint64_t));
+    for (size_t word = 0; word < bs->fbm_word_count; ++word) {
+        fbm_summary_update(bs, word << 6);
+    }
+}
+
+void fbm_set(back_store_t *const bs, const size_t block_id) {
+    bitmap_set(bs->fbm, block_id);
+    fbm_summary_update(bs, block_id);
+}
+
+void fbm_reset(back_store_t *const bs, const size_t block_id) {
+    bitmap_reset(bs->fbm, block_id);
+    fbm_summary_update(bs, block_id);
+}
+
+// Same as bitmap_ffz, but only ever looks at one summary word hit and one FBM word
+size_t fbm_ffz(const back_store_t *const bs) {
+    for (size_t i = 0; i < bs->fbm_summary_count; ++i) {
+        if (bs->fbm_summary[i]) {
+            const size_t word = (i << 6) + __builtin_ctzll(bs->fbm_summary[i]);
+            return (word << 6) + __builtin_ctzll(~fbm_word(bs, word));
+        }
+    }
+    return SIZE_MAX;
+}
+
+bool geometry_valid(const size_t block_size, const size_t block_count) {
+    return block_size >= BACK_STORE_BLOCK_SIZE_MIN && block_size <= BACK_STORE_BLOCK_SIZE_MAX
+           && !(block_size & (block_size - 1)) && block_count >= 64 && block_count <= BACK_STORE_BLOCK_COUNT_MAX
+           && !(block_count & 0x3F);
+}
+
+// Fills in everything that falls out of the block size and count
+// Summary gets sized here too, since it depends on the count
+bool geometry_setup(back_store_t *const bs, const size_t block_size, const size_t block_count,
+                    const bool superblock) {
+    const size_t fbm_blocks = ((block_count >> 3) + block_size - 1) / block_size;
+    bs->block_size          = block_size;
+    bs->block_count         = block_count;
+    bs->byte_total          = block_size * block_count;
+    bs->data_block_start    = fbm_blocks + (superblock ? 1 : 0);
+    bs->fbm_word_count      = block_count >> 6;
+    bs->fbm_summary_count   = (bs->fbm_word_count + 63) >> 6;
+    if (bs->data_block_start < block_count) {
+        bs->fbm_summary = (uint64_t *) calloc(bs->fbm_summary_count, sizeof(uint64_t));
+        return bs->fbm_summary;
+    }
+    return false;
+}
+
+int create_file(const char *const fname, const size_t byte_total) {
     if (fname) {
         int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
         if (fd != -1) {
-            if (ftruncate(fd, BYTE_TOTAL) != -1) {
+            if (ftruncate(fd, byte_total) != -1) {
                 return fd;
             }
             close(fd);
@@ -36,13 +128,22 @@ int create_file(const char *const fname) {
     }
     return -1;
 }
-int check_file(const char *const fname) {
+
+// Opens the file and works out its geometry, superblock if there is one, original layout if not
+int check_file(const char *const fname, size_t *block_size, size_t *block_count, bool *superblock) {
     if (fname) {
         int fd = open(fname, O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
         if (fd != -1) {
             struct stat file_info;
-            if (fstat(fd, &file_info) != -1 && file_info.st_size == BYTE_TOTAL) {
-                return fd;
+            superblock_t super;
+            if (fstat(fd, &file_info) != -1 && pread(fd, &super, sizeof(super), 0) == sizeof(super)) {
+                *superblock  = super.magic == SUPERBLOCK_MAGIC;
+                *block_size  = *superblock ? super.block_size : BLOCK_SIZE;
+                *block_count = *superblock ? super.block_count : BLOCK_COUNT;
+                if (geometry_valid(*block_size, *block_count)
+                    && (size_t) file_info.st_size == *block_size * *block_count) {
+                    return fd;
+                }
             }
             close(fd);
         }
@@ -51,33 +152,121 @@ int check_file(const char *const fname) {
 }
 
 
-back_store_t *back_store_init(const bool init, const char *const fname) {
+// fbm_ffz, but starting at block start. Wraps around to the front if nothing is free past it
+size_t fbm_ffz_from(const back_store_t *const bs, const size_t start) {
+    if (start < bs->block_count) {
+        // rest of the word start is in
+        size_t word              = start >> 6;
+        const uint64_t free_bits = ~fbm_word(bs, word) & (~UINT64_C(0) << (start & 0x3F));
+        if (free_bits) {
+            return (word << 6) + __builtin_ctzll(free_bits);
+        }
+        // then any word after it the summary says has space
+        ++word;
+        for (size_t i = word >> 6; i < bs->fbm_summary_count; ++i) {
+            uint64_t candidates = bs->fbm_summary[i];
+            if (i == (word >> 6)) {
+                candidates &= ~UINT64_C(0) << (word & 0x3F);
+            }
+            if (candidates) {
+                const size_t found = (i << 6) + __builtin_ctzll(candidates);
+                return (found << 6) + __builtin_ctzll(~fbm_word(bs, found));
+            }
+        }
+    }
+    return fbm_ffz(bs);
+}
+
+// First block of a free run of count blocks, SIZE_MAX if there isn't one
+size_t fbm_find_run(const back_store_t *const bs, const size_t count) {
+    size_t start = fbm_ffz(bs);
+    while (start != SIZE_MAX && start + count <= bs->block_count) {
+        size_t end = start + 1;
+        while (end < start + count && !bitmap_test(bs->fbm, end)) {
+            ++end;
+        }
+        if (end == start + count) {
+            return start;
+        }
+        // end is in use, pick back up at the next free block past it
+        const size_t next = fbm_ffz_from(bs, end + 1);
+        if (next <= end) {
+            break;  // wrapped, nothing left past here
+        }
+        start = next;
+    }
+    return SIZE_MAX;
+}
+
+// Claims up to count free blocks into out, going up from start and wrapping once
+// Takes every free block in a word before moving on, so it's one pass over the FBM
+size_t fbm_claim(back_store_t *const bs, const size_t start, const size_t count, unsigned *const out) {
+    size_t claimed = 0;
+    size_t block   = fbm_ffz_from(bs, start);
+    while (claimed < count && block != SIZE_MAX) {
+        const size_t word  = block >> 6;
+        uint64_t free_bits = ~fbm_word(bs, word) & (~UINT64_C(0) << (block & 0x3F));
+        while (free_bits && claimed < count) {
+            const size_t free_block = (word << 6) + __builtin_ctzll(free_bits);
+            bitmap_set(bs->fbm, free_block);
+            out[claimed++] = free_block;
+            free_bits &= free_bits - 1;
+        }
+        fbm_summary_update(bs, block);
+        // every pass claims at least one block, so this can't spin
+        block = claimed < count ? fbm_ffz_from(bs, (word + 1) << 6) : SIZE_MAX;
+    }
+    return claimed;
+}
+
+back_store_t *back_store_init(const bool init, const char *const fname, size_t block_size, size_t block_count,
+                              bool superblock) {
     if (fname) {
         back_store_t *bs = (back_store_t *) malloc(sizeof(back_store_t));
         if (bs) {
-            bs->fd = init ? create_file(fname) : check_file(fname);
-            if (bs->fd != -1) {
-                bs->data_blocks = (uint8_t *) mmap(NULL, BYTE_TOTAL, PROT_READ | PROT_WRITE, MAP_SHARED, bs->fd, 0);
-                if (bs->data_blocks != (uint8_t *) MAP_FAILED) {
-                    // Woo hoo! Done. Mostly. Kinda.
-                    if (init) {
-                        // init FBM and wipe remaining data
-                        // Could/should be done in create_file
-                        // but it's so much easier here...
-                        memset(bs->data_blocks, 0xFF, FBM_BLOCK_COUNT >> 3);
-                        memset(bs->data_blocks + FBM_BYTE_TOTAL, 0x00, DATA_BLOCK_BYTE_TOTAL);
-                    }
-                    // Not quite sure what to do with madvise
-                    // Honestly, I feel like a split mapping may be best
-                    // Sequential for the FBM, random for the data
-                    // but I'll just not mess with it unless I get the time to profile them
-                    // madvise()
-                    bs->fbm = bitmap_overlay(BLOCK_COUNT, bs->data_blocks);
-                    if (bs->fbm) {
-                        return bs;
+            bs->fd = init ? -1 : check_file(fname, &block_size, &block_count, &superblock);
+            if ((init || bs->fd != -1) && geometry_setup(bs, block_size, block_count, superblock)) {
+                if (init) {
+                    bs->fd = create_file(fname, bs->byte_total);
+                }
+                if (bs->fd != -1) {
+                    bs->data_blocks =
+                        (uint8_t *) mmap(NULL, bs->byte_total, PROT_READ | PROT_WRITE, MAP_SHARED, bs->fd, 0);
+                    if (bs->data_blocks != (uint8_t *) MAP_FAILED) {
+                        // Woo hoo! Done. Mostly. Kinda.
+                        uint8_t *fbm_data = bs->data_blocks + (superblock ? block_size : 0);
+                        // Not quite sure what to do with madvise
+                        // Honestly, I feel like a split mapping may be best
+                        // Sequential for the FBM, random for the data
+                        // but I'll just not mess with it unless I get the time to profile them
+                        // madvise()
+                        bs->fbm = bitmap_overlay(block_count, fbm_data);
+                        if (bs->fbm) {
+                            if (init) {
+                                // init superblock and FBM, the data is already zero
+                                // create_file truncates to nothing and then grows it, so the file is one big hole
+                                // Wiping it here would just make the kernel write out 64MB of zeroes
+                                if (superblock) {
+                                    const superblock_t super = {SUPERBLOCK_MAGIC, (uint32_t) block_size,
+                                                                (uint32_t) block_count,
+                                                                (uint32_t) (bs->data_block_start - 1)};
+                                    memcpy(bs->data_blocks, &super, sizeof(super));
+                                }
+                                for (size_t i = 0; i < bs->data_block_start; ++i) {
+                                    bitmap_set(bs->fbm, i);
+                                }
+                            }
+                            fbm_summary_build(bs);
+                            bs->async_head  = 0;
+                            bs->async_count = 0;
+                            return bs;
+                        }
+                        munmap(bs->data_blocks, bs->byte_total);
                     }
-                    munmap(bs->data_blocks, BYTE_TOTAL);
+                    close(bs->fd);
                 }
+                free(bs->fbm_summary);
+            } else if (bs->fd != -1) {
                 close(bs->fd);
             }
             free(bs);
@@ -87,37 +276,89 @@ back_store_t *back_store_init(const bool init, const char *const fname) {
 }
 
 back_store_t *back_store_create(const char *const fname) {
-    return back_store_init(true, fname);
+    return back_store_init(true, fname, BLOCK_SIZE, BLOCK_COUNT, false);
+}
+
+back_store_t *back_store_create_ex(const char *const fname, const unsigned block_size, const unsigned block_count) {
+    if (geometry_valid(block_size, block_count)) {
+        return back_store_init(true, fname, block_size, block_count, true);
+    }
+    return NULL;
 }
 
 back_store_t *back_store_open(const char *const fname) {
-    return back_store_init(false, fname);
+    return back_store_init(false, fname, 0, 0, false);
 }
 
 void back_store_close(back_store_t *const bs) {
     if (bs) {
         bitmap_destroy(bs->fbm);
-        munmap(bs->data_blocks, BYTE_TOTAL);
+        munmap(bs->data_blocks, bs->byte_total);
         close(bs->fd);
+        free(bs->fbm_summary);
         free(bs);
     }
 }
 
+unsigned back_store_block_size(const back_store_t *const bs) {
+    return bs ? bs->block_size : 0;
+}
+
+unsigned back_store_block_count(const back_store_t *const bs) {
+    return bs ? bs->block_count : 0;
+}
+
 unsigned back_store_allocate(back_store_t *const bs) {
     if (bs) {
-        size_t free_block = bitmap_ffz(bs->fbm);
+        size_t free_block = fbm_ffz(bs);
         if (free_block != SIZE_MAX) {
-            bitmap_set(bs->fbm, free_block);
+            fbm_set(bs, free_block);
+            return free_block;
+        }
+    }
+    return 0;
+}
+
+unsigned back_store_allocate_near(back_store_t *const bs, const unsigned hint) {
+    if (bs) {
+        size_t free_block = fbm_ffz_from(bs, hint);
+        if (free_block != SIZE_MAX) {
+            fbm_set(bs, free_block);
             return free_block;
         }
     }
     return 0;
 }
 
+unsigned back_store_allocate_contiguous(back_store_t *const bs, const unsigned count) {
+    if (bs && count) {
+        size_t first_block = fbm_find_run(bs, count);
+        if (first_block != SIZE_MAX) {
+            for (size_t i = 0; i < count; ++i) {
+                fbm_set(bs, first_block + i);
+            }
+            return first_block;
+        }
+    }
+    return 0;
+}
+
+unsigned back_store_allocate_range(back_store_t *const bs, const unsigned count, unsigned *const out_ptrs) {
+    return back_store_allocate_range_near(bs, 0, count, out_ptrs);
+}
+
+unsigned back_store_allocate_range_near(back_store_t *const bs, const unsigned hint, const unsigned count,
+                                        unsigned *const out_ptrs) {
+    if (bs && out_ptrs) {
+        return fbm_claim(bs, hint, count, out_ptrs);
+    }
+    return 0;
+}
+
 bool back_store_request(back_store_t *const bs, const unsigned block_id) {
-    if (bs && block_id >= DATA_BLOCK_START && block_id <= BLOCK_COUNT) {
+    if (bs && block_id >= bs->data_block_start && block_id < bs->block_count) {
         if (!bitmap_test(bs->fbm, block_id)) {
-            bitmap_set(bs->fbm, block_id);
+            fbm_set(bs, block_id);
             return true;
         }
     }
@@ -125,14 +366,23 @@ bool back_store_request(back_store_t *const bs, const unsigned block_id) {
 }
 
 void back_store_release(back_store_t *const bs, const unsigned block_id) {
-    if (bs && block_id >= DATA_BLOCK_START && block_id <= BLOCK_COUNT) {
-        bitmap_reset(bs->fbm, block_id);
+    if (bs && block_id >= bs->data_block_start && block_id < bs->block_count) {
+        fbm_reset(bs, block_id);
+    }
+}
+
+void back_store_release_range(back_store_t *const bs, const unsigned count, const unsigned *const ptrs) {
+    if (bs && ptrs) {
+        for (unsigned i = 0; i < count; ++i) {
+            back_store_release(bs, ptrs[i]);
+        }
     }
 }
 
 bool back_store_read(back_store_t *const bs, const unsigned block_id, void *const dst) {
-    if (bs && dst && block_id >= DATA_BLOCK_START && block_id <= BLOCK_COUNT /* && bitmap_set(bs->fbm,block_id) */) {
-        memcpy(dst, bs->data_blocks + (BLOCK_SIZE * block_id), BLOCK_SIZE);
+    if (bs && dst && block_id >= bs->data_block_start
+        && block_id < bs->block_count /* && bitmap_set(bs->fbm,block_id) */) {
+        memcpy(dst, bs->data_blocks + (bs->block_size * block_id), bs->block_size);
         return true;
     }
     return false;
@@ -140,8 +390,186 @@ bool back_store_read(back_store_t *const bs, const unsigned block_id, void *cons
 
 
 bool back_store_write(back_store_t *const bs, const unsigned block_id, const void *const src) {
-    if (bs && src && block_id >= DATA_BLOCK_START && block_id <= BLOCK_COUNT /* && bitmap_set(bs->fbm,block_id) */) {
-        memcpy(bs->data_blocks + (BLOCK_SIZE * block_id), src, BLOCK_SIZE);
+    if (bs && src && block_id >= bs->data_block_start
+        && block_id < bs->block_count /* && bitmap_set(bs->fbm,block_id) */) {
+        memcpy(bs->data_blocks + (bs->block_size * block_id), src, bs->block_size);
+        return true;
+    }
+    return false;
+}
+
+// Block ids and iovecs all have to be good before we touch anything
+bool vector_valid(const back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                  const unsigned count) {
+    if (block_ids && iov) {
+        for (unsigned i = 0; i < count; ++i) {
+            if (block_ids[i] < bs->data_block_start || block_ids[i] >= bs->block_count
+                || !iov[i].iov_base || iov[i].iov_len != bs->block_size) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// Length of the run starting at i where both the blocks and the buffers are back to back
+// That whole run is a single memcpy
+unsigned vector_run(const back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                    const unsigned count, const unsigned i) {
+    unsigned run = 1;
+    while (i + run < count && block_ids[i + run] == block_ids[i] + run
+           && iov[i + run].iov_base == INCREMENT_IOV(iov[i].iov_base, run * bs->block_size)) {
+        ++run;
+    }
+    return run;
+}
+
+bool back_store_readv(back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                      const unsigned count) {
+    if (bs && vector_valid(bs, block_ids, iov, count)) {
+        for (unsigned i = 0, run; i < count; i += run) {
+            run = vector_run(bs, block_ids, iov, count, i);
+            memcpy(iov[i].iov_base, bs->data_blocks + (bs->block_size * block_ids[i]), bs->block_size * run);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool back_store_writev(back_store_t *const bs, const unsigned *const block_ids, const struct iovec *const iov,
+                       const unsigned count) {
+    if (bs && vector_valid(bs, block_ids, iov, count)) {
+        for (unsigned i = 0, run; i < count; i += run) {
+            run = vector_run(bs, block_ids, iov, count, i);
+            memcpy(bs->data_blocks + (bs->block_size * block_ids[i]), iov[i].iov_base, bs->block_size * run);
+        }
+        return true;
+    }
+    return false;
+}
+
+
+// The whole store is already mapped, so a borrow is just a pointer into it
+// Pins don't need tracking, the mapping outlives every borrow until close
+const void *back_store_map_block(back_store_t *const bs, const unsigned block_id) {
+    return back_store_map_block_mut(bs, block_id);
+}
+
+void *back_store_map_block_mut(back_store_t *const bs, const unsigned block_id) {
+    if (bs && block_id >= bs->data_block_start && block_id < bs->block_count) {
+        return bs->data_blocks + (bs->block_size * block_id);
+    }
+    return NULL;
+}
+
+void back_store_unmap_block(back_store_t *const bs, const void *const block) {
+    // writes already landed in the mapping, nothing to do
+    (void) bs;
+    (void) block;
+}
+
+bool back_store_flush(back_store_t *const bs) {
+    // every change is already in the mapping, just push it to disk
+    return bs && msync(bs->data_blocks, bs->byte_total, MS_SYNC) == 0;
+}
+
+bool back_store_export_fbm(const back_store_t *const bs, void *const dst) {
+    if (bs && dst) {
+        memcpy(dst, bitmap_export(bs->fbm), bs->block_count >> 3);
+        return true;
+    }
+    return false;
+}
+
+// The FBM is overlaid on the mapping, so this is just a copy into the file
+bool back_store_import_fbm(back_store_t *const bs, const void *const src) {
+    if (bs && src) {
+        const size_t fbm_blocks = ((bs->block_count >> 3) + bs->block_size - 1) / bs->block_size;
+        memcpy(bs->data_blocks + (bs->data_block_start - fbm_blocks) * bs->block_size, src, bs->block_count >> 3);
+        for (size_t i = 0; i < bs->data_block_start; ++i) {
+            bitmap_set(bs->fbm, i);
+        }
+        fbm_summary_build(bs);
+        return true;
+    }
+    return false;
+}
+
+// The mapping is the cache (the page cache, really), nothing here to size or count
+bool back_store_cache_resize(back_store_t *const bs, const unsigned blocks) {
+    (void) bs;
+    (void) blocks;
+    return false;
+}
+
+bool back_store_cache_stats(const back_store_t *const bs, uint64_t *const hits, uint64_t *const misses) {
+    (void) bs;
+    (void) hits;
+    (void) misses;
+    return false;
+}
+
+// No point in threads or io_uring when the data is already in memory
+// A submit does the copy right away and queues the completion for poll
+bool async_complete(back_store_t *const bs, const uint64_t tag) {
+    if (bs->async_count < BACK_STORE_ASYNC_DEPTH) {
+        back_store_completion_t *done =
+            &bs->async_done[(bs->async_head + bs->async_count) % BACK_STORE_ASYNC_DEPTH];
+        done->tag     = tag;
+        done->success = true;
+        ++bs->async_count;
+        return true;
+    }
+    return false;
+}
+
+bool back_store_submit_read(back_store_t *const bs, const unsigned block_id, void *const dst, const uint64_t tag) {
+    return bs && bs->async_count < BACK_STORE_ASYNC_DEPTH && back_store_read(bs, block_id, dst)
+           && async_complete(bs, tag);
+}
+
+bool back_store_submit_write(back_store_t *const bs, const unsigned block_id, const void *const src,
+                             const uint64_t tag) {
+    return bs && bs->async_count < BACK_STORE_ASYNC_DEPTH && back_store_write(bs, block_id, src)
+           && async_complete(bs, tag);
+}
+
+unsigned back_store_poll(back_store_t *const bs, back_store_completion_t *const completions, const unsigned max,
+                         const bool wait) {
+    // nothing is ever still running, so there's never anything to wait for
+    (void) wait;
+    unsigned polled = 0;
+    if (bs && completions) {
+        while (polled < max && bs->async_count) {
+            completions[polled++] = bs->async_done[bs->async_head];
+            bs->async_head        = (bs->async_head + 1) % BACK_STORE_ASYNC_DEPTH;
+            --bs->async_count;
+        }
+    }
+    return polled;
+}
+
+// The page cache is the cache here, so the hint goes to the kernel for each run of blocks
+// It reads them in the background and the memcpy out of the mapping doesn't fault later
+bool back_store_prefetch(back_store_t *const bs, const unsigned *const block_ids, const unsigned count) {
+    if (bs && block_ids) {
+        for (unsigned i = 0; i < count; ++i) {
+            if (block_ids[i] < bs->data_block_start || block_ids[i] >= bs->block_count) {
+                return false;
+            }
+        }
+        // madvise wants a page aligned start
+        const size_t page_mask = (size_t) sysconf(_SC_PAGESIZE) - 1;
+        for (unsigned i = 0, run; i < count; i += run) {
+            run = 1;
+            while (i + run < count && block_ids[i + run] == block_ids[i] + run) {
+                ++run;
+            }
+            const size_t start = bs->block_size * block_ids[i];
+            const size_t front = ((size_t) bs->data_blocks + start) & page_mask;
+            posix_madvise(bs->data_blocks + start - front, bs->block_size * run + front, POSIX_MADV_WILLNEED);
+        }
         return true;
     }
     return false;